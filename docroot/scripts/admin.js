@@ -208,6 +208,22 @@ Admin = {
 			cell = row.insertCell(row.cells.length);
 			$(cell).text(job.status);
 			
+			// client, time spent in the queue, run time and threads
+			cell = row.insertCell(row.cells.length);
+			$(cell).text(job.client);
+			
+			cell = row.insertCell(row.cells.length);
+			$(cell).text(job.queueTime.toFixed(1) + 's').attr('style', 'text-align:right');
+			cell.className = 'nr';
+			
+			cell = row.insertCell(row.cells.length);
+			$(cell).text(job.runTime.toFixed(1) + 's').attr('style', 'text-align:right');
+			cell.className = 'nr';
+			
+			cell = row.insertCell(row.cells.length);
+			$(cell).text(job.threads).attr('style', 'text-align:right');
+			cell.className = 'nr';
+			
 			if (job.status == 'running')
 				$(row).addClass('active');
 			else if (job.status == 'queued')
@@ -242,7 +258,7 @@ Admin = {
 			}
 	*/
 			// remove link
-			cell = row.insertCell(4);
+			cell = row.insertCell(row.cells.length);
 			
 			// work around msie missing features
 			cell.className = 'c5';
@@ -9,12 +9,19 @@
 #include <limits>
 #include <numeric>
 #include <atomic>
+#include <memory>
+#include <type_traits>
+
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+#include <immintrin.h>
+#endif
 
 #include <boost/regex.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <boost/thread.hpp>
 
 #include <zeep/xml/writer.hpp>
@@ -771,15 +778,19 @@ bool Word<WORDSIZE>::PermutationIterator::Next(uint32& outIndex)
     return result;
 }
 
-template<int WORDSIZE>
+// The word hit iterator returns the query offsets for each word in a
+// target. The batch search uses 32 bit offsets that contain the query
+// number as well.
+
+template<int WORDSIZE, class T = uint16>
 class WordHitIterator
 {
-    static const uint32 kMask;
+    static const uint32 kMask = (1 << (kBits * (WORDSIZE - 1))) - 1;
 
     struct Entry
     {
-        uint16                    mCount;
-        uint16                    mDataOffset;
+        T                        mCount;
+        T                        mDataOffset;
     };
 
   public:
@@ -790,7 +801,10 @@ class WordHitIterator
     struct WordHitIteratorStaticData
     {
         vector<Entry>        mLookup;
-        vector<uint16>        mOffsets;
+        vector<T>            mOffsets;
+        vector<uint64>        mWordSet;    // bit set of the words in mLookup
+
+        void                InitWordSet();
     };
                             WordHitIterator(const WordHitIteratorStaticData& inStaticData)
                                 : mLookup(inStaticData.mLookup), mOffsets(inStaticData.mOffsets) {}
@@ -798,8 +812,12 @@ class WordHitIterator
     static void                Init(const sequence& inQuery, const Matrix& inMatrix,
                                 uint32 inThreshhold, WordHitIteratorStaticData& outStaticData);
 
+    // A cheap test whether inTarget has at least inMinHits word hits
+    static bool                HasWordHits(const WordHitIteratorStaticData& inStaticData,
+                                const sequence& inTarget, uint32 inMinHits);
+
     void                    Reset(const sequence& inTarget);
-    bool                    Next(uint16& outQueryOffset, uint16& outTargetOffset);
+    bool                    Next(T& outQueryOffset, uint16& outTargetOffset);
     uint32                    Index() const        { return mIndex; }
 
   private:
@@ -808,18 +826,14 @@ class WordHitIterator
     const uint8*            mTargetEnd;
     uint16                    mTargetOffset;
     const vector<Entry>&    mLookup;
-    const vector<uint16>&    mOffsets;
+    const vector<T>&        mOffsets;
     uint32                    mIndex;
-    const uint16*            mOffset;
-    uint16                    mCount;
+    const T*                mOffset;
+    T                        mCount;
 };
 
-template<> const uint32 WordHitIterator<2>::kMask = 0x0001F;
-template<> const uint32 WordHitIterator<3>::kMask = 0x003FF;
-template<> const uint32 WordHitIterator<4>::kMask = 0x07FFF;
-
-template<int WORDSIZE>
-void WordHitIterator<WORDSIZE>::Init(const sequence& inQuery,
+template<int WORDSIZE, class T>
+void WordHitIterator<WORDSIZE, T>::Init(const sequence& inQuery,
     const Matrix& inMatrix, uint32 inThreshhold, WordHitIteratorStaticData& outStaticData)
 {
     uint64 N = IWord::kMaxWordIndex;
@@ -842,14 +856,14 @@ void WordHitIterator<WORDSIZE>::Init(const sequence& inQuery,
     }
 
     outStaticData.mLookup = vector<Entry>(N);
-    outStaticData.mOffsets = vector<uint16>(M);
+    outStaticData.mOffsets = vector<T>(M);
 
-    uint16* data = &outStaticData.mOffsets[0];
+    T* data = &outStaticData.mOffsets[0];
 
     for (uint32 i = 0; i < N; ++i)
     {
-        outStaticData.mLookup[i].mCount = static_cast<uint16>(test[i].size());
-        outStaticData.mLookup[i].mDataOffset = static_cast<uint16>(data - &outStaticData.mOffsets[0]);
+        outStaticData.mLookup[i].mCount = static_cast<T>(test[i].size());
+        outStaticData.mLookup[i].mDataOffset = static_cast<T>(data - &outStaticData.mOffsets[0]);
 
         for (uint32 j = 0; j < outStaticData.mLookup[i].mCount; ++j)
             *data++ = test[i][j];
@@ -859,10 +873,76 @@ void WordHitIterator<WORDSIZE>::Init(const sequence& inQuery,
 #if DEBUG
     outStaticData.mOffsets.push_back(0);
 #endif
+
+    outStaticData.InitWordSet();
 }
 
-template<int WORDSIZE>
-void WordHitIterator<WORDSIZE>::Reset(const sequence& inTarget)
+template<int WORDSIZE, class T>
+void WordHitIterator<WORDSIZE, T>::WordHitIteratorStaticData::InitWordSet()
+{
+    mWordSet = vector<uint64>(mLookup.size() / 64 + 1, 0);
+
+    for (uint32 i = 0; i < mLookup.size(); ++i)
+    {
+        if (mLookup[i].mCount > 0)
+            mWordSet[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+// The bit set of words is small enough to stay in the first level cache,
+// unlike the lookup table. For words of up to three residues the SSE2
+// version calculates the words for eight positions at a time.
+
+template<int WORDSIZE, class T>
+bool WordHitIterator<WORDSIZE, T>::HasWordHits(const WordHitIteratorStaticData& inStaticData,
+    const sequence& inTarget, uint32 inMinHits)
+{
+    const uint64* words = &inStaticData.mWordSet[0];
+    const uint8* target = inTarget.c_str();
+    size_t length = inTarget.length(), i = 0;
+    uint32 hits = 0;
+
+    if (length < WORDSIZE)
+        return false;
+
+#if defined(__GNUC__) and defined(__SSE2__)
+    if (WORDSIZE * kBits <= 16)
+    {
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; i + 7 + WORDSIZE <= length and hits < inMinHits; i += 8)
+        {
+            __m128i w = zero;
+            for (uint32 k = 0; k < WORDSIZE; ++k)
+            {
+                __m128i r = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(target + i + k));
+                w = _mm_or_si128(_mm_slli_epi16(w, kBits), _mm_unpacklo_epi8(r, zero));
+            }
+
+            uint16 ix[8];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ix), w);
+
+            for (uint32 j = 0; j < 8; ++j)
+                hits += (words[ix[j] / 64] >> (ix[j] % 64)) & 1;
+        }
+    }
+#endif
+
+    uint32 index = 0;
+    for (uint32 k = 0; k < WORDSIZE - 1; ++k)
+        index = index << kBits | target[i + k];
+
+    for (i += WORDSIZE - 1; i < length and hits < inMinHits; ++i)
+    {
+        index = ((index & kMask) << kBits) | target[i];
+        hits += (words[index / 64] >> (index % 64)) & 1;
+    }
+
+    return hits >= inMinHits;
+}
+
+template<int WORDSIZE, class T>
+void WordHitIterator<WORDSIZE, T>::Reset(const sequence& inTarget)
 {
     mTargetCurrent = inTarget.c_str();
     mTargetEnd = mTargetCurrent + inTarget.length();
@@ -877,8 +957,8 @@ void WordHitIterator<WORDSIZE>::Reset(const sequence& inTarget)
     mOffset = &mOffsets[current.mDataOffset];
 }
 
-template<int WORDSIZE>
-bool WordHitIterator<WORDSIZE>::Next(uint16& outQueryOffset, uint16& outTargetOffset)
+template<int WORDSIZE, class T>
+bool WordHitIterator<WORDSIZE, T>::Next(T& outQueryOffset, uint16& outTargetOffset)
 {
     bool result = false;
 
@@ -908,9 +988,13 @@ bool WordHitIterator<WORDSIZE>::Next(uint16& outQueryOffset, uint16& outTargetOf
 
 // --------------------------------------------------------------------
 
+// The start of the last word hit on each diagonal. The table is not filled
+// for each target, instead each entry has the number of the target it was
+// last set for. Entries for another target have the initial value.
+
 struct DiagonalStartTable
 {
-            DiagonalStartTable() : mTable(nullptr), mTableLength(0) {}
+            DiagonalStartTable() : mTable(nullptr), mTableLength(0), mEpoch(0) {}
             ~DiagonalStartTable() { delete[] mTable; }
 
     void    Reset(int32 inQueryLength, int32 inTargetLength)
@@ -921,24 +1005,46 @@ struct DiagonalStartTable
                 if (mTable == nullptr or n >= mTableLength)
                 {
                     uint32 k = ((n / 10240) + 1) * 10240;
-                    int32* t = new int32[k];
+                    Entry* t = new Entry[k];
                     delete[] mTable;
                     mTable = t;
                     mTableLength = k;
+                    mEpoch = 0;
                 }
 
-                fill(mTable, mTable + n, -inTargetLength);
+                if (mEpoch == 0 or ++mEpoch == 0)
+                {
+                    fill(mTable, mTable + mTableLength, Entry());
+                    mEpoch = 1;
+                }
             }
 
     int32&    operator()(uint16 inQueryOffset, uint16 inTargetOffset)
-                { return mTable[mTargetLength - inTargetOffset + inQueryOffset]; }
+            {
+                Entry& e = mTable[mTargetLength - inTargetOffset + inQueryOffset];
+                if (e.mEpoch != mEpoch)
+                {
+                    e.mEpoch = mEpoch;
+                    e.mStart = -mTargetLength;
+                }
+                return e.mStart;
+            }
 
   private:
                             DiagonalStartTable(const DiagonalStartTable&);
     DiagonalStartTable&    operator=(const DiagonalStartTable&);
 
-    int32*    mTable;
+    struct Entry
+    {
+                Entry() : mEpoch(0), mStart(0) {}
+
+        uint32    mEpoch;
+        int32    mStart;
+    };
+
+    Entry*    mTable;
     int32    mTableLength, mTargetLength;
+    uint32    mEpoch;
 };
 
 // --------------------------------------------------------------------
@@ -1000,6 +1106,209 @@ struct RecordTraceBack
     DPData&    mTraceBack;
 };
 
+// --------------------------------------------------------------------
+//    When no traceback is needed, the gapped alignment is calculated one
+//    column at a time keeping only the previous column. The diagonal and
+//    horizontal gap scores in a column depend on the previous column only
+//    and so these are calculated for a range of rows at once, using SSE4.1
+//    or AVX2 if the CPU has it. The vertical gap and X-drop part is done
+//    row by row afterwards, in exactly the same order as AlignGapped.
+
+struct GappedColumn
+{
+    const int16*    mB;            // B and Ix of the previous column
+    const int16*    mIx;
+    const uint8*    mTarget;    // the residue for row j is at mTarget[j - 1]
+    const int8*        mScores;    // scores for the query residue of this column
+    int16            mOpen, mExtend;
+
+    int16*            mM;            // results for this column: M, max(M, Ix1) and Ix
+    int16*            mMIx;
+    int16*            mNewIx;
+};
+
+// The SIMD versions may read and write up to 15 rows past inLast
+
+const uint32 kGappedColumnPadding = 16;
+
+void CalculateGappedColumn(const GappedColumn& inColumn, uint32 inFirst, uint32 inLast)
+{
+    for (uint32 j = inFirst; j <= inLast; ++j)
+    {
+        int32 M = inColumn.mB[j - 1] + inColumn.mScores[inColumn.mTarget[j - 1]];
+        if (M > numeric_limits<int16>::max())
+            M = numeric_limits<int16>::max();
+
+        int32 Ix1 = inColumn.mIx[j];
+
+        inColumn.mM[j] = M;
+        inColumn.mMIx[j] = max(M, Ix1);
+        inColumn.mNewIx[j] = max(M - inColumn.mOpen, Ix1 - inColumn.mExtend);
+    }
+}
+
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+
+// look up the scores for 16 residues, the 32 scores for the query
+// residue are in two registers, pshufb only uses the lower four bits
+
+__attribute__((target("sse4.1")))
+inline __m128i LookupScores(__m128i inResidues, __m128i inLow, __m128i inHigh)
+{
+    return _mm_blendv_epi8(
+        _mm_shuffle_epi8(inLow, inResidues),
+        _mm_shuffle_epi8(inHigh, inResidues),
+        _mm_cmpgt_epi8(inResidues, _mm_set1_epi8(15)));
+}
+
+__attribute__((target("sse4.1")))
+void CalculateGappedColumnSSE41(const GappedColumn& inColumn, uint32 inFirst, uint32 inLast)
+{
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inColumn.mScores));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inColumn.mScores + 16));
+    const __m128i open = _mm_set1_epi16(inColumn.mOpen);
+    const __m128i extend = _mm_set1_epi16(inColumn.mExtend);
+
+    for (uint32 j = inFirst; j <= inLast; j += 8)
+    {
+        __m128i r = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(inColumn.mTarget + j - 1));
+        __m128i s = _mm_cvtepi8_epi16(LookupScores(r, low, high));
+
+        __m128i M = _mm_adds_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(inColumn.mB + j - 1)), s);
+        __m128i Ix1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inColumn.mIx + j));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(inColumn.mM + j), M);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(inColumn.mMIx + j), _mm_max_epi16(M, Ix1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(inColumn.mNewIx + j),
+            _mm_max_epi16(_mm_subs_epi16(M, open), _mm_subs_epi16(Ix1, extend)));
+    }
+}
+
+__attribute__((target("avx2")))
+void CalculateGappedColumnAVX2(const GappedColumn& inColumn, uint32 inFirst, uint32 inLast)
+{
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inColumn.mScores));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inColumn.mScores + 16));
+    const __m256i open = _mm256_set1_epi16(inColumn.mOpen);
+    const __m256i extend = _mm256_set1_epi16(inColumn.mExtend);
+
+    for (uint32 j = inFirst; j <= inLast; j += 16)
+    {
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inColumn.mTarget + j - 1));
+        __m256i s = _mm256_cvtepi8_epi16(LookupScores(r, low, high));
+
+        __m256i M = _mm256_adds_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(inColumn.mB + j - 1)), s);
+        __m256i Ix1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inColumn.mIx + j));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(inColumn.mM + j), M);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(inColumn.mMIx + j), _mm256_max_epi16(M, Ix1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(inColumn.mNewIx + j),
+            _mm256_max_epi16(_mm256_subs_epi16(M, open), _mm256_subs_epi16(Ix1, extend)));
+    }
+}
+
+#endif
+
+typedef void (*CalculateGappedColumnFunc)(const GappedColumn& inColumn, uint32 inFirst, uint32 inLast);
+
+CalculateGappedColumnFunc SelectGappedColumnFunc()
+{
+    CalculateGappedColumnFunc result = &CalculateGappedColumn;
+
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        result = &CalculateGappedColumnAVX2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        result = &CalculateGappedColumnSSE41;
+#endif
+
+    return result;
+}
+
+const CalculateGappedColumnFunc kCalculateGappedColumn = SelectGappedColumnFunc();
+
+// --------------------------------------------------------------------
+//    Ungapped X-drop extension in one direction using the query profile,
+//    inProfile points to the profile row of the first query residue and
+//    inTarget to the first target residue, inStep is 1 or -1. The extension
+//    stops when the score drops more than inDropOff below the best score.
+//    ioScore is updated with the best score and the number of residues
+//    that gave that score is returned.
+//
+//    The SSE2 version takes the scores of eight residues at a time and
+//    calculates the running sum and maximum for them without branches.
+
+inline uint32 ExtendUngapped(const int8* inProfile, const uint8* inTarget, int32 inStep,
+    uint32 inLength, int32 inDropOff, int32& ioScore)
+{
+    const int32 profileStep = inStep * static_cast<int32>(kResCount);
+
+    int32 score = ioScore, test = ioScore;
+    uint32 result = 0, k = 0;
+
+#if defined(__GNUC__) and defined(__SSE2__)
+    const __m128i dropOff = _mm_set1_epi16(static_cast<int16>(min(inDropOff, 10000)));
+
+    while (k + 8 <= inLength)
+    {
+        int16 s[8];
+        for (int32 i = 0, j = static_cast<int32>(k); i < 8; ++i, ++j)
+            s[i] = inProfile[j * profileStep + inTarget[j * inStep]];
+
+        // running sum and maximum relative to test, the maximum starts at
+        // the best score so far. The zeros shifted in are harmless since
+        // score >= test.
+        __m128i sum = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+        sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 2));
+        sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 4));
+        sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 8));
+
+        __m128i best = _mm_max_epi16(sum, _mm_set1_epi16(static_cast<int16>(score - test)));
+        best = _mm_max_epi16(best, _mm_slli_si128(best, 2));
+        best = _mm_max_epi16(best, _mm_slli_si128(best, 4));
+        best = _mm_max_epi16(best, _mm_slli_si128(best, 8));
+
+        // the residues up to and including the first that drops too far are used
+        uint32 drop = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_sub_epi16(best, sum), dropOff));
+        uint32 n = drop ? __builtin_ctz(drop) / 2 + 1 : 8;
+
+        int16 sums[8], bests[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), sum);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bests), best);
+
+        if (test + bests[n - 1] > score)
+        {
+            uint32 first = _mm_movemask_epi8(_mm_cmpeq_epi16(sum, _mm_set1_epi16(bests[n - 1])));
+            result = k + __builtin_ctz(first) / 2 + 1;
+            score = test + bests[n - 1];
+        }
+
+        test += sums[n - 1];
+        k += n;
+
+        if (drop)
+            break;
+    }
+
+#endif
+
+    for (; k < inLength and test >= score - inDropOff; ++k)
+    {
+        int32 j = static_cast<int32>(k);
+        test += inProfile[j * profileStep + inTarget[j * inStep]];
+
+        if (test > score)
+        {
+            score = test;
+            result = k + 1;
+        }
+    }
+
+    ioScore = score;
+    return result;
+}
+
 // --------------------------------------------------------------------
 
 inline void ReadEntry(const char*& inFasta, const char* inEnd, sequence& outTarget)
@@ -1034,163 +1343,715 @@ inline void ReadEntry(const char*& inFasta, const char* inEnd, sequence& outTarg
 }
 
 // --------------------------------------------------------------------
+// The sequences to search are read from a FastA file or from a binary
+// databank. SearchPart uses a reader that returns the entries one by one.
 
-struct HspData
+class FastaReader
 {
-    uint32        mScore;
-    uint32        mQueryStart, mQueryEnd, mTargetStart, mTargetEnd, mTargetLength;
-    sequence    mAlignedQuery, mAlignedTarget;
-    double        mBitScore;
-    double        mExpect;
-    bool        mGapped;
+  public:
+                FastaReader(const char* inData, size_t inLength)
+                    : mData(inData), mEnd(inData + inLength) {}
 
-    bool        operator>(const HspData& inHsp) const                { return mScore > inHsp.mScore; }
-    void        CalculateExpect(int64 inSearchSpace, double inLambda, double inLogKappa);
-    bool        Overlaps(const HspData& inOther) const
-                {
-                    return
-                        mQueryEnd >= inOther.mQueryStart and mQueryStart <= inOther.mQueryEnd and
-                        mTargetEnd >= inOther.mTargetStart and mTargetStart <= inOther.mTargetEnd;
-                }
+    bool        Next(const char*& outDefLine, size_t& outDefLineLength,
+                    sequence& outTarget, size_t& outConsumed);
+
+  private:
+    const char*    mData;
+    const char*    mEnd;
 };
 
-void HspData::CalculateExpect(int64 inSearchSpace, double inLambda, double inLogKappa)
+bool FastaReader::Next(const char*& outDefLine, size_t& outDefLineLength,
+    sequence& outTarget, size_t& outConsumed)
 {
-    mBitScore = floor((inLambda * mScore - inLogKappa) / kLn2);
-    mExpect = inSearchSpace / pow(2., mBitScore);
+    if (mData == mEnd)
+        return false;
+
+    const char* entry = mData;
+    ReadEntry(mData, mEnd, outTarget);
+
+    const char* eol = static_cast<const char*>(memchr(entry, '\n', mEnd - entry));
+
+    outDefLine = entry;
+    outDefLineLength = (eol ? eol : mEnd) - entry;
+    outConsumed = mData - entry;
+
+    return true;
 }
 
-// --------------------------------------------------------------------
+// The binary databank is a single file. The header is followed by the
+// residues of all sequences, encoded with ResidueNr. After that come
+// the offset table for the sequences, the offset table for the
+// definition lines and the definition lines themselves.
 
-struct HitData;
-typedef shared_ptr<HitData> HitPtr;
+const uint32
+    kBinaryDbSignature    = 'm6bd',
+    kBinaryDbVersion    = 1;
 
-struct HitData
+struct BinaryDbHeader
 {
-                    HitData(const char* inEntry, const sequence& inTarget);
+    uint32        mSignature;
+    uint32        mVersion;
+    uint32        mEntryCount;
+    uint32        mReserved;
+    int64        mResidueCount;
+    int64        mSequenceOffsets;    // file offset of mEntryCount + 1 offsets into the residues
+    int64        mDefLineOffsets;    // file offset of mEntryCount + 1 offsets into the def lines
+    int64        mDefLines;            // file offset of the def lines
+    int64        mDefLineSize;
+    int64        mFileSize;
+};
 
-    void            AddHsp(const HspData& inHsp);
-    void            Cleanup(int64 inSearchSpace, double inLambda, double inLogKappa, double inExpect);
+class BinaryDatabank
+{
+  public:
+                BinaryDatabank(const fs::path& inFasta);
 
-    string            mDefLine;
-    sequence        mTarget;
-    vector<HspData>    mHsps;
+    bool        IsOpen() const                        { return mHeader != nullptr; }
+
+    uint32        GetEntryCount() const                { return mHeader->mEntryCount; }
+    int64        GetResidueCount() const                { return mHeader->mResidueCount; }
+    int64        GetSize() const                        { return mHeader->mResidueCount + mHeader->mDefLineSize; }
+
+    // offset of the first residue of inEntry, inEntry may be GetEntryCount()
+    int64        GetSequenceOffset(uint32 inEntry) const    { return mSequenceOffsets[inEntry]; }
+
+    // return the first entry with a sequence starting at or after inResidue
+    uint32        GetEntryForResidue(int64 inResidue) const;
+
+    void        GetEntry(uint32 inEntry, const char*& outDefLine, size_t& outDefLineLength,
+                    const uint8*& outSequence, size_t& outLength) const;
+
+  private:
+    io::mapped_file            mFile;
+    const BinaryDbHeader*    mHeader;
+    const uint8*            mResidues;
+    const int64*            mSequenceOffsets;
+    const int64*            mDefLineOffsets;
+    const char*                mDefLines;
 };
 
-HitData::HitData(const char* inEntry, const sequence& inTarget)
-    : mTarget(inTarget)
-{
-    const char* b = inEntry;
-    const char* e = strchr(inEntry, '\n');
-    mDefLine.assign(b, e);
-}
+// Open the binary version of inFasta, if it exists, is valid and is not
+// older than inFasta. Otherwise the databank is not opened.
 
-void HitData::AddHsp(const HspData& inHsp)
+BinaryDatabank::BinaryDatabank(const fs::path& inFasta)
+    : mHeader(nullptr)
 {
-    bool found = false;
+    fs::path path = GetBinaryDatabankPath(inFasta);
 
-    for (auto& hsp : mHsps)
+    if (not fs::exists(path) or
+        (fs::exists(inFasta) and fs::last_write_time(path) < fs::last_write_time(inFasta)) or
+        fs::file_size(path) < sizeof(BinaryDbHeader))
     {
-        if (inHsp.Overlaps(hsp))
-        {
-            if (hsp.mScore < inHsp.mScore)
-                hsp = inHsp;
-            found = true;
-            break;
-        }
+        return;
     }
 
-    if (not found)
-        mHsps.push_back(inHsp);
-}
+    mFile.open(path.string().c_str(), io::mapped_file::readonly);
+    if (not mFile.is_open())
+        return;
 
-void HitData::Cleanup(int64 inSearchSpace, double inLambda, double inLogKappa, double inExpect)
-{
-    sort(mHsps.begin(), mHsps.end(), greater<HspData>());
+    const char* data = mFile.const_data();
+    const BinaryDbHeader* header = reinterpret_cast<const BinaryDbHeader*>(data);
 
-    vector<HspData>::iterator a = mHsps.begin();
-    while (a != mHsps.end() and a + 1 != mHsps.end())
+    if (header->mSignature != kBinaryDbSignature or header->mVersion != kBinaryDbVersion or
+        header->mFileSize != static_cast<int64>(mFile.size()))
     {
-        vector<HspData>::iterator b = a + 1;
-        while (b != mHsps.end())
-        {
-            if (a->Overlaps(*b))
-                b = mHsps.erase(b);
-            else
-                ++b;
-        }
-        ++a;
+        LOG(WARN, "Binary blast databank %s is invalid, using FastA file instead", path.string().c_str());
+        mFile.close();
+        return;
     }
 
-    for_each(mHsps.begin(), mHsps.end(), [=](HspData& hsp) {
-        hsp.CalculateExpect(inSearchSpace, inLambda, inLogKappa);
-    });
-
-    sort(mHsps.begin(), mHsps.end(), greater<HspData>());
+    mHeader = header;
+    mResidues = reinterpret_cast<const uint8*>(data + sizeof(BinaryDbHeader));
+    mSequenceOffsets = reinterpret_cast<const int64*>(data + header->mSequenceOffsets);
+    mDefLineOffsets = reinterpret_cast<const int64*>(data + header->mDefLineOffsets);
+    mDefLines = data + header->mDefLines;
+}
 
-    mHsps.erase(
-        remove_if(mHsps.begin(), mHsps.end(), [=](const HspData& hsp) -> bool {
-            return hsp.mExpect > inExpect;
-        }),
-        mHsps.end());
+uint32 BinaryDatabank::GetEntryForResidue(int64 inResidue) const
+{
+    const int64* offsets = mSequenceOffsets;
+    return static_cast<uint32>(lower_bound(offsets, offsets + mHeader->mEntryCount, inResidue) - offsets);
 }
 
-// --------------------------------------------------------------------
+void BinaryDatabank::GetEntry(uint32 inEntry, const char*& outDefLine, size_t& outDefLineLength,
+    const uint8*& outSequence, size_t& outLength) const
+{
+    assert(inEntry < mHeader->mEntryCount);
 
-template<int WORDSIZE>
-class BlastQuery
+    outDefLine = mDefLines + mDefLineOffsets[inEntry];
+    outDefLineLength = static_cast<size_t>(mDefLineOffsets[inEntry + 1] - mDefLineOffsets[inEntry]);
+    outSequence = mResidues + mSequenceOffsets[inEntry];
+    outLength = static_cast<size_t>(mSequenceOffsets[inEntry + 1] - mSequenceOffsets[inEntry]);
+}
+
+class BinaryReader
 {
   public:
-                    BlastQuery(const string& inQuery, bool inFilter, double inExpect,
-                        const string& inMatrix, bool inGapped, int32 inGapOpen, int32 inGapExtend,
-                        uint32 inReportLimit);
-                    ~BlastQuery();
+                BinaryReader(const BinaryDatabank& inDatabank, uint32 inFirst, uint32 inLast)
+                    : mDatabank(inDatabank), mNext(inFirst), mLast(inLast) {}
 
-    void            Search(const vector<fs::path>& inDatabanks, M6Progress& inProgress, uint32 inNrOfThreads);
-    void            Report(Result& outResult);
-    void            WriteAsFasta(ostream& inStream);
+    bool        Next(const char*& outDefLine, size_t& outDefLineLength,
+                    sequence& outTarget, size_t& outConsumed);
 
   private:
+    const BinaryDatabank&    mDatabank;
+    uint32                    mNext, mLast;
+};
 
-    void            SearchPart(const char* inFasta, size_t inLength, M6Progress& inProgress,
-                        uint32& outDbCount, int64& outDbLength, vector<HitPtr>& outHits) const;
+bool BinaryReader::Next(const char*& outDefLine, size_t& outDefLineLength,
+    sequence& outTarget, size_t& outConsumed)
+{
+    if (mNext == mLast)
+        return false;
 
-    int32            Extend(int32& ioQueryStart, const sequence& inTarget, int32& ioTargetStart, int32& ioDistance) const;
-    template<class Iterator1, class Iterator2, class TraceBack>
-    int32            AlignGapped(Iterator1 inQueryBegin, Iterator1 inQueryEnd,
-                        Iterator2 inTargetBegin, Iterator2 inTargetEnd,
-                        TraceBack& inTraceBack, int32 inDropOff, uint32& outBestX, uint32& outBestY) const;
+    const uint8* residues;
+    size_t length;
 
-    int32            AlignGappedFirst(const sequence& inTarget, HspData& ioHsp) const;
-    int32            AlignGappedSecond(const sequence& inTarget, HspData& ioHsp) const;
+    mDatabank.GetEntry(mNext++, outDefLine, outDefLineLength, residues, length);
 
-    void            AddHit(HitPtr inHit, vector<HitPtr>& inHitList) const;
+    outTarget.assign(residues, length);
+    outConsumed = outDefLineLength + length;
 
-    typedef WordHitIterator<WORDSIZE>                                IWordHitIterator;
-    typedef typename IWordHitIterator::WordHitIteratorStaticData    StaticData;
+    return true;
+}
 
-    string            mUnfiltered;
-    sequence        mQuery;
-    Matrix        mMatrix;
-    double            mExpect, mCutOff;
-    bool            mGapped;
-    int32            mS1, mS2, mXu, mXg, mXgFinal;
-    uint32            mReportLimit;
+fs::path GetBinaryDatabankPath(const fs::path& inFasta)
+{
+    return inFasta.parent_path() / (inFasta.filename().string() + ".bin");
+}
 
-    uint32            mDbCount;
-    int64            mDbLength, mSearchSpace;
+void CreateBinaryDatabank(const fs::path& inFasta)
+{
+    io::mapped_file file(inFasta.string().c_str(), io::mapped_file::readonly);
+    if (not file.is_open())
+        throw M6Exception("FastA file %s not open", inFasta.string().c_str());
 
-    vector<HitPtr>    mHits;
+    fs::path path = GetBinaryDatabankPath(inFasta);
 
-    StaticData    mWordHitData;
-};
+    // the residues are written directly, the rest is collected in
+    // temporary files and appended at the end
 
-template<int WORDSIZE>
-BlastQuery<WORDSIZE>::BlastQuery(const string& inQuery, bool inFilter, double inExpect,
-        const string& inMatrix, bool inGapped, int32 inGapOpen, int32 inGapExtend, uint32 inReportLimit)
-    : mUnfiltered(inQuery), mMatrix(inMatrix, inGapOpen, inGapExtend)
-    , mExpect(inExpect), mGapped(inGapped), mReportLimit(inReportLimit)
-    , mDbCount(0), mDbLength(0), mSearchSpace(0)
+    fs::path tmpDir = path.parent_path();
+    fs::path tmpSeqIx = tmpDir / (path.filename().string() + "-seqix.tmp");
+    fs::path tmpDefIx = tmpDir / (path.filename().string() + "-defix.tmp");
+    fs::path tmpDefs = tmpDir / (path.filename().string() + "-defs.tmp");
+    fs::path tmpPath = tmpDir / (path.filename().string() + ".tmp");
+
+    try
+    {
+        fs::ofstream out(tmpPath, ios::binary | ios::trunc);
+        fs::ofstream seqIx(tmpSeqIx, ios::binary | ios::trunc);
+        fs::ofstream defIx(tmpDefIx, ios::binary | ios::trunc);
+        fs::ofstream defs(tmpDefs, ios::binary | ios::trunc);
+
+        if (not out.is_open() or not seqIx.is_open() or not defIx.is_open() or not defs.is_open())
+            throw M6Exception("Could not create binary databank %s", path.string().c_str());
+
+        BinaryDbHeader header = { kBinaryDbSignature, kBinaryDbVersion };
+        out.write(reinterpret_cast<char*>(&header), sizeof(header));
+
+        FastaReader reader(file.const_data(), file.size());
+        const char* defLine;
+        size_t defLineLength, consumed;
+        sequence target;
+
+        int64 residues = 0, defLineSize = 0;
+
+        while (reader.Next(defLine, defLineLength, target, consumed))
+        {
+            seqIx.write(reinterpret_cast<char*>(&residues), sizeof(residues));
+            defIx.write(reinterpret_cast<char*>(&defLineSize), sizeof(defLineSize));
+
+            out.write(reinterpret_cast<const char*>(target.c_str()), target.length());
+            defs.write(defLine, defLineLength);
+
+            residues += target.length();
+            defLineSize += defLineLength;
+            header.mEntryCount += 1;
+        }
+
+        seqIx.write(reinterpret_cast<char*>(&residues), sizeof(residues));
+        defIx.write(reinterpret_cast<char*>(&defLineSize), sizeof(defLineSize));
+
+        seqIx.close();
+        defIx.close();
+        defs.close();
+
+        header.mResidueCount = residues;
+        header.mDefLineSize = defLineSize;
+
+        // align the offset tables
+        int64 offset = sizeof(header) + residues;
+        while (offset % sizeof(int64))
+        {
+            out.put(0);
+            ++offset;
+        }
+
+        header.mSequenceOffsets = offset;
+        header.mDefLineOffsets = offset + (header.mEntryCount + 1) * sizeof(int64);
+        header.mDefLines = header.mDefLineOffsets + (header.mEntryCount + 1) * sizeof(int64);
+        header.mFileSize = header.mDefLines + defLineSize;
+
+        for (const fs::path& tmp : { tmpSeqIx, tmpDefIx, tmpDefs })
+        {
+            fs::ifstream in(tmp, ios::binary);
+            if (fs::file_size(tmp) > 0)
+                out << in.rdbuf();
+        }
+
+        out.seekp(0);
+        out.write(reinterpret_cast<char*>(&header), sizeof(header));
+        out.close();
+
+        if (out.fail())
+            throw M6Exception("Error writing binary databank %s", path.string().c_str());
+
+        fs::rename(tmpPath, path);
+    }
+    catch (...)
+    {
+        fs::remove(tmpPath);
+        fs::remove(tmpSeqIx);
+        fs::remove(tmpDefIx);
+        fs::remove(tmpDefs);
+        throw;
+    }
+
+    fs::remove(tmpSeqIx);
+    fs::remove(tmpDefIx);
+    fs::remove(tmpDefs);
+}
+
+// The seed index lists for each word of kSeedWordSize residues the
+// positions where it occurs in the binary databank. The positions are
+// offsets in the residues of the binary databank, in increasing order.
+// Only words made up of the residues used in the word lookup of a query
+// are indexed. The file contains a header, an offset table with the
+// start of the positions for each word and the positions themselves.
+
+const uint32
+    kSeedIndexSignature    = 'm6si',
+    kSeedIndexVersion    = 1,
+    kSeedWordSize        = 3,
+    kSeedWordCount        = 1 << (kBits * kSeedWordSize);
+
+struct SeedIndexHeader
+{
+    uint32        mSignature;
+    uint32        mVersion;
+    uint32        mWordSize;
+    uint32        mReserved;
+    int64        mResidueCount;        // of the binary databank
+    int64        mPositionCount;
+    int64        mFileSize;
+};
+
+class SeedIndex
+{
+  public:
+                SeedIndex(const fs::path& inFasta, const BinaryDatabank& inDatabank);
+
+    bool        IsOpen() const                        { return mHeader != nullptr; }
+
+    uint32        GetPositionCount(uint32 inWord) const
+                {
+                    return static_cast<uint32>(mOffsets[inWord + 1] - mOffsets[inWord]);
+                }
+
+    // the positions of inWord in the residue range [inFirst, inLast)
+    void        GetPositions(uint32 inWord, int64 inFirst, int64 inLast,
+                    const uint32*& outBegin, const uint32*& outEnd) const;
+
+  private:
+    io::mapped_file            mFile;
+    const SeedIndexHeader*    mHeader;
+    const int64*            mOffsets;
+    const uint32*            mPositions;
+};
+
+// Open the seed index for inFasta, if it exists and belongs to the
+// current binary databank. Otherwise the index is not opened.
+
+SeedIndex::SeedIndex(const fs::path& inFasta, const BinaryDatabank& inDatabank)
+    : mHeader(nullptr)
+{
+    fs::path path = GetSeedIndexPath(inFasta);
+    fs::path binary = GetBinaryDatabankPath(inFasta);
+
+    if (not inDatabank.IsOpen() or not fs::exists(path) or
+        fs::last_write_time(path) < fs::last_write_time(binary) or
+        fs::file_size(path) < sizeof(SeedIndexHeader))
+    {
+        return;
+    }
+
+    mFile.open(path.string().c_str(), io::mapped_file::readonly);
+    if (not mFile.is_open())
+        return;
+
+    const char* data = mFile.const_data();
+    const SeedIndexHeader* header = reinterpret_cast<const SeedIndexHeader*>(data);
+
+    if (header->mSignature != kSeedIndexSignature or header->mVersion != kSeedIndexVersion or
+        header->mWordSize != kSeedWordSize or header->mResidueCount != inDatabank.GetResidueCount() or
+        header->mFileSize != static_cast<int64>(mFile.size()))
+    {
+        LOG(WARN, "Blast seed index %s is invalid, scanning databank instead", path.string().c_str());
+        mFile.close();
+        return;
+    }
+
+    mHeader = header;
+    mOffsets = reinterpret_cast<const int64*>(data + sizeof(SeedIndexHeader));
+    mPositions = reinterpret_cast<const uint32*>(mOffsets + kSeedWordCount + 1);
+}
+
+void SeedIndex::GetPositions(uint32 inWord, int64 inFirst, int64 inLast,
+    const uint32*& outBegin, const uint32*& outEnd) const
+{
+    const uint32* begin = mPositions + mOffsets[inWord];
+    const uint32* end = mPositions + mOffsets[inWord + 1];
+
+    outBegin = lower_bound(begin, end, inFirst, [](uint32 a, int64 b) -> bool { return a < b; });
+    outEnd = lower_bound(outBegin, end, inLast, [](uint32 a, int64 b) -> bool { return a < b; });
+}
+
+SeedIndexMode sSeedIndexMode = eSeedIndexAuto;
+
+void SetSeedIndexMode(SeedIndexMode inMode)
+{
+    sSeedIndexMode = inMode;
+}
+
+fs::path GetSeedIndexPath(const fs::path& inFasta)
+{
+    return inFasta.parent_path() / (inFasta.filename().string() + ".seeds");
+}
+
+// Call inProc for each word in inDatabank that is indexed, and its position
+
+template<class Proc>
+void ForEachSeedWord(const BinaryDatabank& inDatabank, Proc inProc)
+{
+    const uint32 kMask = (1 << (kBits * (kSeedWordSize - 1))) - 1;
+
+    for (uint32 entry = 0; entry < inDatabank.GetEntryCount(); ++entry)
+    {
+        const char* defLine;
+        size_t defLineLength, length;
+        const uint8* residues;
+
+        inDatabank.GetEntry(entry, defLine, defLineLength, residues, length);
+
+        uint32 position = static_cast<uint32>(inDatabank.GetSequenceOffset(entry));
+        uint32 word = 0, valid = 0;
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            word = ((word & kMask) << kBits) | residues[i];
+            valid = residues[i] < kAACount ? valid + 1 : 0;
+
+            if (valid >= kSeedWordSize)
+                inProc(word, static_cast<uint32>(position + i + 1 - kSeedWordSize));
+        }
+    }
+}
+
+// Creating the index takes two passes over the binary databank, the first
+// counts the words, the second stores the positions. The file is mapped
+// into memory while the positions are written.
+
+void CreateSeedIndex(const fs::path& inFasta)
+{
+    BinaryDatabank databank(inFasta);
+    if (not databank.IsOpen())
+        throw M6Exception("No binary databank for %s", inFasta.string().c_str());
+
+    // positions are stored in 32 bits
+    if (databank.GetResidueCount() > numeric_limits<uint32>::max())
+    {
+        LOG(WARN, "Databank %s is too large for a blast seed index", inFasta.string().c_str());
+        return;
+    }
+
+    fs::path path = GetSeedIndexPath(inFasta);
+    fs::path tmpPath = path.parent_path() / (path.filename().string() + ".tmp");
+
+    vector<int64> offsets(kSeedWordCount + 1);
+    ForEachSeedWord(databank, [&offsets](uint32 inWord, uint32 inPosition) { ++offsets[inWord + 1]; });
+
+    for (uint32 w = 0; w < kSeedWordCount; ++w)
+        offsets[w + 1] += offsets[w];
+
+    SeedIndexHeader header = { kSeedIndexSignature, kSeedIndexVersion, kSeedWordSize };
+    header.mResidueCount = databank.GetResidueCount();
+    header.mPositionCount = offsets[kSeedWordCount];
+    header.mFileSize = sizeof(header) + offsets.size() * sizeof(int64) + header.mPositionCount * sizeof(uint32);
+
+    try
+    {
+        io::mapped_file_params params(tmpPath.string());
+        params.flags = io::mapped_file::readwrite;
+        params.new_file_size = header.mFileSize;
+
+        io::mapped_file file(params);
+        if (not file.is_open())
+            throw M6Exception("Could not create blast seed index %s", path.string().c_str());
+
+        char* data = file.data();
+
+        memcpy(data, &header, sizeof(header));
+        memcpy(data + sizeof(header), &offsets[0], offsets.size() * sizeof(int64));
+
+        uint32* positions = reinterpret_cast<uint32*>(data + sizeof(header) + offsets.size() * sizeof(int64));
+        vector<int64> next(offsets.begin(), offsets.end() - 1);
+
+        ForEachSeedWord(databank, [positions, &next](uint32 inWord, uint32 inPosition) {
+            positions[next[inWord]++] = inPosition;
+        });
+
+        file.close();
+
+        fs::rename(tmpPath, path);
+    }
+    catch (...)
+    {
+        boost::system::error_code ec;
+        fs::remove(tmpPath, ec);
+        throw;
+    }
+}
+
+// --------------------------------------------------------------------
+
+struct HspData
+{
+    uint32        mScore;
+    uint32        mQueryStart, mQueryEnd, mTargetStart, mTargetEnd, mTargetLength;
+    sequence    mAlignedQuery, mAlignedTarget;
+    double        mBitScore;
+    double        mExpect;
+    bool        mGapped;
+
+    bool        operator>(const HspData& inHsp) const                { return mScore > inHsp.mScore; }
+    void        CalculateExpect(int64 inSearchSpace, double inLambda, double inLogKappa);
+    bool        Overlaps(const HspData& inOther) const
+                {
+                    return
+                        mQueryEnd >= inOther.mQueryStart and mQueryStart <= inOther.mQueryEnd and
+                        mTargetEnd >= inOther.mTargetStart and mTargetStart <= inOther.mTargetEnd;
+                }
+};
+
+void HspData::CalculateExpect(int64 inSearchSpace, double inLambda, double inLogKappa)
+{
+    mBitScore = floor((inLambda * mScore - inLogKappa) / kLn2);
+    mExpect = inSearchSpace / pow(2., mBitScore);
+}
+
+// --------------------------------------------------------------------
+
+struct HitData;
+typedef shared_ptr<HitData> HitPtr;
+
+struct HitData
+{
+                    HitData(const char* inDefLine, size_t inDefLineLength, const sequence& inTarget);
+
+    void            AddHsp(const HspData& inHsp);
+    void            Cleanup(int64 inSearchSpace, double inLambda, double inLogKappa, double inExpect);
+
+    string            mDefLine;
+    sequence        mTarget;
+    vector<HspData>    mHsps;
+};
+
+HitData::HitData(const char* inDefLine, size_t inDefLineLength, const sequence& inTarget)
+    : mDefLine(inDefLine, inDefLineLength), mTarget(inTarget)
+{
+}
+
+void HitData::AddHsp(const HspData& inHsp)
+{
+    bool found = false;
+
+    for (auto& hsp : mHsps)
+    {
+        if (inHsp.Overlaps(hsp))
+        {
+            if (hsp.mScore < inHsp.mScore)
+                hsp = inHsp;
+            found = true;
+            break;
+        }
+    }
+
+    if (not found)
+        mHsps.push_back(inHsp);
+}
+
+void HitData::Cleanup(int64 inSearchSpace, double inLambda, double inLogKappa, double inExpect)
+{
+    sort(mHsps.begin(), mHsps.end(), greater<HspData>());
+
+    vector<HspData>::iterator a = mHsps.begin();
+    while (a != mHsps.end() and a + 1 != mHsps.end())
+    {
+        vector<HspData>::iterator b = a + 1;
+        while (b != mHsps.end())
+        {
+            if (a->Overlaps(*b))
+                b = mHsps.erase(b);
+            else
+                ++b;
+        }
+        ++a;
+    }
+
+    for_each(mHsps.begin(), mHsps.end(), [=](HspData& hsp) {
+        hsp.CalculateExpect(inSearchSpace, inLambda, inLogKappa);
+    });
+
+    sort(mHsps.begin(), mHsps.end(), greater<HspData>());
+
+    mHsps.erase(
+        remove_if(mHsps.begin(), mHsps.end(), [=](const HspData& hsp) -> bool {
+            return hsp.mExpect > inExpect;
+        }),
+        mHsps.end());
+}
+
+// --------------------------------------------------------------------
+
+// SearchDatabanks cuts the databanks up in small chunks. A single set of
+// threads is started for all databanks, each thread takes the next chunk
+// to search from a shared counter until all chunks are done. This way a
+// thread that runs into a slow region does not keep the others waiting.
+// The searcher collects the results of a thread in a PartResult, these
+// are merged using MergePart when the thread is done.
+
+template<class Searcher>
+void SearchDatabanks(Searcher& inSearcher, const vector<fs::path>& inDatabanks,
+    M6Progress& inProgress, uint32 inNrOfThreads, const ThreadLimit* inThreadLimit);
+
+// A search can be resized while it runs, threads numbered at or above the
+// thread limit wait until the limit is raised again.
+
+void ThreadLimit::Set(uint32 inLimit)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    mLimit = inLimit;
+    mCondition.notify_all();
+}
+
+void ThreadLimit::Wait(uint32 inThreadNr) const
+{
+    if (inThreadNr < mLimit)
+        return;
+
+    boost::mutex::scoped_lock lock(mMutex);
+    while (inThreadNr >= mLimit)
+        mCondition.wait(lock);
+}
+
+inline void WaitForThreadLimit(uint32 inThreadNr, const ThreadLimit* inThreadLimit)
+{
+    if (inThreadLimit != nullptr)
+        inThreadLimit->Wait(inThreadNr);
+}
+
+template<int WORDSIZE>
+class BlastBatch;
+
+template<int WORDSIZE>
+class BlastQuery
+{
+  public:
+                    BlastQuery(const string& inQuery, bool inFilter, double inExpect,
+                        const string& inMatrix, bool inGapped, int32 inGapOpen, int32 inGapExtend,
+                        uint32 inReportLimit);
+                    ~BlastQuery();
+
+    void            Search(const vector<fs::path>& inDatabanks, M6Progress& inProgress,
+                        uint32 inNrOfThreads, const ThreadLimit* inThreadLimit);
+    void            Report(Result& outResult);
+    void            WriteAsFasta(ostream& inStream);
+
+  private:
+
+    friend class BlastBatch<WORDSIZE>;
+
+    template<class Searcher>
+    friend void        SearchDatabanks(Searcher& inSearcher, const vector<fs::path>& inDatabanks,
+                        M6Progress& inProgress, uint32 inNrOfThreads, const ThreadLimit* inThreadLimit);
+
+    struct PartResult
+    {
+                        PartResult() : mDbCount(0), mDbLength(0) {}
+
+        uint32            mDbCount;
+        int64            mDbLength;
+        vector<HitPtr>    mHits;
+    };
+
+    template<class Reader>
+    void            SearchPart(Reader& inReader, M6Progress& inProgress, PartResult& ioResult) const;
+    void            MergePart(PartResult& inResult);
+
+    bool            UseSeedIndex(const SeedIndex& inSeeds, const BinaryDatabank& inDatabank) const;
+    void            SearchSeeds(const SeedIndex& inSeeds, const BinaryDatabank& inDatabank,
+                        uint32 inFirst, uint32 inLast, M6Progress& inProgress, PartResult& ioResult) const;
+
+    void            WordHit(const char* inDefLine, size_t inDefLineLength, const sequence& inTarget,
+                        uint16 inQueryOffset, uint16 inTargetOffset,
+                        DiagonalStartTable& ioDiagonals, HitPtr& ioHit) const;
+
+    void            FinishSearch(uint32 inNrOfThreads, const ThreadLimit* inThreadLimit);
+
+    int32            Extend(int32& ioQueryStart, const sequence& inTarget, int32& ioTargetStart, int32& ioDistance) const;
+    template<class Iterator1, class Iterator2, class TraceBack>
+    int32            AlignGapped(Iterator1 inQueryBegin, Iterator1 inQueryEnd,
+                        Iterator2 inTargetBegin, Iterator2 inTargetEnd,
+                        TraceBack& inTraceBack, int32 inDropOff, uint32& outBestX, uint32& outBestY) const;
+
+    template<class Iterator1, class Iterator2>
+    int32            AlignGappedScore(Iterator1 inQueryBegin, Iterator1 inQueryEnd,
+                        Iterator2 inTargetBegin, Iterator2 inTargetEnd, int32 inDropOff) const;
+
+    int32            AlignGappedFirst(const sequence& inTarget, HspData& ioHsp) const;
+    int32            AlignGappedSecond(const sequence& inTarget, HspData& ioHsp) const;
+
+    void            AddHit(HitPtr inHit, vector<HitPtr>& inHitList) const;
+    void            PushHit(HitPtr inHit, vector<HitPtr>& inHitList) const;
+
+    typedef WordHitIterator<WORDSIZE>                                IWordHitIterator;
+    typedef typename IWordHitIterator::WordHitIteratorStaticData    StaticData;
+
+    string            mUnfiltered;
+    sequence        mQuery;
+    Matrix        mMatrix;
+    int8            mScoreProfile[kResCount][32];
+    vector<int8>    mQueryProfile;
+    double            mExpect, mCutOff;
+    bool            mGapped;
+    int32            mS1, mS2, mXu, mXg, mXgFinal;
+    uint32            mReportLimit;
+
+    uint32            mDbCount;
+    int64            mDbLength, mSearchSpace;
+
+    vector<HitPtr>    mHits;
+
+    StaticData    mWordHitData;
+};
+
+template<int WORDSIZE>
+BlastQuery<WORDSIZE>::BlastQuery(const string& inQuery, bool inFilter, double inExpect,
+        const string& inMatrix, bool inGapped, int32 inGapOpen, int32 inGapExtend, uint32 inReportLimit)
+    : mUnfiltered(inQuery), mMatrix(inMatrix, inGapOpen, inGapExtend)
+    , mExpect(inExpect), mGapped(inGapped), mReportLimit(inReportLimit)
+    , mDbCount(0), mDbLength(0), mSearchSpace(0)
 {
     if (mQuery.length() >= kMaxSequenceLength)
         throw M6Exception("Query length exceeds maximum");
@@ -1216,6 +2077,21 @@ BlastQuery<WORDSIZE>::BlastQuery(const string& inQuery, bool inFilter, double in
     mS2 =        static_cast<int32>((kLn2 * kGapTrigger + log(mMatrix.GappedKappa())) / mMatrix.GappedLambda());;    // yeah, that sucks... perhaps
 
     IWordHitIterator::Init(mQuery, mMatrix, kThreshold, mWordHitData);
+
+    // the position specific scores of the query, for Extend
+    mQueryProfile.resize(mQuery.length() * kResCount);
+    for (size_t q = 0; q < mQuery.length(); ++q)
+    {
+        for (uint8 r = 0; r < kResCount; ++r)
+            mQueryProfile[q * kResCount + r] = mMatrix(mQuery[q], r);
+    }
+
+    // the scores of each residue against all others, for AlignGappedScore
+    for (uint8 a = 0; a < kResCount; ++a)
+    {
+        for (uint8 b = 0; b < 32; ++b)
+            mScoreProfile[a][b] = b < kResCount ? mMatrix(a, b) : 0;
+    }
 }
 
 template<int WORDSIZE>
@@ -1223,89 +2099,167 @@ BlastQuery<WORDSIZE>::~BlastQuery()
 {
 }
 
-template<int WORDSIZE>
-void BlastQuery<WORDSIZE>::Search(const vector<fs::path>& inDatabanks, M6Progress& inProgress, uint32 inNrOfThreads)
+// A chunk is either a range of entries in a binary databank or
+// a range of a FastA file that starts at an entry.
+
+struct DatabankChunk
 {
-    exception_ptr ex;
+    const BinaryDatabank*    mBinary;
+    const SeedIndex*        mSeeds;            // set when the seed index is used
+    uint32                    mFirst, mLast;
+    const char*                mData;
+    size_t                    mLength;
+};
+
+const uint32
+    kChunkEntryCount = 2000;        // entries per chunk of a binary databank
+const size_t
+    kChunkSize = 1024 * 1024;        // bytes per chunk of a FastA file
+
+template<class Searcher>
+void SearchDatabanks(Searcher& inSearcher, const vector<fs::path>& inDatabanks,
+    M6Progress& inProgress, uint32 inNrOfThreads, const ThreadLimit* inThreadLimit)
+{
+    // the databanks stay open until all chunks are searched
+    vector<unique_ptr<BinaryDatabank>> binaries;
+    vector<unique_ptr<SeedIndex>> seeds;
+    vector<unique_ptr<io::mapped_file>> files;
+    vector<DatabankChunk> chunks;
 
     for (const fs::path& p : inDatabanks)
     {
-        io::mapped_file file(p.string().c_str(), io::mapped_file::readonly);
-        if (not file.is_open())
+        unique_ptr<BinaryDatabank> binary(new BinaryDatabank(p));
+
+        if (binary->IsOpen())
+        {
+            unique_ptr<SeedIndex> seedIndex(new SeedIndex(p, *binary));
+            if (not seedIndex->IsOpen() or not inSearcher.UseSeedIndex(*seedIndex, *binary))
+                seedIndex.reset();
+
+            uint32 entryCount = binary->GetEntryCount();
+            for (uint32 first = 0; first < entryCount; first += kChunkEntryCount)
+            {
+                DatabankChunk chunk = { binary.get(), seedIndex.get(),
+                    first, min(entryCount, first + kChunkEntryCount), nullptr, 0 };
+                chunks.push_back(chunk);
+            }
+
+            binaries.push_back(move(binary));
+            seeds.push_back(move(seedIndex));
+            continue;
+        }
+
+        unique_ptr<io::mapped_file> file(new io::mapped_file(p.string().c_str(), io::mapped_file::readonly));
+        if (not file->is_open())
             throw M6Exception("FastA file %s not open", p.string().c_str());
 
-        const char* data = file.const_data();
-        size_t length = file.size();
+        const char* data = file->const_data();
+        const char* end = data + file->size();
 
-        if (inNrOfThreads <= 1)
-            SearchPart(data, length, inProgress, mDbCount, mDbLength, mHits);
-        else
+        while (data < end)
         {
-            boost::thread_group t;
-            boost::mutex m;
+            // a chunk ends where the next entry starts
+            const char* chunkEnd = data + min(kChunkSize, static_cast<size_t>(end - data));
+            while (chunkEnd < end and not (*chunkEnd == '>' and chunkEnd[-1] == '\n'))
+                ++chunkEnd;
 
-            size_t k = length / inNrOfThreads;
-            const char *prevEnd = data;
-            for (uint32 i = 0; i < inNrOfThreads and length > 0; ++i)
-            {
-                size_t n = k;
-                if (n > length)
-                    n = length;
-                const char* end = data + n;
+            DatabankChunk chunk = { nullptr, nullptr, 0, 0, data, static_cast<size_t>(chunkEnd - data) };
+            chunks.push_back(chunk);
 
-                while (end <= prevEnd)
-                {
-                    end++;
-                    n++;
-                }
-                prevEnd = end;
+            data = chunkEnd;
+        }
 
-                while (n < length and *end != '>')
-                {
-                    ++end;
-                    ++n;
-                }
+        files.push_back(move(file));
+    }
 
-                t.create_thread([data, n, &m, &inProgress, &ex, this]() {
-                    try
-                    {
-                        uint32 dbCount = 0;
-                        int64 dbLength = 0;
-                        vector<HitPtr> hits;
+    atomic<size_t> next(0);
 
-                        this->SearchPart(data, n, inProgress, dbCount, dbLength, hits);
+    auto searchChunks = [&](uint32 inThreadNr) {
+        typename Searcher::PartResult result;
 
-                        boost::mutex::scoped_lock lock(m);
-                        mDbCount += dbCount;
-                        mDbLength += dbLength;
-                        this->mHits.insert(mHits.end(), hits.begin(), hits.end());
-                    }
-                    catch (...)
-                    {
-                        ex = current_exception();
-                    }
-                });
+        for (;;)
+        {
+            WaitForThreadLimit(inThreadNr, inThreadLimit);
+
+            size_t i = next++;
+            if (i >= chunks.size())
+                break;
 
-                data += n;
-                length -= n;
+            const DatabankChunk& chunk = chunks[i];
+            if (chunk.mSeeds != nullptr)
+                inSearcher.SearchSeeds(*chunk.mSeeds, *chunk.mBinary, chunk.mFirst, chunk.mLast, inProgress, result);
+            else if (chunk.mBinary != nullptr)
+            {
+                BinaryReader reader(*chunk.mBinary, chunk.mFirst, chunk.mLast);
+                inSearcher.SearchPart(reader, inProgress, result);
             }
+            else
+            {
+                FastaReader reader(chunk.mData, chunk.mLength);
+                inSearcher.SearchPart(reader, inProgress, result);
+            }
+        }
+
+        return result;
+    };
+
+    if (inNrOfThreads <= 1 or chunks.size() <= 1)
+    {
+        typename Searcher::PartResult result = searchChunks(0);
+        inSearcher.MergePart(result);
+        return;
+    }
+
+    exception_ptr ex;
+    boost::mutex m;
+    boost::thread_group t;
 
+    for (uint32 i = 0; i < inNrOfThreads and i < chunks.size(); ++i)
+    {
+        t.create_thread([&, i]() {
             try
             {
-                t.join_all();
+                typename Searcher::PartResult result = searchChunks(i);
+
+                boost::mutex::scoped_lock lock(m);
+                inSearcher.MergePart(result);
             }
-            catch (boost::thread_interrupted&)
+            catch (...)
             {
-                t.interrupt_all();
-                t.join_all();
-                throw;
+                boost::mutex::scoped_lock lock(m);
+                ex = current_exception();
             }
-        }
+        });
+    }
+
+    try
+    {
+        t.join_all();
+    }
+    catch (boost::thread_interrupted&)
+    {
+        t.interrupt_all();
+        t.join_all();
+        throw;
     }
 
     if (not (ex == exception_ptr()))
         rethrow_exception(ex);
+}
+
+// --------------------------------------------------------------------
 
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::Search(const vector<fs::path>& inDatabanks, M6Progress& inProgress,
+    uint32 inNrOfThreads, const ThreadLimit* inThreadLimit)
+{
+    SearchDatabanks(*this, inDatabanks, inProgress, inNrOfThreads, inThreadLimit);
+    FinishSearch(inNrOfThreads, inThreadLimit);
+}
+
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::FinishSearch(uint32 inNrOfThreads, const ThreadLimit* inThreadLimit)
+{
     int32 lengthAdjustment = ncbi::BlastComputeLengthAdjustment(mMatrix, static_cast<uint32>(mQuery.length()), mDbLength, mDbCount);
 
     int64 effectiveQueryLength = mQuery.length() - lengthAdjustment;
@@ -1315,19 +2269,22 @@ void BlastQuery<WORDSIZE>::Search(const vector<fs::path>& inDatabanks, M6Progres
 
     if (not mHits.empty())
     {
+        exception_ptr ex;
         boost::thread_group t;
         atomic<int> ix(-1);
         //boost::detail::atomic_count ix(-1);
 
         for (uint32 i = 0; i < inNrOfThreads; ++i)
         {
-            t.create_thread([this, &ix, &ex]() {
+            t.create_thread([this, i, inThreadLimit, &ix, &ex]() {
                 try
                 {
                     double lambda = mMatrix.GappedLambda(), logK = log(mMatrix.GappedKappa());
 
                     for (;;)
                     {
+                        WaitForThreadLimit(i, inThreadLimit);
+
                         uint32 next = ++ix;
                         if (next >= this->mHits.size())
                             break;
@@ -1473,158 +2430,292 @@ void BlastQuery<WORDSIZE>::WriteAsFasta(ostream& inStream)
     }
 }
 
-template<int WORDSIZE>
-void BlastQuery<WORDSIZE>::SearchPart(const char* inFasta, size_t inLength, M6Progress& inProgress,
-    uint32& outDbCount, int64& outDbLength, vector<HitPtr>& outHits) const
-{
-    const char* end = inFasta + inLength;
-    int32 queryLength = static_cast<int32>(mQuery.length());
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::MergePart(PartResult& inResult)
+{
+    mDbCount += inResult.mDbCount;
+    mDbLength += inResult.mDbLength;
+
+    for (HitPtr hit : inResult.mHits)
+        PushHit(hit, mHits);
+}
+
+template<int WORDSIZE>
+template<class Reader>
+void BlastQuery<WORDSIZE>::SearchPart(Reader& inReader, M6Progress& inProgress, PartResult& ioResult) const
+{
+    int32 queryLength = static_cast<int32>(mQuery.length());
+
+    IWordHitIterator iter(mWordHitData);
+    DiagonalStartTable diagonals;
+    sequence target;
+    target.reserve(kMaxSequenceLength);
+
+    HitPtr hit;
+
+    const char* defLine;
+    size_t defLineLength, consumed;
+
+    LOG(INFO, "running SearchPart");
+
+    while (inReader.Next(defLine, defLineLength, target, consumed))
+    {
+        // make it possible to interrupt a search
+        boost::this_thread::interruption_point();
+
+        if (hit)
+        {
+            AddHit(hit, ioResult.mHits);
+            hit.reset();
+        }
+
+        inProgress.Consumed(consumed);
+
+        if (target.empty() or target.length() > kMaxSequenceLength)
+            continue;
+
+        ioResult.mDbCount += 1;
+        ioResult.mDbLength += target.length();
+
+        // an HSP needs at least two word hits
+        if (not IWordHitIterator::HasWordHits(mWordHitData, target, 2))
+            continue;
+
+        iter.Reset(target);
+        diagonals.Reset(queryLength, static_cast<int32>(target.length()));
+
+        uint16 queryOffset, targetOffset;
+        while (iter.Next(queryOffset, targetOffset))
+            WordHit(defLine, defLineLength, target, queryOffset, targetOffset, diagonals, hit);
+    }
+
+    if (hit)
+        AddHit(hit, ioResult.mHits);
+
+    LOG(INFO, "finished SearchPart");
+}
+
+// The cost model for the seed index. A scan looks up every word in the
+// databank, the seed index search reads the positions of the words in the
+// query lookup table and sorts the resulting word hits. The costs are
+// relative to looking up a word in a scan and were measured with
+// TestSeedIndex. The extension of the word hits is the same for both.
+
+const double
+    kScanCostPerResidue        = 1.0,
+    kSeedCostPerPosition    = 1.0,
+    kSeedCostPerWordHit        = 20.0,        // mostly sorting
+    kSeedCostPerLookup        = 40.0;        // for each word for each chunk
+
+template<int WORDSIZE>
+bool BlastQuery<WORDSIZE>::UseSeedIndex(const SeedIndex& inSeeds, const BinaryDatabank& inDatabank) const
+{
+    if (WORDSIZE != kSeedWordSize or sSeedIndexMode == eSeedIndexNever)
+        return false;
+
+    if (sSeedIndexMode == eSeedIndexAlways)
+        return true;
+
+    int64 words = 0, positions = 0, wordHits = 0;
+    for (uint32 word = 0; word < mWordHitData.mLookup.size(); ++word)
+    {
+        uint32 count = mWordHitData.mLookup[word].mCount;
+        if (count > 0)
+        {
+            uint32 n = inSeeds.GetPositionCount(word);
+
+            words += 1;
+            positions += n;
+            wordHits += int64(count) * n;
+        }
+    }
+
+    uint32 chunks = (inDatabank.GetEntryCount() + kChunkEntryCount - 1) / kChunkEntryCount;
+
+    double scanCost = inDatabank.GetResidueCount() * kScanCostPerResidue;
+    double seedCost = positions * kSeedCostPerPosition + wordHits * kSeedCostPerWordHit +
+        words * chunks * kSeedCostPerLookup;
+
+    LOG(INFO, "seed index cost %g, scan cost %g", seedCost, scanCost);
+
+    return seedCost < scanCost;
+}
+
+// Search the entries inFirst to inLast using the seed index. The word hits
+// are collected as position in the databank and query offset. Sorted they
+// come in the same order as the hits of a scan and so the result is the
+// same as that of SearchPart.
+
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::SearchSeeds(const SeedIndex& inSeeds, const BinaryDatabank& inDatabank,
+    uint32 inFirst, uint32 inLast, M6Progress& inProgress, PartResult& ioResult) const
+{
+    int32 queryLength = static_cast<int32>(mQuery.length());
+    int64 first = inDatabank.GetSequenceOffset(inFirst), last = inDatabank.GetSequenceOffset(inLast);
+
+    vector<uint64> wordHits;
+
+    for (uint32 word = 0; word < mWordHitData.mLookup.size(); ++word)
+    {
+        uint32 count = mWordHitData.mLookup[word].mCount;
+        if (count == 0)
+            continue;
+
+        const uint16* offsets = &mWordHitData.mOffsets[mWordHitData.mLookup[word].mDataOffset];
+
+        const uint32* begin;
+        const uint32* end;
+        inSeeds.GetPositions(word, first, last, begin, end);
+
+        for (const uint32* p = begin; p != end; ++p)
+        {
+            for (uint32 i = 0; i < count; ++i)
+                wordHits.push_back(uint64(*p) << 16 | offsets[i]);
+        }
+    }
+
+    sort(wordHits.begin(), wordHits.end());
 
-    IWordHitIterator iter(mWordHitData);
     DiagonalStartTable diagonals;
     sequence target;
-    target.reserve(kMaxSequenceLength);
-
-    int64 hitsToDb = 0, extensions = 0, successfulExtensions = 0;
     HitPtr hit;
+    int64 consumed = 0;
 
-    LOG(INFO, "running SearchPart with inLength=%d", inLength);
+    auto wordHit = wordHits.begin();
 
-    while (inFasta != end)
+    for (uint32 entry = inFirst; entry < inLast; ++entry)
     {
-        // make it possible to interrupt a search
         boost::this_thread::interruption_point();
 
-        if (hit)
-        {
-            AddHit(hit, outHits);
-            hit.reset();
-        }
+        const char* defLine;
+        size_t defLineLength, length;
+        const uint8* residues;
 
-        const char* entry = inFasta;
-        ReadEntry(inFasta, end, target);
+        inDatabank.GetEntry(entry, defLine, defLineLength, residues, length);
+        consumed += defLineLength + length;
 
-        inProgress.Consumed(inFasta - entry);
+        int64 start = inDatabank.GetSequenceOffset(entry);
+        int64 end = inDatabank.GetSequenceOffset(entry + 1);
 
-        if (target.empty() or target.length() > kMaxSequenceLength)
+        if (length == 0 or length > kMaxSequenceLength)
+        {
+            while (wordHit != wordHits.end() and int64(*wordHit >> 16) < end)
+                ++wordHit;
             continue;
+        }
 
-        outDbCount += 1;
-        outDbLength += target.length();
+        ioResult.mDbCount += 1;
+        ioResult.mDbLength += length;
 
-        iter.Reset(target);
-        diagonals.Reset(queryLength, static_cast<int32>(target.length()));
+        // an HSP needs at least two word hits
+        auto next = wordHit;
+        while (next != wordHits.end() and int64(*next >> 16) < end)
+            ++next;
 
-        uint16 queryOffset, targetOffset;
-        while (iter.Next(queryOffset, targetOffset))
+        if (next - wordHit < 2)
         {
-            ++hitsToDb;
+            wordHit = next;
+            continue;
+        }
 
-            int32& ds = diagonals(queryOffset, targetOffset);
-            int32 distance = queryOffset - ds;
+        target.assign(residues, length);
+        diagonals.Reset(queryLength, static_cast<int32>(length));
 
-            if (distance >= kHitWindow)
-                ds = queryOffset;
-            else if (distance > WORDSIZE)
-            {
-                int32 queryStart = ds;
-                int32 targetStart = targetOffset - distance;
-                int32 alignmentDistance = distance + WORDSIZE;
+        for (; wordHit != wordHits.end() and int64(*wordHit >> 16) < end; ++wordHit)
+        {
+            WordHit(defLine, defLineLength, target, static_cast<uint16>(*wordHit & 0xffff),
+                static_cast<uint16>((*wordHit >> 16) - start), diagonals, hit);
+        }
 
-                if (targetStart < 0 or queryStart < 0)
-                    continue;
+        if (hit)
+        {
+            AddHit(hit, ioResult.mHits);
+            hit.reset();
+        }
+    }
 
-                ++extensions;
+    inProgress.Consumed(consumed);
+}
 
-                int32 score = Extend(queryStart, target, targetStart, alignmentDistance);
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::WordHit(const char* inDefLine, size_t inDefLineLength, const sequence& inTarget,
+    uint16 inQueryOffset, uint16 inTargetOffset, DiagonalStartTable& ioDiagonals, HitPtr& ioHit) const
+{
+    int32& ds = ioDiagonals(inQueryOffset, inTargetOffset);
+    int32 distance = inQueryOffset - ds;
 
-                if (score >= mS1)
-                {
-                    ++successfulExtensions;
+    if (distance >= kHitWindow)
+        ds = inQueryOffset;
+    else if (distance > WORDSIZE)
+    {
+        int32 queryStart = ds;
+        int32 targetStart = inTargetOffset - distance;
+        int32 alignmentDistance = distance + WORDSIZE;
 
-                    HspData hsp;
+        if (targetStart < 0 or queryStart < 0)
+            return;
 
-                    // extension results, to be updated later
-                    hsp.mQueryStart = queryStart;
-                    hsp.mQueryEnd = queryStart + alignmentDistance;
-                    hsp.mTargetStart = targetStart;
-                    hsp.mTargetEnd = targetStart + alignmentDistance;
-                    hsp.mTargetLength = static_cast<uint32>(target.length());
+        int32 score = Extend(queryStart, inTarget, targetStart, alignmentDistance);
 
-                    if (not hit)
-                        hit.reset(new HitData(entry, target));
+        if (score >= mS1)
+        {
+            HspData hsp;
 
-                    if (mGapped)
-                        hsp.mScore = AlignGappedFirst(target, hsp);
-                    else
-                    {
-                        hsp.mScore = score;
-                        hsp.mAlignedQuery = mQuery.substr(hsp.mQueryStart, hsp.mQueryEnd - hsp.mQueryStart);
-                        hsp.mAlignedTarget = hit->mTarget.substr(hsp.mTargetStart, hsp.mTargetEnd - hsp.mTargetStart);
-                    }
+            // extension results, to be updated later
+            hsp.mQueryStart = queryStart;
+            hsp.mQueryEnd = queryStart + alignmentDistance;
+            hsp.mTargetStart = targetStart;
+            hsp.mTargetEnd = targetStart + alignmentDistance;
+            hsp.mTargetLength = static_cast<uint32>(inTarget.length());
 
-                    hit->AddHsp(hsp);
-                }
+            if (not ioHit)
+                ioHit.reset(new HitData(inDefLine, inDefLineLength, inTarget));
 
-                ds = queryStart + alignmentDistance;
+            if (mGapped)
+                hsp.mScore = AlignGappedFirst(inTarget, hsp);
+            else
+            {
+                hsp.mScore = score;
+                hsp.mAlignedQuery = mQuery.substr(hsp.mQueryStart, hsp.mQueryEnd - hsp.mQueryStart);
+                hsp.mAlignedTarget = ioHit->mTarget.substr(hsp.mTargetStart, hsp.mTargetEnd - hsp.mTargetStart);
             }
-        }
-    }
 
-    if (hit)
-        AddHit(hit, outHits);
+            ioHit->AddHsp(hsp);
+        }
 
-    LOG(INFO, "finished SearchPart with inLength=%d", inLength);
+        ds = queryStart + alignmentDistance;
+    }
 }
 
 template<int WORDSIZE>
 int32 BlastQuery<WORDSIZE>::Extend(int32& ioQueryStart, const sequence& inTarget, int32& ioTargetStart, int32& ioDistance) const
 {
-    // use iterators
-    sequence::const_iterator ai = mQuery.begin() + ioQueryStart;
-    sequence::const_iterator bi = inTarget.begin() + ioTargetStart;
+    const int8* profile = &mQueryProfile[ioQueryStart * kResCount];
+    const uint8* target = inTarget.data() + ioTargetStart;
 
     int32 score = 0;
-    for (int i = 0; i < ioDistance; ++i, ++ai, ++bi)
-        score += mMatrix(*ai, *bi);
+    for (int32 i = 0; i < ioDistance; ++i)
+        score += profile[i * kResCount + target[i]];
 
     // record start and stop positions for optimal score
-    sequence::const_iterator qe = ai;
-
-    for (int32 test = score, n = static_cast<int32>(min(mQuery.end() - ai, inTarget.end() - bi));
-         test >= score - mXu and n > 0;
-         --n, ++ai, ++bi)
-    {
-        test += mMatrix(*ai, *bi);
-
-        if (test > score)
-        {
-            score = test;
-            qe = ai;
-        }
-    }
+    int32 queryEnd = ioQueryStart + ioDistance;
+    uint32 n = static_cast<uint32>(min(mQuery.length() - queryEnd, inTarget.length() - (ioTargetStart + ioDistance)));
 
-    ai = mQuery.begin() + ioQueryStart;
-    bi = inTarget.begin() + ioTargetStart;
-    sequence::const_iterator qs = ai + 1;
+    n = ExtendUngapped(profile + ioDistance * kResCount, target + ioDistance, 1, n, mXu, score);
+    if (n > 0)
+        queryEnd += n - 1;
 
-    for (int32 test = score, n = min(ioQueryStart, ioTargetStart);
-         test >= score - mXu and n > 0;
-         --n)
-    {
-        test += mMatrix(*--ai, *--bi);
+    int32 queryStart = ioQueryStart + 1;
+    n = static_cast<uint32>(min(ioQueryStart, ioTargetStart));
 
-        if (test > score)
-        {
-            score = test;
-            qs = ai;
-        }
-    }
+    n = ExtendUngapped(profile - kResCount, target - 1, -1, n, mXu, score);
+    if (n > 0)
+        queryStart = ioQueryStart - n;
 
-    int32 delta = static_cast<int32>(ioQueryStart - (qs - mQuery.begin()));
+    int32 delta = ioQueryStart - queryStart;
     ioQueryStart -= delta;
     ioTargetStart -= delta;
-    ioDistance = static_cast<int32>(qe - qs);
+    ioDistance = queryEnd - queryStart;
 
     return score;
 }
@@ -1779,26 +2870,176 @@ int32 BlastQuery<WORDSIZE>::AlignGapped(
     return bestScore;
 }
 
+template<int WORDSIZE>
+template<class Iterator1, class Iterator2>
+int32 BlastQuery<WORDSIZE>::AlignGappedScore(
+    Iterator1 inQueryBegin, Iterator1 inQueryEnd, Iterator2 inTargetBegin, Iterator2 inTargetEnd,
+    int32 inDropOff) const
+{
+    uint32 dimX = static_cast<uint32>(inQueryEnd - inQueryBegin);
+    uint32 dimY = static_cast<uint32>(inTargetEnd - inTargetBegin);
+
+    if (dimX == 0 or dimY == 0)
+    {
+        uint32 x, y;
+        DiscardTraceBack tb;
+        return AlignGapped(inQueryBegin, inQueryEnd, inTargetBegin, inTargetEnd, tb, inDropOff, x, y);
+    }
+
+    int16 d = static_cast<int16>(mMatrix.OpenCost());
+    int16 e = static_cast<int16>(mMatrix.ExtendCost());
+
+    // B and Ix for the previous and current column and M and max(M, Ix1)
+    // for the current column. Iy is only needed for the previous row.
+    size_t n = dimY + 1 + kGappedColumnPadding;
+    unique_ptr<int16[]> data(new int16[6 * n]);
+
+    int16* Bp = data.get();
+    int16* Bc = Bp + n;
+    int16* Ixp = Bc + n;
+    int16* Ixc = Ixp + n;
+    int16* M = Ixc + n;
+    int16* MIx = M + n;
+
+    // the target residues are copied when needed, most alignments
+    // only cover a small part of the target
+    unique_ptr<uint8[]> target(new uint8[dimY + kGappedColumnPadding]);
+    uint32 targetCopied = 0;
+
+    // first column
+    Iterator1 x = inQueryBegin;
+
+    int32 bestScore = Bp[1] = mMatrix(*x, *inTargetBegin);
+    Ixp[1] = bestScore - d;
+
+    uint32 bestY = 1;
+    uint32 colStart = 1;
+    uint32 lastColStart = 1;
+    uint32 colEnd = dimY;
+
+    int16 Iy = bestScore - d;
+
+    for (uint32 j = 2; j <= dimY; ++j)
+    {
+        int32 Bij = Bp[j] = Iy;
+        Ixp[j] = kSentinalScore;
+        Iy -= e;
+
+        if (Bij < bestScore - inDropOff)
+        {
+            colEnd = j;
+            break;
+        }
+    }
+
+    // remaining columns
+    ++x;
+    for (uint32 i = 2; x != inQueryEnd and colEnd >= colStart; ++i, ++x)
+    {
+        // the diagonal is only available for rows up to the end of the previous column
+        uint32 lastRow = colEnd;
+
+        if (targetCopied < lastRow)
+        {
+            uint32 copied = min(dimY, max(lastRow, targetCopied + 256));
+            copy(inTargetBegin + targetCopied, inTargetBegin + copied, target.get() + targetCopied);
+            targetCopied = copied;
+        }
+
+        GappedColumn column = { Bp, Ixp, target.get(), mScoreProfile[*x], d, e, M, MIx, Ixc };
+        kCalculateGappedColumn(column, colStart, lastRow);
+
+        // there's no diagonal for the first row of the previous column
+        // and no horizontal gap for its last row
+        for (uint32 j : { colStart, lastRow })
+        {
+            if (j > lastColStart and j < lastRow)
+                continue;
+
+            int32 Mj = j <= lastColStart ? kSentinalScore : M[j];
+            int32 Ix1 = j < lastRow ? Ixp[j] : kSentinalScore;
+
+            M[j] = Mj;
+            MIx[j] = max(Mj, Ix1);
+            Ixc[j] = max(Mj - d, Ix1 - e);
+        }
+
+        uint32 newColStart = colStart;
+        bool beforeFirstRow = true;
+
+        Iy = kSentinalScore;
+
+        for (uint32 j = colStart; j <= dimY; ++j)
+        {
+            int32 Mj = kSentinalScore;
+            int32 MIxj = kSentinalScore;
+
+            if (j <= lastRow)
+            {
+                Mj = M[j];
+                MIxj = MIx[j];
+            }
+            else
+                Ixc[j] = max(kSentinalScore - d, kSentinalScore - e);
+
+            int32 Iy1 = Iy;
+
+            int32 Bij = Bc[j] = max(MIxj, Iy1);
+            Iy = max(Mj - d, Iy1 - e);
+
+            if (Bij > bestScore)
+            {
+                bestScore = Bij;
+                bestY = j;
+                beforeFirstRow = false;
+            }
+            else if (Bij < bestScore - inDropOff)
+            {
+                if (beforeFirstRow)
+                {
+                    newColStart = j;
+                    if (newColStart > colEnd)
+                        break;
+                }
+                else if (j > bestY + 1)
+                {
+                    colEnd = j;
+                    break;
+                }
+            }
+            else
+            {
+                beforeFirstRow = false;
+                if (j > colEnd)
+                    colEnd = j;
+            }
+        }
+
+        lastColStart = colStart;
+        colStart = newColStart;
+
+        swap(Bp, Bc);
+        swap(Ixp, Ixc);
+    }
+
+    return bestScore;
+}
+
 template<int WORDSIZE>
 int32 BlastQuery<WORDSIZE>::AlignGappedFirst(const sequence& inTarget, HspData& ioHsp) const
 {
     int32 score;
 
-    uint32 x, y;
     uint32 targetSeed = (ioHsp.mTargetStart + ioHsp.mTargetEnd) / 2;
     uint32 querySeed = (ioHsp.mQueryStart + ioHsp.mQueryEnd) / 2;
 
-    DiscardTraceBack tb;
-
-    score = AlignGapped(
+    score = AlignGappedScore(
         mQuery.begin() + querySeed + 1, mQuery.end(),
-        inTarget.begin() + targetSeed + 1, inTarget.end(),
-        tb, mXg, x, y);
+        inTarget.begin() + targetSeed + 1, inTarget.end(), mXg);
 
-    score += AlignGapped(
+    score += AlignGappedScore(
         mQuery.rbegin() + (mQuery.length() - querySeed), mQuery.rend(),
-        inTarget.rbegin() + (inTarget.length() - targetSeed), inTarget.rend(),
-        tb, mXg, x, y);
+        inTarget.rbegin() + (inTarget.length() - targetSeed), inTarget.rend(), mXg);
 
     score += mMatrix(mQuery[querySeed], inTarget[targetSeed]);
 
@@ -1881,98 +3122,287 @@ int32 BlastQuery<WORDSIZE>::AlignGappedSecond(const sequence& inTarget, HspData&
     sequence::const_reverse_iterator qri = mQuery.rbegin() + (mQuery.length() - querySeed) - 1 - x, qris = qri;
     sequence::const_reverse_iterator sri = inTarget.rbegin() + (inTarget.length() - targetSeed) - 1 - y, sris = sri;
 
-    sequence q, s;
+    sequence q, s;
+
+    while (x >= 1 and y >= 1)
+    {
+        if (x >= 1 and y >= 1 and d2(x, y) == 0)
+        {
+            q += *qri++;
+            s += *sri++;
+            --x;
+            --y;
+        }
+        else if (y >= 1 and d2(x, y) < 0)
+        {
+            q += kGapCode;
+            s += *sri++;
+            --y;
+            ioHsp.mGapped = true;
+        }
+        else // if (x >= 1 and d2(x, y) > 0)
+        {
+            q += *qri++;
+            s += kGapCode;
+            --x;
+            ioHsp.mGapped = true;
+        }
+    }
+
+    reverse(q.begin(), q.end());
+    reverse(s.begin(), s.end());
+
+    alignedQuery += q;
+    alignedTarget += s;
+
+    qLen += static_cast<uint32>(qri - qris);
+    sLen += static_cast<uint32>(sri - sris);
+
+    ioHsp.mAlignedQuery.assign(alignedQuery.begin(), alignedQuery.end());
+    ioHsp.mAlignedTarget.assign(alignedTarget.begin(), alignedTarget.end());
+    ioHsp.mQueryEnd = ioHsp.mQueryStart + qLen;
+    ioHsp.mTargetEnd = ioHsp.mTargetStart + sLen;
+
+    return score;
+}
+
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::AddHit(HitPtr inHit, vector<HitPtr>& inHitList) const
+{
+    sort(inHit->mHsps.begin(), inHit->mHsps.end(), greater<HspData>());
+    PushHit(inHit, inHitList);
+}
+
+// The hit list is a heap that keeps the best mReportLimit hits. Hits with
+// equal scores are ordered by definition line, like in the final result,
+// so that the hits kept do not depend on the order in which they are found.
+
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::PushHit(HitPtr inHit, vector<HitPtr>& inHitList) const
+{
+    inHitList.push_back(inHit);
+
+    auto cmp = [](const HitPtr a, const HitPtr b) -> bool {
+        return a->mHsps.front().mScore > b->mHsps.front().mScore or
+            (a->mHsps.front().mScore == b->mHsps.front().mScore and a->mDefLine < b->mDefLine);
+    };
+
+    push_heap(inHitList.begin(), inHitList.end(), cmp);
+    if (inHitList.size() > mReportLimit and mReportLimit > 0)
+    {
+        pop_heap(inHitList.begin(), inHitList.end(), cmp);
+        inHitList.erase(inHitList.end() - 1);
+    }
+}
+
+// --------------------------------------------------------------------
+//    BlastBatch searches several queries in one pass over the databanks.
+//    The word lookup table contains the offsets of all queries, tagged with
+//    the query number in the upper 16 bits. Each target is read and scanned
+//    for words once, the word hits are then handed to the query they belong
+//    to. The results are the same as when the queries are searched one by one.
+
+template<int WORDSIZE>
+class BlastBatch
+{
+  public:
+    typedef BlastQuery<WORDSIZE>    Query;
+
+                    BlastBatch(const vector<Query*>& inQueries);
+
+    void            Search(const vector<fs::path>& inDatabanks, M6Progress& inProgress,
+                        uint32 inNrOfThreads, const ThreadLimit* inThreadLimit);
+
+  private:
+
+    template<class Searcher>
+    friend void        SearchDatabanks(Searcher& inSearcher, const vector<fs::path>& inDatabanks,
+                        M6Progress& inProgress, uint32 inNrOfThreads, const ThreadLimit* inThreadLimit);
+
+    struct PartResult
+    {
+                        PartResult() : mDbCount(0), mDbLength(0) {}
+
+        uint32            mDbCount;
+        int64            mDbLength;
+        vector<vector<HitPtr>>
+                        mHits;
+    };
+
+    template<class Reader>
+    void            SearchPart(Reader& inReader, M6Progress& inProgress, PartResult& ioResult) const;
+    void            MergePart(PartResult& inResult);
+
+    // a batch has many words to look up, scanning is always faster
+    bool            UseSeedIndex(const SeedIndex& inSeeds, const BinaryDatabank& inDatabank) const
+                    {
+                        return false;
+                    }
+
+    void            SearchSeeds(const SeedIndex& inSeeds, const BinaryDatabank& inDatabank,
+                        uint32 inFirst, uint32 inLast, M6Progress& inProgress, PartResult& ioResult) const
+                    {
+                        BinaryReader reader(inDatabank, inFirst, inLast);
+                        SearchPart(reader, inProgress, ioResult);
+                    }
+
+    typedef WordHitIterator<WORDSIZE, uint32>                        IWordHitIterator;
+    typedef typename IWordHitIterator::WordHitIteratorStaticData    StaticData;
+
+    vector<Query*>    mQueries;
+    StaticData        mWordHitData;
+};
+
+template<int WORDSIZE>
+BlastBatch<WORDSIZE>::BlastBatch(const vector<Query*>& inQueries)
+    : mQueries(inQueries)
+{
+    if (mQueries.size() > numeric_limits<uint16>::max())
+        throw M6Exception("Too many queries in blast batch");
+
+    // merge the word lookup tables of the queries
+    size_t N = mQueries.front()->mWordHitData.mLookup.size(), M = 0;
+    for (Query* q : mQueries)
+        M += q->mWordHitData.mOffsets.size();
+
+    mWordHitData.mLookup.resize(N);
+    mWordHitData.mOffsets.reserve(M);
 
-    while (x >= 1 and y >= 1)
+    for (size_t i = 0; i < N; ++i)
     {
-        if (x >= 1 and y >= 1 and d2(x, y) == 0)
-        {
-            q += *qri++;
-            s += *sri++;
-            --x;
-            --y;
-        }
-        else if (y >= 1 and d2(x, y) < 0)
-        {
-            q += kGapCode;
-            s += *sri++;
-            --y;
-            ioHsp.mGapped = true;
-        }
-        else // if (x >= 1 and d2(x, y) > 0)
+        mWordHitData.mLookup[i].mDataOffset = static_cast<uint32>(mWordHitData.mOffsets.size());
+
+        for (uint32 q = 0; q < mQueries.size(); ++q)
         {
-            q += *qri++;
-            s += kGapCode;
-            --x;
-            ioHsp.mGapped = true;
+            auto& e = mQueries[q]->mWordHitData.mLookup[i];
+            const uint16* offsets = &mQueries[q]->mWordHitData.mOffsets[0] + e.mDataOffset;
+
+            for (uint32 j = 0; j < e.mCount; ++j)
+                mWordHitData.mOffsets.push_back(q << 16 | offsets[j]);
         }
+
+        mWordHitData.mLookup[i].mCount =
+            static_cast<uint32>(mWordHitData.mOffsets.size()) - mWordHitData.mLookup[i].mDataOffset;
     }
 
-    reverse(q.begin(), q.end());
-    reverse(s.begin(), s.end());
+    mWordHitData.InitWordSet();
+}
 
-    alignedQuery += q;
-    alignedTarget += s;
+template<int WORDSIZE>
+void BlastBatch<WORDSIZE>::Search(const vector<fs::path>& inDatabanks, M6Progress& inProgress,
+    uint32 inNrOfThreads, const ThreadLimit* inThreadLimit)
+{
+    SearchDatabanks(*this, inDatabanks, inProgress, inNrOfThreads, inThreadLimit);
 
-    qLen += static_cast<uint32>(qri - qris);
-    sLen += static_cast<uint32>(sri - sris);
+    for (Query* q : mQueries)
+        q->FinishSearch(inNrOfThreads, inThreadLimit);
+}
 
-    ioHsp.mAlignedQuery.assign(alignedQuery.begin(), alignedQuery.end());
-    ioHsp.mAlignedTarget.assign(alignedTarget.begin(), alignedTarget.end());
-    ioHsp.mQueryEnd = ioHsp.mQueryStart + qLen;
-    ioHsp.mTargetEnd = ioHsp.mTargetStart + sLen;
+template<int WORDSIZE>
+void BlastBatch<WORDSIZE>::MergePart(PartResult& inResult)
+{
+    for (uint32 q = 0; q < mQueries.size(); ++q)
+    {
+        Query* query = mQueries[q];
 
-    return score;
+        query->mDbCount += inResult.mDbCount;
+        query->mDbLength += inResult.mDbLength;
+
+        // a thread that did not get any chunk has no hit lists
+        if (q < inResult.mHits.size())
+        {
+            for (HitPtr hit : inResult.mHits[q])
+                query->PushHit(hit, query->mHits);
+        }
+    }
 }
 
 template<int WORDSIZE>
-void BlastQuery<WORDSIZE>::AddHit(HitPtr inHit, vector<HitPtr>& inHitList) const
+template<class Reader>
+void BlastBatch<WORDSIZE>::SearchPart(Reader& inReader, M6Progress& inProgress, PartResult& ioResult) const
 {
-    sort(inHit->mHsps.begin(), inHit->mHsps.end(), greater<HspData>());
+    uint32 queryCount = static_cast<uint32>(mQueries.size());
+    ioResult.mHits.resize(queryCount);
 
-    inHitList.push_back(inHit);
+    IWordHitIterator iter(mWordHitData);
+    sequence target;
+    target.reserve(kMaxSequenceLength);
 
-    auto cmp = [](const HitPtr a, const HitPtr b) -> bool {
-        return a->mHsps.front().mScore > b->mHsps.front().mScore;
-    };
+    // the diagonal tables are only reset for the queries that have a
+    // word hit in the current target
+    vector<DiagonalStartTable> diagonals(queryCount);
+    vector<HitPtr> hits(queryCount);
+    vector<uint32> targetNr(queryCount, 0), queriesHit;
+    uint32 nr = 0;
 
-    push_heap(inHitList.begin(), inHitList.end(), cmp);
-    if (inHitList.size() > mReportLimit and mReportLimit > 0)
+    const char* defLine;
+    size_t defLineLength, consumed;
+
+    LOG(INFO, "running SearchPart for %d queries", queryCount);
+
+    while (inReader.Next(defLine, defLineLength, target, consumed))
     {
-        pop_heap(inHitList.begin(), inHitList.end(), cmp);
-        inHitList.erase(inHitList.end() - 1);
-    }
-}
+        // make it possible to interrupt a search
+        boost::this_thread::interruption_point();
 
-// --------------------------------------------------------------------
+        inProgress.Consumed(consumed);
 
-Result* Search(const vector<fs::path>& inDatabanks,
-    const string& inQuery, const string& inProgram,
-    const string& inMatrix, uint32 inWordSize, double inExpect,
-    bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
-    uint32 inReportLimit, uint32 inThreads)
-{
-    if (inProgram != "blastp")
-        throw M6Exception("Unsupported program %s", inProgram.c_str());
+        if (target.empty() or target.length() > kMaxSequenceLength)
+            continue;
 
-    for (const fs::path& db : inDatabanks)
-    {
-        if (not fs::exists(db))
-            throw M6Exception("Databank not found (%s)", db.string().c_str());
-    }
+        ioResult.mDbCount += 1;
+        ioResult.mDbLength += target.length();
 
-    if (inGapped)
-    {
-        if (inGapOpen == -1) inGapOpen = 11;
-        if (inGapExtend == -1) inGapExtend = 1;
+        // an HSP needs at least two word hits for one query
+        if (not IWordHitIterator::HasWordHits(mWordHitData, target, 2))
+            continue;
+
+        ++nr;
+
+        iter.Reset(target);
+
+        uint32 queryOffset;
+        uint16 targetOffset;
+        while (iter.Next(queryOffset, targetOffset))
+        {
+            uint32 q = queryOffset >> 16;
+            const Query* query = mQueries[q];
+
+            if (targetNr[q] != nr)
+            {
+                targetNr[q] = nr;
+                diagonals[q].Reset(static_cast<int32>(query->mQuery.length()), static_cast<int32>(target.length()));
+                queriesHit.push_back(q);
+            }
+
+            query->WordHit(defLine, defLineLength, target, queryOffset & 0x0FFFF, targetOffset, diagonals[q], hits[q]);
+        }
+
+        for (uint32 q : queriesHit)
+        {
+            if (hits[q])
+            {
+                mQueries[q]->AddHit(hits[q], ioResult.mHits[q]);
+                hits[q].reset();
+            }
+        }
+
+        queriesHit.clear();
     }
 
-    if (inWordSize == 0) inWordSize = 3;
+    LOG(INFO, "finished SearchPart");
+}
+
+// --------------------------------------------------------------------
+
+// Parse a query in FastA format, returns the sequence
 
+string ParseQuery(const string& inQuery, uint32 inWordSize, string& outQueryID, string& outQueryDef)
+{
     if (inQuery.length() < inWordSize)
         throw M6Exception("query length is less than wordsize");
 
-    string query, queryID, queryDef;
+    string query;
     string::const_iterator i = inQuery.begin();
 
     if (inQuery[0] == '>' and not isspace(inQuery[1]))
@@ -1980,11 +3410,11 @@ Result* Search(const vector<fs::path>& inDatabanks,
         ++i;
 
         do
-            queryID += *i;
+            outQueryID += *i;
         while (i != inQuery.end() and not isspace(*++i));
 
         while (i != inQuery.end() and *i != '\r' and *i != '\n')
-            queryDef += *i++;
+            outQueryDef += *i++;
     }
 
     while (i != inQuery.end())
@@ -2009,11 +3439,31 @@ Result* Search(const vector<fs::path>& inDatabanks,
     if (query.length() < inWordSize)
         THROW(("Query length should be at least wordsize"));
 
-    int64 totalLength = accumulate(inDatabanks.begin(), inDatabanks.end(), 0LL,
-        [](int64 l, const fs::path& p) -> int64 { return l + fs::file_size(p); });
+    return query;
+}
+
+// The total size of the databanks, checks if they exist as well
 
-    M6Progress progress("blast", totalLength, "blast");
+int64 GetDatabanksSize(const vector<fs::path>& inDatabanks)
+{
+    for (const fs::path& db : inDatabanks)
+    {
+        if (not fs::exists(db))
+            throw M6Exception("Databank not found (%s)", db.string().c_str());
+    }
 
+    return accumulate(inDatabanks.begin(), inDatabanks.end(), 0LL,
+        [](int64 l, const fs::path& p) -> int64
+        {
+            BinaryDatabank binary(p);
+            return l + (binary.IsOpen() ? binary.GetSize() : fs::file_size(p));
+        });
+}
+
+Result* CreateResult(const vector<fs::path>& inDatabanks, const string& inProgram,
+    const string& inMatrix, double inExpect, bool inFilter, bool inGapped,
+    int32 inGapOpen, int32 inGapExtend)
+{
     unique_ptr<Result> result(new Result);
 
     result->mParams.mProgram = inProgram;
@@ -2024,15 +3474,46 @@ Result* Search(const vector<fs::path>& inDatabanks,
         result->mDb += db.string();
     }
     result->mParams.mExpect = inExpect;
-    result->mQueryID = queryID;
-    result->mQueryDef = queryDef;
-    result->mQueryLength = static_cast<uint32>(query.length());
     result->mParams.mMatrix = inMatrix;
     result->mParams.mGapped = inGapped;
     result->mParams.mGapOpen = inGapOpen;
     result->mParams.mGapExtend = inGapExtend;
     result->mParams.mFilter = inFilter;
 
+    return result.release();
+}
+
+Result* Search(const vector<fs::path>& inDatabanks,
+    const string& inQuery, const string& inProgram,
+    const string& inMatrix, uint32 inWordSize, double inExpect,
+    bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
+    uint32 inReportLimit, uint32 inThreads, const ThreadLimit* inThreadLimit)
+{
+    if (inProgram != "blastp")
+        throw M6Exception("Unsupported program %s", inProgram.c_str());
+
+    int64 totalLength = GetDatabanksSize(inDatabanks);
+
+    if (inGapped)
+    {
+        if (inGapOpen == -1) inGapOpen = 11;
+        if (inGapExtend == -1) inGapExtend = 1;
+    }
+
+    if (inWordSize == 0) inWordSize = 3;
+
+    string queryID, queryDef;
+    string query = ParseQuery(inQuery, inWordSize, queryID, queryDef);
+
+    M6Progress progress("blast", totalLength, "blast");
+
+    unique_ptr<Result> result(CreateResult(inDatabanks, inProgram, inMatrix,
+        inExpect, inFilter, inGapped, inGapOpen, inGapExtend));
+
+    result->mQueryID = queryID;
+    result->mQueryDef = queryDef;
+    result->mQueryLength = static_cast<uint32>(query.length());
+
     if (inThreads < 1)
         inThreads = boost::thread::hardware_concurrency();
 
@@ -2041,7 +3522,7 @@ Result* Search(const vector<fs::path>& inDatabanks,
         case 2:
         {
             BlastQuery<2> q(query, inFilter, inExpect, inMatrix, inGapped, inGapOpen, inGapExtend, inReportLimit);
-            q.Search(inDatabanks, progress, inThreads);
+            q.Search(inDatabanks, progress, inThreads, inThreadLimit);
             q.Report(*result);
             break;
         }
@@ -2049,7 +3530,7 @@ Result* Search(const vector<fs::path>& inDatabanks,
         case 3:
         {
             BlastQuery<3> q(query, inFilter, inExpect, inMatrix, inGapped, inGapOpen, inGapExtend, inReportLimit);
-            q.Search(inDatabanks, progress, inThreads);
+            q.Search(inDatabanks, progress, inThreads, inThreadLimit);
             q.Report(*result);
             break;
         }
@@ -2057,7 +3538,7 @@ Result* Search(const vector<fs::path>& inDatabanks,
         case 4:
         {
             BlastQuery<4> q(query, inFilter, inExpect, inMatrix, inGapped, inGapOpen, inGapExtend, inReportLimit);
-            q.Search(inDatabanks, progress, inThreads);
+            q.Search(inDatabanks, progress, inThreads, inThreadLimit);
             q.Report(*result);
             break;
         }
@@ -2069,6 +3550,89 @@ Result* Search(const vector<fs::path>& inDatabanks,
     return result.release();
 }
 
+template<int WORDSIZE>
+void SearchBatch(const vector<fs::path>& inDatabanks, const vector<BatchQuery>& inQueries,
+    const vector<string>& inSequences, const string& inMatrix, M6Progress& inProgress,
+    uint32 inThreads, const ThreadLimit* inThreadLimit, vector<unique_ptr<Result>>& ioResults)
+{
+    vector<unique_ptr<BlastQuery<WORDSIZE>>> queries;
+    vector<BlastQuery<WORDSIZE>*> batchQueries;
+
+    for (size_t i = 0; i < inQueries.size(); ++i)
+    {
+        const BatchQuery& q = inQueries[i];
+
+        queries.emplace_back(new BlastQuery<WORDSIZE>(inSequences[i], q.mFilter, q.mExpect,
+            inMatrix, q.mGapped, q.mGapOpen, q.mGapExtend, q.mReportLimit));
+        batchQueries.push_back(queries.back().get());
+    }
+
+    BlastBatch<WORDSIZE> batch(batchQueries);
+    batch.Search(inDatabanks, inProgress, inThreads, inThreadLimit);
+
+    for (size_t i = 0; i < queries.size(); ++i)
+        queries[i]->Report(*ioResults[i]);
+}
+
+vector<Result*> SearchBatch(const vector<fs::path>& inDatabanks,
+    const vector<BatchQuery>& inQueries, const string& inProgram,
+    const string& inMatrix, uint32 inWordSize, uint32 inThreads, const ThreadLimit* inThreadLimit)
+{
+    if (inProgram != "blastp")
+        throw M6Exception("Unsupported program %s", inProgram.c_str());
+
+    if (inQueries.empty())
+        return vector<Result*>();
+
+    int64 totalLength = GetDatabanksSize(inDatabanks);
+
+    if (inWordSize == 0) inWordSize = 3;
+
+    vector<BatchQuery> queries(inQueries);
+    vector<string> sequences;
+    vector<unique_ptr<Result>> results;
+
+    for (BatchQuery& q : queries)
+    {
+        if (q.mGapped)
+        {
+            if (q.mGapOpen == -1) q.mGapOpen = 11;
+            if (q.mGapExtend == -1) q.mGapExtend = 1;
+        }
+
+        string queryID, queryDef;
+        sequences.push_back(ParseQuery(q.mQuery, inWordSize, queryID, queryDef));
+
+        results.emplace_back(CreateResult(inDatabanks, inProgram, inMatrix,
+            q.mExpect, q.mFilter, q.mGapped, q.mGapOpen, q.mGapExtend));
+
+        results.back()->mQueryID = queryID;
+        results.back()->mQueryDef = queryDef;
+        results.back()->mQueryLength = static_cast<uint32>(sequences.back().length());
+    }
+
+    M6Progress progress("blast", totalLength, "blast");
+
+    if (inThreads < 1)
+        inThreads = boost::thread::hardware_concurrency();
+
+    switch (inWordSize)
+    {
+        case 2:    SearchBatch<2>(inDatabanks, queries, sequences, inMatrix, progress, inThreads, inThreadLimit, results); break;
+        case 3:    SearchBatch<3>(inDatabanks, queries, sequences, inMatrix, progress, inThreads, inThreadLimit, results); break;
+        case 4:    SearchBatch<4>(inDatabanks, queries, sequences, inMatrix, progress, inThreads, inThreadLimit, results); break;
+        default:
+            throw M6Exception("Unsupported word size %d", inWordSize);
+    }
+
+    vector<Result*> result;
+    result.reserve(results.size());
+    for (auto& r : results)
+        result.push_back(r.release());
+
+    return result;
+}
+
 // --------------------------------------------------------------------
 
 void operator&(xml::writer& w, const Hsp& inHsp)
@@ -2163,4 +3727,150 @@ void Result::WriteAsNCBIBlastXML(ostream& os)
     w.end_element();    // BlastOutput
 }
 
+// --------------------------------------------------------------------
+// The binary result format is used to cache results. It is written using
+// the serialize methods of the result classes, values are stored in native
+// byte order, strings and lists are preceded by their length.
+
+const uint32
+    kBinaryResultSignature    = 'm6br',
+    kBinaryResultVersion    = 1,
+    kMaxBinaryResultString    = 1 << 28;
+
+class BinaryResultWriter
+{
+  public:
+                BinaryResultWriter(ostream& inStream) : mStream(inStream) {}
+
+    template<class T>
+    BinaryResultWriter&
+                operator&(const boost::serialization::nvp<T>& inValue)
+                {
+                    Write(inValue.value());
+                    return *this;
+                }
+
+    template<class T>
+    typename enable_if<is_arithmetic<T>::value>::type
+                Write(const T& inValue)
+                {
+                    mStream.write(reinterpret_cast<const char*>(&inValue), sizeof(T));
+                }
+
+    void        Write(const string& inValue)
+                {
+                    Write(static_cast<uint32>(inValue.length()));
+                    mStream.write(inValue.c_str(), inValue.length());
+                }
+
+    template<class T>
+    void        Write(const list<T>& inValue)
+                {
+                    Write(static_cast<uint32>(inValue.size()));
+                    for (const T& v : inValue)
+                        Write(v);
+                }
+
+    template<class T>
+    typename enable_if<is_class<T>::value>::type
+                Write(const T& inValue)
+                {
+                    const_cast<T&>(inValue).serialize(*this, 0);
+                }
+
+  private:
+    ostream&    mStream;
+};
+
+class BinaryResultReader
+{
+  public:
+                BinaryResultReader(istream& inStream) : mStream(inStream) {}
+
+    template<class T>
+    BinaryResultReader&
+                operator&(const boost::serialization::nvp<T>& inValue)
+                {
+                    Read(inValue.value());
+                    return *this;
+                }
+
+    template<class T>
+    typename enable_if<is_arithmetic<T>::value>::type
+                Read(T& outValue)
+                {
+                    mStream.read(reinterpret_cast<char*>(&outValue), sizeof(T));
+                    Check();
+                }
+
+    void        Read(string& outValue)
+                {
+                    uint32 length;
+                    Read(length);
+                    if (length > kMaxBinaryResultString)
+                        throw M6Exception("Invalid binary blast result");
+
+                    outValue.resize(length);
+                    if (length > 0)
+                        mStream.read(&outValue[0], length);
+                    Check();
+                }
+
+    template<class T>
+    void        Read(list<T>& outValue)
+                {
+                    uint32 count;
+                    Read(count);
+
+                    outValue.clear();
+                    while (count-- > 0)
+                    {
+                        outValue.push_back(T());
+                        Read(outValue.back());
+                    }
+                }
+
+    template<class T>
+    typename enable_if<is_class<T>::value>::type
+                Read(T& outValue)
+                {
+                    outValue.serialize(*this, 0);
+                }
+
+  private:
+    void        Check()
+                {
+                    if (not mStream)
+                        throw M6Exception("Truncated binary blast result");
+                }
+
+    istream&    mStream;
+};
+
+void Result::WriteBinary(ostream& os) const
+{
+    BinaryResultWriter w(os);
+
+    w.Write(kBinaryResultSignature);
+    w.Write(kBinaryResultVersion);
+    w.Write(*this);
+}
+
+void Result::ReadBinary(istream& is)
+{
+    BinaryResultReader r(is);
+
+    uint32 signature, version;
+    r.Read(signature);
+    r.Read(version);
+
+    if (signature != kBinaryResultSignature)
+        throw M6Exception("Not a binary blast result");
+
+    if (version != kBinaryResultVersion)
+        throw M6Exception("Unsupported binary blast result version %d", version);
+
+    r.Read(*this);
+}
+
 }
@@ -8,8 +8,11 @@
 #include <string>
 #include <list>
 #include <vector>
+#include <atomic>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <zeep/xml/serialize.hpp>
 
 namespace M6Blast
@@ -154,13 +157,93 @@ struct Result
                     }
 
     void            WriteAsNCBIBlastXML(std::ostream& os);
+
+    // A compact binary format, used to cache results. ReadBinary throws
+    // when the data is not in the current version of the format.
+    void            WriteBinary(std::ostream& os) const;
+    void            ReadBinary(std::istream& is);
+};
+
+// A FastA file can be converted into a binary databank that contains the
+// sequences already encoded, an offset table and the definition lines.
+// Search uses this binary databank when it is available and up to date
+// and falls back to reading the FastA file otherwise.
+
+boost::filesystem::path GetBinaryDatabankPath(const boost::filesystem::path& inFasta);
+void CreateBinaryDatabank(const boost::filesystem::path& inFasta);
+
+// A seed index contains the positions of all words of three residues in
+// a binary databank. Short queries look up their words in this index
+// instead of scanning all sequences, a cost model decides which of the
+// two is faster for a query. The mode can be set to force either one,
+// this is meant for testing.
+
+enum SeedIndexMode
+{
+    eSeedIndexAuto,
+    eSeedIndexNever,
+    eSeedIndexAlways
+};
+
+boost::filesystem::path GetSeedIndexPath(const boost::filesystem::path& inFasta);
+void CreateSeedIndex(const boost::filesystem::path& inFasta);
+void SetSeedIndexMode(SeedIndexMode inMode);
+
+// ThreadLimit is the number of threads a running search may use. Threads
+// numbered at or above the limit block in Wait until Set raises it, a limit
+// of zero pauses the search.
+
+class ThreadLimit
+{
+  public:
+                    ThreadLimit(uint32 inLimit = 0) : mLimit(inLimit) {}
+
+    uint32            Get() const                    { return mLimit; }
+    void            Set(uint32 inLimit);
+    void            Wait(uint32 inThreadNr) const;
+
+  private:
+                    ThreadLimit(const ThreadLimit&);
+    ThreadLimit&    operator=(const ThreadLimit&);
+
+    std::atomic<uint32>    mLimit;
+    mutable boost::mutex
+                    mMutex;
+    mutable boost::condition_variable
+                    mCondition;
 };
 
+// Search and SearchBatch use at most inThreads threads. The number of
+// threads that actually run can be changed while the search runs by
+// passing inThreadLimit.
+
 Result* Search(const std::vector<boost::filesystem::path>& inDatabanks,
     const std::string& inQuery, const std::string& inProgram,
     const std::string& inMatrix, uint32 inWordSize, double inExpect,
     bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
-    uint32 inReportLimit, uint32 inThreads = 0);
+    uint32 inReportLimit, uint32 inThreads = 0,
+    const ThreadLimit* inThreadLimit = nullptr);
+
+// Search several queries in one pass over the databanks. The queries share
+// the program, matrix and word size, the other parameters are per query.
+// The results are returned in the order of the queries and are the same as
+// those of separate Search calls. The caller owns the results.
+
+struct BatchQuery
+{
+    std::string        mQuery;
+    double            mExpect;
+    bool            mFilter;
+    bool            mGapped;
+    int32            mGapOpen;
+    int32            mGapExtend;
+    uint32            mReportLimit;
+};
+
+std::vector<Result*> SearchBatch(const std::vector<boost::filesystem::path>& inDatabanks,
+    const std::vector<BatchQuery>& inQueries, const std::string& inProgram,
+    const std::string& inMatrix, uint32 inWordSize, uint32 inThreads = 0,
+    const ThreadLimit* inThreadLimit = nullptr);
 
 }
 
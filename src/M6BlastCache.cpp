@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include <set>
+#include <map>
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
@@ -25,6 +26,7 @@
 #include <boost/iostreams/filter/bzip2.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/functional/hash.hpp>
 
 #include "M6Config.h"
 #include "M6Error.h"
@@ -38,8 +40,11 @@ namespace io = boost::iostreams;
 namespace ba = boost::algorithm;
 namespace zx = zeep::xml;
 
-const uint32 kMaxCachedEntryResults = 1000;
-const char* kBlastFileExtensions[] = { ".xml.bz2", ".job", ".err" };
+const uint32 kMaxCachedEntryResults = 10000;    // default, configurable with blaster/@cache-size
+const uint32 kMaxLoadedResults = 32;
+const uint32 kMaxBatchSize = 32;
+const uint32 kMaxRunningJobsPerThread = 2;
+const char* kBlastFileExtensions[] = { ".m6br", ".xml.bz2", ".job", ".err" };
 
 // --------------------------------------------------------------------
 
@@ -60,6 +65,31 @@ bool M6BlastJob::IsJobFor(const string& inDatabank, const string& inQuery, const
         reportLimit >= inReportLimit;        // <-- report limit at least inReportLimit
 }
 
+size_t M6BlastJob::Digest(const string& inDatabank, const string& inQuery, const string& inProgram,
+    const string& inMatrix, uint32 inWordSize, double inExpect, bool inLowComplexityFilter,
+    bool inGapped, int32 inGapOpen, int32 inGapExtend)
+{
+    size_t result = 0;
+
+    boost::hash_combine(result, inDatabank);
+    boost::hash_combine(result, inQuery);
+    boost::hash_combine(result, inProgram);
+    boost::hash_combine(result, inMatrix);
+    boost::hash_combine(result, inWordSize);
+    boost::hash_combine(result, inExpect);
+    boost::hash_combine(result, inLowComplexityFilter);
+    boost::hash_combine(result, inGapped);
+    boost::hash_combine(result, inGapOpen);
+    boost::hash_combine(result, inGapExtend);
+
+    return result;
+}
+
+size_t M6BlastJob::Digest() const
+{
+    return Digest(db, query, program, matrix, wordsize, expect, filter, gapped, gapOpen, gapExtend);
+}
+
 bool M6BlastJob::IsStillValid(const vector<fs::path>& inFiles) const
 {
     vector<M6BlastDbInfo> fileInfo;
@@ -73,8 +103,275 @@ bool M6BlastJob::IsStillValid(const vector<fs::path>& inFiles) const
     return files == fileInfo;
 }
 
+bool M6BlastJob::IsCompatible(const M6BlastJob& inJob) const
+{
+    return db == inJob.db and
+        program == inJob.program and
+        matrix == inJob.matrix and
+        wordsize == inJob.wordsize and
+        files == inJob.files;
+}
+
 // --------------------------------------------------------------------
 
+// The job catalog is an append-only file with all jobs in the cache. A job
+// is added again when it changes, removed jobs are marked as such. The
+// catalog is rewritten at startup when it contains mostly stale records.
+
+const uint32
+    kCatalogSignature = 'm6bc',
+    kCatalogVersion = 1;
+
+enum M6CatalogRecord : uint8
+{
+    eCatalogAddJob = 1,
+    eCatalogRemoveJob = 2
+};
+
+class M6CatalogWriter
+{
+  public:
+                M6CatalogWriter(ostream& inStream) : mStream(inStream) {}
+
+    template<class T>
+    void        Write(T inValue)
+                {
+                    mStream.write(reinterpret_cast<const char*>(&inValue), sizeof(T));
+                }
+
+    void        Write(const string& inValue)
+                {
+                    Write(static_cast<uint32>(inValue.length()));
+                    mStream.write(inValue.c_str(), inValue.length());
+                }
+
+    void        Write(const M6BlastJob& inJob)
+                {
+                    Write(inJob.db);            Write(inJob.query);
+                    Write(inJob.program);        Write(inJob.matrix);
+                    Write(inJob.wordsize);        Write(inJob.expect);
+                    Write(inJob.filter);        Write(inJob.gapped);
+                    Write(inJob.gapOpen);        Write(inJob.gapExtend);
+                    Write(inJob.reportLimit);
+
+                    Write(static_cast<uint32>(inJob.files.size()));
+                    for (const M6BlastDbInfo& file : inJob.files)
+                    {
+                        Write(file.path);
+                        Write(static_cast<int64>((file.timestamp - kEpoch).total_seconds()));
+                    }
+                }
+
+  private:
+    static const boost::posix_time::ptime kEpoch;
+
+    ostream&    mStream;
+};
+
+class M6CatalogReader
+{
+  public:
+                M6CatalogReader(istream& inStream) : mStream(inStream) {}
+
+    template<class T>
+    bool        Read(T& outValue)
+                {
+                    return mStream.read(reinterpret_cast<char*>(&outValue), sizeof(T)).good();
+                }
+
+    bool        Read(string& outValue)
+                {
+                    uint32 length;
+                    if (not Read(length) or length > kMaxQueryLength)
+                        return false;
+
+                    outValue.resize(length);
+                    return length == 0 or mStream.read(&outValue[0], length).good();
+                }
+
+    bool        Read(M6BlastJob& outJob)
+                {
+                    uint32 fileCount;
+
+                    bool result =
+                        Read(outJob.db) and Read(outJob.query) and
+                        Read(outJob.program) and Read(outJob.matrix) and
+                        Read(outJob.wordsize) and Read(outJob.expect) and
+                        Read(outJob.filter) and Read(outJob.gapped) and
+                        Read(outJob.gapOpen) and Read(outJob.gapExtend) and
+                        Read(outJob.reportLimit) and Read(fileCount);
+
+                    outJob.files.clear();
+                    while (result and fileCount-- > 0)
+                    {
+                        M6BlastDbInfo info;
+                        int64 timestamp;
+
+                        result = Read(info.path) and Read(timestamp);
+                        info.timestamp = boost::posix_time::from_time_t(static_cast<time_t>(timestamp));
+
+                        outJob.files.push_back(info);
+                    }
+
+                    return result;
+                }
+
+  private:
+    static const uint32 kMaxQueryLength = 1 << 26;
+
+    istream&    mStream;
+};
+
+const boost::posix_time::ptime M6CatalogWriter::kEpoch(boost::gregorian::date(1970, 1, 1));
+
+bool M6BlastCache::ReadCatalog()
+{
+    fs::path path = mCacheDir / "jobs.catalog";
+
+    fs::ifstream file(path, ios::binary);
+    if (not file.is_open())
+        return false;
+
+    M6CatalogReader reader(file);
+
+    uint32 signature, version;
+    if (not reader.Read(signature) or signature != kCatalogSignature or
+        not reader.Read(version) or version != kCatalogVersion)
+    {
+        LOG(WARN, "Ignoring blast job catalog with unknown format");
+        return false;
+    }
+
+    uint32 records = 0;
+    streamoff valid = file.tellg();
+    uint8 kind;
+
+    // a record that was not completely written ends the catalog
+    while (reader.Read(kind))
+    {
+        CacheEntry e;
+        if (not reader.Read(e.id))
+            break;
+
+        if (kind == eCatalogAddJob)
+        {
+            if (not reader.Read(e.job))
+                break;
+
+            e.hitCount = 0;
+            e.bestScore = -1;
+            e.cost = EstimateCost(e.job);
+            e.queued = boost::posix_time::microsec_clock::universal_time();
+
+            if (fs::exists(mCacheDir / (e.id + ".err")))
+                e.status = bj_Error;
+            else if (fs::exists(mCacheDir / (e.id + ".m6br")) or fs::exists(mCacheDir / (e.id + ".xml.bz2")))
+                e.status = bj_Finished;
+            else
+                e.status = bj_Queued;
+
+            // the most recently added jobs come first
+            auto i = mJobIndex.find(e.id);
+            if (i != mJobIndex.end())
+                EraseEntry(i->second);
+            AddEntry(e);
+        }
+        else if (kind == eCatalogRemoveJob)
+        {
+            auto i = mJobIndex.find(e.id);
+            if (i != mJobIndex.end())
+                EraseEntry(i->second);
+        }
+        else
+            break;
+
+        ++records;
+        valid = file.tellg();
+    }
+
+    file.close();
+
+    // rewrite a catalog that ends in a partial record or contains mostly stale records
+    if (valid != static_cast<streamoff>(fs::file_size(path)) or records > 2 * mResultCache.size() + 100)
+        WriteCatalog();
+
+    return true;
+}
+
+void M6BlastCache::WriteCatalog()
+{
+    fs::path path = mCacheDir / "jobs.catalog";
+
+    {
+        fs::ofstream file(path.string() + ".new", ios::binary | ios::trunc);
+        if (not file.is_open())
+            THROW(("Could not create blast job catalog"));
+
+        M6CatalogWriter writer(file);
+
+        writer.Write(kCatalogSignature);
+        writer.Write(kCatalogVersion);
+
+        // written in reverse, the most recent job is added last
+        for (auto e = mResultCache.rbegin(); e != mResultCache.rend(); ++e)
+        {
+            writer.Write(static_cast<uint8>(eCatalogAddJob));
+            writer.Write(e->id);
+            writer.Write(e->job);
+        }
+    }
+
+    fs::rename(path.string() + ".new", path);
+}
+
+void M6BlastCache::AppendToCatalog(const string& inJobID, const M6BlastJob* inJob)
+{
+    fs::ofstream file(mCacheDir / "jobs.catalog", ios::binary | ios::app);
+    if (not file.is_open())
+        THROW(("Could not open blast job catalog"));
+
+    M6CatalogWriter writer(file);
+
+    writer.Write(static_cast<uint8>(inJob ? eCatalogAddJob : eCatalogRemoveJob));
+    writer.Write(inJobID);
+    if (inJob != nullptr)
+        writer.Write(*inJob);
+}
+
+// The cache entries are kept in a list, most recently used first. The
+// indices refer to the list entries by id and by digest of the job.
+
+void M6BlastCache::AddEntry(const CacheEntry& inEntry)
+{
+    mResultCache.push_front(inEntry);
+
+    auto i = mResultCache.begin();
+    mJobIndex[i->id] = i;
+    mDigestIndex.insert(make_pair(i->job.Digest(), i));
+}
+
+void M6BlastCache::EraseEntry(CacheEntryIterator inEntry)
+{
+    auto r = mDigestIndex.equal_range(inEntry->job.Digest());
+    for (auto i = r.first; i != r.second; ++i)
+    {
+        if (i->second == inEntry)
+        {
+            mDigestIndex.erase(i);
+            break;
+        }
+    }
+
+    mJobIndex.erase(inEntry->id);
+    mResultCache.erase(inEntry);
+}
+
+M6BlastCache::CacheEntryIterator M6BlastCache::FindEntry(const string& inJobID)
+{
+    auto i = mJobIndex.find(inJobID);
+    return i == mJobIndex.end() ? mResultCache.end() : i->second;
+}
+
 M6BlastCache& M6BlastCache::Instance()
 {
     static M6BlastCache sInstance;
@@ -93,74 +390,98 @@ M6BlastCache::M6BlastCache()
     if (not fs::exists(mCacheDir))
         fs::create_directory(mCacheDir);
 
-    // read cached entries in result cache (unspecified order)
-    fs::directory_iterator end;
-    for (fs::directory_iterator iter(mCacheDir); iter != end; ++iter)
+    // read the job catalog, or the job files written by older versions
+    if (not ReadCatalog())
     {
-        if (iter->path().extension().string() == ".job" and iter->path().filename().string().length() > 4)
+        fs::directory_iterator end;
+        for (fs::directory_iterator iter(mCacheDir); iter != end; ++iter)
         {
-            fs::ifstream file(iter->path());
-            if (not file.is_open())
+            if (iter->path().extension().string() == ".job" and iter->path().filename().string().length() > 4)
             {
-                LOG(WARN,"unable to open: %s",iter->path().extension().string().c_str());
-                continue;
-            }
+                fs::ifstream file(iter->path());
+                if (not file.is_open())
+                {
+                    LOG(WARN,"unable to open: %s",iter->path().extension().string().c_str());
+                    continue;
+                }
 
-            try // Must verify that the file's contents are OK, otherwise MRS will crash on startup
-            {
-                CacheEntry e;
+                try // Must verify that the file's contents are OK, otherwise MRS will crash on startup
+                {
+                    CacheEntry e;
 
-                e.id = iter->path().filename().stem().string();
-                e.hitCount = 0;
-                e.bestScore = -1;
+                    e.id = iter->path().filename().stem().string();
+                    e.hitCount = 0;
+                    e.bestScore = -1;
 
-                zeep::xml::document doc(file);
-                doc.deserialize("blastjob", e.job);
+                    zeep::xml::document doc(file);
+                    doc.deserialize("blastjob", e.job);
 
-                if (fs::exists(mCacheDir / (e.id + ".err")))
-                    e.status = bj_Error;
-                else if (fs::exists(mCacheDir / (e.id + ".xml.bz2")))
-                    e.status = bj_Finished;
-                else
-                    e.status = bj_Queued;
+                    e.cost = EstimateCost(e.job);
+                    e.queued = boost::posix_time::microsec_clock::universal_time();
 
-                mResultCache.push_back(e);
-            }
-            catch (exception& ex)
-            {
-                LOG(WARN,"Cannot parse job file %s: %s",iter->path().string().c_str(),ex.what());
-                fs::remove(iter->path());
+                    if (fs::exists(mCacheDir / (e.id + ".err")))
+                        e.status = bj_Error;
+                    else if (fs::exists(mCacheDir / (e.id + ".m6br")) or fs::exists(mCacheDir / (e.id + ".xml.bz2")))
+                        e.status = bj_Finished;
+                    else
+                        e.status = bj_Queued;
+
+                    AddEntry(e);
+                }
+                catch (exception& ex)
+                {
+                    LOG(WARN,"Cannot parse job file %s: %s",iter->path().string().c_str(),ex.what());
+                    fs::remove(iter->path());
+                }
             }
         }
+
+        WriteCatalog();
     }
 
     // Determine the number of threads from config:
     const zx::element *server = M6Config::GetServer(),
                       *blaster = server->find_first("blaster");
     mMaxThreads = boost::thread::hardware_concurrency();
+    mMaxCachedJobs = kMaxCachedEntryResults;
     if (blaster != nullptr)
     {
         uint32 n =  boost::lexical_cast<uint32> (blaster->get_attribute ("nthread"));
         if (n > 0)
             mMaxThreads = n;
+
+        string cacheSize = blaster->get_attribute("cache-size");
+        if (not cacheSize.empty() and boost::lexical_cast<uint32>(cacheSize) > 0)
+            mMaxCachedJobs = boost::lexical_cast<uint32>(cacheSize);
     }
 
-    // finally start the worker threads
+    // finally start the scheduler
     mStopWorkingFlag = false;
-    mWorkerThread = boost::thread([this](){ this->Work (); });
-    mHighLoadThread = boost::thread([this](){ this->Work (true); });
+    mSchedulerThread = boost::thread([this](){ this->Schedule(); });
 
     LOG(DEBUG,"M6BlastCache has been created");
 }
 
 M6BlastCache::~M6BlastCache()
 {
-    mStopWorkingFlag = true;
+    {
+        boost::mutex::scoped_lock lock(mCacheMutex);
+
+        mStopWorkingFlag = true;
+        for (RunningJobPtr& job : mRunningJobs)
+            job->thread.interrupt();
+    }
 
-    if (mWorkerThread.joinable())
+    if (mSchedulerThread.joinable())
     {
-        mWorkerThread.interrupt();
-        mWorkerThread.join();
+        mSchedulerThread.interrupt();
+        mSchedulerThread.join();
+    }
+
+    for (RunningJobPtr& job : mRunningJobs)
+    {
+        if (job->started)
+            job->thread.join();
     }
 }
 
@@ -192,8 +513,7 @@ tuple<M6BlastJobStatus,string,uint32,double> M6BlastCache::JobStatus(const strin
 
     LOG (DEBUG,"M6BlastCache::JobStatus: looking up job \"%s\" in cache",inJobID.c_str());
 
-    auto i = find_if(mResultCache.begin(), mResultCache.end(), [&inJobID](CacheEntry& e) -> bool
-                { return e.id == inJobID; });
+    auto i = FindEntry(inJobID);
 
     if (i != mResultCache.end()) // is requested job id in list ?
     {
@@ -247,48 +567,98 @@ tuple<M6BlastJobStatus,string,uint32,double> M6BlastCache::JobStatus(const strin
     }
 
     LOG (DEBUG, "M6BlastCache::JobStatus: returning status %s for job %s",
-		StatusToString (i->status).c_str (),
+		StatusToString (get<0>(result)).c_str (),
 		inJobID.c_str ());
 
     return result;
 }
 
+// Results are stored in a compact binary format, compressed with zlib at
+// its fastest setting. Results stored by older versions as bzip2 compressed
+// XML can still be read. The last results used are kept in memory.
+
 M6BlastResultPtr M6BlastCache::JobResult(const string& inJobID)
 {
-    fs::path xmlPath = mCacheDir / (inJobID + ".xml.bz2");
+    {
+        boost::mutex::scoped_lock lock(mLoadedMutex);
+
+        auto i = find_if(mLoadedResults.begin(), mLoadedResults.end(),
+            [&inJobID](const pair<string,M6BlastResultPtr>& r) { return r.first == inJobID; });
+
+        if (i != mLoadedResults.end())
+        {
+            mLoadedResults.splice(mLoadedResults.begin(), mLoadedResults, i);
+            return i->second;
+        }
+    }
+
+    fs::path path = mCacheDir / (inJobID + ".m6br");
+    bool binary = fs::exists(path);
+    if (not binary)
+        path = mCacheDir / (inJobID + ".xml.bz2");
+
     io::filtering_stream<io::input> in;
-    fs::ifstream file(xmlPath, ios::binary);
+    fs::ifstream file(path, ios::binary);
     if (not file.is_open())
         throw M6Exception("missing blast result file");
 
-    in.push(io::bzip2_decompressor());
+    if (binary)
+        in.push(io::zlib_decompressor());
+    else
+        in.push(io::bzip2_decompressor());
     in.push(file);
 
-    M6BlastResultPtr result(new M6Blast::Result);
+    shared_ptr<M6Blast::Result> result(new M6Blast::Result);
 
     try
     {
-        zeep::xml::document doc(in);
-        doc.deserialize("blast-result", const_cast<M6Blast::Result&>(*result));
+        if (binary)
+            result->ReadBinary(in);
+        else
+        {
+            zeep::xml::document doc(in);
+            doc.deserialize("blast-result", *result);
+        }
     }
     catch(exception &ex)
     {
-        LOG(WARN,"Cannot parse result file %s: %s", xmlPath.string().c_str(), ex.what());
-        fs::remove(xmlPath);
+        LOG(WARN,"Cannot parse result file %s: %s", path.string().c_str(), ex.what());
+        fs::remove(path);
         SetJobStatus(inJobID, bj_Queued);
+
+        return result;
     }
 
+    RememberResult(inJobID, result);
+
     return result;
 }
 
+void M6BlastCache::RememberResult(const string& inJobID, M6BlastResultPtr inResult)
+{
+    boost::mutex::scoped_lock lock(mLoadedMutex);
+
+    mLoadedResults.remove_if([&inJobID](const pair<string,M6BlastResultPtr>& r) { return r.first == inJobID; });
+
+    mLoadedResults.push_front(make_pair(inJobID, inResult));
+    if (mLoadedResults.size() > kMaxLoadedResults)
+        mLoadedResults.pop_back();
+}
+
+void M6BlastCache::ForgetResult(const string& inJobID)
+{
+    boost::mutex::scoped_lock lock(mLoadedMutex);
+
+    mLoadedResults.remove_if([&inJobID](const pair<string,M6BlastResultPtr>& r) { return r.first == inJobID; });
+}
+
 void M6BlastCache::CacheResult(const string& inJobID, M6BlastResultPtr inResult)
 {
     // A job has just been completed and must be cached.
 
     boost::mutex::scoped_lock lock(mCacheMutex);
 
-    auto i = find_if(mResultCache.begin(), mResultCache.end(), [&inJobID](CacheEntry& e) -> bool
-                { return e.id == inJobID; });
+    auto i = FindEntry(inJobID);
 
     if (i != mResultCache.end()) // is requested job id in list ?
     {
@@ -300,21 +670,22 @@ void M6BlastCache::CacheResult(const string& inJobID, M6BlastResultPtr inResult)
         else
             i->bestScore = 0;
 
-        zeep::xml::document doc;
-        doc.serialize("blast-result", *inResult);
-
         LOG(DEBUG,"Storing result of blast job with id: %s",inJobID.c_str());
 
-        fs::ofstream file(mCacheDir / (inJobID + ".xml.bz2"), ios_base::out|ios_base::trunc|ios_base::binary);
-        io::filtering_stream<io::output> out;
+        {
+            fs::ofstream file(mCacheDir / (inJobID + ".m6br"), ios_base::out|ios_base::trunc|ios_base::binary);
+            io::filtering_stream<io::output> out;
 
-        if (not file.is_open())
-            throw runtime_error("could not create output file");
+            if (not file.is_open())
+                throw runtime_error("could not create output file");
+
+            out.push(io::zlib_compressor(io::zlib::best_speed));
+            out.push(file);
 
-        out.push(io::bzip2_compressor());
-        out.push(file);
+            inResult->WriteBinary(out);
+        }
 
-        out << doc;
+        RememberResult(inJobID, inResult);
 
         // Place the job with requested id at the beginning of the list
         auto j = i;
@@ -326,15 +697,19 @@ void M6BlastCache::CacheResult(const string& inJobID, M6BlastResultPtr inResult)
     }
 
     // do some housekeeping, jobs at the back are first to be removed.
-    while (mResultCache.size() > kMaxCachedEntryResults)
+    while (mResultCache.size() > mMaxCachedJobs)
     {
+        string id = mResultCache.back().id;
+
         for (const char* ext : kBlastFileExtensions)
         {
             boost::system::error_code ec;
-            fs::remove(mCacheDir / (mResultCache.back().id + ext), ec);
+            fs::remove(mCacheDir / (id + ext), ec);
         }
 
-        mResultCache.pop_back();
+        ForgetResult(id);
+        EraseEntry(prev(mResultCache.end()));
+        AppendToCatalog(id, nullptr);
     }
 }
 
@@ -363,7 +738,7 @@ string M6BlastCache::Submit(const string& inDatabank, const string& inQuery,
     const string& inProgram, const string& inMatrix, uint32 inWordSize,
     double inExpect, bool inLowComplexityFilter,
     bool inGapped, int32 inGapOpen, int32 inGapExtend,
-    uint32 inReportLimit)
+    uint32 inReportLimit, const string& inClient)
 {
     LOG(DEBUG,"M6BlastCache::Submit call with query length %d and databank %s",inQuery.size(),inDatabank.c_str());
 
@@ -377,8 +752,13 @@ string M6BlastCache::Submit(const string& inDatabank, const string& inQuery,
     boost::mutex::scoped_lock lock(mCacheMutex);
 
     // see if the job has already been submitted before
-    for (CacheEntry& e : mResultCache)
+    auto r = mDigestIndex.equal_range(M6BlastJob::Digest(inDatabank, inQuery, inProgram, inMatrix,
+        inWordSize, inExpect, inLowComplexityFilter, inGapped, inGapOpen, inGapExtend));
+
+    for (auto i = r.first; i != r.second; ++i)
     {
+        CacheEntry& e = *i->second;
+
         if (not e.job.IsJobFor(inDatabank, inQuery, inProgram, inMatrix, inWordSize, inExpect,
                 inLowComplexityFilter, inGapped, inGapOpen, inGapExtend, inReportLimit))
             continue;
@@ -388,14 +768,18 @@ string M6BlastCache::Submit(const string& inDatabank, const string& inQuery,
         if ((e.status == bj_Finished or e.status == bj_Error) and not e.job.IsStillValid(fastaFiles))
         {
             e.status = bj_Queued;
-            StoreJob(e.id, e.job);    // need to store the job again, since the timestamps changed
 
             mWorkCondition.notify_all();
 
             // clean up stale files
+            if (fs::exists(mCacheDir / (e.id + ".m6br")))
+                fs::remove(mCacheDir / (e.id + ".m6br"));
+
             if (fs::exists(mCacheDir / (e.id + ".xml.bz2")))
                 fs::remove(mCacheDir / (e.id + ".xml.bz2"));
 
+            ForgetResult(e.id);
+
             if (fs::exists(mCacheDir / (e.id + ".err")))
                 fs::remove(mCacheDir / (e.id + ".err"));
 
@@ -406,6 +790,13 @@ string M6BlastCache::Submit(const string& inDatabank, const string& inQuery,
                 M6BlastDbInfo info = { fastaFile.string(), boost::posix_time::from_time_t(fs::last_write_time(fastaFile)) };
                 e.job.files.push_back(info);
             }
+
+            StoreJob(e.id, e.job);    // need to store the job again, since the timestamps changed
+
+            e.client = inClient;
+            e.cost = EstimateCost(e.job);
+            e.queued = boost::posix_time::microsec_clock::universal_time();
+            e.started = e.finished = boost::posix_time::ptime();
         }
 
         LOG(DEBUG,"M6BlastCache::Submit: returning existing blast job id: %s",result.c_str());
@@ -440,10 +831,14 @@ string M6BlastCache::Submit(const string& inDatabank, const string& inQuery,
             e.job.files.push_back(info);
         }
 
+        e.client = inClient;
+        e.cost = EstimateCost(e.job);
+        e.queued = boost::posix_time::microsec_clock::universal_time();
+
         StoreJob(e.id, e.job);
 
         // New jobs are added to the front, because jobs at the back are first to be removed when the queue is full.
-        mResultCache.push_front(e);
+        AddEntry(e);
         mWorkCondition.notify_all();
 
         result = e.id;
@@ -456,113 +851,252 @@ string M6BlastCache::Submit(const string& inDatabank, const string& inQuery,
 
 void M6BlastCache::StoreJob(const string& inJobID, const M6BlastJob& inJob)
 {
-    // store the job in the cache directory
-    zeep::xml::document doc;
-    doc.serialize("blastjob", inJob);
-
-    fs::ofstream file(mCacheDir / (inJobID + ".job"), ios_base::out|ios_base::trunc);
-    file << doc;
+    // store the job in the catalog in the cache directory
+    AppendToCatalog(inJobID, &inJob);
 }
 
-bool IsHighLoad(const M6BlastJob &job)
+double M6BlastCache::EstimateCost(const M6BlastJob& inJob)
 {
-    // query sequence length:
-    if (job.query.length () > 1e4)
-        return true;
-
     // Database files contain fasta format sequences (uncompressed)
-    for (const M6BlastDbInfo& dbi : job.files)
+    double size = 0;
+    for (const M6BlastDbInfo& dbi : inJob.files)
     {
-        uintmax_t size = fs::file_size (dbi.path);
-
-        if (size > 1e9) // larger than a gigabyte
-            return true;
+        boost::system::error_code ec;
+        uintmax_t fileSize = fs::file_size(dbi.path, ec);
+        if (not ec)
+            size += fileSize;
     }
 
-    return false;
+    return size * inJob.query.length();
 }
 
-void M6BlastCache::Work(const bool highload)
+// The scheduler runs several jobs at the same time, all running jobs
+// together get mMaxThreads threads. The threads are shared fairly between
+// the clients that have running jobs, within a client the job that is
+// expected to finish first gets threads first. When a new job starts the
+// running jobs are resized to make room for it, when there are more jobs
+// than threads the new ones wait until another job is done.
+
+void M6BlastCache::Schedule()
 {
     using namespace boost::posix_time;
 
-    boost::mutex::scoped_lock lock (highload? mHighLoadMutex: mWorkMutex);
+    boost::mutex::scoped_lock lock(mCacheMutex);
 
-    while (not mStopWorkingFlag)
+    try
     {
-        try
+        while (not mStopWorkingFlag)
         {
-            string next;
-
+            try
             {
-                // Pick the frontmost queued entry. An alternative would be to use reversed looping.
-                boost::mutex::scoped_lock lock2(mCacheMutex);
-                for (CacheEntry& e : mResultCache)
+                // clean up the jobs that are done
+                for (auto r = mRunningJobs.begin(); r != mRunningJobs.end(); )
                 {
-                    if (e.status != bj_Queued)
-                        continue;
-
-                    /*
-                        The highload thread must only do highload jobs,
-                        the normal thread must only do normal jobs.
-                     */
-                    if (highload != IsHighLoad (e.job))
-                        continue;
-
-                    next = e.id;
-                    break;
+                    if ((*r)->done)
+                    {
+                        (*r)->thread.join();
+                        r = mRunningJobs.erase(r);
+                    }
+                    else
+                        ++r;
+                }
+
+                while (mRunningJobs.size() < kMaxRunningJobsPerThread * mMaxThreads and StartNextJob())
+                    ;
+
+                Rebalance();
+
+                for (RunningJobPtr& job : mRunningJobs)
+                {
+                    if (not job->started and job->threadLimit.Get() > 0)
+                        StartJobThread(job);
                 }
-            }
 
-            if (next.empty()) // if no new job, wait
                 mWorkCondition.wait(lock);
+            }
+            catch (boost::thread_interrupted&)
+            {
+                throw;
+            }
+            catch (exception& e)
+            {
+                cerr << e.what() << endl;
+                mWorkCondition.timed_wait(lock, seconds(5));
+            }
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+        // time to stop
+    }
+}
+
+// Called with mCacheMutex locked. Picks the queued job of the client with the
+// fewest running jobs, shortest expected job first. Other queued jobs that can
+// be searched in the same pass over the databank are added to the batch.
+
+bool M6BlastCache::StartNextJob()
+{
+    map<string,uint32> runningJobs;
+    for (RunningJobPtr& r : mRunningJobs)
+        ++runningJobs[r->client];
+
+    CacheEntry* first = nullptr;
+    for (CacheEntry& e : mResultCache)
+    {
+        if (e.status != bj_Queued)
+            continue;
+
+        if (first == nullptr or
+            make_tuple(runningJobs[e.client], e.cost, e.queued) <
+            make_tuple(runningJobs[first->client], first->cost, first->queued))
+        {
+            first = &e;
+        }
+    }
+
+    if (first == nullptr)
+        return false;
+
+    RunningJobPtr job(new RunningJob);
+    job->client = first->client;
+    job->cost = 0;
+    job->started = false;
+    job->done = false;
+
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    auto add = [&job, now](CacheEntry& e) {
+        e.status = bj_Running;
+        e.started = now;
+        e.finished = boost::posix_time::ptime();
+
+        job->ids.push_back(e.id);
+        job->cost += e.cost;
+    };
+
+    add(*first);
+
+    for (CacheEntry& e : mResultCache)
+    {
+        if (job->ids.size() == kMaxBatchSize)
+            break;
+
+        if (e.status == bj_Queued and first->job.IsCompatible(e.job))
+            add(e);
+    }
+
+    mRunningJobs.push_back(job);
+
+    return true;
+}
+
+// Called with mCacheMutex locked, once the job got a share of the threads.
+
+void M6BlastCache::StartJobThread(RunningJobPtr inJob)
+{
+    uint32 nrOfThreads = mMaxThreads;
+
+    inJob->started = true;
+    inJob->thread = boost::thread([this, inJob, nrOfThreads]() {
+        try
+        {
+            if (inJob->ids.size() == 1)
+                ExecuteJob(inJob->ids.front(), nrOfThreads, &inJob->threadLimit);
             else
-                ExecuteJob (next, highload? 1: mMaxThreads - 1);
+                ExecuteBatch(inJob->ids, nrOfThreads, &inJob->threadLimit);
         }
         catch (boost::thread_interrupted&)
         {
-            // just continue with the next queued job
+            // the job was deleted
         }
         catch (exception& e)
         {
             cerr << e.what() << endl;
-            boost::this_thread::sleep(seconds(5));
         }
         catch (...)
         {
             cerr << "unknown exception" << endl;
-            boost::this_thread::sleep(seconds(5));
         }
-    }
+
+        boost::mutex::scoped_lock lock(mCacheMutex);
+
+        boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+        for (const string& id : inJob->ids)
+        {
+            auto e = FindEntry(id);
+            if (e != mResultCache.end() and e->status != bj_Queued)
+                e->finished = now;
+        }
+
+        inJob->done = true;
+        mWorkCondition.notify_all();
+    });
 }
 
-bool M6BlastCache::LoadCacheJob(const std::string& inJobID, M6BlastJob& job)
+// Called with mCacheMutex locked. A job whose thread was started keeps at
+// least one thread, so at most mMaxThreads jobs are ever started. The other
+// threads are handed out one by one to the client that has the fewest
+// threads, and there to its job with the fewest threads. Ties go to the job
+// that is expected to finish first. Jobs that get no thread wait.
+
+void M6BlastCache::Rebalance()
 {
-    boost::mutex::scoped_lock lock(mCacheMutex);
+    if (mRunningJobs.empty())
+        return;
 
-    fs::ifstream file(mCacheDir / (inJobID + ".job"));
-    if (file.is_open())
+    vector<RunningJobPtr> jobs(mRunningJobs.begin(), mRunningJobs.end());
+    vector<uint32> threads(jobs.size(), 0);
+    map<string,uint32> clientThreads;
+
+    uint32 n = 0;
+    for (size_t i = 0; i < jobs.size() and n < mMaxThreads; ++i)
     {
-        try
+        if (jobs[i]->started and not jobs[i]->done)
         {
-            zeep::xml::document doc(file);
-            doc.deserialize("blastjob", job);
+            ++threads[i];
+            ++clientThreads[jobs[i]->client];
+            ++n;
         }
-        catch(exception &ex)
-        {
-            LOG(ERROR, "cannot parse job %s: %s", inJobID.c_str(), ex.what());
+    }
 
-            return false;
+    for (; n < mMaxThreads; ++n)
+    {
+        size_t best = 0;
+        for (size_t i = 1; i < jobs.size(); ++i)
+        {
+            if (make_tuple(clientThreads[jobs[i]->client], threads[i], jobs[i]->cost) <
+                make_tuple(clientThreads[jobs[best]->client], threads[best], jobs[best]->cost))
+            {
+                best = i;
+            }
         }
 
+        ++threads[best];
+        ++clientThreads[jobs[best]->client];
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+        jobs[i]->threadLimit.Set(threads[i]);
+}
+
+bool M6BlastCache::LoadCacheJob(const std::string& inJobID, M6BlastJob& job)
+{
+    boost::mutex::scoped_lock lock(mCacheMutex);
+
+    auto i = FindEntry(inJobID);
+    if (i != mResultCache.end())
+    {
+        job = i->job;
         return true;
     }
 
-    LOG(ERROR, "cannot missing job file for %s: %s", inJobID.c_str());
+    LOG(ERROR, "missing job %s", inJobID.c_str());
 
     return false;
 }
-void M6BlastCache::ExecuteJob(const string& inJobID, const uint32 n_threads)
+void M6BlastCache::ExecuteJob(const string& inJobID, const uint32 n_threads,
+    const M6Blast::ThreadLimit* inThreadLimit)
 {
     try
     {
@@ -583,7 +1117,7 @@ void M6BlastCache::ExecuteJob(const string& inJobID, const uint32 n_threads)
 
         M6BlastResultPtr result(M6Blast::Search(files, job.query, job.program,
             job.matrix, job.wordsize, job.expect, job.filter, job.gapped,
-            job.gapOpen, job.gapExtend, job.reportLimit, n_threads));
+            job.gapOpen, job.gapExtend, job.reportLimit, n_threads, inThreadLimit));
 
         CacheResult(inJobID, result);
 
@@ -603,17 +1137,101 @@ void M6BlastCache::ExecuteJob(const string& inJobID, const uint32 n_threads)
     }
 }
 
-void M6BlastCache::SetJobStatus(const string inJobId, M6BlastJobStatus inStatus)
+void M6BlastCache::ExecuteBatch(const vector<string>& inJobIDs, const uint32 n_threads,
+    const M6Blast::ThreadLimit* inThreadLimit)
 {
-    boost::mutex::scoped_lock lock(mCacheMutex);
+    LOG(INFO, "executing %d blast jobs in one batch", inJobIDs.size());
 
-    for (CacheEntry& e : mResultCache)
+    vector<string> ids;
+    vector<M6BlastJob> jobs;
+
+    for (const string& id : inJobIDs)
     {
-        if (e.id != inJobId)
+        SetJobStatus(id, bj_Running);
+
+        M6BlastJob job;
+        if (!LoadCacheJob (id, job))
+        {
+            DeleteJob(id);
             continue;
+        }
 
-        e.status = inStatus;
-        break;
+        ids.push_back(id);
+        jobs.push_back(job);
+    }
+
+    if (jobs.empty())
+        return;
+
+    vector<fs::path> files;
+    transform(jobs.front().files.begin(), jobs.front().files.end(), back_inserter(files),
+        [](M6BlastDbInfo& dbi) { return dbi.path; });
+
+    vector<M6Blast::BatchQuery> queries;
+    for (const M6BlastJob& job : jobs)
+    {
+        M6Blast::BatchQuery q = { job.query, job.expect, job.filter, job.gapped,
+            job.gapOpen, job.gapExtend, job.reportLimit };
+        queries.push_back(q);
+    }
+
+    vector<M6BlastResultPtr> results;
+
+    try
+    {
+        vector<M6Blast::Result*> r = M6Blast::SearchBatch(files, queries, jobs.front().program,
+            jobs.front().matrix, jobs.front().wordsize, n_threads, inThreadLimit);
+
+        for (M6Blast::Result* result : r)
+            results.push_back(M6BlastResultPtr(result));
+    }
+    catch (boost::thread_interrupted&)
+    {
+        // one of the jobs was deleted, the others have to run again
+        for (const string& id : ids)
+            SetJobStatus(id, bj_Queued);
+        throw;
+    }
+    catch (exception& e)
+    {
+        // run the jobs one by one, so that each job gets its own error
+        LOG(INFO, "blast batch failed (%s), executing jobs separately", e.what());
+
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            try
+            {
+                ExecuteJob(ids[i], n_threads, inThreadLimit);
+            }
+            catch (boost::thread_interrupted&)
+            {
+                // as above, the jobs that did not complete have to run again
+                for (size_t j = i; j < ids.size(); ++j)
+                    SetJobStatus(ids[j], bj_Queued);
+                throw;
+            }
+            catch (exception&) {}
+        }
+
+        return;
+    }
+
+    for (size_t i = 0; i < ids.size(); ++i)
+        CacheResult(ids[i], results[i]);
+
+    LOG(INFO,"completed %d blast jobs", ids.size());
+}
+
+void M6BlastCache::SetJobStatus(const string inJobId, M6BlastJobStatus inStatus)
+{
+    boost::mutex::scoped_lock lock(mCacheMutex);
+
+    auto i = FindEntry(inJobId);
+    if (i != mResultCache.end())
+    {
+        i->status = inStatus;
+        if (inStatus == bj_Queued)
+            mWorkCondition.notify_all();
     }
 }
 
@@ -631,6 +1249,8 @@ M6BlastJobDescList M6BlastCache::GetJobList()
 
     M6BlastJobDescList result;
 
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
     for (CacheEntry& e : mResultCache)
     {
         M6BlastJobDesc desc;
@@ -638,6 +1258,15 @@ M6BlastJobDescList M6BlastCache::GetJobList()
         desc.id = e.id;
         desc.db = e.job.db;
         desc.queryLength = static_cast<uint32>(e.job.query.length());
+        desc.client = e.client;
+        desc.queueTime = desc.runTime = 0;
+        desc.threads = 0;
+
+        if (not e.queued.is_not_a_date_time())
+            desc.queueTime = ((e.started.is_not_a_date_time() ? now : e.started) - e.queued).total_milliseconds() / 1000.0;
+
+        if (not e.started.is_not_a_date_time())
+            desc.runTime = ((e.finished.is_not_a_date_time() ? now : e.finished) - e.started).total_milliseconds() / 1000.0;
 
         switch (e.status)
         {
@@ -648,6 +1277,18 @@ M6BlastJobDescList M6BlastCache::GetJobList()
             case bj_Finished:    desc.status = "finished"; break;
         }
 
+        if (e.status == bj_Running)
+        {
+            for (RunningJobPtr& job : mRunningJobs)
+            {
+                if (find(job->ids.begin(), job->ids.end(), e.id) != job->ids.end())
+                    desc.threads = job->threadLimit.Get();
+            }
+
+            if (desc.threads == 0)
+                desc.status = "paused";
+        }
+
         result.push_back(desc);
     }
 
@@ -667,14 +1308,23 @@ void M6BlastCache::DeleteJob(const string& inJobID)
 
     boost::mutex::scoped_lock lockdb(mCacheMutex);
 
-    auto c = find_if(mResultCache.begin(), mResultCache.end(),
-        [&inJobID](CacheEntry& e) -> bool { return e.id == inJobID; });
+    auto c = FindEntry(inJobID);
 
     if (c != mResultCache.end()) // if the ID was found, remove the job from the list
-        mResultCache.erase(c);
+    {
+        EraseEntry(c);
+        AppendToCatalog(inJobID, nullptr);
+    }
 
-    if (mWorkerThread.joinable())
-        mWorkerThread.interrupt();
+    // stop the job if it is running, unless it is the job itself that deletes it
+    for (RunningJobPtr& job : mRunningJobs)
+    {
+        if (find(job->ids.begin(), job->ids.end(), inJobID) != job->ids.end() and
+            job->thread.get_id() != boost::this_thread::get_id())
+        {
+            job->thread.interrupt();
+        }
+    }
 
     for (const char* ext : kBlastFileExtensions) // remove job files from the cache directory
     {
@@ -682,5 +1332,7 @@ void M6BlastCache::DeleteJob(const string& inJobID)
         fs::remove(mCacheDir / (inJobID + ext), ec);
     }
 
+    ForgetResult(inJobID);
+
     mWorkCondition.notify_all();
 }
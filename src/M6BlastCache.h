@@ -8,6 +8,9 @@
 #include <queue>
 #include <tuple>
 #include <string>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
 
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
@@ -72,6 +75,18 @@ struct M6BlastJob
 
     bool                        IsStillValid(const std::vector<boost::filesystem::path>& inFiles) const;
 
+    // Jobs for the same search have the same digest, the report limit
+    // is left out since a job with a larger limit can answer the search
+    size_t                        Digest() const;
+    static size_t                Digest(const std::string& inDatabank,
+                                    const std::string& inQuery, const std::string& inProgram,
+                                    const std::string& inMatrix, uint32 inWordSize,
+                                    double inExpect, bool inLowComplexityFilter,
+                                    bool inGapped, int32 inGapOpen, int32 inGapExtend);
+
+    // jobs that are compatible can be searched in one pass over the databank
+    bool                        IsCompatible(const M6BlastJob& inJob) const;
+
     template<class Archive>
     void serialize(Archive& ar, const unsigned int version)
     {
@@ -100,6 +115,10 @@ struct M6BlastJobDesc
     std::string        db;
     uint32            queryLength;
     std::string        status;
+    std::string        client;
+    double            queueTime;        // seconds waiting in the queue
+    double            runTime;        // seconds running, so far
+    uint32            threads;        // threads assigned to a running job
 };
 
 typedef std::list<M6BlastJobDesc> M6BlastJobDescList;
@@ -119,7 +138,7 @@ class M6BlastCache
                                     const std::string& inMatrix, uint32 inWordSize,
                                     double inExpect, bool inLowComplexityFilter,
                                     bool inGapped, int32 inGapOpen, int32 inGapExtend,
-                                    uint32 inReportLimit);
+                                    uint32 inReportLimit, const std::string& inClient = "");
 
     void                        Purge(bool inDeleteFiles = false);
 
@@ -134,27 +153,51 @@ class M6BlastCache
     M6BlastCache&                operator=(const M6BlastCache&);
                                 ~M6BlastCache();
 
-    void                        Work(const bool highload=false);
-    void                        ExecuteJob(const std::string& inJobID, const uint32 n_threads);
+    // Jobs run concurrently, each in its own thread. The scheduler makes
+    // sure the running jobs together use no more than mMaxThreads threads.
+    // The thread of a job is started once it gets a share of the threads.
+    struct RunningJob
+    {
+        std::vector<std::string>    ids;
+        std::string                    client;
+        double                        cost;
+        M6Blast::ThreadLimit        threadLimit;
+        boost::thread                thread;
+        bool                        started, done;
+    };
+
+    typedef std::shared_ptr<RunningJob> RunningJobPtr;
+
+    void                        Schedule();
+    bool                        StartNextJob();
+    void                        StartJobThread(RunningJobPtr inJob);
+    void                        Rebalance();
+
+    void                        ExecuteJob(const std::string& inJobID, const uint32 n_threads,
+                                    const M6Blast::ThreadLimit* inThreadLimit = nullptr);
+    void                        ExecuteBatch(const std::vector<std::string>& inJobIDs, const uint32 n_threads,
+                                    const M6Blast::ThreadLimit* inThreadLimit = nullptr);
     void                        StoreJob(const std::string& inJobID, const M6BlastJob& inJob);
     void                        SetJobStatus(const std::string inJobId, M6BlastJobStatus inStatus);
     void                        CacheResult(const std::string& inJobId, M6BlastResultPtr inResult);
 
+    void                        RememberResult(const std::string& inJobID, M6BlastResultPtr inResult);
+    void                        ForgetResult(const std::string& inJobID);
+
     void                        FastaFilesForDatabank(const std::string& inDatabank,
                                     std::vector<boost::filesystem::path>& outFiles);
 
     void                        ExecuteStatement(const std::string& inStatement);
 
     boost::filesystem::path        mCacheDir;
-    boost::thread                mWorkerThread,
-                                 mHighLoadThread;
-    boost::mutex                mCacheMutex,
-                                mWorkMutex,
-                                mHighLoadMutex;
+    boost::thread                mSchedulerThread;
+    boost::mutex                mCacheMutex;
     boost::condition            mWorkCondition;
     bool                        mStopWorkingFlag;
 
     uint32                      mMaxThreads;
+    uint32                        mMaxCachedJobs;
+    std::list<RunningJobPtr>    mRunningJobs;
 
     struct CacheEntry
     {
@@ -163,7 +206,36 @@ class M6BlastCache
         M6BlastJobStatus        status;
         uint32                    hitCount;
         double                    bestScore;
+
+        // scheduling info, not stored in the job file
+        std::string                client;
+        double                    cost;        // expected run time, query length times databank size
+        boost::posix_time::ptime
+                                queued, started, finished;
     };
 
+    static double                EstimateCost(const M6BlastJob& inJob);
+
+    typedef std::list<CacheEntry>::iterator    CacheEntryIterator;
+
+    void                        AddEntry(const CacheEntry& inEntry);
+    void                        EraseEntry(CacheEntryIterator inEntry);
+    CacheEntryIterator            FindEntry(const std::string& inJobID);
+
+    // the job catalog in the cache directory
+    bool                        ReadCatalog();
+    void                        WriteCatalog();
+    void                        AppendToCatalog(const std::string& inJobID, const M6BlastJob* inJob);
+
+    // the cache, most recently used first, and indexed by id and by job digest
     std::list<CacheEntry>        mResultCache;
+    std::unordered_map<std::string,CacheEntryIterator>
+                                mJobIndex;
+    std::unordered_multimap<size_t,CacheEntryIterator>
+                                mDigestIndex;
+
+    // the results that were used last, most recent first
+    boost::mutex                mLoadedMutex;
+    std::list<std::pair<std::string,M6BlastResultPtr>>
+                                mLoadedResults;
 };
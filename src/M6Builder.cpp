@@ -38,6 +38,7 @@
 #include "M6Databank.h"
 #include "M6Document.h"
 #include "M6Builder.h"
+#include "M6Blast.h"
 #include "M6Config.h"
 #include "M6Progress.h"
 #include "M6DataSource.h"
@@ -140,7 +141,7 @@ M6Processor::M6Processor(M6Databank& inDatabank, M6Lexicon& inLexicon,
     // see if this is an XML parser
     const zx::element* p = M6Config::GetParser(parser);
     if (p == nullptr)
-        mParser = new M6Parser(parser);
+        mParser = new M6Parser(parser, mConfig->get_attribute("native-parser") == "true");
     else
     {
         mChunkXPath = p->get_attribute("chunk");
@@ -452,56 +453,11 @@ void M6Processor::ProcessDocument()
 {
     try
     {
-        unique_ptr<M6Lexicon> tsLexicon(new M6Lexicon);
-        vector<M6InputDocument*> docs;
-
         for (;;)
         {
             string text, filename;
             tie(text, filename) = mDocQueue.Get();
 
-            if (text.empty() or docs.size() == 100)
-            {
-                // remap tokens
-                vector<uint32> remapped(tsLexicon->Count() + 1, 0);
-
-                {
-                    M6Lexicon::M6SharedLock sharedLock(mLexicon);
-
-                    for (uint32 t = 1; t < tsLexicon->Count(); ++t)
-                    {
-                        const char* w;
-                        size_t l;
-                        tsLexicon->GetString(t, w, l);
-                        remapped[t] = mLexicon.Lookup(w, l);
-                    }
-                }
-
-                {
-                    M6Lexicon::M6UniqueLock uniqueLock(mLexicon);
-
-                    for (uint32 t = 1; t < tsLexicon->Count(); ++t)
-                    {
-                        if (remapped[t] != 0)
-                            continue;
-
-                        const char* w;
-                        size_t l;
-                        tsLexicon->GetString(t, w, l);
-                        remapped[t] = mLexicon.Store(w, l);
-                    }
-                }
-
-                for (M6InputDocument* doc : docs)
-                {
-                    doc->RemapTokens(&remapped[0]);
-                    mDatabank.Store(doc);
-                }
-
-                docs.clear();
-                tsLexicon.reset(new M6Lexicon);
-            }
-
             if (text.empty())
                 break;
 
@@ -517,12 +473,12 @@ void M6Processor::ProcessDocument()
                     doc->SetFasta(fasta);
             }
 
-            doc->Tokenize(*tsLexicon, 0);
+            // the lexicon is shared, parse threads store their words directly
+            doc->Tokenize(mLexicon, 0);
             doc->Compress();
-            docs.push_back(doc);
-        }
 
-        assert(docs.empty());
+            mDatabank.Store(doc);
+        }
 
         mDocQueue.Put(kSentinel);
     }
@@ -546,7 +502,8 @@ void M6Processor::Process(vector<fs::path>& inFiles, M6Progress& inProgress,
 
     if (inFiles.size() == 1)
     {
-        M6DataSource data(inFiles.front(), inProgress);
+        // a single file, use multiple threads to decompress it
+        M6DataSource data(inFiles.front(), inProgress, inNrOfThreads);
         for (M6DataSource::iterator i = data.begin(); i != data.end(); ++i)
         {
             LOG(INFO, "M6Processor: processing file %s", i->mFilename.c_str());
@@ -600,6 +557,7 @@ void M6Processor::Process(vector<fs::path>& inFiles, M6Progress& inProgress,
 M6Builder::M6Builder(const string& inDatabank)
     : mConfig(M6Config::GetEnabledDatabank(inDatabank))
     , mDatabank(nullptr)
+    , mLexicon(true)
 {
     if (mConfig == nullptr)
         THROW(("Databank %s not known or not enabled", inDatabank.c_str()));
@@ -699,8 +657,20 @@ void M6Builder::Build(uint32 inNrOfThreads)
 
     // TODO fetch version string?
 
+    // the number of threads for storing and indexing documents
+    uint32 storeThreads = max(inNrOfThreads / 4, 1U), indexThreads = max(inNrOfThreads / 2, 1U);
+
+    const zx::element* builder = M6Config::GetServer()->find_first("builder");
+    if (builder != nullptr)
+    {
+        if (not builder->get_attribute("store-threads").empty())
+            storeThreads = boost::lexical_cast<uint32>(builder->get_attribute("store-threads"));
+        if (not builder->get_attribute("index-threads").empty())
+            indexThreads = boost::lexical_cast<uint32>(builder->get_attribute("index-threads"));
+    }
+
     mDatabank = M6Databank::CreateNew(dbID, path.string(), version, indexNames);
-    mDatabank->StartBatchImport(mLexicon);
+    mDatabank->StartBatchImport(mLexicon, storeThreads, indexThreads);
 
     vector<fs::path> files;
     int64 rawBytes = Glob(M6Config::GetDirectory("raw"), source, files);
@@ -716,9 +686,22 @@ void M6Builder::Build(uint32 inNrOfThreads)
 
     mDatabank->FinishBatchImport();
 
+    if (mConfig->get_attribute("similar-index") == "true")
+        mDatabank->CreateSimilarityIndex();
+
     delete mDatabank;
     mDatabank = nullptr;
 
+    // blast searches use a binary version of the fasta file, and
+    // optionally a seed index for short queries
+    if (fs::exists(path / "fasta"))
+    {
+        M6Blast::CreateBinaryDatabank(path / "fasta");
+
+        if (mConfig->get_attribute("blast-seeds") == "true")
+            M6Blast::CreateSeedIndex(path / "fasta");
+    }
+
     // if we created a temporary db
     if (path != dstPath)
     {
@@ -741,7 +724,7 @@ void M6Builder::IndexDocument(const std::string& inDatabankID, M6Databank* inDat
 
     for (auto& list : doc->GetIndexTokens())
     {
-        for (auto& token : list.mTokens)
+        for (uint32 token : doc->GetTokens(list))
         {
             if (token != 0)
                 outTerms.push_back(lexicon.GetString(token));
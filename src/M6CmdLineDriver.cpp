@@ -9,6 +9,8 @@
 
 #include <iostream>
 #include <tuple>
+#include <chrono>
+#include <numeric>
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -18,10 +20,13 @@
 
 #include "M6Builder.h"
 #include "M6Databank.h"
+#include "M6LinkGraph.h"
 #include "M6Config.h"
 #include "M6Error.h"
 #include "M6Iterator.h"
+#include "M6Query.h"
 #include "M6Document.h"
+#include "M6Tokenizer.h"
 #include "M6Blast.h"
 #include "M6Progress.h"
 #include "M6Fetch.h"
@@ -124,6 +129,17 @@ class M6BuildDriver : public M6CmdLineDriver
    virtual int     Exec(const string& inCommand, po::variables_map& vm);
 };
 
+class M6LinkGraphDriver : public M6CmdLineDriver
+{
+  public:
+                   M6LinkGraphDriver() {};
+
+   virtual void    AddOptions(po::options_description& desc,
+                       unique_ptr<po::positional_options_description>& p);
+   virtual bool    Validate(po::variables_map& vm);
+   virtual int     Exec(const string& inCommand, po::variables_map& vm);
+};
+
 class M6QueryDriver : public M6CmdLineDriver
 {
   public:
@@ -135,6 +151,17 @@ class M6QueryDriver : public M6CmdLineDriver
    virtual int     Exec(const string& inCommand, po::variables_map& vm);
 };
 
+class M6SuggestDriver : public M6CmdLineDriver
+{
+  public:
+                   M6SuggestDriver() {};
+
+   virtual void    AddOptions(po::options_description& desc,
+                       unique_ptr<po::positional_options_description>& p);
+   virtual bool    Validate(po::variables_map& vm);
+   virtual int     Exec(const string& inCommand, po::variables_map& vm);
+};
+
 class M6InfoDriver : public M6CmdLineDriver
 {
   public:
@@ -574,6 +601,7 @@ int M6BuildDriver::Exec(const string& inCommand, po::variables_map& vm)
         databanks.push_back(sDatabank);
 
     int result = 0;
+    bool built = false;
 
     for (string databank : databanks)
     {
@@ -591,6 +619,7 @@ int M6BuildDriver::Exec(const string& inCommand, po::variables_map& vm)
                 try
                 {
                     builder.Build(nrOfThreads);
+                    built = true;
                 }
                 catch (exception& e)
                 {
@@ -617,9 +646,81 @@ int M6BuildDriver::Exec(const string& inCommand, po::variables_map& vm)
         }
     }
 
+    if (built and fs::exists(M6Config::GetLinkGraphFile()))
+    {
+        cout << "The link graph is now out of date for the rebuilt databanks," << endl
+             << "run mrs link-graph to update it" << endl
+             << endl;
+    }
+
     return result;
 }
 
+// --------------------------------------------------------------------
+//    link-graph
+
+void M6LinkGraphDriver::AddOptions(po::options_description& desc,
+    unique_ptr<po::positional_options_description>& p)
+{
+    desc.add_options()
+        ("config,c",    po::value<string>(),    "Configuration file")
+        ("verbose,v",                            "Be verbose")
+        ("help,h",                                "Display help message")
+        ;
+}
+
+bool M6LinkGraphDriver::Validate(po::variables_map& vm)
+{
+    LoadConfig(vm);
+    return true;
+}
+
+// The link graph contains the links between all enabled databanks, the
+// link map is set up the same way as the server does.
+
+int M6LinkGraphDriver::Exec(const string& inCommand, po::variables_map& vm)
+{
+    M6LinkMap linkMap;
+    vector<unique_ptr<M6Databank>> loaded;
+    vector<M6Databank*> databanks;
+
+    for (zx::element* config : M6Config::GetDatabanks())
+    {
+        if (config->get_attribute("enabled") != "true")
+            continue;
+
+        string databank = config->get_attribute("id");
+
+        fs::path dbdir = M6Config::GetDbDirectory(databank);
+        if (not fs::exists(dbdir) or not fs::is_directory(dbdir))
+            continue;
+
+        if (VERBOSE)
+            cout << "adding " << databank << endl;
+
+        M6Databank* db = new M6Databank(dbdir, eReadOnly);
+        loaded.emplace_back(db);
+        databanks.push_back(db);
+
+        linkMap[databank].insert(db);
+        for (zx::element* alias : config->find("aliases/alias"))
+        {
+            string s(alias->content());
+            M6Tokenizer::CaseFold(s);
+            linkMap[s].insert(db);
+        }
+    }
+
+    for (M6Databank* db : databanks)
+        db->InitLinkMap(linkMap);
+
+    cout << "creating link graph for " << databanks.size() << " databanks" << endl;
+
+    M6LinkGraph::Create(M6Config::GetLinkGraphFile(), databanks, linkMap);
+
+    return 0;
+}
+
 // --------------------------------------------------------------------
 //    query
 
@@ -633,6 +734,7 @@ void M6QueryDriver::AddOptions(po::options_description& desc,
         ("all",                                  "Print all results")
         ("count", po::value<uint32>(),            "Result count (default = 10)")
         ("offset", po::value<uint32>(),            "Result offset (default = 0)")
+        ("explain",                                "Print the query plan with estimated and actual counts")
         ;
 
     p->add("query", 2);
@@ -651,6 +753,12 @@ int M6QueryDriver::Exec(const string& inCommand, po::variables_map& vm)
 
     M6Databank db(path.string());
 
+    if (vm.count("explain"))
+    {
+        ExplainQuery(db, vm["query"].as<string>(), true, cout);
+        return 0;
+    }
+
     uint32 count = 10;
     if (vm.count("count"))
         count = vm["count"].as<uint32>();
@@ -689,6 +797,117 @@ int M6QueryDriver::Exec(const string& inCommand, po::variables_map& vm)
     return 0;
 }
 
+// --------------------------------------------------------------------
+//    suggest
+
+void M6SuggestDriver::AddOptions(po::options_description& desc,
+    unique_ptr<po::positional_options_description>& p)
+{
+    M6CmdLineDriver::AddOptions(desc, p);
+    desc.add_options()
+        ("prefix,p", po::value<string>(),        "Prefix to complete")
+        ("benchmark",                            "Measure the latency of completing all one, two and three letter prefixes")
+        ;
+
+    p->add("prefix", 2);
+}
+
+bool M6SuggestDriver::Validate(po::variables_map& vm)
+{
+    return M6CmdLineDriver::Validate(vm) and (vm.count("prefix") or vm.count("benchmark"));
+}
+
+int M6SuggestDriver::Exec(const string& inCommand, po::variables_map& vm)
+{
+    vector<string> databanks;
+
+    if (vm["databank"].as<string>() == "all")
+    {
+        for (zx::element* db : M6Config::GetDatabanks())
+        {
+            if (db->get_attribute("enabled") != "false")
+                databanks.push_back(db->get_attribute("id"));
+        }
+    }
+    else
+        databanks.push_back(vm["databank"].as<string>());
+
+    vector<string> prefixes;
+    if (vm.count("benchmark"))
+    {
+        for (char a = 'a'; a <= 'z'; ++a)
+        {
+            prefixes.push_back(string(1, a));
+            for (char b = 'a'; b <= 'z'; ++b)
+            {
+                prefixes.push_back(string(1, a) + b);
+                for (char c = 'a'; c <= 'z'; ++c)
+                    prefixes.push_back(string(1, a) + b + c);
+            }
+        }
+    }
+
+    for (const string& databank : databanks)
+    {
+        unique_ptr<M6Databank> db;
+
+        try
+        {
+            const zx::element* config;
+            fs::path path;
+            tie(config, path) = GetDatabank(databank);
+
+            db.reset(new M6Databank(path.string()));
+        }
+        catch (exception& e)
+        {
+            cerr << databank << ": " << e.what() << endl;
+            continue;
+        }
+
+        if (vm.count("prefix"))
+        {
+            vector<pair<string,uint32>> terms;
+            db->SuggestSearchTerms(vm["prefix"].as<string>(), terms);
+
+            for (auto& t : terms)
+                cout << databank << '\t' << t.first << '\t' << t.second << endl;
+        }
+
+        if (not prefixes.empty())
+        {
+            vector<double> latency;
+            uint32 found = 0;
+
+            for (const string& prefix : prefixes)
+            {
+                vector<pair<string,uint32>> terms;
+
+                auto start = chrono::high_resolution_clock::now();
+                db->SuggestSearchTerms(prefix, terms);
+                auto stop = chrono::high_resolution_clock::now();
+
+                latency.push_back(chrono::duration<double, micro>(stop - start).count());
+                if (not terms.empty())
+                    ++found;
+            }
+
+            sort(latency.begin(), latency.end());
+            double total = accumulate(latency.begin(), latency.end(), 0.0);
+
+            cout << databank << ": " << latency.size() << " prefixes, " << found << " with suggestions, "
+                 << boost::format("mean %1.1f us, median %1.1f us, 99%% %1.1f us, max %1.1f us")
+                        % (total / latency.size())
+                        % latency[latency.size() / 2]
+                        % latency[latency.size() * 99 / 100]
+                        % latency.back()
+                 << endl;
+        }
+    }
+
+    return 0;
+}
+
 // --------------------------------------------------------------------
 //    info
 
@@ -1061,8 +1280,10 @@ int main(int argc, char* argv[])
         M6CmdLineDriver::Register<M6EntryDriver>    ("entry",    "Retrieve and print an entry");
         M6CmdLineDriver::Register<M6FetchDriver>    ("fetch",    "Fetch/mirror remote data for a databank");
         M6CmdLineDriver::Register<M6InfoDriver>        ("info",    "Display information and statistics for a databank");
+        M6CmdLineDriver::Register<M6LinkGraphDriver>("link-graph","Create the link graph for all databanks");
         M6CmdLineDriver::Register<M6QueryDriver>    ("query",    "Perform a search in a databank");
         M6CmdLineDriver::Register<M6ServerDriver>    ("server",    "Start or Stop a server session, or query the status");
+        M6CmdLineDriver::Register<M6SuggestDriver>    ("suggest",    "Suggest search terms for a prefix");
         M6CmdLineDriver::Register<M6VacuumDriver>    ("vacuum",    "Clean up a databank reclaiming unused disk space");
         M6CmdLineDriver::Register<M6ValidateDriver>    ("validate","Perform a set of validation tests");
         M6CmdLineDriver::Register<M6BuildDriver>    ("update",    "Same as build, but does a fetch first");
@@ -299,6 +299,12 @@ fs::path GetDbDirectory(const std::string& inDatabankID)
     return mrsdir / (inDatabankID + ".m6");
 }
 
+fs::path GetLinkGraphFile()
+{
+    fs::path mrsdir(GetDirectory("mrs"));
+    return mrsdir / "link-graph";
+}
+
 void GetSchedule(bool& outEnabled, boost::posix_time::ptime& outTime, string& outWeekDay)
 {
     zeep::xml::element* schedule = File::Instance().GetSchedule();
@@ -77,6 +77,7 @@ const zeep::xml::element*        GetDatabank(const std::string& inID);
 const zeep::xml::element_set    GetDatabanks(const std::string& inID);
 std::string                        GetDatabankParam(const std::string& inID, const std::string& inParam);
 boost::filesystem::path            GetDbDirectory(const std::string& inDatabankID);
+boost::filesystem::path            GetLinkGraphFile();
 void                            GetSchedule(bool& outEnabled, boost::posix_time::ptime& outTime,
                                     std::string& outWeekDay);
 
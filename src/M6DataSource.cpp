@@ -20,6 +20,7 @@
 #include <boost/algorithm/string.hpp>
 
 #include "M6DataSource.h"
+#include "M6Decompressor.h"
 #include "M6Error.h"
 #include "M6Progress.h"
 #include "M6File.h"
@@ -111,7 +112,7 @@ struct M6DataSourceImpl
                     Next() = 0;
 
     static M6DataSourceImpl*
-                    Create(const fs::path& inFile, M6Progress& inProgress);
+                    Create(const fs::path& inFile, M6Progress& inProgress, uint32 inNrOfThreads);
 
     M6Progress&        mProgress;
 };
@@ -205,14 +206,16 @@ struct M6PlainTextDataSourceImpl : public M6DataSourceImpl
 {
     typedef M6DataSource::M6DataFile M6DataFile;
 
-                            M6PlainTextDataSourceImpl(const fs::path& inFile, M6Progress& inProgress);
+                            M6PlainTextDataSourceImpl(const fs::path& inFile, M6Progress& inProgress,
+                                uint32 inNrOfThreads);
 
     virtual M6DataFile*        Next()    { return mNext.release(); }
 
     unique_ptr<M6DataFile>    mNext;
 };
 
-M6PlainTextDataSourceImpl::M6PlainTextDataSourceImpl(const fs::path& inFile, M6Progress& inProgress)
+M6PlainTextDataSourceImpl::M6PlainTextDataSourceImpl(const fs::path& inFile, M6Progress& inProgress,
+        uint32 inNrOfThreads)
     : M6DataSourceImpl(inProgress)
 {
     if (not inFile.empty())
@@ -220,14 +223,19 @@ M6PlainTextDataSourceImpl::M6PlainTextDataSourceImpl(const fs::path& inFile, M6P
         mNext.reset(new M6DataSource::M6DataFile);
         mNext->mFilename = inFile.filename().string();
 
-        if (inFile.extension() == ".gz")
-            mNext->mStream.push(io::gzip_decompressor());
-        else if (inFile.extension() == ".bz2")
-            mNext->mStream.push(io::bzip2_decompressor());
-        else if (inFile.extension() == ".Z")
-            mNext->mStream.push(compress_decompressor());
-
-        mNext->mStream.push(m6file_device(inFile, mProgress));
+        if (inNrOfThreads > 1 and M6Decompressor::Supports(inFile))
+            mNext->mStream.push(M6Decompressor(inFile, mProgress, inNrOfThreads));
+        else
+        {
+            if (inFile.extension() == ".gz")
+                mNext->mStream.push(io::gzip_decompressor());
+            else if (inFile.extension() == ".bz2")
+                mNext->mStream.push(io::bzip2_decompressor());
+            else if (inFile.extension() == ".Z")
+                mNext->mStream.push(compress_decompressor());
+
+            mNext->mStream.push(m6file_device(inFile, mProgress));
+        }
 
         mProgress.Message(inFile.filename().string());
     }
@@ -241,7 +249,8 @@ struct M6TarDataSourceImpl : public M6DataSourceImpl
     typedef M6DataSource::M6DataFile M6DataFile;
     typedef M6DataSource::istream_type istream_type;
 
-                        M6TarDataSourceImpl(const fs::path& inArchive, M6Progress& inProgress);
+                        M6TarDataSourceImpl(const fs::path& inArchive, M6Progress& inProgress,
+                            uint32 inNrOfThreads);
                         ~M6TarDataSourceImpl();
 
     struct device : public io::source
@@ -291,17 +300,23 @@ struct M6TarDataSourceImpl : public M6DataSourceImpl
     M6Progress&        mProgress;
 };
 
-M6TarDataSourceImpl::M6TarDataSourceImpl(const fs::path& inArchive, M6Progress& inProgress)
+M6TarDataSourceImpl::M6TarDataSourceImpl(const fs::path& inArchive, M6Progress& inProgress,
+        uint32 inNrOfThreads)
     : M6DataSourceImpl(inProgress), mProgress(inProgress)
 {
-    if (inArchive.extension() == ".gz" or inArchive.extension() == ".tgz")
-        mStream.push(io::gzip_decompressor());
-    else if (inArchive.extension() == ".bz2" or inArchive.extension() == ".tbz")
-        mStream.push(io::bzip2_decompressor());
-    else if (inArchive.extension() == ".Z")
-        mStream.push(compress_decompressor());
-
-    mStream.push(m6file_device(inArchive, inProgress));
+    if (inNrOfThreads > 1 and M6Decompressor::Supports(inArchive))
+        mStream.push(M6Decompressor(inArchive, inProgress, inNrOfThreads));
+    else
+    {
+        if (inArchive.extension() == ".gz" or inArchive.extension() == ".tgz")
+            mStream.push(io::gzip_decompressor());
+        else if (inArchive.extension() == ".bz2" or inArchive.extension() == ".tbz")
+            mStream.push(io::bzip2_decompressor());
+        else if (inArchive.extension() == ".Z")
+            mStream.push(compress_decompressor());
+
+        mStream.push(m6file_device(inArchive, inProgress));
+    }
 }
 
 M6TarDataSourceImpl::~M6TarDataSourceImpl()
@@ -399,7 +414,8 @@ M6TarDataSourceImpl::M6DataFile* M6TarDataSourceImpl::Next()
 
 // --------------------------------------------------------------------
 
-M6DataSourceImpl* M6DataSourceImpl::Create(const fs::path& inFile, M6Progress& inProgress)
+M6DataSourceImpl* M6DataSourceImpl::Create(const fs::path& inFile, M6Progress& inProgress,
+    uint32 inNrOfThreads)
 {
     M6DataSourceImpl* result = nullptr;
 
@@ -414,10 +430,10 @@ M6DataSourceImpl* M6DataSourceImpl::Create(const fs::path& inFile, M6Progress& i
             ba::ends_with(name, ".tar.bz2") or
             ba::ends_with(name, ".tar.Z"))
         {
-            result = new M6TarDataSourceImpl(inFile, inProgress);
+            result = new M6TarDataSourceImpl(inFile, inProgress, inNrOfThreads);
         }
         else
-            result = new M6PlainTextDataSourceImpl(inFile, inProgress);
+            result = new M6PlainTextDataSourceImpl(inFile, inProgress, inNrOfThreads);
     }
 
     return result;
@@ -425,8 +441,8 @@ M6DataSourceImpl* M6DataSourceImpl::Create(const fs::path& inFile, M6Progress& i
 
 // --------------------------------------------------------------------
 
-M6DataSource::M6DataSource(const fs::path& inFile, M6Progress& inProgress)
-    : mImpl(M6DataSourceImpl::Create(inFile, inProgress))
+M6DataSource::M6DataSource(const fs::path& inFile, M6Progress& inProgress, uint32 inNrOfThreads)
+    : mImpl(M6DataSourceImpl::Create(inFile, inProgress, inNrOfThreads))
 {
 }
 
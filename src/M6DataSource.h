@@ -17,8 +17,10 @@ struct M6DataSource
   public:
     typedef boost::iostreams::filtering_stream<boost::iostreams::input> istream_type;
 
+                        // inNrOfThreads > 1 enables multi-threaded decompression
+                        // of gzip and bzip2 compressed files
                         M6DataSource(const boost::filesystem::path& inFile,
-                            M6Progress& inProgress);
+                            M6Progress& inProgress, uint32 inNrOfThreads = 1);
     virtual                ~M6DataSource();
 
     struct M6DataFile
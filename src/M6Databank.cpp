@@ -38,6 +38,8 @@
 #include "M6Query.h"
 #include "M6Iterator.h"
 #include "M6Dictionary.h"
+#include "M6Similarity.h"
+#include "M6LinkGraph.h"
 #include "M6Tokenizer.h"
 
 using namespace std;
@@ -104,7 +106,8 @@ class M6DatabankImpl
     string            GetID() const                        { return mID; }
     string            GetUUID() const                        { return mUUID; }
 
-    void            StartBatchImport(M6Lexicon& inLexicon);
+    void            StartBatchImport(M6Lexicon& inLexicon,
+                        uint32 inStoreThreads, uint32 inIndexThreads);
     void            EndBatchImport();
     void            FinishBatchImport();
 
@@ -119,15 +122,18 @@ class M6DatabankImpl
     M6Iterator*     Find(const string& inIndex, const string& inLowerBound, const string& inUpperBound);
     M6Iterator*        FindPattern(const string& inIndex, const string& inPattern);
     M6Iterator*        FindString(const string& inIndex, const string& inString);
+    M6Iterator*        FindNear(const string& inIndex, const string& inTermA, const string& inTermB, uint32 inDistance);
+    M6Iterator*        FindSimilar(uint32 inDocNr, uint32 inReportLimit);
     tuple<bool,uint32>
                     Exists(const string& inIndex, const string& inValue);
 
-    void            InitLinkMap(const M6LinkMap& inLinkMap);
+    void            InitLinkMap(const M6LinkMap& inLinkMap, const M6LinkGraph* inLinkGraph);
     bool            IsLinked(const string& inDB, const string& inID);
     M6Iterator*        GetLinkedDocuments(const string& inDB, const string& inID);
+    void            VisitLinks(M6Databank::LinkVisitor inVisitor);
 
     void            SuggestCorrection(const string& inWord, vector<pair<string,uint16>>& outCorrections);
-    void            SuggestSearchTerms(const string& inWord, vector<string>& outSearchTerms);
+    void            SuggestSearchTerms(const string& inWord, vector<pair<string,uint32>>& outSearchTerms);
 
     bool            BrowseSectionsForIndex(const string& inIndex, const string& inFirst, const string& inLast,
                         uint32 inRequestedBrowseSections, vector<pair<string,string>>& outBrowseSections);
@@ -146,13 +152,15 @@ class M6DatabankImpl
 
     void            RecalculateDocumentWeights();
     void            CreateDictionary();
+    void            CreateSimilarityIndex();
     void            Vacuum();
 
     void            Validate();
     void            DumpIndex(const string& inIndex, ostream& inStream);
 
-    void            StoreThread();
-    void            IndexThread();
+    void            StoreThread(uint32 inWriter);
+    void            IndexThread(uint32 inShard);
+    void            StopBatchThreads();
 
   protected:
 
@@ -178,16 +186,19 @@ class M6DatabankImpl
     MOpenMode                mMode;
     M6DocStore*                mStore;
     M6Dictionary*            mDictionary;
+    M6CompletionIndex*        mCompletion;
+    M6SimilarityIndex*        mSimilarity;
     M6BatchIndexProcessor*    mBatch;
     M6IndexDescList            mIndices;
     M6BasicIndexPtr            mAllTextIndex;
     vector<float>            mDocWeights;
     M6DocQueue                mStoreQueue, mIndexQueue;
-    boost::thread            mStoreThread, mIndexThread;
-    boost::mutex            mMutex;
+    vector<boost::thread>    mStoreThreads, mIndexThreads;
+    boost::mutex            mMutex, mFastaMutex;
     exception_ptr            mException;
     M6IndexDescList            mLinkIndices;
     M6LinkMap                mLinkMap;
+    const M6LinkGraph*        mLinkGraph;
 };
 
 // --------------------------------------------------------------------
@@ -195,7 +206,8 @@ class M6DatabankImpl
 class M6FullTextIx
 {
   public:
-                    M6FullTextIx(const fs::path& inDBDirectory, const string& inName);
+                    M6FullTextIx(const fs::path& inDBDirectory, const string& inName,
+                        uint32 inShardCount);
     virtual            ~M6FullTextIx();
 
     void            SetUsesInDocLocation(uint32 inIndexNr)        { mDocLocationIxMap[inIndexNr] = true; }
@@ -205,8 +217,12 @@ class M6FullTextIx
     bool            ExcludesInFullText(uint32 inIndexNr) const    { return mFullTextIxMap[inIndexNr]; }
     M6IndexMap        GetFullTextIxMap() const                    { return mFullTextIxMap; }
 
-    void            AddWord(uint8 inIndex, uint32 inWord);
-    void            FlushDoc(uint32 inDocNr);
+    // Documents are added to a shard, each thread adding documents
+    // should use its own shard.
+    uint32            GetShardCount() const                        { return static_cast<uint32>(mShards.size()); }
+
+    void            AddWord(uint32 inShard, uint8 inIndex, uint32 inWord);
+    void            FlushDoc(uint32 inShard, uint32 inDocNr);
 
     struct M6BufferEntry
     {
@@ -239,7 +255,6 @@ class M6FullTextIx
                                     (term == inOther.term and doc < inOther.doc); }
     };
 
-    void            PushEntry(M6BufferEntry&& inEntry);
     int64            Finish();
     bool            NextEntry(M6BufferEntry& outEntry);
 
@@ -272,13 +287,38 @@ class M6FullTextIx
 
     struct M6EntryRun
     {
+                        M6EntryRun(uint32 inSize)
+                            : mCount(0), mEntries(new M6BufferEntry[inSize]) {}
+                        ~M6EntryRun()                            { delete[] mEntries; }
+
         uint32            mCount;
-        M6BufferEntry    mEntries[kM6BufferEntryCount];
+        M6BufferEntry*    mEntries;
     };
 
     typedef M6Queue<M6EntryRun*>    M6EntryRunQueue;
 
-    void            FlushEntryRuns();
+    // A shard contains the words for whole documents since the weights
+    // are normalized per document. The entries are written to a
+    // separate file for each shard and merged again in Finish.
+    struct M6Shard
+    {
+                        M6Shard(const fs::path& inFile)
+                            : mDocWordLocation(1), mEntryBufferFile(inFile)
+                            , mEntryBuffer(inFile, eReadWrite)
+                            , mEntryRun(nullptr), mEntryCount(0) {}
+
+        DocWords        mDocWords;
+        uint32            mDocWordLocation;
+        fs::path        mEntryBufferFile;
+        M6File            mEntryBuffer;
+        M6EntryRun*        mEntryRun;
+        M6EntryRunQueue    mEntryRunQueue;
+        boost::thread    mEntryRunThread;
+        int64            mEntryCount;
+    };
+
+    void            PushEntry(M6Shard& inShard, M6BufferEntry&& inEntry);
+    void            FlushEntryRuns(M6Shard* inShard);
 
     static const uint32 kM6LargeBitBufferSize = 65536;
 
@@ -312,17 +352,14 @@ class M6FullTextIx
 
     typedef vector<M6BufferEntryIterator*>    M6EntryQueue;
 
-    DocWords        mDocWords;
     M6IndexMap        mDocLocationIxMap, mFullTextIxMap;
-    uint32            mDocWordLocation;
     fs::path        mDbDirectory;
 
-    M6File            mEntryBuffer;
-    M6EntryRun*        mEntryRun;
-    M6EntryRunQueue    mEntryRunQueue;
-    boost::thread    mEntryRunThread;
+    vector<M6Shard*>
+                    mShards;
+    uint32            mEntryRunSize;
     M6EntryQueue    mEntryQueue;
-    int64            mEntryCount;
+    boost::mutex    mEntryQueueMutex;
 };
 
 ostream& operator<<(ostream& os, const M6FullTextIx::M6BufferEntry& e)
@@ -334,63 +371,89 @@ ostream& operator<<(ostream& os, const M6FullTextIx::M6BufferEntry& e)
     return os;
 }
 
-M6FullTextIx::M6FullTextIx(const fs::path& inDBDirectory, const string& inName)
-    : mDocWordLocation(1)
-    , mDbDirectory(inDBDirectory)
-    , mEntryBuffer(mDbDirectory / inName, eReadWrite)
-    , mEntryRun(nullptr)
-    , mEntryRunThread(boost::bind(&M6FullTextIx::FlushEntryRuns, this))
-    , mEntryCount(0)
+M6FullTextIx::M6FullTextIx(const fs::path& inDBDirectory, const string& inName,
+        uint32 inShardCount)
+    : mDbDirectory(inDBDirectory)
 {
     mFullTextIxMap.assign(false);
     mDocLocationIxMap.assign(false);
+
+    if (inShardCount < 1)
+        inShardCount = 1;
+
+    // the total amount of memory used for buffering stays the same
+    mEntryRunSize = kM6BufferEntryCount / inShardCount;
+
+    for (uint32 n = 0; n < inShardCount; ++n)
+    {
+        M6Shard* shard = new M6Shard(mDbDirectory / (inName + '-' + to_string(n) + ".tmp"));
+        shard->mEntryRunThread = boost::thread(boost::bind(&M6FullTextIx::FlushEntryRuns, this, shard));
+        mShards.push_back(shard);
+    }
 }
 
 M6FullTextIx::~M6FullTextIx()
 {
-    delete mEntryRun;
-    if (mEntryRunThread.joinable())
+    for (M6Shard* shard : mShards)
     {
-        mEntryRunQueue.Put(nullptr);
-        mEntryRunThread.join();
+        if (shard->mEntryRunThread.joinable())
+        {
+            shard->mEntryRunQueue.Put(nullptr);
+            shard->mEntryRunThread.join();
+        }
+    }
 
-        for (M6BufferEntryIterator* iter : mEntryQueue)
-            delete iter;
+    for (M6BufferEntryIterator* iter : mEntryQueue)
+        delete iter;
+
+    for (M6Shard* shard : mShards)
+    {
+        delete shard->mEntryRun;
+
+        fs::path file = shard->mEntryBufferFile;
+        delete shard;
+
+        fs::remove(file);
     }
 }
 
-void M6FullTextIx::AddWord(uint8 inIndex, uint32 inWord)
+void M6FullTextIx::AddWord(uint32 inShard, uint8 inIndex, uint32 inWord)
 {
-    ++mDocWordLocation;    // always increment, even if we do not add the word
+    M6Shard& shard = *mShards[inShard];
+
+    ++shard.mDocWordLocation;    // always increment, even if we do not add the word
 
     if (inWord > 0)
     {
         DocWord w = { inWord, inIndex, 1 };
 
-        DocWords::iterator i = mDocWords.find(w);
-        if (i != mDocWords.end())
+        DocWords::iterator i = shard.mDocWords.find(w);
+        if (i != shard.mDocWords.end())
             const_cast<DocWord&>(*i).freq += 1;
         else
-            i = mDocWords.insert(w).first;
+            i = shard.mDocWords.insert(w).first;
 
         if (UsesInDocLocation(inIndex))
         {
             DocWord& dw = const_cast<DocWord&>(*i);
-            dw.loc.push_back(mDocWordLocation);
+            dw.loc.push_back(shard.mDocWordLocation);
         }
     }
 }
 
-void M6FullTextIx::FlushDoc(uint32 inDoc)
+void M6FullTextIx::FlushDoc(uint32 inShard, uint32 inDoc)
 {
+    M6Shard& shard = *mShards[inShard];
+    DocWords& docWords = shard.mDocWords;
+
     // normalize the frequencies.
     uint32 maxFreq = 1;
 
-    for (DocWords::iterator w = mDocWords.begin(); w != mDocWords.end(); ++w)
+    for (DocWords::iterator w = docWords.begin(); w != docWords.end(); ++w)
         if (w->freq > maxFreq)
             maxFreq = w->freq;
 
-    for (DocWords::iterator w = mDocWords.begin(); w != mDocWords.end(); ++w)
+    for (DocWords::iterator w = docWords.begin(); w != docWords.end(); ++w)
     {
         if (w->freq == 0)
             continue;
@@ -408,42 +471,39 @@ void M6FullTextIx::FlushDoc(uint32 inDoc)
         if (UsesInDocLocation(w->index))
             WriteArray(e.idl, w->loc);
 
-        PushEntry(move(e));
+        PushEntry(shard, move(e));
     }
 
-    mDocWords.clear();
-    mDocWordLocation = 1;
+    docWords.clear();
+    shard.mDocWordLocation = 1;
 }
 
-void M6FullTextIx::PushEntry(M6BufferEntry&& inEntry)
+void M6FullTextIx::PushEntry(M6Shard& inShard, M6BufferEntry&& inEntry)
 {
-    if (mEntryRun != nullptr and mEntryRun->mCount >= kM6BufferEntryCount)
+    if (inShard.mEntryRun != nullptr and inShard.mEntryRun->mCount >= mEntryRunSize)
     {
-        mEntryRunQueue.Put(mEntryRun);
-        mEntryRun = nullptr;
+        inShard.mEntryRunQueue.Put(inShard.mEntryRun);
+        inShard.mEntryRun = nullptr;
     }
 
-    if (mEntryRun == nullptr)
-    {
-        mEntryRun = new M6EntryRun;
-        mEntryRun->mCount = 0;
-    }
+    if (inShard.mEntryRun == nullptr)
+        inShard.mEntryRun = new M6EntryRun(mEntryRunSize);
 
-    mEntryRun->mEntries[mEntryRun->mCount] = move(inEntry);
-    ++mEntryRun->mCount;
-    ++mEntryCount;
+    inShard.mEntryRun->mEntries[inShard.mEntryRun->mCount] = move(inEntry);
+    ++inShard.mEntryRun->mCount;
+    ++inShard.mEntryCount;
 }
 
-void M6FullTextIx::FlushEntryRuns()
+void M6FullTextIx::FlushEntryRuns(M6Shard* inShard)
 {
     for (;;)
     {
-        M6EntryRun* run = mEntryRunQueue.Get();
+        M6EntryRun* run = inShard->mEntryRunQueue.Get();
         if (run == nullptr)
             break;
 
-        int64 offset = mEntryBuffer.Size();
-        M6OBitStream bits(mEntryBuffer);
+        int64 offset = inShard->mEntryBuffer.Size();
+        M6OBitStream bits(inShard->mEntryBuffer);
 
         M6BufferEntry* entries = run->mEntries;
         uint32 count = run->mCount;
@@ -485,8 +545,13 @@ void M6FullTextIx::FlushEntryRuns()
         bits.Sync();
 
         // create an iterator now that we have all the info
-        mEntryQueue.push_back(new M6BufferEntryIterator(mEntryBuffer, offset,
-            count, firstDoc, mDocLocationIxMap));
+        M6BufferEntryIterator* iter = new M6BufferEntryIterator(inShard->mEntryBuffer, offset,
+            count, firstDoc, mDocLocationIxMap);
+
+        {
+            boost::mutex::scoped_lock lock(mEntryQueueMutex);
+            mEntryQueue.push_back(iter);
+        }
 
         delete run;
     }
@@ -494,15 +559,25 @@ void M6FullTextIx::FlushEntryRuns()
 
 int64 M6FullTextIx::Finish()
 {
-    // flush the runs and stop the thread
-    if (mEntryRun != nullptr)
+    // flush the runs and stop the threads
+    int64 entryCount = 0;
+
+    for (M6Shard* shard : mShards)
     {
-        mEntryRunQueue.Put(mEntryRun);
-        mEntryRun = nullptr;
+        if (shard->mEntryRun != nullptr)
+        {
+            shard->mEntryRunQueue.Put(shard->mEntryRun);
+            shard->mEntryRun = nullptr;
+        }
+
+        shard->mEntryRunQueue.Put(nullptr);
     }
 
-    mEntryRunQueue.Put(nullptr);
-    mEntryRunThread.join();
+    for (M6Shard* shard : mShards)
+    {
+        shard->mEntryRunThread.join();
+        entryCount += shard->mEntryCount;
+    }
 
     // setup the input queue
     vector<M6BufferEntryIterator*> iterators;
@@ -519,7 +594,7 @@ int64 M6FullTextIx::Finish()
         else
             delete iter;
     }
-    return mEntryCount;
+    return entryCount;
 }
 
 bool M6FullTextIx::NextEntry(M6BufferEntry& outEntry)
@@ -851,7 +926,7 @@ class M6BasicIx
                         const string& inName, uint8 inIndexNr);
     virtual         ~M6BasicIx();
 
-    void            AddWord(uint32 inWord);
+    void            AddWord(uint32 inShard, uint32 inWord);
     void            AddDocTerm(uint32 inDoc, uint32 inTerm, uint8 inFrequency, M6OBitStream& inIDL);
 
     void            SetDbDocCount(uint32 inDBDocCount);
@@ -905,9 +980,9 @@ M6BasicIx::~M6BasicIx()
     }
 }
 
-void M6BasicIx::AddWord(uint32 inWord)
+void M6BasicIx::AddWord(uint32 inShard, uint32 inWord)
 {
-    mFullTextIndex.AddWord(mIndexNr, inWord);
+    mFullTextIndex.AddWord(inShard, mIndexNr, inWord);
 }
 
 void M6BasicIx::SetDbDocCount(uint32 inDBDocCount)
@@ -1048,7 +1123,9 @@ void M6StringIx::FlushTerm(uint32 inTerm, uint32 inDocCount)
 
 void M6StringIx::FlushTerm(FlushedTerm* inTermData)
 {
-    mIndex->Insert(inTermData->mTerm, inTermData->mDocs);
+    // the uint32 Insert stores the number itself as key, as is needed
+    // for number indices, here the key is the term from the lexicon
+    mIndex->InsertTerm(inTermData->mTerm, inTermData->mDocs);
 }
 
 // --------------------------------------------------------------------
@@ -1072,11 +1149,18 @@ class M6TextIx : public M6BasicIx
 
     virtual void    FlushTerm(FlushedTerm* inTermData);
 
+    void            WriteBlock();
+
     M6File*            mIDLFile;
     M6OBitStream*    mIDLBits;
     int64            mIDLOffset;
     M6MultiIDLBasicIndex*
                     mIndex;
+
+    // positional postings, documents and locations in blocks
+    bool            mPositional;
+    M6OBitStream    mBlockDocs, mBlockLocations;
+    uint32            mBlockDocCount, mBlockLastDoc, mPrevBlockLastDoc;
 };
 
 M6TextIx::M6TextIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
@@ -1086,13 +1170,28 @@ M6TextIx::M6TextIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
     , mIDLBits(nullptr)
     , mIDLOffset(0)
     , mIndex(dynamic_cast<M6MultiIDLBasicIndex*>(inIndex.get()))
+    , mPositional(false)
+    , mBlockDocCount(0)
+    , mBlockLastDoc(0)
+    , mPrevBlockLastDoc(0)
 {
     assert(mIndex);
     mIndex->SetAutoCommit(false);
     mIndex->SetBatchMode(inLexicon);
     mFullTextIndex.SetUsesInDocLocation(mIndexNr);
-    mIDLFile = new M6File(
-        mFullTextIndex.GetDbDirectory() / (inName + ".idl"), eReadWrite);
+
+    fs::path path = mFullTextIndex.GetDbDirectory() / (inName + ".idl");
+    mIDLFile = new M6File(path, eReadWrite);
+
+    // new files get positional postings, existing files keep their format
+    if (mIDLFile->Size() == 0)
+    {
+        M6PostingFileHeader header = { kM6PostingFileSignature, kM6PostingFileVersion };
+        mIDLFile->PWrite(header, 0);
+        mPositional = true;
+    }
+    else
+        mPositional = M6PositionalIterator::IsPositionalFile(path);
 }
 
 M6TextIx::~M6TextIx()
@@ -1109,13 +1208,47 @@ void M6TextIx::AddDocTerm(uint32 inDoc, uint8 inFrequency, M6OBitStream& inIDL)
     {
         mIDLOffset = mIDLFile->Seek(0, SEEK_END);
         mIDLBits = new M6OBitStream(*mIDLFile);
+        mBlockLastDoc = mPrevBlockLastDoc = 0;
+    }
+
+    if (not mPositional)
+        CopyBits(*mIDLBits, inIDL);
+    else
+    {
+        WriteGamma(mBlockDocs, inDoc - mBlockLastDoc);
+        WriteGamma(mBlockDocs, inIDL.BitSize() + 1);
+        CopyBits(mBlockLocations, inIDL);
+
+        mBlockLastDoc = inDoc;
+        if (++mBlockDocCount == kM6PostingBlockSize)
+            WriteBlock();
     }
+}
+
+void M6TextIx::WriteBlock()
+{
+    M6OBitStream block;
+    WriteGamma(block, mBlockLastDoc - mPrevBlockLastDoc);
+    WriteGamma(block, mBlockDocCount);
+    CopyBits(block, mBlockDocs);
+    CopyBits(block, mBlockLocations);
+    block.Sync();
+
+    // blocks are byte aligned, so they can be skipped without reading them
+    WriteBinary(*mIDLBits, 32, block.BitSize() / 8);
+    CopyBits(*mIDLBits, block);
 
-    CopyBits(*mIDLBits, inIDL);
+    mBlockDocs.Clear();
+    mBlockLocations.Clear();
+    mBlockDocCount = 0;
+    mPrevBlockLastDoc = mBlockLastDoc;
 }
 
 void M6TextIx::FlushTerm(uint32 inTerm, uint32 inDocCount)
 {
+    if (mBlockDocCount > 0)
+        WriteBlock();
+
     if (mDocCount > 0 and not mBits.Empty())
     {
         // flush the raw index bits
@@ -1272,16 +1405,19 @@ void M6WeightedWordIx::FlushTerm(FlushedTerm* inTermData)
 class M6BatchIndexProcessor
 {
   public:
-                M6BatchIndexProcessor(M6DatabankImpl& inDatabank, M6Lexicon& inLexicon);
+                M6BatchIndexProcessor(M6DatabankImpl& inDatabank, M6Lexicon& inLexicon,
+                    uint32 inThreadCount);
                 ~M6BatchIndexProcessor();
 
-    void        IndexTokens(const string& inIndexName, M6DataType inDataType,
-                    const M6InputDocument::M6TokenList& inTokens);
-    void        IndexValue(const string& inIndexName, M6DataType inDataType,
+    // These may be called from several threads at the same time, each
+    // thread passes its own number as inThread.
+    void        IndexTokens(uint32 inThread, const string& inIndexName, M6DataType inDataType,
+                    const M6InputDocument::M6TokenRange& inTokens);
+    void        IndexValue(uint32 inThread, const string& inIndexName, M6DataType inDataType,
                     const string& inValue, bool inUnique, uint32 inDocNr);
-    void        IndexValue(const string& inIndexName, double inValue, bool inUnique, uint32 inDocNr);
-    void        IndexLink(uint32 inDocNr, const string& inDB, const string& inID);
-    void        FlushDoc(uint32 inDocNr);
+    void        IndexLink(uint32 inThread, uint32 inDocNr, const string& inDB, const string& inID);
+    void        FlushDoc(uint32 inThread, uint32 inDocNr);
+
     void        Finish(uint32 inDocCount);
 
   private:
@@ -1295,6 +1431,7 @@ class M6BatchIndexProcessor
     M6FullTextIx        mFullTextIndex;
     M6DatabankImpl&        mDatabank;
     M6Lexicon&            mLexicon;
+    boost::mutex        mMutex;
 
     struct M6BasicIxDesc
     {
@@ -1318,8 +1455,9 @@ class M6BatchIndexProcessor
     M6ValueIxDescList    mValueIndices;
 };
 
-M6BatchIndexProcessor::M6BatchIndexProcessor(M6DatabankImpl& inDatabank, M6Lexicon& inLexicon)
-    : mFullTextIndex(inDatabank.GetDbDirectory(), "full-text.tmp")
+M6BatchIndexProcessor::M6BatchIndexProcessor(M6DatabankImpl& inDatabank, M6Lexicon& inLexicon,
+        uint32 inThreadCount)
+    : mFullTextIndex(inDatabank.GetDbDirectory(), "full-text", inThreadCount)
     , mDatabank(inDatabank)
     , mLexicon(inLexicon)
 {
@@ -1337,6 +1475,8 @@ M6BatchIndexProcessor::~M6BatchIndexProcessor()
 template<class T>
 M6BasicIx* M6BatchIndexProcessor::GetIndexBase(const string& inName, M6IndexType inType)
 {
+    boost::mutex::scoped_lock lock(mMutex);
+
     T* result = nullptr;
     for (M6BasicIxDesc& ix : mIndices)
     {
@@ -1390,30 +1530,32 @@ M6BasicValueIx* M6BatchIndexProcessor::GetValueIndex(const string& inName)
     return result;
 }
 
-void M6BatchIndexProcessor::IndexTokens(const string& inIndexName,
-    M6DataType inDataType, const M6InputDocument::M6TokenList& inTokens)
+void M6BatchIndexProcessor::IndexTokens(uint32 inThread, const string& inIndexName,
+    M6DataType inDataType, const M6InputDocument::M6TokenRange& inTokens)
 {
     if (not inTokens.empty())
     {
         if (inDataType == eM6StringData)
         {
             for (uint32 t : inTokens)
-                mFullTextIndex.AddWord(0, t);
+                mFullTextIndex.AddWord(inThread, 0, t);
         }
         else
         {
             M6BasicIx* index = GetIndexBase<M6TextIx>(inIndexName, eM6CharMultiIDLIndex);
             for (uint32 t : inTokens)
-                index->AddWord(t);
+                index->AddWord(inThread, t);
         }
     }
 }
 
-void M6BatchIndexProcessor::IndexValue(const string& inIndexName,
+void M6BatchIndexProcessor::IndexValue(uint32 inThread, const string& inIndexName,
     M6DataType inDataType, const string& inValue, bool inUnique, uint32 inDocNr)
 {
     if (inUnique)
     {
+        boost::mutex::scoped_lock lock(mMutex);
+
         M6BasicIndexPtr index;
 
         switch (inDataType)
@@ -1436,11 +1578,15 @@ void M6BatchIndexProcessor::IndexValue(const string& inIndexName,
     }
     else if (inDataType == eM6FloatData)
     {
+        boost::mutex::scoped_lock lock(mMutex);
+
         M6BasicValueIx* index = GetValueIndex<eM6FloatMultiIndex,M6FloatIx>(inIndexName);
         index->AddValue(inValue, inDocNr);
     }
     else if (inDataType == eM6NumberData)
     {
+        boost::mutex::scoped_lock lock(mMutex);
+
         M6BasicValueIx* index = GetValueIndex<eM6NumberMultiIndex,M6NumberIx>(inIndexName);
         index->AddValue(inValue, inDocNr);
     }
@@ -1449,49 +1595,27 @@ void M6BatchIndexProcessor::IndexValue(const string& inIndexName,
         // too bad, we still have to go through the old route
         M6BasicIx* index = GetIndexBase<M6StringIx>(inIndexName, eM6CharMultiIndex);
 
-        uint32 t = 0;
-
-        {
-            M6Lexicon::M6SharedLock lock(mLexicon);
-            t = mLexicon.Lookup(inValue);
-        }
-
-        if (t == 0)
-        {
-            M6Lexicon::M6UniqueLock lock(mLexicon);
-            t = mLexicon.Store(inValue);
-        }
+        uint32 t = mLexicon.Store(inValue);
 
-        index->AddWord(t);
+        index->AddWord(inThread, t);
     }
 }
 
-void M6BatchIndexProcessor::IndexLink(uint32 inDocNr, const string& inDB, const string& inID)
+void M6BatchIndexProcessor::IndexLink(uint32 inThread, uint32 inDocNr, const string& inDB, const string& inID)
 {
     string db = zeep::http::encode_url(inDB);
     ba::replace_all(db, "/", "%2F");
 
     M6BasicIx* index = GetIndexBase<M6StringIx>(db, eM6LinkIndex);
 
-    uint32 t = 0;
-
-    {
-        M6Lexicon::M6SharedLock lock(mLexicon);
-        t = mLexicon.Lookup(inID);
-    }
-
-    if (t == 0)
-    {
-        M6Lexicon::M6UniqueLock lock(mLexicon);
-        t = mLexicon.Store(inID);
-    }
+    uint32 t = mLexicon.Store(inID);
 
-    index->AddWord(t);
+    index->AddWord(inThread, t);
 }
 
-void M6BatchIndexProcessor::FlushDoc(uint32 inDocNr)
+void M6BatchIndexProcessor::FlushDoc(uint32 inThread, uint32 inDocNr)
 {
-    mFullTextIndex.FlushDoc(inDocNr);
+    mFullTextIndex.FlushDoc(inThread, inDocNr);
 }
 
 void M6BatchIndexProcessor::Finish(uint32 inDocCount)
@@ -1604,6 +1728,9 @@ M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const fs::path& inPath, M
     , mMode(inMode)
     , mStore(nullptr)
     , mDictionary(nullptr)
+    , mCompletion(nullptr)
+    , mSimilarity(nullptr)
+    , mLinkGraph(nullptr)
     , mBatch(nullptr)
 {
     if (not fs::is_directory(mDbDirectory))
@@ -1680,6 +1807,14 @@ M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const fs::path& inPath, M
     if (fs::exists(dict) and fs::file_size(dict) > 0)
         mDictionary = new M6Dictionary(dict);
 
+    fs::path completion(mDbDirectory / "full-text.completion");
+    if (fs::exists(completion) and fs::file_size(completion) > 0)
+        mCompletion = new M6CompletionIndex(completion);
+
+    fs::path similarity(mDbDirectory / "full-text.similar");
+    if (fs::exists(similarity) and fs::file_size(similarity) > 0)
+        mSimilarity = new M6SimilarityIndex(similarity);
+
     // read uuid
     if (fs::exists(mDbDirectory / "uuid"))
     {
@@ -1714,6 +1849,9 @@ M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const string& inDatabankI
     , mMode(eReadWrite)
     , mStore(nullptr)
     , mDictionary(nullptr)
+    , mCompletion(nullptr)
+    , mSimilarity(nullptr)
+    , mLinkGraph(nullptr)
     , mBatch(nullptr)
 {
     if (fs::exists(inPath))
@@ -1749,9 +1887,7 @@ M6DatabankImpl::~M6DatabankImpl()
         When an exception occurs, make the threads stop before
         deleting the data structures that they are using.
      */
-    mStoreQueue.Put(nullptr);
-    mStoreThread.join();
-    mIndexThread.join();
+    StopBatchThreads();
 
     boost::unique_lock<boost::mutex> lock(mMutex);
 
@@ -1763,6 +1899,8 @@ M6DatabankImpl::~M6DatabankImpl()
 
     delete mFastaFile;
     delete mDictionary;
+    delete mCompletion;
+    delete mSimilarity;
 }
 
 void M6DatabankImpl::GetInfo(M6DatabankInfo& outInfo)
@@ -1885,7 +2023,7 @@ M6BasicIndexPtr M6DatabankImpl::CreateIndex(const string& inName, M6IndexType in
     return result;
 }
 
-void M6DatabankImpl::StoreThread()
+void M6DatabankImpl::StoreThread(uint32 inWriter)
 {
     try
     {
@@ -1895,11 +2033,13 @@ void M6DatabankImpl::StoreThread()
             if (doc == nullptr)
                 break;
 
-            doc->Store();
+            doc->Store(inWriter);
 
             const string& fasta = doc->GetFasta();
             if (not fasta.empty())
             {
+                boost::mutex::scoped_lock lock(mFastaMutex);
+
                 if (mFastaFile == nullptr)
                 {
                     mFastaFile = new fs::ofstream(mDbDirectory / "fasta", ios_base::out|ios_base::trunc|ios_base::binary);
@@ -1911,8 +2051,6 @@ void M6DatabankImpl::StoreThread()
 
             mIndexQueue.Put(doc);
         }
-
-        mIndexQueue.Put(nullptr);
     }
     catch (exception& e)
     {
@@ -1921,7 +2059,7 @@ void M6DatabankImpl::StoreThread()
     }
 }
 
-void M6DatabankImpl::IndexThread()
+void M6DatabankImpl::IndexThread(uint32 inShard)
 {
     try
     {
@@ -1935,20 +2073,24 @@ void M6DatabankImpl::IndexThread()
             assert(docNr > 0);
 
             for (const M6InputDocument::M6IndexTokens& d : doc->GetIndexTokens())
-                mBatch->IndexTokens(d.mIndexName, d.mDataType, d.mTokens);
+            {
+                mBatch->IndexTokens(inShard, M6InputDocument::GetName(d.mIndex), d.mDataType,
+                    doc->GetTokens(d));
+            }
 
             for (const M6InputDocument::M6IndexValue& v : doc->GetIndexValues())
             {
-                mBatch->IndexValue(v.mIndexName, v.mDataType, v.mIndexValue, v.mUnique, docNr);
+                mBatch->IndexValue(inShard, M6InputDocument::GetName(v.mIndex), v.mDataType,
+                    doc->GetValue(v), v.mUnique, docNr);
             }
 
-            for (const auto& lDb : doc->GetLinks())
+            for (const M6InputDocument::M6Link& l : doc->GetLinkList())
             {
-                for (const string& lId : lDb.second)
-                    mBatch->IndexLink(docNr, lDb.first, lId);
+                mBatch->IndexLink(inShard, docNr, M6InputDocument::GetName(l.mDatabank),
+                    doc->GetLinkID(l));
             }
 
-            mBatch->FlushDoc(docNr);
+            mBatch->FlushDoc(inShard, docNr);
 
             delete doc;
         }
@@ -2350,6 +2492,52 @@ M6Iterator* M6DatabankImpl::FindString(const string& inIndex, const string& inSt
     return result.release();
 }
 
+// FindSimilar returns nullptr if the databank has no similarity index,
+// i.e. it was created before these were introduced.
+
+M6Iterator* M6DatabankImpl::FindSimilar(uint32 inDocNr, uint32 inReportLimit)
+{
+    if (mSimilarity == nullptr)
+        return nullptr;
+
+    vector<pair<uint32,float>> docs;
+    uint32 count;
+    mSimilarity->FindSimilar(inDocNr, inReportLimit, docs, count);
+
+    M6Iterator* result = new M6VectorIterator(docs);
+    result->SetCount(count);
+    return result;
+}
+
+M6Iterator* M6DatabankImpl::FindNear(const string& inIndex, const string& inTermA, const string& inTermB, uint32 inDistance)
+{
+    string termA(inTermA), termB(inTermB);
+    M6Tokenizer::CaseFold(termA);
+    M6Tokenizer::CaseFold(termB);
+
+    unique_ptr<M6UnionIterator> result(new M6UnionIterator);
+
+    for (const M6IndexDesc& desc : mIndices)
+    {
+        if (inIndex != "*" and not ba::iequals(inIndex, desc.mName))
+            continue;
+
+        // only full text indices store the word positions NEAR needs
+        if (desc.mType != eM6CharMultiIDLIndex)
+        {
+            if (inIndex != "*")
+                THROW(("NEAR is not supported for index %s, it is not a full text index", desc.mName.c_str()));
+            continue;
+        }
+
+        M6Iterator* iter = desc.mIndex->FindNear(termA, termB, inDistance);
+        if (iter != nullptr)
+            result->AddIterator(iter);
+    }
+
+    return result.release();
+}
+
 tuple<bool,uint32> M6DatabankImpl::Exists(const string& inIndex, const string& inValue)
 {
     unique_ptr<M6UnionIterator> iter(new M6UnionIterator);
@@ -2383,9 +2571,10 @@ tuple<bool,uint32> M6DatabankImpl::Exists(const string& inIndex, const string& i
     return result;
 }
 
-void M6DatabankImpl::InitLinkMap(const M6LinkMap& inLinkMap)
+void M6DatabankImpl::InitLinkMap(const M6LinkMap& inLinkMap, const M6LinkGraph* inLinkGraph)
 {
     mLinkMap = inLinkMap;
+    mLinkGraph = inLinkGraph;
 
     for (const auto& l : inLinkMap)
     {
@@ -2428,8 +2617,30 @@ M6Iterator* M6DatabankImpl::GetLinkedDocuments(const string& inDB, const string&
     string id(inID);
     M6Tokenizer::CaseFold(id);
 
+    uint32 graphNr = M6LinkGraph::kNoDatabank;
+    if (mLinkGraph != nullptr)
+        graphNr = mLinkGraph->GetDatabankNr(mDatabank);
+
     for (M6Databank* db : mLinkMap[inDB])
     {
+        // with a link graph containing both databanks this is a lookup
+        uint32 dbGraphNr = M6LinkGraph::kNoDatabank;
+        if (graphNr != M6LinkGraph::kNoDatabank)
+            dbGraphNr = mLinkGraph->GetDatabankNr(*db);
+
+        if (dbGraphNr != M6LinkGraph::kNoDatabank)
+        {
+            uint32 docNr = db->DocNrForID(id);
+            if (docNr == 0)
+                continue;
+
+            vector<uint32> docs;
+            mLinkGraph->GetLinkedDocuments(dbGraphNr, docNr, graphNr, docs);
+            if (not docs.empty())
+                result->AddIterator(new M6VectorIterator(docs));
+            continue;
+        }
+
         for (auto& li : mLinkIndices)
         {
             if (mLinkMap[li.mName].count(db) == 0)
@@ -2469,16 +2680,33 @@ M6Iterator* M6DatabankImpl::GetLinkedDocuments(const string& inDB, const string&
     return result.release();
 }
 
+void M6DatabankImpl::VisitLinks(M6Databank::LinkVisitor inVisitor)
+{
+    for (auto& li : mLinkIndices)
+    {
+        for (auto key = li.mIndex->begin(); key != li.mIndex->end(); ++key)
+        {
+            unique_ptr<M6Iterator> docs(key.GetDocuments());
+            if (docs)
+                inVisitor(li.mName, *key, *docs);
+        }
+    }
+}
+
 void M6DatabankImpl::SuggestCorrection(const string& inWord, vector<pair<string,uint16>>& outCorrections)
 {
     if (mDictionary != nullptr)
         mDictionary->SuggestCorrection(inWord, outCorrections);
 }
 
-void M6DatabankImpl::SuggestSearchTerms(const string& inWord, vector<string>& outSearchTerms)
+void M6DatabankImpl::SuggestSearchTerms(const string& inWord, vector<pair<string,uint32>>& outSearchTerms)
 {
-    if (mDictionary != nullptr)
-        mDictionary->SuggestSearchTerms(inWord, outSearchTerms);
+    string word = ba::to_lower_copy(inWord);
+
+    if (mCompletion != nullptr)
+        mCompletion->Complete(word, outSearchTerms);
+    else if (mDictionary != nullptr)
+        mDictionary->SuggestSearchTerms(word, outSearchTerms);
 }
 
 bool M6DatabankImpl::BrowseSectionsForIndex(const string& inIndex, const string& inFirst, const string& inLast,
@@ -2525,19 +2753,50 @@ void M6DatabankImpl::ListIndexEntries(const string& inIndex, const string& inFir
     }
 }
 
-void M6DatabankImpl::StartBatchImport(M6Lexicon& inLexicon)
+void M6DatabankImpl::StartBatchImport(M6Lexicon& inLexicon,
+    uint32 inStoreThreads, uint32 inIndexThreads)
+{
+    if (inStoreThreads < 1)
+        inStoreThreads = 1;
+
+    if (inIndexThreads < 1)
+        inIndexThreads = 1;
+
+    mBatch = new M6BatchIndexProcessor(*this, inLexicon, inIndexThreads);
+
+    // each store thread uses its own writer, each index thread its own
+    // shard of the full text index
+    mStore->SetWriterCount(inStoreThreads);
+
+    for (uint32 i = 0; i < inStoreThreads; ++i)
+        mStoreThreads.push_back(boost::thread(boost::bind(&M6DatabankImpl::StoreThread, this, i)));
+
+    for (uint32 i = 0; i < inIndexThreads; ++i)
+        mIndexThreads.push_back(boost::thread(boost::bind(&M6DatabankImpl::IndexThread, this, i)));
+}
+
+void M6DatabankImpl::StopBatchThreads()
 {
-    mBatch = new M6BatchIndexProcessor(*this, inLexicon);
+    for (size_t i = 0; i < mStoreThreads.size(); ++i)
+        mStoreQueue.Put(nullptr);
+
+    for (boost::thread& t : mStoreThreads)
+        t.join();
+
+    // all documents are in the index queue now
+    for (size_t i = 0; i < mIndexThreads.size(); ++i)
+        mIndexQueue.Put(nullptr);
+
+    for (boost::thread& t : mIndexThreads)
+        t.join();
 
-    mStoreThread = boost::thread(boost::bind(&M6DatabankImpl::StoreThread, this));
-    mIndexThread = boost::thread(boost::bind(&M6DatabankImpl::IndexThread, this));
+    mStoreThreads.clear();
+    mIndexThreads.clear();
 }
 
 void M6DatabankImpl::EndBatchImport()
 {
-    mStoreQueue.Put(nullptr);
-    mStoreThread.join();
-    mIndexThread.join();
+    StopBatchThreads();
 
     if (not (mException == exception_ptr()))
         rethrow_exception(mException);
@@ -2568,7 +2827,6 @@ void M6DatabankImpl::FinishBatchImport()
 
         g.join_all();
 
-        fs::remove(mDbDirectory / "full-text.tmp");
         progress.Consumed(1);
     }
 
@@ -2606,6 +2864,28 @@ void M6DatabankImpl::CreateDictionary()
     M6Progress progress(mID, mAllTextIndex->size(), "creating dictionary");
     M6File dictFile(mDbDirectory / "full-text.dict", eReadWrite);
     M6Dictionary::Create(*mAllTextIndex, docCount, dictFile, progress);
+
+    M6Progress completionProgress(mID, mAllTextIndex->size(), "creating completion index");
+    M6File completionFile(mDbDirectory / "full-text.completion", eReadWrite);
+    M6CompletionIndex::Create(*mAllTextIndex, docCount, completionFile, completionProgress);
+}
+
+void M6DatabankImpl::CreateSimilarityIndex()
+{
+    M6WeightedBasicIndex* ix = dynamic_cast<M6WeightedBasicIndex*>(mAllTextIndex.get());
+    if (ix == nullptr)
+        THROW(("Invalid index"));
+
+    if (not M6SimilarityIndex::CanCreate(static_cast<uint32>(mDocWeights.size())))
+    {
+        cerr << endl
+             << "Warning: " << mID << " has too many documents for a similarity index, skipped" << endl;
+        return;
+    }
+
+    M6Progress progress(mID, ix->size(), "creating similarity index");
+    M6File file(mDbDirectory / "full-text.similar", eReadWrite);
+    M6SimilarityIndex::Create(*ix, mStore->size(), mDocWeights, file, progress);
 }
 
 void M6DatabankImpl::Vacuum()
@@ -2694,9 +2974,10 @@ M6Databank* M6Databank::CreateNew(const string& inDatabankID, const fs::path& in
     return new M6Databank(inDatabankID, inPath, inVersion, inIndexNames);
 }
 
-void M6Databank::StartBatchImport(M6Lexicon& inLexicon)
+void M6Databank::StartBatchImport(M6Lexicon& inLexicon,
+    uint32 inStoreThreads, uint32 inIndexThreads)
 {
-    mImpl->StartBatchImport(inLexicon);
+    mImpl->StartBatchImport(inLexicon, inStoreThreads, inIndexThreads);
 }
 
 void M6Databank::EndBatchImport()
@@ -2792,14 +3073,24 @@ M6Iterator* M6Databank::FindString(const string& inIndex, const string& inString
     return mImpl->FindString(inIndex, inString);
 }
 
+M6Iterator* M6Databank::FindNear(const string& inIndex, const string& inTermA, const string& inTermB, uint32 inDistance)
+{
+    return mImpl->FindNear(inIndex, inTermA, inTermB, inDistance);
+}
+
+M6Iterator* M6Databank::FindSimilar(uint32 inDocNr, uint32 inReportLimit)
+{
+    return mImpl->FindSimilar(inDocNr, inReportLimit);
+}
+
 tuple<bool,uint32> M6Databank::Exists(const string& inIndex, const string& inValue)
 {
     return mImpl->Exists(inIndex, inValue);
 }
 
-void M6Databank::InitLinkMap(const M6LinkMap& inLinkMap)
+void M6Databank::InitLinkMap(const M6LinkMap& inLinkMap, const M6LinkGraph* inLinkGraph)
 {
-    mImpl->InitLinkMap(inLinkMap);
+    mImpl->InitLinkMap(inLinkMap, inLinkGraph);
 }
 
 bool M6Databank::IsLinked(const string& inDB, const string& inID)
@@ -2812,12 +3103,17 @@ M6Iterator* M6Databank::GetLinkedDocuments(const string& inDB, const string& inI
     return mImpl->GetLinkedDocuments(inDB, inID);
 }
 
+void M6Databank::VisitLinks(LinkVisitor inVisitor)
+{
+    mImpl->VisitLinks(inVisitor);
+}
+
 void M6Databank::SuggestCorrection(const string& inWord, vector<pair<string,uint16>>& outCorrections)
 {
     mImpl->SuggestCorrection(inWord, outCorrections);
 }
 
-void M6Databank::SuggestSearchTerms(const string& inWord, vector<string>& outSearchTerms)
+void M6Databank::SuggestSearchTerms(const string& inWord, vector<pair<string,uint32>>& outSearchTerms)
 {
     mImpl->SuggestSearchTerms(inWord, outSearchTerms);
 }
@@ -2827,6 +3123,11 @@ void M6Databank::RecalculateDocumentWeights()
     mImpl->RecalculateDocumentWeights();
 }
 
+void M6Databank::CreateSimilarityIndex()
+{
+    mImpl->CreateSimilarityIndex();
+}
+
 void M6Databank::Vacuum()
 {
     mImpl->Vacuum();
@@ -10,6 +10,8 @@
 #include <set>
 #include <tuple>
 
+#include <boost/function.hpp>
+
 #include "M6File.h"
 
 class M6Databank;
@@ -19,6 +21,7 @@ class M6DocStore;
 class M6Lexicon;
 class M6Iterator;
 class M6BasicIndex;
+class M6LinkGraph;
 
 typedef boost::shared_ptr<M6BasicIndex> M6BasicIndexPtr;
 
@@ -68,13 +71,20 @@ class M6Databank
     boost::filesystem::path
                     GetDbDirectory() const;
 
-    void            StartBatchImport(M6Lexicon& inLexicon);
+    // During a batch import documents are stored and indexed by
+    // separate threads, the number of each can be specified.
+    void            StartBatchImport(M6Lexicon& inLexicon,
+                        uint32 inStoreThreads = 1, uint32 inIndexThreads = 1);
     void            EndBatchImport();
     void            FinishBatchImport();
 
     void            RecalculateDocumentWeights();
     void            Vacuum();
 
+    // The similarity index used by FindSimilar is optional, it takes
+    // 128 bytes per document to build.
+    void            CreateSimilarityIndex();
+
     void            Validate();
     void            DumpIndex(const std::string& inIndex, std::ostream& inStream);
 
@@ -97,14 +107,28 @@ class M6Databank
                         const std::string& inUpperBound);
     M6Iterator*        FindPattern(const std::string& inIndex, const std::string& inPattern);
     M6Iterator*        FindString(const std::string& inIndex, const std::string& inString);
+    // documents where the two terms occur at most inDistance words apart
+    M6Iterator*        FindNear(const std::string& inIndex, const std::string& inTermA,
+                        const std::string& inTermB, uint32 inDistance);
+    // documents with the most similar term vectors, nullptr if the databank
+    // has no similarity index
+    M6Iterator*        FindSimilar(uint32 inDocNr, uint32 inReportLimit);
 
     // Very low level...
     M6BasicIndexPtr    GetIndex(const std::string& inIndex) const;
 
-    // retrieve links for a certain record
-    void            InitLinkMap(const M6LinkMap& inLinkMap);
+    // retrieve links for a certain record, if a link graph is specified
+    // it is used to resolve links instead of the documents
+    void            InitLinkMap(const M6LinkMap& inLinkMap,
+                        const M6LinkGraph* inLinkGraph = nullptr);
     bool            IsLinked(const std::string& inDb, const std::string& inId);
 
+    // VisitLinks calls inVisitor for each ID stored in the link indices of
+    // this databank with the linked databank name and the linking documents
+    typedef boost::function<void(const std::string& inDb, const std::string& inId,
+                        M6Iterator& inDocs)> LinkVisitor;
+    void            VisitLinks(LinkVisitor inVisitor);
+
     // GetLinkedDocuments returns documents in this databank that are linked to
     // by inDb/inId or that link themselves to inDb/inId
     M6Iterator*        GetLinkedDocuments(const std::string& inDb, const std::string& inId);
@@ -121,7 +145,7 @@ class M6Databank
     void            SuggestCorrection(const std::string& inWord,
                         std::vector<std::pair<std::string,uint16>>& outCorrections);
     void            SuggestSearchTerms(const std::string& inWord,
-                        std::vector<std::string>& outSearchTerms);
+                        std::vector<std::pair<std::string,uint32>>& outSearchTerms);
 
     // for browsing
     bool            BrowseSectionsForIndex(const std::string& inIndex,
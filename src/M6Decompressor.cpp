@@ -0,0 +1,1030 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#include "M6Lib.h"
+
+#include <deque>
+#include <vector>
+#include <cstring>
+
+#include <boost/thread.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <zlib.h>
+#include <bzlib.h>
+
+#include "M6Decompressor.h"
+#include "M6Progress.h"
+#include "M6Error.h"
+#include "M6File.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+const uint32
+    kReadChunkSize = 4 * 1024 * 1024,
+    kGzipBlockSize = 1024 * 1024,
+    kOutputChunkSize = 1024 * 1024,
+    kMaxMergeCount = 8;
+
+const uint64
+    kBzip2BlockMagic = 0x314159265359ULL,
+    kBzip2EOSMagic = 0x177245385090ULL,
+    kBzip2MagicMask = 0xffffffffffffULL;
+
+// Append inCount bits from inSrc, starting at bit inOffset, to ioDst
+// which currently holds ioBits bits. Bits are stored MSB first.
+
+void AppendBits(string& ioDst, uint64& ioBits, const uint8* inSrc, uint64 inOffset, uint64 inCount)
+{
+    ioDst.resize((ioBits + inCount + 7) / 8, 0);
+    uint8* dst = reinterpret_cast<uint8*>(&ioDst[0]);
+
+    if ((ioBits & 7) == 0 and (inOffset & 7) == 0)
+    {
+        uint64 n = inCount / 8;
+        memcpy(dst + ioBits / 8, inSrc + inOffset / 8, n);
+        ioBits += n * 8;
+        inOffset += n * 8;
+        inCount -= n * 8;
+    }
+
+    while (inCount > 0)
+    {
+        uint32 n = inCount < 8 ? static_cast<uint32>(inCount) : 8;
+
+        uint32 srcShift = inOffset & 7;
+        uint32 v = inSrc[inOffset >> 3] << 8;
+        if (srcShift + n > 8)
+            v |= inSrc[(inOffset >> 3) + 1];
+        v = ((v << srcShift) >> 8) & (0xff00 >> n);
+
+        uint32 dstShift = ioBits & 7;
+        dst[ioBits >> 3] |= static_cast<uint8>(v >> dstShift);
+        if (dstShift + n > 8)
+            dst[(ioBits >> 3) + 1] |= static_cast<uint8>(v << (8 - dstShift));
+
+        ioBits += n;
+        inOffset += n;
+        inCount -= n;
+    }
+}
+
+}
+
+// --------------------------------------------------------------------
+
+struct M6DecompressBlock
+{
+    enum State { eQueued, eBusy, eDone, eFailed };
+
+                    M6DecompressBlock() : mState(eQueued), mBits(0), mDataBits(0), mCRC(0) {}
+
+    State            mState;
+    string            mInput, mOutput;
+    uint64            mBits;        // bzip2 only, number of valid bits in mInput
+    uint64            mDataBits;    // bzip2 only, number of bits up to the end-of-stream marker
+    uint32            mCRC;        // bzip2 only, the stored block CRC
+    string            mError;
+};
+
+// --------------------------------------------------------------------
+
+struct M6DecompressorImpl
+{
+                        M6DecompressorImpl(const fs::path& inFile,
+                            M6Progress& inProgress, uint32 inNrOfThreads);
+    virtual                ~M6DecompressorImpl();
+
+    void                Start();
+    void                Stop();
+
+    streamsize            Read(char* s, streamsize n);
+
+  protected:
+    // ReadBlocks is called by the reader thread, it should split the input
+    // into blocks and pass them on to Emit
+    virtual void        ReadBlocks() = 0;
+
+    // Decode is called by the worker threads, returns false on a data error
+    virtual bool        Decode(M6DecompressBlock& ioBlock) = 0;
+
+    // When a block fails to decode, the consumer may ask to merge it with
+    // the block that follows. Returns false if the format does not allow this.
+    virtual bool        Merge(M6DecompressBlock& ioBlock, const M6DecompressBlock& inNext)
+                            { return false; }
+
+    // When a block cannot be repaired, a format may continue decoding the
+    // file with a single sequential decoder. ReadSequential is called
+    // after the file was rewound and should skip inSkip decoded bytes,
+    // the number of bytes returned before the switch.
+    virtual bool        SupportsSequential() const        { return false; }
+    virtual streamsize    ReadSequential(char* s, streamsize n, uint64 inSkip)
+                            { return -1; }
+
+    streamsize            ReadRaw(void* inBuffer, streamsize inSize);
+    void                Emit(M6DecompressBlock* inBlock);
+
+    uint32                mNrOfThreads;
+
+  private:
+                        M6DecompressorImpl(const M6DecompressorImpl&);
+    M6DecompressorImpl&    operator=(const M6DecompressorImpl&);
+
+    void                Reader();
+    void                Worker();
+    void                Repair(boost::unique_lock<boost::mutex>& inLock);
+    void                SwitchToSequential(boost::unique_lock<boost::mutex>& inLock);
+
+    M6File                mFile;
+    int64                mSize, mConsumed;
+    M6Progress&            mProgress;
+    uint32                mMaxBlocks;
+    deque<M6DecompressBlock*>
+                        mBlocks;
+    size_t                mOffset;
+    uint64                mDelivered;
+    bool                mEOF, mStop, mSequential;
+    exception_ptr        mException;
+    boost::mutex        mMutex;
+    boost::condition_variable
+                        mCondition;
+    boost::thread_group    mThreads;
+};
+
+M6DecompressorImpl::M6DecompressorImpl(const fs::path& inFile,
+        M6Progress& inProgress, uint32 inNrOfThreads)
+    : mNrOfThreads(inNrOfThreads), mFile(inFile, eReadOnly), mSize(fs::file_size(inFile)), mConsumed(0)
+    , mProgress(inProgress), mMaxBlocks(2 * inNrOfThreads + 2), mOffset(0), mDelivered(0)
+    , mEOF(false), mStop(false), mSequential(false)
+{
+}
+
+M6DecompressorImpl::~M6DecompressorImpl()
+{
+    for (M6DecompressBlock* block : mBlocks)
+        delete block;
+}
+
+void M6DecompressorImpl::Start()
+{
+    mThreads.create_thread([this]() { this->Reader(); });
+    for (uint32 i = 0; i < mNrOfThreads; ++i)
+        mThreads.create_thread([this]() { this->Worker(); });
+}
+
+void M6DecompressorImpl::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mStop = true;
+        mCondition.notify_all();
+    }
+
+    mThreads.join_all();
+}
+
+streamsize M6DecompressorImpl::ReadRaw(void* inBuffer, streamsize inSize)
+{
+    if (inSize > mSize)
+        inSize = mSize;
+
+    if (inSize > 0)
+    {
+        mFile.Read(inBuffer, inSize);
+        mSize -= inSize;
+
+        // after switching to sequential decoding the file is read again
+        int64 offset = mFile.Size() - mSize;
+        if (offset > mConsumed)
+        {
+            mProgress.Consumed(offset - mConsumed);
+            mConsumed = offset;
+        }
+    }
+
+    return inSize;
+}
+
+void M6DecompressorImpl::Emit(M6DecompressBlock* inBlock)
+{
+    boost::unique_lock<boost::mutex> lock(mMutex);
+
+    while (not mStop and mBlocks.size() >= mMaxBlocks)
+        mCondition.wait(lock);
+
+    if (mStop)
+    {
+        delete inBlock;
+        throw boost::thread_interrupted();
+    }
+
+    mBlocks.push_back(inBlock);
+    mCondition.notify_all();
+}
+
+void M6DecompressorImpl::Reader()
+{
+    try
+    {
+        ReadBlocks();
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+    catch (...)
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mException = current_exception();
+    }
+
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mEOF = true;
+    mCondition.notify_all();
+}
+
+void M6DecompressorImpl::Worker()
+{
+    for (;;)
+    {
+        M6DecompressBlock* block = nullptr;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+
+            for (;;)
+            {
+                if (mStop)
+                    return;
+
+                for (M6DecompressBlock* b : mBlocks)
+                {
+                    if (b->mState == M6DecompressBlock::eQueued)
+                    {
+                        block = b;
+                        break;
+                    }
+                }
+
+                if (block != nullptr)
+                    break;
+
+                if (mEOF)
+                    return;
+
+                mCondition.wait(lock);
+            }
+
+            block->mState = M6DecompressBlock::eBusy;
+        }
+
+        bool ok = false;
+        try
+        {
+            ok = Decode(*block);
+        }
+        catch (exception& e)
+        {
+            block->mError = e.what();
+        }
+
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        block->mState = ok ? M6DecompressBlock::eDone : M6DecompressBlock::eFailed;
+        mCondition.notify_all();
+    }
+}
+
+// A block that failed to decode may have been split at a false block
+// boundary, try again after merging it with the next block.
+
+void M6DecompressorImpl::Repair(boost::unique_lock<boost::mutex>& inLock)
+{
+    M6DecompressBlock* block = mBlocks.front();
+
+    for (uint32 n = 0; block->mState == M6DecompressBlock::eFailed; ++n)
+    {
+        for (;;)
+        {
+            if (mBlocks.size() >= 2 and
+                (mBlocks[1]->mState == M6DecompressBlock::eDone or
+                 mBlocks[1]->mState == M6DecompressBlock::eFailed))
+                break;
+
+            if (mBlocks.size() < 2 and mEOF)
+                break;
+
+            mCondition.wait(inLock);
+        }
+
+        if (mBlocks.size() < 2 or n == kMaxMergeCount or not Merge(*block, *mBlocks[1]))
+        {
+            if (SupportsSequential())
+            {
+                SwitchToSequential(inLock);
+                break;
+            }
+
+            if (block->mError.empty())
+                THROW(("Error decompressing data"));
+            THROW(("Error decompressing data: %s", block->mError.c_str()));
+        }
+
+        delete mBlocks[1];
+        mBlocks.erase(mBlocks.begin() + 1);
+        mCondition.notify_all();
+
+        inLock.unlock();
+
+        bool ok = false;
+        try
+        {
+            block->mError.clear();
+            ok = Decode(*block);
+        }
+        catch (exception& e)
+        {
+            block->mError = e.what();
+        }
+
+        inLock.lock();
+
+        if (ok)
+            block->mState = M6DecompressBlock::eDone;
+    }
+}
+
+// A block boundary may also be found at a false end-of-stream magic, in
+// that case merging does not help. The reader and the workers are stopped
+// and the file is decoded again from the start, sequentially.
+
+void M6DecompressorImpl::SwitchToSequential(boost::unique_lock<boost::mutex>& inLock)
+{
+    mStop = true;
+    mCondition.notify_all();
+
+    inLock.unlock();
+    mThreads.join_all();
+    inLock.lock();
+
+    for (M6DecompressBlock* block : mBlocks)
+        delete block;
+    mBlocks.clear();
+    mOffset = 0;
+
+    mException = exception_ptr();
+
+    mFile.Seek(0, SEEK_SET);
+    mSize = mFile.Size();
+
+    mSequential = true;
+}
+
+streamsize M6DecompressorImpl::Read(char* s, streamsize n)
+{
+    streamsize result = 0;
+
+    if (mSequential)
+        return ReadSequential(s, n, mDelivered);
+
+    boost::unique_lock<boost::mutex> lock(mMutex);
+
+    while (result < n)
+    {
+        if (mBlocks.empty())
+        {
+            if (not (mException == exception_ptr()))
+                rethrow_exception(mException);
+
+            if (mEOF or result > 0)
+                break;
+
+            mCondition.wait(lock);
+            continue;
+        }
+
+        M6DecompressBlock* block = mBlocks.front();
+
+        if (block->mState == M6DecompressBlock::eFailed)
+        {
+            Repair(lock);
+
+            if (mSequential)
+            {
+                lock.unlock();
+
+                streamsize r = ReadSequential(s + result, n - result, mDelivered);
+                if (r > 0)
+                    result += r;
+                break;
+            }
+        }
+
+        if (block->mState != M6DecompressBlock::eDone)
+        {
+            if (result > 0)
+                break;
+
+            mCondition.wait(lock);
+            continue;
+        }
+
+        size_t k = block->mOutput.length() - mOffset;
+        if (k > static_cast<size_t>(n - result))
+            k = static_cast<size_t>(n - result);
+
+        memcpy(s + result, block->mOutput.data() + mOffset, k);
+        result += k;
+        mOffset += k;
+        mDelivered += k;
+
+        if (mOffset == block->mOutput.length())
+        {
+            mBlocks.pop_front();
+            delete block;
+            mOffset = 0;
+            mCondition.notify_all();
+        }
+    }
+
+    if (result == 0 and n > 0)
+        result = -1;
+
+    return result;
+}
+
+// --------------------------------------------------------------------
+// bzip2 compresses data in independent blocks, each starting with a
+// 48 bit magic number. These blocks are not byte aligned, so we scan
+// for the magic at every bit offset. Each block is then wrapped into
+// a stream of its own and decoded with libbz2.
+//
+// The magic number may occur by chance inside compressed data, in
+// that case the block fails its CRC check and is merged with the next.
+// A false end-of-stream magic cannot be fixed that way, when merging
+// fails the file is decoded sequentially instead.
+
+struct M6Bzip2DecompressorImpl : public M6DecompressorImpl
+{
+                    M6Bzip2DecompressorImpl(const fs::path& inFile,
+                        M6Progress& inProgress, uint32 inNrOfThreads)
+                        : M6DecompressorImpl(inFile, inProgress, inNrOfThreads)
+                        , mZStream(), mZInit(false), mZEOF(false), mSkipped(0) {}
+                    ~M6Bzip2DecompressorImpl();
+
+    virtual void    ReadBlocks();
+    virtual bool    Decode(M6DecompressBlock& ioBlock);
+    virtual bool    Merge(M6DecompressBlock& ioBlock, const M6DecompressBlock& inNext);
+
+    virtual bool    SupportsSequential() const        { return true; }
+    virtual streamsize
+                    ReadSequential(char* s, streamsize n, uint64 inSkip);
+
+    void            EmitBlock(const vector<uint8>& inBuffer, uint64 inStart,
+                        uint64 inEnd, int64 inEOS);
+
+    // the sequential decoder
+    bz_stream        mZStream;
+    bool            mZInit, mZEOF;
+    vector<char>    mZBuffer;
+    uint64            mSkipped;
+};
+
+M6Bzip2DecompressorImpl::~M6Bzip2DecompressorImpl()
+{
+    if (mZInit)
+        BZ2_bzDecompressEnd(&mZStream);
+}
+
+void M6Bzip2DecompressorImpl::ReadBlocks()
+{
+    vector<uint8> buffer;
+    int64 blockStart = -1;    // bit offset of the current block in buffer
+    int64 eos = -1;            // bit offset of the last end-of-stream marker
+    size_t scan = 0;        // next byte to scan for a magic
+    bool first = true, eof = false;
+
+    while (not eof)
+    {
+        size_t size = buffer.size();
+        buffer.resize(size + kReadChunkSize);
+        streamsize r = ReadRaw(&buffer[size], kReadChunkSize);
+        eof = r == 0;
+        buffer.resize(size + r);
+
+        if (first)
+        {
+            if (buffer.size() < 4 or buffer[0] != 'B' or buffer[1] != 'Z' or buffer[2] != 'h')
+                THROW(("Not a bzip2 file"));
+            first = false;
+        }
+
+        // pad the buffer at the end so we can always load 8 bytes
+        size_t limit = buffer.size();
+        if (eof)
+            buffer.insert(buffer.end(), 8, 0);
+
+        size_t i = scan;
+        uint64 w = 0;
+        if (i + 8 <= buffer.size())
+        {
+            for (uint32 j = 0; j < 8; ++j)
+                w = w << 8 | buffer[i + j];
+        }
+
+        for (; i < limit and i + 8 <= buffer.size(); ++i)
+        {
+            if (i > scan)
+                w = w << 8 | buffer[i + 7];
+
+            for (uint32 s = 0; s < 8; ++s)
+            {
+                uint64 m = (w >> (16 - s)) & kBzip2MagicMask;
+                if (m != kBzip2BlockMagic and m != kBzip2EOSMagic)
+                    continue;
+
+                int64 bit = i * 8 + s;
+                if (bit + 48 > static_cast<int64>(limit * 8))
+                    continue;
+
+                if (m == kBzip2EOSMagic)
+                    eos = bit;
+                else
+                {
+                    if (blockStart >= 0)
+                        EmitBlock(buffer, blockStart, bit, eos);
+                    blockStart = bit;
+                    eos = -1;
+                }
+            }
+        }
+
+        scan = i;
+
+        if (eof)
+        {
+            buffer.resize(limit);
+
+            if (blockStart >= 0)
+            {
+                if (eos < 0)
+                    THROW(("Premature end of bzip2 data"));
+                EmitBlock(buffer, blockStart, limit * 8, eos);
+            }
+            break;
+        }
+
+        // discard the data we no longer need
+        size_t keep = blockStart >= 0 ? static_cast<size_t>(blockStart / 8) : scan;
+        if (keep > 0)
+        {
+            buffer.erase(buffer.begin(), buffer.begin() + keep);
+            scan -= keep;
+            if (blockStart >= 0)
+                blockStart -= keep * 8;
+            if (eos >= 0)
+                eos -= keep * 8;
+        }
+    }
+}
+
+void M6Bzip2DecompressorImpl::EmitBlock(const vector<uint8>& inBuffer,
+    uint64 inStart, uint64 inEnd, int64 inEOS)
+{
+    unique_ptr<M6DecompressBlock> block(new M6DecompressBlock);
+
+    AppendBits(block->mInput, block->mBits, &inBuffer[0], inStart, inEnd - inStart);
+    block->mDataBits = inEOS >= 0 ? inEOS - inStart : block->mBits;
+
+    // the block CRC follows the magic
+    if (block->mInput.length() >= 10)
+    {
+        const uint8* p = reinterpret_cast<const uint8*>(block->mInput.data()) + 6;
+        block->mCRC = p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+
+    Emit(block.release());
+}
+
+bool M6Bzip2DecompressorImpl::Merge(M6DecompressBlock& ioBlock, const M6DecompressBlock& inNext)
+{
+    ioBlock.mDataBits = ioBlock.mBits + inNext.mDataBits;
+    AppendBits(ioBlock.mInput, ioBlock.mBits,
+        reinterpret_cast<const uint8*>(inNext.mInput.data()), 0, inNext.mBits);
+    return true;
+}
+
+bool M6Bzip2DecompressorImpl::Decode(M6DecompressBlock& ioBlock)
+{
+    // construct a stream containing this block only, the combined
+    // CRC of a stream with one block is the block CRC
+    string data("BZh9");
+    uint64 bits = 32;
+
+    AppendBits(data, bits, reinterpret_cast<const uint8*>(ioBlock.mInput.data()), 0, ioBlock.mDataBits);
+
+    uint8 trailer[10] = {
+        0x17, 0x72, 0x45, 0x38, 0x50, 0x90,
+        static_cast<uint8>(ioBlock.mCRC >> 24), static_cast<uint8>(ioBlock.mCRC >> 16),
+        static_cast<uint8>(ioBlock.mCRC >> 8), static_cast<uint8>(ioBlock.mCRC)
+    };
+    AppendBits(data, bits, trailer, 0, 80);
+
+    bz_stream z = {};
+    if (BZ2_bzDecompressInit(&z, 0, 0) != BZ_OK)
+        THROW(("Error initializing bzip2 decompressor"));
+
+    z.next_in = &data[0];
+    z.avail_in = static_cast<unsigned int>(data.length());
+
+    string& out = ioBlock.mOutput;
+    out.clear();
+
+    int err;
+    for (;;)
+    {
+        size_t size = out.length();
+        out.resize(size + kOutputChunkSize);
+
+        z.next_out = &out[size];
+        z.avail_out = kOutputChunkSize;
+
+        err = BZ2_bzDecompress(&z);
+
+        out.resize(out.length() - z.avail_out);
+
+        if (err != BZ_OK or (z.avail_in == 0 and z.avail_out > 0))
+            break;
+    }
+
+    BZ2_bzDecompressEnd(&z);
+
+    if (err != BZ_STREAM_END)
+    {
+        ioBlock.mError = "bzip2 data error";
+        out.clear();
+    }
+
+    return err == BZ_STREAM_END;
+}
+
+// Decode the file as a series of bzip2 streams, like bzip2 itself does,
+// dropping the first inSkip bytes of output.
+
+streamsize M6Bzip2DecompressorImpl::ReadSequential(char* s, streamsize n, uint64 inSkip)
+{
+    streamsize result = 0;
+    char skip[4096];
+
+    while (result < n)
+    {
+        if (mZStream.avail_in == 0 and not mZEOF)
+        {
+            mZBuffer.resize(kReadChunkSize);
+            streamsize r = ReadRaw(&mZBuffer[0], kReadChunkSize);
+            mZEOF = r == 0;
+            mZStream.next_in = &mZBuffer[0];
+            mZStream.avail_in = static_cast<unsigned int>(r);
+        }
+
+        if (not mZInit)
+        {
+            if (mZStream.avail_in == 0)
+                break;
+
+            char* next = mZStream.next_in;
+            unsigned int avail = mZStream.avail_in;
+
+            if (BZ2_bzDecompressInit(&mZStream, 0, 0) != BZ_OK)
+                THROW(("Error initializing bzip2 decompressor"));
+            mZInit = true;
+
+            mZStream.next_in = next;
+            mZStream.avail_in = avail;
+        }
+
+        bool skipping = mSkipped < inSkip;
+        if (skipping)
+        {
+            mZStream.next_out = skip;
+            mZStream.avail_out = static_cast<unsigned int>(min<uint64>(sizeof(skip), inSkip - mSkipped));
+        }
+        else
+        {
+            mZStream.next_out = s + result;
+            mZStream.avail_out = static_cast<unsigned int>(min<streamsize>(n - result, kOutputChunkSize));
+        }
+
+        unsigned int avail = mZStream.avail_out;
+        int err = BZ2_bzDecompress(&mZStream);
+        unsigned int k = avail - mZStream.avail_out;
+
+        if (skipping)
+            mSkipped += k;
+        else
+            result += k;
+
+        if (err == BZ_STREAM_END)
+        {
+            // another stream may follow
+            BZ2_bzDecompressEnd(&mZStream);
+            mZInit = false;
+        }
+        else if (err != BZ_OK)
+            THROW(("Error decompressing data: bzip2 data error"));
+        else if (mZEOF and mZStream.avail_in == 0 and k == 0)
+            THROW(("Premature end of bzip2 data"));
+    }
+
+    if (result == 0 and n > 0)
+        result = -1;
+
+    return result;
+}
+
+// --------------------------------------------------------------------
+// BGZF files are gzip files consisting of many small members, each
+// carrying its compressed size in a 'BC' extra field. We collect
+// members into blocks of about kGzipBlockSize and inflate those in
+// parallel.
+
+struct M6BGZFDecompressorImpl : public M6DecompressorImpl
+{
+                    M6BGZFDecompressorImpl(const fs::path& inFile,
+                        M6Progress& inProgress, uint32 inNrOfThreads)
+                        : M6DecompressorImpl(inFile, inProgress, inNrOfThreads) {}
+
+    static bool        IsBGZF(const fs::path& inFile);
+
+    virtual void    ReadBlocks();
+    virtual bool    Decode(M6DecompressBlock& ioBlock);
+};
+
+bool M6BGZFDecompressorImpl::IsBGZF(const fs::path& inFile)
+{
+    if (fs::file_size(inFile) < 18)
+        return false;
+
+    uint8 h[18];
+    M6File file(inFile, eReadOnly);
+    file.Read(h, sizeof(h));
+
+    return h[0] == 0x1f and h[1] == 0x8b and h[2] == 8 and (h[3] & 4) != 0 and
+        h[10] == 6 and h[11] == 0 and h[12] == 'B' and h[13] == 'C' and h[14] == 2 and h[15] == 0;
+}
+
+void M6BGZFDecompressorImpl::ReadBlocks()
+{
+    unique_ptr<M6DecompressBlock> block(new M6DecompressBlock);
+
+    for (;;)
+    {
+        uint8 h[12];
+        streamsize r = ReadRaw(h, sizeof(h));
+        if (r == 0)
+            break;
+
+        if (r != sizeof(h) or h[0] != 0x1f or h[1] != 0x8b or h[2] != 8 or (h[3] & 4) == 0)
+            THROW(("Invalid BGZF member header"));
+
+        uint32 xlen = h[10] | h[11] << 8;
+        vector<uint8> extra(xlen);
+        if (ReadRaw(&extra[0], xlen) != xlen)
+            THROW(("Premature end of BGZF data"));
+
+        uint32 bsize = 0;
+        for (uint32 i = 0; i + 4 <= xlen; )
+        {
+            uint32 slen = extra[i + 2] | extra[i + 3] << 8;
+            if (extra[i] == 'B' and extra[i + 1] == 'C' and slen == 2 and i + 6 <= xlen)
+            {
+                bsize = (extra[i + 4] | extra[i + 5] << 8) + 1;
+                break;
+            }
+            i += 4 + slen;
+        }
+
+        if (bsize < sizeof(h) + xlen)
+            THROW(("Invalid BGZF member header, missing block size"));
+
+        string& data = block->mInput;
+        data.append(reinterpret_cast<char*>(h), sizeof(h));
+        data.append(reinterpret_cast<char*>(&extra[0]), xlen);
+
+        size_t size = data.length();
+        size_t rest = bsize - sizeof(h) - xlen;
+        data.resize(size + rest);
+        if (ReadRaw(&data[size], rest) != static_cast<streamsize>(rest))
+            THROW(("Premature end of BGZF data"));
+
+        if (data.length() >= kGzipBlockSize)
+        {
+            Emit(block.release());
+            block.reset(new M6DecompressBlock);
+        }
+    }
+
+    if (not block->mInput.empty())
+        Emit(block.release());
+}
+
+bool M6BGZFDecompressorImpl::Decode(M6DecompressBlock& ioBlock)
+{
+    z_stream z = {};
+    if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK)
+        THROW(("Error initializing zlib"));
+
+    z.next_in = reinterpret_cast<Bytef*>(&ioBlock.mInput[0]);
+    z.avail_in = static_cast<uInt>(ioBlock.mInput.length());
+
+    string& out = ioBlock.mOutput;
+    out.clear();
+
+    bool result = true;
+    while (result and z.avail_in > 0)
+    {
+        size_t size = out.length();
+        out.resize(size + kOutputChunkSize);
+
+        z.next_out = reinterpret_cast<Bytef*>(&out[size]);
+        z.avail_out = kOutputChunkSize;
+
+        int err = inflate(&z, Z_NO_FLUSH);
+
+        out.resize(out.length() - z.avail_out);
+
+        if (err == Z_STREAM_END)
+            inflateReset(&z);
+        else if (err != Z_OK or z.avail_out > 0)    // error or truncated member
+        {
+            ioBlock.mError = z.msg ? z.msg : "gzip data error";
+            result = false;
+        }
+    }
+
+    inflateEnd(&z);
+
+    return result;
+}
+
+// --------------------------------------------------------------------
+// Regular gzip files are inflated by a single worker, reading the file
+// and inflating the data are pipelined with the consumer of the data.
+
+struct M6GzipDecompressorImpl : public M6DecompressorImpl
+{
+                    M6GzipDecompressorImpl(const fs::path& inFile, M6Progress& inProgress);
+                    ~M6GzipDecompressorImpl();
+
+    virtual void    ReadBlocks();
+    virtual bool    Decode(M6DecompressBlock& ioBlock);
+
+    z_stream        mZStream;
+    bool            mStreamEnd, mNewMember, mPending, mTrailer;
+};
+
+M6GzipDecompressorImpl::M6GzipDecompressorImpl(const fs::path& inFile, M6Progress& inProgress)
+    : M6DecompressorImpl(inFile, inProgress, 1)
+    , mZStream(), mStreamEnd(false), mNewMember(false), mPending(false), mTrailer(false)
+{
+    if (inflateInit2(&mZStream, 16 + MAX_WBITS) != Z_OK)
+        THROW(("Error initializing zlib"));
+}
+
+M6GzipDecompressorImpl::~M6GzipDecompressorImpl()
+{
+    inflateEnd(&mZStream);
+}
+
+void M6GzipDecompressorImpl::ReadBlocks()
+{
+    for (;;)
+    {
+        unique_ptr<M6DecompressBlock> block(new M6DecompressBlock);
+        block->mInput.resize(kGzipBlockSize);
+        streamsize r = ReadRaw(&block->mInput[0], kGzipBlockSize);
+        block->mInput.resize(r);
+
+        // an empty block signals the end of the data to Decode
+        Emit(block.release());
+
+        if (r == 0)
+            break;
+    }
+}
+
+bool M6GzipDecompressorImpl::Decode(M6DecompressBlock& ioBlock)
+{
+    if (mTrailer)    // ignore trailing garbage, e.g. padding after a tar.gz
+        return true;
+
+    z_stream& z = mZStream;
+
+    z.next_in = reinterpret_cast<Bytef*>(&ioBlock.mInput[0]);
+    z.avail_in = static_cast<uInt>(ioBlock.mInput.length());
+
+    string& out = ioBlock.mOutput;
+    bool result = true;
+
+    for (;;)
+    {
+        if (mStreamEnd)
+        {
+            if (z.avail_in == 0)
+                break;
+
+            inflateReset(&z);
+            mStreamEnd = false;
+            mNewMember = true;
+        }
+        else if (z.avail_in == 0 and not mPending)
+            break;
+
+        size_t size = out.length();
+        out.resize(size + kOutputChunkSize);
+
+        z.next_out = reinterpret_cast<Bytef*>(&out[size]);
+        z.avail_out = kOutputChunkSize;
+
+        int err = inflate(&z, Z_NO_FLUSH);
+
+        out.resize(out.length() - z.avail_out);
+
+        // inflate may have more output pending if it filled the buffer
+        mPending = z.avail_out == 0;
+
+        if (z.total_out > 0)
+            mNewMember = false;
+
+        if (err == Z_STREAM_END)
+        {
+            mStreamEnd = true;
+            mPending = false;
+        }
+        else if (err == Z_BUF_ERROR)
+        {
+            mPending = false;
+            break;
+        }
+        else if (err == Z_DATA_ERROR and mNewMember and z.total_in < 10)
+        {
+            // not the start of a new gzip member, ignore the rest
+            mTrailer = true;
+            break;
+        }
+        else if (err != Z_OK)
+        {
+            ioBlock.mError = z.msg ? z.msg : "gzip data error";
+            result = false;
+            break;
+        }
+    }
+
+    // an empty block signals the end of the input
+    if (result and ioBlock.mInput.empty() and not (mStreamEnd or mTrailer))
+    {
+        ioBlock.mError = "Premature end of gzip data";
+        result = false;
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------
+
+M6Decompressor::M6Decompressor(const fs::path& inFile, M6Progress& inProgress, uint32 inNrOfThreads)
+{
+    if (inNrOfThreads < 1)
+        inNrOfThreads = 1;
+
+    M6DecompressorImpl* impl;
+
+    string ext = inFile.extension().string();
+    if (ext == ".bz2" or ext == ".tbz")
+        impl = new M6Bzip2DecompressorImpl(inFile, inProgress, inNrOfThreads);
+    else if (M6BGZFDecompressorImpl::IsBGZF(inFile))
+        impl = new M6BGZFDecompressorImpl(inFile, inProgress, inNrOfThreads);
+    else
+        impl = new M6GzipDecompressorImpl(inFile, inProgress);
+
+    mImpl.reset(impl, [](M6DecompressorImpl* p) { p->Stop(); delete p; });
+
+    impl->Start();
+}
+
+streamsize M6Decompressor::read(char* s, streamsize n)
+{
+    return mImpl->Read(s, n);
+}
+
+bool M6Decompressor::Supports(const fs::path& inFile)
+{
+    string ext = inFile.extension().string();
+    return ext == ".gz" or ext == ".tgz" or ext == ".bz2" or ext == ".tbz";
+}
@@ -0,0 +1,44 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <memory>
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/filesystem/path.hpp>
+
+class M6Progress;
+struct M6DecompressorImpl;
+
+// --------------------------------------------------------------------
+// M6Decompressor is a boost::iostreams source that decompresses a
+// gzip or bzip2 file using multiple threads. A reader thread splits
+// the compressed data into blocks, worker threads decode these and
+// read() returns the decoded data in the original order.
+//
+// bzip2 blocks and BGZF members are decoded in parallel. Other gzip
+// files cannot be split without inflating them, for those the reading
+// and inflating are done in a separate thread, pipelined with the
+// consumer.
+
+class M6Decompressor
+{
+  public:
+    typedef char                            char_type;
+    typedef boost::iostreams::source_tag    category;
+
+                        M6Decompressor(const boost::filesystem::path& inFile,
+                            M6Progress& inProgress, uint32 inNrOfThreads);
+
+    std::streamsize        read(char* s, std::streamsize n);
+
+    // returns true if inFile has an extension we can decompress
+    static bool            Supports(const boost::filesystem::path& inFile);
+
+  private:
+    std::shared_ptr<M6DecompressorImpl>
+                        mImpl;
+};
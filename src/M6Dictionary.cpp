@@ -13,6 +13,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/bind.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 #include "M6Dictionary.h"
 #include "M6Error.h"
@@ -22,6 +23,7 @@
 using namespace std;
 namespace fs = boost::filesystem;
 namespace ba = boost::algorithm;
+namespace io = boost::iostreams;
 
 // The M6Transition type was altered in version 5.1 of MRS
 // to be able to construct larger dictionaries.
@@ -38,6 +40,7 @@ struct suggestion
 {
     string    word;
     float    idf;
+    uint16    df;
 
     bool    operator<(const suggestion& rhs) const    { return idf < rhs.idf; }
 };
@@ -77,17 +80,17 @@ const uint32
 class M6Automaton
 {
   public:
-            M6Automaton(M6File& inFile);
-            ~M6Automaton();
+            M6Automaton(const fs::path& inFile);
 
     void    SuggestCorrection(const string& inWord, vector<pair<string,uint16>>& outCorrections) const;
     void    SuggestSearchTerms(const string& inWord, M6Suggestions& outSearchTerms) const;
 
   private:
 
+    io::mapped_file    mFile;
     uint32    mAutomatonLength;
     uint32    mDocCount;
-    M6Transition*
+    const M6Transition*
             mAutomaton;
 };
 
@@ -194,7 +197,18 @@ uint32 M6HashTable::Lookup(M6Transition* state, uint32 state_len, M6AutomatonTyp
 
 const uint32
     kMaxScoreTableSize = 20,
-    kMaxEdits = 2;
+    kMaxEdits = 2,
+    kMaxCorrectionLength = 32,
+    kMaxCorrectionDepth = kMaxCorrectionLength + kMaxEdits,
+    kMaxCorrectionWork = 1 << 18;    // max number of transitions visited per word
+
+// The correction search walks the automaton depth first while keeping
+// a Levenshtein automaton for the word in step: for each candidate prefix
+// a row holding the (Damerau) edit distance and the score against each
+// prefix of the word. A branch is abandoned as soon as no cell in the row
+// is within kMaxEdits, or cannot improve on the current table anymore.
+// All state lives in fixed size arrays and the total number of transitions
+// visited is capped at kMaxCorrectionWork.
 
 struct M6ScoreTableImp
 {
@@ -220,20 +234,9 @@ struct M6ScoreTableImp
                     M6ScoreTableImp(const M6Transition* inAutomaton,
                         uint32 inAutomatonLength, const string& inWord);
 
-    void            Test(uint32 inState, int16 inScore, uint32 inEdits,
-                        string inMatch, const char* inWord, uint32 inWordLength);
-    bool            Match(uint32 inState, int16 inScore, uint32 inEdits,
-                        string inMatch, const char* inWord, uint32 inWordLength);
-    void            Delete(uint32 inState, int16 inScore, uint32 inEdits,
-                        string inMatch, const char* inWord, uint32 inWordLength);
-    void            Insert(uint32 inState, int16 inScore, uint32 inEdits,
-                        string inMatch, const char* inWord, uint32 inWordLength);
-    void            Transpose(uint32 inState, int16 inScore, uint32 inEdits,
-                        string inMatch, const char* inWord, uint32 inWordLength);
-    void            Substitute(uint32 inState, int16 inScore, uint32 inEdits,
-                        string inMatch, const char* inWord, uint32 inWordLength);
-
-    void            Add(string inTerm, int16 inScore, uint16 inDF);
+    void            Search(const char* inWord, uint32 inWordLength);
+
+    void            Add(const char* inTerm, uint32 inTermLength, int16 inScore, uint16 inDF);
     void            Finish();
     int32            MinScore();
 
@@ -248,134 +251,126 @@ M6ScoreTableImp::M6ScoreTableImp(const M6Transition* inAutomaton,
     uint32 inAutomatonLength, const string& inWord)
     : mAutomaton(inAutomaton), mAutomatonLength(inAutomatonLength), n(0)
 {
-    string match;
-    Test(mAutomaton[mAutomatonLength - 1].b.dest, 0, 0, match, inWord.c_str(), inWord.length());
+    if (not inWord.empty() and inWord.length() <= kMaxCorrectionLength)
+        Search(inWord.c_str(), static_cast<uint32>(inWord.length()));
 
     Finish();
 }
 
-void M6ScoreTableImp::Test(uint32 inState, int16 inScore, uint32 inEdits, string inMatch, const char* inWord, uint32 inWordLength)
+void M6ScoreTableImp::Search(const char* inWord, uint32 inWordLength)
 {
-    Match(inState, inScore, inEdits, inMatch, inWord, inWordLength);
+    uint8    edits[kMaxCorrectionDepth + 1][kMaxCorrectionLength + 1];
+    int16    score[kMaxCorrectionDepth + 1][kMaxCorrectionLength + 1];
+    uint32    state[kMaxCorrectionDepth];
+    char    match[kMaxCorrectionDepth];
 
-    if (inScore >= max(MinScore() - 3, 0) and inEdits < 3)
+    for (uint32 i = 0; i <= inWordLength; ++i)
     {
-        Delete(inState, inScore, inEdits, inMatch, inWord, inWordLength);
-        Insert(inState, inScore, inEdits, inMatch, inWord, inWordLength);
-        Transpose(inState, inScore, inEdits, inMatch, inWord, inWordLength);
-        Substitute(inState, inScore, inEdits, inMatch, inWord, inWordLength);
+        edits[0][i] = i;
+        score[0][i] = i * kInsertPenalty;
     }
-}
 
-bool M6ScoreTableImp::Match(uint32 inState, int16 inScore, uint32 inEdits, string inMatch, const char* inWord, uint32 inWordLength)
-{
-    bool match = false;
+    uint32 depth = 0, work = 0;
+    state[0] = mAutomaton[mAutomatonLength - 1].b.dest;
 
-    if (*inWord != 0)
+    for (;;)
     {
-        match = true;
-
-        while (mAutomaton[inState].b.attr != inWord[0])
-        {
-            if (mAutomaton[inState].b.last)
-            {
-                match = false;
-                break;
-            }
+        if (++work > kMaxCorrectionWork)
+            break;
 
-            ++inState;
-        }
+        const M6Transition& t = mAutomaton[state[depth]];
+        char ch = t.b.attr;
 
-        if (match)
+        if (ch != 0)
         {
-            inScore += kMatchReward;
-            inMatch += inWord[0];
+            match[depth] = ch;
 
-            if (mAutomaton[inState].b.term and inEdits + inWordLength <= kMaxEdits)
-                Add(inMatch, inScore + (inWordLength - 1) * kDeletePenalty, mAutomaton[inState].b.df);
+            const uint8* e0 = edits[depth];
+            const int16* s0 = score[depth];
+            uint8* e1 = edits[depth + 1];
+            int16* s1 = score[depth + 1];
 
-            Test(mAutomaton[inState].b.dest, inScore, inEdits, inMatch, inWord + 1, inWordLength - 1);
-        }
-    }
+            e1[0] = depth + 1;
+            s1[0] = (depth + 1) * kDeletePenalty;
 
-    return match;
-}
+            uint8 minEdits = e1[0];
+            int32 maxScore = s1[0] + inWordLength * kMatchReward;
 
-void M6ScoreTableImp::Delete(uint32 inState, int16 inScore, uint32 inEdits, string inMatch, const char* inWord, uint32 inWordLength)
-{
-    uint32 state = inState;
+            for (uint32 i = 1; i <= inWordLength; ++i)
+            {
+                uint8 e;
+                int16 s;
 
-    for (;;)
-    {
-        char ch = mAutomaton[state].b.attr;
+                if (inWord[i - 1] == ch)
+                {
+                    e = e0[i - 1];
+                    s = s0[i - 1] + kMatchReward;
+                }
+                else
+                {
+                    e = e0[i - 1] + 1;
+                    s = s0[i - 1] + kSubstitutePenalty;
+                }
 
-        if (mAutomaton[state].b.term and inEdits + inWordLength <= kMaxEdits)
-            Add(inMatch + ch, inScore + inWordLength * kDeletePenalty, mAutomaton[state].b.df);
+                // an extra character in the candidate
+                e = min<uint8>(e, e0[i] + 1);
+                s = max<int16>(s, s0[i] + kDeletePenalty);
 
-        Test(mAutomaton[state].b.dest, inScore + kDeletePenalty, inEdits + 1, inMatch + ch, inWord, inWordLength);
+                // an extra character in the word
+                e = min<uint8>(e, e1[i - 1] + 1);
+                s = max<int16>(s, s1[i - 1] + kInsertPenalty);
 
-        if (mAutomaton[state].b.last)
-            break;
+                if (depth > 0 and i > 1 and inWord[i - 1] == match[depth - 1] and inWord[i - 2] == ch)
+                {
+                    e = min<uint8>(e, edits[depth - 1][i - 2] + 1);
+                    s = max<int16>(s, score[depth - 1][i - 2] + 2 * kMatchReward + kTransposePenalty);
+                }
 
-        ++state;
-    }
-}
+                e1[i] = e;
+                s1[i] = s;
 
-void M6ScoreTableImp::Insert(uint32 inState, int16 inScore, uint32 inEdits, string inMatch, const char* inWord, uint32 inWordLength)
-{
-    if (*inWord != 0)
-        Test(inState, inScore + kInsertPenalty, inEdits + 1, inMatch, inWord + 1, inWordLength - 1);
-}
+                minEdits = min(minEdits, e);
+                maxScore = max<int32>(maxScore, s + (inWordLength - i) * kMatchReward);
+            }
 
-void M6ScoreTableImp::Transpose(uint32 inState, int16 inScore, uint32 inEdits, string inMatch, const char* inWord, uint32 inWordLength)
-{
-    if (inWord[0] != 0 and inWord[1] != 0)
-    {
-        string woord;
-        woord = inWord[1];
-        woord += inWord[0];
-        woord += inWord + 2;
-        Test(inState, inScore + kTransposePenalty, inEdits + 1, inMatch, woord.c_str(), woord.length());
-    }
-}
+            if (t.b.term and e1[inWordLength] <= kMaxEdits)
+                Add(match, depth + 1, s1[inWordLength], t.b.df);
 
-void M6ScoreTableImp::Substitute(uint32 inState, int16 inScore, uint32 inEdits, string inMatch, const char* inWord, uint32 inWordLength)
-{
-    if (inWord[0] != 0)
-    {
-        uint32 state = inState;
-
-        for (;;)
-        {
-            char ch = mAutomaton[state].b.attr;
+            bool full = n >= kMaxScoreTableSize;
 
-            if (mAutomaton[state].b.term and inEdits + inWordLength <= kMaxEdits)
-                Add(inMatch + ch, inScore + kSubstitutePenalty + (inWordLength - 1) * kDeletePenalty, mAutomaton[state].b.df);
+            if (t.b.dest != 0 and depth + 1 < kMaxCorrectionDepth and
+                minEdits <= kMaxEdits and (not full or maxScore > MinScore()))
+            {
+                state[++depth] = t.b.dest;
+                continue;
+            }
+        }
 
-            Test(mAutomaton[state].b.dest, inScore + kSubstitutePenalty, inEdits + 1, inMatch + ch, inWord + 1, inWordLength - 1);
+        // move on to the next transition, popping exhausted states
+        while (mAutomaton[state[depth]].b.last and depth > 0)
+            --depth;
 
-            if (mAutomaton[state].b.last)
-                break;
+        if (mAutomaton[state[depth]].b.last)
+            break;
 
-            ++state;
-        }
+        ++state[depth];
     }
 }
 
-void M6ScoreTableImp::Add(string inTerm, int16 inScore, uint16 inDF)
+void M6ScoreTableImp::Add(const char* inTerm, uint32 inTermLength, int16 inScore, uint16 inDF)
 {
     if (n >= kMaxScoreTableSize)
     {
         if (inScore > scores[0].score)
         {
             pop_heap(scores, scores + n, greater<M6Score>());
-            scores[kMaxScoreTableSize - 1] = M6Score(inTerm, inScore, inDF);
+            scores[kMaxScoreTableSize - 1] = M6Score(string(inTerm, inTermLength), inScore, inDF);
             push_heap(scores, scores + n, greater<M6Score>());
         }
     }
     else
     {
-        scores[n] = M6Score(inTerm, inScore, inDF);
+        scores[n] = M6Score(string(inTerm, inTermLength), inScore, inDF);
         ++n;
         push_heap(scores, scores + n, greater<M6Score>());
     }
@@ -408,6 +403,7 @@ void ExtendSuggestion(uint32 inDocCount,
         {
             suggestion s;
             s.word = inWord + ch;
+            s.df = inAutomaton[state].b.df;
             s.idf = static_cast<float>(log(1.0 + inDocCount / inAutomaton[state].b.df));
 
             outWords.push_back(s);
@@ -430,18 +426,28 @@ void ExtendSuggestion(uint32 inDocCount,
     }
 }
 
-M6Automaton::M6Automaton(M6File& inFile)
+// The automaton is mapped read-only, the pages are shared by all processes
+// that have the same dictionary open.
+
+M6Automaton::M6Automaton(const fs::path& inFile)
 {
-    inFile.Read(&mDocCount, sizeof(mDocCount));
-    inFile.Read(&mAutomatonLength, sizeof(mAutomatonLength));
+    mFile.open(inFile.string().c_str(), io::mapped_file::readonly);
+    if (not mFile.is_open())
+        THROW(("Could not open dictionary %s", inFile.string().c_str()));
 
-    mAutomaton = new M6Transition[mAutomatonLength];
-    inFile.Read(mAutomaton, mAutomatonLength * sizeof(M6Transition));
-}
+    const char* data = mFile.const_data();
+    const size_t kHeaderSize = 2 * sizeof(uint32);
 
-M6Automaton::~M6Automaton()
-{
-    delete[] mAutomaton;
+    if (mFile.size() < kHeaderSize)
+        THROW(("Dictionary %s is invalid", inFile.string().c_str()));
+
+    mDocCount = reinterpret_cast<const uint32*>(data)[0];
+    mAutomatonLength = reinterpret_cast<const uint32*>(data)[1];
+
+    if (mAutomatonLength == 0 or mFile.size() < kHeaderSize + mAutomatonLength * sizeof(M6Transition))
+        THROW(("Dictionary %s is invalid", inFile.string().c_str()));
+
+    mAutomaton = reinterpret_cast<const M6Transition*>(data + kHeaderSize);
 }
 
 void M6Automaton::SuggestCorrection(const string& inWord, vector<pair<string,uint16>>& outCorrections) const
@@ -527,8 +533,7 @@ M6Dictionary::M6Dictionary(fs::path inFile)
     if (not fs::exists(inFile))
         THROW(("Dictionary %s does not exist", inFile.string().c_str()));
 
-    M6File file(inFile, eReadOnly);
-    mAutomaton = new M6Automaton(file);
+    mAutomaton = new M6Automaton(inFile);
 }
 
 M6Dictionary::~M6Dictionary()
@@ -671,7 +676,7 @@ void M6Dictionary::SuggestCorrection(const string& inWord, vector<pair<string,ui
     mAutomaton->SuggestCorrection(inWord, outCorrections);
 }
 
-void M6Dictionary::SuggestSearchTerms(const string& inWord, vector<string>& outSearchTerms)
+void M6Dictionary::SuggestSearchTerms(const string& inWord, vector<pair<string,uint32>>& outSearchTerms)
 {
     M6Suggestions suggestions;
     mAutomaton->SuggestSearchTerms(inWord, suggestions);
@@ -685,6 +690,274 @@ void M6Dictionary::SuggestSearchTerms(const string& inWord, vector<string>& outS
             continue;
         words.insert(s.word);
 
-        outSearchTerms.push_back(s.word);
+        outSearchTerms.push_back(make_pair(s.word, s.df));
     }
 }
+
+// --------------------------------------------------------------------
+//
+//    M6CompletionIndex
+//
+// The completion index is a trie over the terms in the full-text index.
+// Each node stores the kM6CompletionSize terms with the highest document
+// frequency that start with the prefix of that node. Nodes are created
+// only for prefixes shared by more than kM6CompletionSize terms. For a
+// longer prefix the few terms in the range of the deepest node are
+// scanned. The file is a header, the sorted terms, their document
+// frequencies, the nodes in breadth first order, and the top term lists.
+// It is mapped read-only.
+
+const uint32
+    kM6CompletionSignature    = 'm6cx',
+    kM6CompletionVersion    = 1,
+    kM6CompletionMinLength    = 2;
+
+struct M6CompletionHeader
+{
+    uint32        mSignature;
+    uint32        mVersion;
+    uint32        mTermCount;
+    uint32        mNodeCount;
+    int64        mTermOffsets;    // file offset of mTermCount + 1 offsets into the term data
+    int64        mTermData;
+    int64        mTermDF;        // file offset of mTermCount document frequencies
+    int64        mNodes;
+    int64        mTop;            // file offset of the top term numbers for the nodes
+    int64        mFileSize;
+};
+
+struct M6CompletionNode
+{
+    uint32        mBegin, mEnd;    // range of terms starting with the prefix
+    uint32        mChild;            // index of the first child node
+    uint32        mTop;            // index of the first top term
+    uint16        mChildCount;
+    uint8        mLabel;            // last character of the prefix
+    uint8        mTopCount;
+};
+
+static_assert(sizeof(M6CompletionNode) == 20, "Completion node is of incorrect size");
+
+struct M6CompletionIndexImpl
+{
+                M6CompletionIndexImpl(const fs::path& inFile);
+
+    string        GetTerm(uint32 inTerm) const
+                {
+                    return string(mTermData + mTermOffsets[inTerm], mTermOffsets[inTerm + 1] - mTermOffsets[inTerm]);
+                }
+
+    void        Complete(const string& inPrefix, vector<pair<string,uint32>>& outTerms) const;
+
+    io::mapped_file                mFile;
+    const M6CompletionHeader*    mHeader;
+    const uint32*                mTermOffsets;
+    const char*                    mTermData;
+    const uint32*                mTermDF;
+    const M6CompletionNode*        mNodes;
+    const uint32*                mTop;
+};
+
+M6CompletionIndexImpl::M6CompletionIndexImpl(const fs::path& inFile)
+{
+    mFile.open(inFile.string().c_str(), io::mapped_file::readonly);
+    if (not mFile.is_open())
+        THROW(("Could not open completion index %s", inFile.string().c_str()));
+
+    const char* data = mFile.const_data();
+    mHeader = reinterpret_cast<const M6CompletionHeader*>(data);
+
+    if (mFile.size() < sizeof(M6CompletionHeader) or
+        mHeader->mSignature != kM6CompletionSignature or mHeader->mVersion != kM6CompletionVersion or
+        mHeader->mFileSize != static_cast<int64>(mFile.size()) or mHeader->mNodeCount == 0)
+    {
+        THROW(("Completion index %s is invalid", inFile.string().c_str()));
+    }
+
+    mTermOffsets = reinterpret_cast<const uint32*>(data + mHeader->mTermOffsets);
+    mTermData = data + mHeader->mTermData;
+    mTermDF = reinterpret_cast<const uint32*>(data + mHeader->mTermDF);
+    mNodes = reinterpret_cast<const M6CompletionNode*>(data + mHeader->mNodes);
+    mTop = reinterpret_cast<const uint32*>(data + mHeader->mTop);
+}
+
+void M6CompletionIndexImpl::Complete(const string& inPrefix, vector<pair<string,uint32>>& outTerms) const
+{
+    const M6CompletionNode* node = mNodes;
+    uint32 depth = 0;
+
+    while (depth < inPrefix.length() and node->mChildCount > 0)
+    {
+        const M6CompletionNode* child = mNodes + node->mChild;
+        const M6CompletionNode* end = child + node->mChildCount;
+
+        child = lower_bound(child, end, static_cast<uint8>(inPrefix[depth]),
+            [](const M6CompletionNode& n, uint8 ch) -> bool { return n.mLabel < ch; });
+
+        if (child == end or child->mLabel != static_cast<uint8>(inPrefix[depth]))
+            return;
+
+        node = child;
+        ++depth;
+    }
+
+    if (depth == inPrefix.length())
+    {
+        for (uint32 i = 0; i < node->mTopCount; ++i)
+        {
+            uint32 term = mTop[node->mTop + i];
+            outTerms.push_back(make_pair(GetTerm(term), mTermDF[term]));
+        }
+    }
+    else
+    {
+        // a leaf, at most kM6CompletionSize terms left to check
+
+        vector<uint32> terms;
+        for (uint32 term = node->mBegin; term < node->mEnd; ++term)
+        {
+            uint32 length = mTermOffsets[term + 1] - mTermOffsets[term];
+            if (length >= inPrefix.length() and
+                inPrefix.compare(0, string::npos, mTermData + mTermOffsets[term], inPrefix.length()) == 0)
+            {
+                terms.push_back(term);
+            }
+        }
+
+        stable_sort(terms.begin(), terms.end(),
+            [this](uint32 a, uint32 b) -> bool { return mTermDF[a] > mTermDF[b]; });
+
+        for (uint32 term : terms)
+            outTerms.push_back(make_pair(GetTerm(term), mTermDF[term]));
+    }
+}
+
+M6CompletionIndex::M6CompletionIndex(fs::path inFile)
+    : mImpl(nullptr)
+{
+    if (not fs::exists(inFile))
+        THROW(("Completion index %s does not exist", inFile.string().c_str()));
+
+    mImpl = new M6CompletionIndexImpl(inFile);
+}
+
+M6CompletionIndex::~M6CompletionIndex()
+{
+    delete mImpl;
+}
+
+void M6CompletionIndex::Complete(const string& inPrefix, vector<pair<string,uint32>>& outTerms) const
+{
+    mImpl->Complete(inPrefix, outTerms);
+}
+
+void M6CompletionIndex::Create(M6BasicIndex& inIndex, uint32 inDocCount,
+    M6File& inFile, M6Progress& inProgress)
+{
+    // use the same minimal occurrence as the dictionary
+    uint32 minOccurrence = static_cast<uint32>(log10(static_cast<float>(inDocCount)));
+    if (minOccurrence < kM6MinWordOccurrence)
+        minOccurrence = kM6MinWordOccurrence;
+
+    vector<uint32> offsets(1, 0), df;
+    string data;
+    uint32 nr = 0;
+
+    inIndex.VisitKeys([&](const char* inKey, uint32 inKeyLength, uint32 inCount) -> bool
+    {
+        if (++nr % 10000 == 0)
+            inProgress.Progress(nr);
+
+        if (inCount >= minOccurrence and inKeyLength >= kM6CompletionMinLength)
+        {
+            data.append(inKey, inKeyLength);
+            offsets.push_back(static_cast<uint32>(data.length()));
+            df.push_back(inCount);
+        }
+
+        return true;
+    });
+
+    inProgress.Progress(inIndex.size());
+
+    uint32 termCount = static_cast<uint32>(df.size());
+
+    // build the nodes breadth first, so that the children of a node
+    // are stored consecutively
+
+    vector<M6CompletionNode> nodes;
+    vector<uint32> depths, top, terms;
+
+    M6CompletionNode root = { 0, termCount };
+    nodes.push_back(root);
+    depths.push_back(0);
+
+    for (uint32 ix = 0; ix < nodes.size(); ++ix)
+    {
+        uint32 begin = nodes[ix].mBegin, end = nodes[ix].mEnd, depth = depths[ix];
+
+        terms.resize(end - begin);
+        iota(terms.begin(), terms.end(), begin);
+
+        auto more = [&df](uint32 a, uint32 b) -> bool { return df[a] > df[b] or (df[a] == df[b] and a < b); };
+
+        if (terms.size() > kM6CompletionSize)
+            partial_sort(terms.begin(), terms.begin() + kM6CompletionSize, terms.end(), more);
+        else
+            sort(terms.begin(), terms.end(), more);
+
+        nodes[ix].mTop = static_cast<uint32>(top.size());
+        nodes[ix].mTopCount = static_cast<uint8>(min<size_t>(terms.size(), kM6CompletionSize));
+        top.insert(top.end(), terms.begin(), terms.begin() + nodes[ix].mTopCount);
+
+        if (end - begin <= kM6CompletionSize)
+            continue;
+
+        nodes[ix].mChild = static_cast<uint32>(nodes.size());
+
+        // terms are sorted and unique, only the first can be equal to the prefix
+        uint32 term = begin;
+        if (offsets[term + 1] - offsets[term] == depth)
+            ++term;
+
+        while (term < end)
+        {
+            uint8 ch = data[offsets[term] + depth];
+
+            M6CompletionNode child = { term };
+            child.mLabel = ch;
+
+            while (term < end and static_cast<uint8>(data[offsets[term] + depth]) == ch)
+                ++term;
+
+            child.mEnd = term;
+
+            nodes.push_back(child);
+            depths.push_back(depth + 1);
+
+            ++nodes[ix].mChildCount;
+        }
+    }
+
+    M6CompletionHeader header = { kM6CompletionSignature, kM6CompletionVersion, termCount,
+        static_cast<uint32>(nodes.size()) };
+
+    header.mTermOffsets = sizeof(header);
+    header.mTermData = header.mTermOffsets + offsets.size() * sizeof(uint32);
+    header.mTermDF = header.mTermData + ((data.length() + 3) & ~3);
+    header.mNodes = header.mTermDF + df.size() * sizeof(uint32);
+    header.mTop = header.mNodes + nodes.size() * sizeof(M6CompletionNode);
+    header.mFileSize = header.mTop + top.size() * sizeof(uint32);
+
+    data.append((4 - data.length() % 4) % 4, 0);
+
+    inFile.Write(&header, sizeof(header));
+    inFile.Write(&offsets[0], offsets.size() * sizeof(uint32));
+    if (not data.empty())
+        inFile.Write(data.c_str(), data.length());
+    if (not df.empty())
+        inFile.Write(&df[0], df.size() * sizeof(uint32));
+    inFile.Write(&nodes[0], nodes.size() * sizeof(M6CompletionNode));
+    if (not top.empty())
+        inFile.Write(&top[0], top.size() * sizeof(uint32));
+}
@@ -11,6 +11,7 @@
 #include "M6Index.h"
 
 class M6Automaton;
+struct M6CompletionIndexImpl;
 class M6File;
 class M6Progress;
 
@@ -24,7 +25,7 @@ class M6Dictionary
                 std::vector<std::pair<std::string,uint16>>& outCorrections);
 
     void    SuggestSearchTerms(const std::string& inWord,
-                std::vector<std::string>& outSearchTerms);
+                std::vector<std::pair<std::string,uint32>>& outSearchTerms);
 
     static void Create(M6BasicIndex& inIndex, uint32 inDocCount,
                 M6File& inFile, M6Progress& inProgress);
@@ -32,3 +33,25 @@ class M6Dictionary
   private:
     M6Automaton*    mAutomaton;
 };
+
+// The completion index is used for type-ahead suggestions. It returns
+// the kM6CompletionSize terms with the highest document frequency for a
+// prefix.
+
+const uint32 kM6CompletionSize = 10;
+
+class M6CompletionIndex
+{
+  public:
+            M6CompletionIndex(boost::filesystem::path inFile);
+            ~M6CompletionIndex();
+
+    void    Complete(const std::string& inPrefix,
+                std::vector<std::pair<std::string,uint32>>& outTerms) const;
+
+    static void Create(M6BasicIndex& inIndex, uint32 inDocCount,
+                M6File& inFile, M6Progress& inProgress);
+
+  private:
+    M6CompletionIndexImpl*    mImpl;
+};
@@ -36,7 +36,8 @@ const int64
 //    kM6DataPageSize            = 256,
     kM6DataPageTextSize        = kM6DataPageSize - 8,
     kM6DataPageIndexCount    = kM6DataPageTextSize / (3 * sizeof(uint32)),
-    kM6DataPageTextCutOff    = 64;    // start a new data page if 'free' is less than this
+    kM6DataPageTextCutOff    = 64,    // start a new data page if 'free' is less than this
+    kM6WriterPageCount        = 32;    // the number of pages a writer reserves at once
 
 enum M6DataPageType
 {
@@ -242,6 +243,21 @@ class M6DocStorePagePtr
 typedef M6DocStorePagePtr<M6DocStoreDataPage>    M6DocStoreDataPagePtr;
 typedef M6DocStorePagePtr<M6DocStoreIndexPage>    M6DocStoreIndexPagePtr;
 
+// --------------------------------------------------------------------
+// A writer stores documents in data pages of its own. These pages are
+// not kept in the cache and page numbers are reserved in ranges, that
+// way several threads can store documents at the same time and only
+// need to lock the store to update the index.
+
+struct M6DocStoreWriter
+{
+                            M6DocStoreWriter()
+                                : mPage(nullptr), mNextPageNr(0), mEndPageNr(0) {}
+
+    M6DocStoreDataPage*        mPage;
+    uint32                    mNextPageNr, mEndPageNr;
+};
+
 // --------------------------------------------------------------------
 
 class M6DocStoreImpl
@@ -258,6 +274,8 @@ class M6DocStoreImpl
     int64            GetFileSize() const                { return mFile.Size(); }
 
     void            StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize);
+    void            StoreDocument(uint32 inWriter, uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize);
+    void            SetWriterCount(uint32 inWriterCount);
     void            EraseDocument(uint32 inDocNr);
     bool            FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize);
     void            OpenDataStream(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize,
@@ -314,6 +332,14 @@ class M6DocStoreImpl
     void            InitCache();
     M6CachedPagePtr    GetCachePage(uint32 inPageNr);
 
+    void            InsertDocument(uint32 inDocNr, uint32 inDocPageNr, uint32 inDocSize, size_t inRawSize);
+    M6DocStoreDataPage*
+                    AllocateWriterPage(M6DocStoreWriter& inWriter);
+    void            FlushWriters();
+
+    vector<M6DocStoreWriter>
+                    mWriters;
+
     M6CachedPagePtr    mCache,    mLRUHead, mLRUTail;
     uint32            mCacheCount;
 };
@@ -881,6 +907,9 @@ M6DocStoreImpl::~M6DocStoreImpl()
 
     mRoot = M6DocStoreIndexPagePtr();
 
+    for (M6DocStoreWriter& w : mWriters)
+        delete w.mPage;
+
     for (uint32 ix = 0; ix < mCacheCount; ++ix)
         delete mCache[ix].mPage;
     delete[] mCache;
@@ -999,6 +1028,60 @@ void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t in
         }
     }
 
+    InsertDocument(inDocNr, docPageNr, docSize, inRawSize);
+}
+
+void M6DocStoreImpl::StoreDocument(uint32 inWriter, uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize)
+{
+    if (inSize == 0 or inData == nullptr)
+        THROW(("Empty document"));
+
+    if (inSize > numeric_limits<uint32>::max())
+        THROW(("Document too large"));
+
+    if (inDocNr == 0 or inDocNr > mNextDocNumber)
+        THROW(("Invalid document number"));
+
+    if (inWriter >= mWriters.size())
+        THROW(("Invalid writer number"));
+
+    M6DocStoreWriter& writer = mWriters[inWriter];
+
+    const uint8* ptr = reinterpret_cast<const uint8*>(inData);
+    uint32 size = static_cast<uint32>(inSize);
+    uint32 docPageNr = 0, docSize = size;
+
+    if (writer.mPage == nullptr)
+        writer.mPage = AllocateWriterPage(writer);
+
+    for (;;)
+    {
+        uint32 k = writer.mPage->Store(inDocNr, ptr, size);
+
+        if (docPageNr == 0 and k > 0)
+            docPageNr = writer.mPage->GetPageNr();
+
+        ptr += k;
+        size -= k;
+
+        if (size == 0)
+            break;
+
+        // the page is full, write it out and continue with a new one
+        M6DocStoreDataPage* next = AllocateWriterPage(writer);
+        writer.mPage->SetLink(next->GetPageNr());
+        writer.mPage->Flush(mFile);
+
+        delete writer.mPage;
+        writer.mPage = next;
+    }
+
+    Lock lock(this);
+    InsertDocument(inDocNr, docPageNr, docSize, inRawSize);
+}
+
+void M6DocStoreImpl::InsertDocument(uint32 inDocNr, uint32 inDocPageNr, uint32 inDocSize, size_t inRawSize)
+{
     if (not mRoot)
     {
         if (mHeader.mIndexRoot == 0)
@@ -1011,12 +1094,12 @@ void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t in
             mRoot = Load<M6DocStoreIndexPage>(mHeader.mIndexRoot);
     }
 
-    if (mRoot->Insert(inDocNr, docPageNr, docSize))
+    if (mRoot->Insert(inDocNr, inDocPageNr, inDocSize))
     {
         M6DocStoreIndexPagePtr newRoot(Allocate<M6DocStoreIndexPage>());
         newRoot->SetPageType(eM6DocStoreIndexBranchPage);
         newRoot->SetLink(mHeader.mIndexRoot);
-        newRoot->InsertValues(inDocNr, docPageNr, 0, 0);
+        newRoot->InsertValues(inDocNr, inDocPageNr, 0, 0);
         mHeader.mIndexRoot = newRoot->GetPageNr();
 
         mRoot = newRoot;
@@ -1028,6 +1111,47 @@ void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t in
     mDirty = true;
 }
 
+M6DocStoreDataPage* M6DocStoreImpl::AllocateWriterPage(M6DocStoreWriter& inWriter)
+{
+    if (inWriter.mNextPageNr == inWriter.mEndPageNr)
+    {
+        Lock lock(this);
+
+        int64 fileSize = mFile.Size();
+        uint32 pageNr = static_cast<uint32>((fileSize - 1) / kM6DataPageSize + 1ULL);
+        mFile.Truncate((pageNr + kM6WriterPageCount) * kM6DataPageSize);
+
+        inWriter.mNextPageNr = pageNr;
+        inWriter.mEndPageNr = pageNr + kM6WriterPageCount;
+    }
+
+    M6DocStorePageData* data = new M6DocStorePageData;
+    memset(data, 0, kM6DataPageSize);
+
+    M6DocStoreDataPage* result = new M6DocStoreDataPage(*this, data, inWriter.mNextPageNr++);
+    result->SetPageType(eM6DocStoreDataPage);
+    return result;
+}
+
+void M6DocStoreImpl::SetWriterCount(uint32 inWriterCount)
+{
+    FlushWriters();
+
+    for (M6DocStoreWriter& w : mWriters)
+        delete w.mPage;
+
+    mWriters = vector<M6DocStoreWriter>(inWriterCount);
+}
+
+void M6DocStoreImpl::FlushWriters()
+{
+    for (M6DocStoreWriter& w : mWriters)
+    {
+        if (w.mPage != nullptr)
+            w.mPage->Flush(mFile);
+    }
+}
+
 void M6DocStoreImpl::EraseDocument(uint32 inDocNr)
 {
     THROW(("unimplemented"));
@@ -1240,6 +1364,8 @@ void M6DocStoreImpl::Release(M6DocStorePage* inPage)
 
 void M6DocStoreImpl::Commit()
 {
+    FlushWriters();
+
     for (uint32 ix = 0; ix < mCacheCount; ++ix)
     {
         if (mCache[ix].mPage != nullptr and mCache[ix].mPage->IsDirty())
@@ -1346,6 +1472,18 @@ void M6DocStore::StoreDocument(uint32 inDocNr, const char* inData, size_t inSize
     mImpl->StoreDocument(inDocNr, inData, inSize, inRawSize);
 }
 
+void M6DocStore::StoreDocument(uint32 inWriter, uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize)
+{
+    // locks internally, only when needed
+    mImpl->StoreDocument(inWriter, inDocNr, inData, inSize, inRawSize);
+}
+
+void M6DocStore::SetWriterCount(uint32 inWriterCount)
+{
+    M6DocStoreImpl::Lock lock(mImpl);
+    mImpl->SetWriterCount(inWriterCount);
+}
+
 void M6DocStore::EraseDocument(uint32 inDocNr)
 {
     M6DocStoreImpl::Lock lock(mImpl);
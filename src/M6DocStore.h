@@ -21,6 +21,12 @@ class M6DocStore
     void            GetInfo(uint32& outDocCount, int64& outFileSize, int64& outRawSize);
 
     void            StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize);
+
+    // Several threads can store documents at the same time if each uses
+    // its own writer, numbered from 0 to the count set with SetWriterCount.
+    // A writer must not be used by more than one thread at a time.
+    void            SetWriterCount(uint32 inWriterCount);
+    void            StoreDocument(uint32 inWriter, uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize);
     bool            FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize);
     void            OpenDataStream(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize,
                         boost::iostreams::filtering_stream<boost::iostreams::input>& ioStream);
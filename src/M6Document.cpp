@@ -37,6 +37,59 @@ namespace
 const uint32
     kUndefinedTokenValue = ~0;
 
+// The names of indices, attributes and linked databanks are shared
+// by all documents.
+
+M6Lexicon& GetNameLexicon()
+{
+    static M6Lexicon sNames;
+    return sNames;
+}
+
+inline uint32 HashWord(const char* inWord, size_t inLength)
+{
+    uint32 h = 2166136261U;
+    for (size_t i = 0; i < inLength; ++i)
+        h = (h ^ static_cast<uint8>(inWord[i])) * 16777619U;
+    return h;
+}
+
+inline int CompareText(const char* inA, size_t inALength, const char* inB, size_t inBLength)
+{
+    int d = memcmp(inA, inB, min(inALength, inBLength));
+    if (d == 0)
+        d = static_cast<int>(inALength) - static_cast<int>(inBLength);
+    return d;
+}
+
+// Append inText to ioBuffer, case folded. Most text is plain ASCII and
+// that is folded in place, without the need to allocate anything.
+
+void AppendCaseFolded(string& ioBuffer, const char* inText, size_t inSize)
+{
+    size_t offset = ioBuffer.length();
+
+    bool ascii = true;
+    for (size_t i = 0; ascii and i < inSize; ++i)
+        ascii = (inText[i] & 0x80) == 0;
+
+    if (ascii)
+    {
+        ioBuffer.append(inText, inSize);
+        for (size_t i = offset; i < ioBuffer.length(); ++i)
+        {
+            if (ioBuffer[i] >= 'A' and ioBuffer[i] <= 'Z')
+                ioBuffer[i] += 'a' - 'A';
+        }
+    }
+    else
+    {
+        string s(inText, inSize);
+        M6Tokenizer::CaseFold(s);
+        ioBuffer.append(s);
+    }
+}
+
 }
 
 // --------------------------------------------------------------------
@@ -54,6 +107,7 @@ M6Document::~M6Document()
 
 M6InputDocument::M6InputDocument(M6Databank& inDatabank)
     : M6Document(inDatabank)
+    , mLinksSorted(true)
     , mDocNr(inDatabank.GetDocStore().GetNextDocumentNumber())
 {
 }
@@ -61,8 +115,27 @@ M6InputDocument::M6InputDocument(M6Databank& inDatabank)
 M6InputDocument::M6InputDocument(M6Databank& inDatabank, const string& inText)
     : M6Document(inDatabank)
     , mText(inText)
+    , mLinksSorted(true)
     , mDocNr(inDatabank.GetDocStore().GetNextDocumentNumber())
 {
+    // Reserve enough room in the buffers for an average entry, based
+    // on the size of the text. This avoids most of the reallocations.
+    size_t size = inText.length();
+
+    mTokens.reserve(16);
+    mLastToken.reserve(16);
+    mTokenRuns.reserve(size / 64 + 16);
+    mTokenBuffer.reserve(size / 6 + 16);
+    mWordBuffer.reserve(size / 4 + 64);
+    mWordOffsets.reserve(size / 32 + 16);
+
+    size_t hashSize = 64;
+    while (hashSize < size / 16)
+        hashSize *= 2;
+    mWordHash.resize(hashSize);
+
+    mValues.reserve(8);
+    mAttributes.reserve(4);
 }
 
 void M6InputDocument::SetText(const string& inText)
@@ -75,9 +148,31 @@ string M6InputDocument::GetText()
     return mText;
 }
 
+uint32 M6InputDocument::GetNameNr(const string& inName)
+{
+    return GetNameLexicon().Store(inName);
+}
+
+string M6InputDocument::GetName(uint32 inNameNr)
+{
+    return GetNameLexicon().GetString(inNameNr);
+}
+
 string M6InputDocument::GetAttribute(const string& inName)
 {
-    return mAttributes[inName];
+    string result;
+
+    uint32 name = GetNameLexicon().Lookup(inName);
+    for (const M6Attribute& attr : mAttributes)
+    {
+        if (attr.mName == name)
+        {
+            result.assign(mAttributeBuffer, attr.mOffset, attr.mLength);
+            break;
+        }
+    }
+
+    return result;
 }
 
 void M6InputDocument::SetAttribute(const string& inName, const char* inText, size_t inSize)
@@ -92,10 +187,24 @@ void M6InputDocument::SetAttribute(const string& inName, const char* inText, siz
         inSize = 255;
     }
 
-    string attribute(inText, inSize);
-    ba::trim(attribute);
+    while (inSize > 0 and isspace(static_cast<uint8>(inText[0])))
+        ++inText, --inSize;
+
+    while (inSize > 0 and isspace(static_cast<uint8>(inText[inSize - 1])))
+        --inSize;
+
+    M6Attribute attribute = {
+        GetNameNr(inName), static_cast<uint32>(mAttributeBuffer.length()), static_cast<uint32>(inSize)
+    };
+    mAttributeBuffer.append(inText, inSize);
+
+    auto a = find_if(mAttributes.begin(), mAttributes.end(),
+        [&attribute](const M6Attribute& attr) -> bool { return attr.mName == attribute.mName; });
 
-    mAttributes[inName] = attribute;
+    if (a == mAttributes.end())
+        mAttributes.push_back(attribute);
+    else
+        *a = attribute;
 }
 
 void M6InputDocument::Compress()
@@ -115,15 +224,15 @@ void M6InputDocument::Compress()
     out.push(z_stream);
     out.push(io::back_inserter(mBuffer));
 
-    for (auto attr : mAttributes)
+    for (const M6Attribute& attr : mAttributes)
     {
-        uint8 attrNr = store.RegisterAttribute(attr.first);
+        uint8 attrNr = store.RegisterAttribute(GetName(attr.mName));
         out.write(reinterpret_cast<char*>(&attrNr), 1);
 
-        uint8 size = static_cast<uint8>(attr.second.length());
+        uint8 size = static_cast<uint8>(attr.mLength);
         out.write(reinterpret_cast<char*>(&size), 1);
 
-        out.write(attr.second.c_str(), size);
+        out.write(mAttributeBuffer.c_str() + attr.mOffset, size);
     }
 
     char mark = 0;
@@ -131,19 +240,28 @@ void M6InputDocument::Compress()
 
     // write links
 
-    if (not mLinks.empty() or ba::starts_with(mText, "[[\n"))
+    SortLinks();
+
+    if (not mLinkList.empty() or ba::starts_with(mText, "[[\n"))
     {
         out << "[[" << endl;
-        stringstream ls;
 
-        for (auto& l : mLinks)
+        for (auto l = mLinkList.begin(); l != mLinkList.end(); ++l)
         {
-            out << l.first << '\t';
-            for (auto id : l.second)
-                out << id << ';';
-            out << endl;
+            if (l == mLinkList.begin() or (l - 1)->mDatabank != l->mDatabank)
+            {
+                if (l != mLinkList.begin())
+                    out << endl;
+                out << GetName(l->mDatabank) << '\t';
+            }
+
+            out.write(mLinkBuffer.c_str() + l->mOffset, l->mLength);
+            out << ';';
         }
 
+        if (not mLinkList.empty())
+            out << endl;
+
         out << "]]" << endl;
     }
 
@@ -156,28 +274,103 @@ void M6InputDocument::Store()
     mDatabank.GetDocStore().StoreDocument(mDocNr, &mBuffer[0], mBuffer.size(), mText.length());
 }
 
-M6InputDocument::M6IndexTokenList::iterator M6InputDocument::GetIndexTokens(
-    const string& inIndex, M6DataType inDataType)
+void M6InputDocument::Store(uint32 inWriter)
+{
+    assert(not mBuffer.empty());
+    mDatabank.GetDocStore().StoreDocument(inWriter, mDocNr, &mBuffer[0], mBuffer.size(), mText.length());
+}
+
+uint32 M6InputDocument::GetIndexTokens(const string& inIndex, M6DataType inDataType)
 {
     if (inIndex.empty())
         THROW(("Empty index name"));
 
-    M6IndexTokenList::iterator result = mTokens.begin();
-    while (result != mTokens.end() and result->mIndexName != inIndex)
+    uint32 index = GetNameNr(inIndex);
+
+    uint32 result = 0;
+    while (result < mTokens.size() and mTokens[result].mIndex != index)
         ++result;
 
-    if (result == mTokens.end())
+    if (result == mTokens.size())
     {
-        M6IndexTokens tokens = { inDataType, inIndex };
+        M6IndexTokens tokens = { index, inDataType };
         mTokens.push_back(tokens);
-        result = mTokens.end() - 1;
+        mLastToken.push_back(kUndefinedTokenValue);
     }
-    else if (result->mDataType != inDataType)
+    else if (mTokens[result].mDataType != inDataType)
         THROW(("Inconsisted datatype for index %s", inIndex.c_str()));
 
     return result;
 }
 
+void M6InputDocument::AddToken(uint32 inIndex, uint32 inToken)
+{
+    if (mTokenRuns.empty() or mTokenRuns.back().mIndex != inIndex)
+    {
+        M6TokenRun run = { inIndex, static_cast<uint32>(mTokenBuffer.size()) };
+        mTokenRuns.push_back(run);
+    }
+
+    mTokenBuffer.push_back(inToken);
+
+    mTokenRuns.back().mCount += 1;
+    mTokens[inIndex].mCount += 1;
+    mLastToken[inIndex] = inToken;
+}
+
+// Store a word in the word buffer of this document, returns the
+// number of the word. Equal words get the same number.
+
+uint32 M6InputDocument::StoreWord(const char* inWord, size_t inLength)
+{
+    assert(inLength > 0 and inLength <= 255);
+
+    if (mWordHash.size() <= 2 * mWordOffsets.size())
+    {
+        vector<uint32> hash(max<size_t>(64, 2 * mWordHash.size()));
+        size_t mask = hash.size() - 1;
+
+        for (uint32 w = 1; w <= mWordOffsets.size(); ++w)
+        {
+            const char* word = mWordBuffer.c_str() + mWordOffsets[w - 1];
+
+            size_t i = HashWord(word + 1, static_cast<uint8>(word[0])) & mask;
+            while (hash[i] != 0)
+                i = (i + 1) & mask;
+            hash[i] = w;
+        }
+
+        swap(hash, mWordHash);
+    }
+
+    size_t mask = mWordHash.size() - 1;
+    size_t i = HashWord(inWord, inLength) & mask;
+
+    for (;;)
+    {
+        uint32 w = mWordHash[i];
+
+        if (w == 0)
+        {
+            mWordOffsets.push_back(static_cast<uint32>(mWordBuffer.length()));
+            mWordBuffer += static_cast<char>(inLength);
+            mWordBuffer.append(inWord, inLength);
+
+            w = static_cast<uint32>(mWordOffsets.size());
+            mWordHash[i] = w;
+            break;
+        }
+
+        const char* word = mWordBuffer.c_str() + mWordOffsets[w - 1];
+        if (static_cast<uint8>(word[0]) == inLength and memcmp(word + 1, inWord, inLength) == 0)
+            break;
+
+        i = (i + 1) & mask;
+    }
+
+    return mWordHash[i];
+}
+
 void M6InputDocument::Index(const string& inIndex, M6DataType inDataType,
     bool isUnique, const char* inText, size_t inSize)
 {
@@ -188,16 +381,23 @@ void M6InputDocument::Index(const string& inIndex, M6DataType inDataType,
     if (inDataType != eM6TextData)
     {
         tokenize = inDataType == eM6StringData;
-        M6IndexValue v = { inDataType, inIndex, string(inText, inSize), 0, isUnique };
+
+        M6IndexValue v = {
+            GetNameNr(inIndex), inDataType, isUnique, static_cast<uint32>(mValueBuffer.length())
+        };
 
         if (inDataType == eM6StringData)
-            M6Tokenizer::CaseFold(v.mIndexValue);
+            AppendCaseFolded(mValueBuffer, inText, inSize);
+        else
+            mValueBuffer.append(inText, inSize);
+
+        v.mLength = static_cast<uint32>(mValueBuffer.length() - v.mOffset);
         mValues.push_back(v);
     }
 
     if (tokenize)
     {
-        auto ix = GetIndexTokens(inIndex, inDataType);
+        uint32 ix = GetIndexTokens(inIndex, inDataType);
 
         M6Tokenizer tokenizer(inText, inSize);
         for (;;)
@@ -223,16 +423,15 @@ void M6InputDocument::Index(const string& inIndex, M6DataType inDataType,
                 token == eM6TokenPunctuation or
                 l > kM6MaxKeyLength)
             {
-                if (ix->mTokens.empty() or ix->mTokens.back() != 0)
-                    ix->mTokens.push_back(0);        // acts as stop word
+                if (mLastToken[ix] != 0)
+                    AddToken(ix, 0);        // acts as stop word
                 continue;
             }
 
             if (token != eM6TokenNumber and token != eM6TokenFloat and token != eM6TokenWord)
                 continue;
 
-            uint32 t = mDocLexicon.Store(tokenizer.GetTokenValue(), l);
-            ix->mTokens.push_back(t);
+            AddToken(ix, StoreWord(tokenizer.GetTokenValue(), l));
         }
     }
 }
@@ -240,91 +439,143 @@ void M6InputDocument::Index(const string& inIndex, M6DataType inDataType,
 void M6InputDocument::Index(const string& inIndex,
         const vector<pair<const char*,size_t>>& inWords)
 {
-    auto ix = GetIndexTokens(inIndex, eM6StringData);
+    uint32 ix = GetIndexTokens(inIndex, eM6StringData);
 
     for (auto word : inWords)
     {
-        uint32 t = mDocLexicon.Store(word.first, word.second);
-        ix->mTokens.push_back(t);
+        if (word.second == 0 or word.second > kM6MaxKeyLength)
+            AddToken(ix, 0);
+        else
+            AddToken(ix, StoreWord(word.first, word.second));
     }
 }
 
-//void M6InputDocument::IndexSequence(const string& inIndex, uint32 inWordSize,
-//    const char* inSequence, size_t inLength)
-//{
-//    auto ix = GetIndexTokens(inIndex, eM6TextData);
-//
-//    for (uint32 i = 0; i + inWordSize <= inLength; ++i)
-//    {
-//        uint32 t = mDocLexicon.Store(inSequence++, inWordSize);
-//        ix->mTokens.push_back(t);
-//    }
-//}
-
 void M6InputDocument::AddLink(const string& inDatabank, const string& inValue)
 {
-    string db(inDatabank);
-    M6Tokenizer::CaseFold(db);
+    string db;
+    AppendCaseFolded(db, inDatabank.c_str(), inDatabank.length());
 
-    string id(inValue);
-    M6Tokenizer::CaseFold(id);
+    M6Link link = { GetNameNr(db), static_cast<uint32>(mLinkBuffer.length()) };
+    AppendCaseFolded(mLinkBuffer, inValue.c_str(), inValue.length());
+    link.mLength = static_cast<uint32>(mLinkBuffer.length() - link.mOffset);
 
-    mLinks[db].insert(id);
+    mLinkList.push_back(link);
+    mLinksSorted = false;
 }
 
-void M6InputDocument::Tokenize(M6Lexicon& inLexicon, uint32 inLastStopWord)
+string M6InputDocument::GetLinkID(const M6Link& inLink) const
+{
+    return mLinkBuffer.substr(inLink.mOffset, inLink.mLength);
+}
+
+// Sort the links on databank name and ID and remove the duplicates,
+// the same order as used for M6DocLinks.
+
+void M6InputDocument::SortLinks()
 {
-    uint32 docTokenCount = mDocLexicon.Count();
-    vector<uint32> tokenRemap(docTokenCount, kUndefinedTokenValue);
-    tokenRemap[0] = 0;
+    if (mLinksSorted)
+        return;
+
+    M6Lexicon& names = GetNameLexicon();
 
+    auto compare = [this, &names](const M6Link& a, const M6Link& b) -> int
     {
-        M6Lexicon::M6SharedLock sharedLock(inLexicon);
+        int d = 0;
 
-        for (uint32 t = 1; t < docTokenCount; ++t)
+        if (a.mDatabank != b.mDatabank)
         {
-            const char* w;
-            size_t wl;
+            const char* an; size_t al;
+            const char* bn; size_t bl;
 
-            mDocLexicon.GetString(t, w, wl);
-            uint32 rt = inLexicon.Lookup(w, wl);
+            names.GetString(a.mDatabank, an, al);
+            names.GetString(b.mDatabank, bn, bl);
 
-            if (rt != 0)
-            {
-                if (rt <= inLastStopWord)
-                    tokenRemap[t] = 0;
-                else
-                    tokenRemap[t] = rt;
-            }
+            d = CompareText(an, al, bn, bl);
         }
+
+        if (d == 0)
+            d = CompareText(mLinkBuffer.c_str() + a.mOffset, a.mLength,
+                mLinkBuffer.c_str() + b.mOffset, b.mLength);
+
+        return d;
+    };
+
+    sort(mLinkList.begin(), mLinkList.end(),
+        [&compare](const M6Link& a, const M6Link& b) -> bool { return compare(a, b) < 0; });
+
+    mLinkList.erase(unique(mLinkList.begin(), mLinkList.end(),
+        [&compare](const M6Link& a, const M6Link& b) -> bool { return compare(a, b) == 0; }),
+        mLinkList.end());
+
+    mLinksSorted = true;
+}
+
+M6DocLinks& M6InputDocument::GetLinks()
+{
+    SortLinks();
+
+    mLinks.clear();
+    for (const M6Link& l : mLinkList)
+        mLinks[GetName(l.mDatabank)].insert(GetLinkID(l));
+
+    return mLinks;
+}
+
+void M6InputDocument::Tokenize(M6Lexicon& inLexicon, uint32 inLastStopWord)
+{
+    // map the words in this document to the tokens in inLexicon
+
+    vector<uint32> tokenMap(mWordOffsets.size() + 1);
+
+    for (uint32 w = 1; w <= mWordOffsets.size(); ++w)
+    {
+        const char* word = mWordBuffer.c_str() + mWordOffsets[w - 1];
+        uint32 t = inLexicon.Store(word + 1, static_cast<uint8>(word[0]));
+
+        if (t > inLastStopWord)
+            tokenMap[w] = t;
     }
 
+    // and collect the tokens for each index, in the order they were added
+
+    uint32 offset = 0;
+    for (M6IndexTokens& ix : mTokens)
     {
-        M6Lexicon::M6UniqueLock uniqueLock(inLexicon);
+        ix.mOffset = offset;
+        offset += ix.mCount;
+    }
 
-        for (uint32 t = 1; t < docTokenCount; ++t)
-        {
-            if (tokenRemap[t] == kUndefinedTokenValue)
-            {
-                const char* w;
-                size_t wl;
+    vector<uint32> tokens(mTokenBuffer.size()), filled(mTokens.size());
 
-                mDocLexicon.GetString(t, w, wl);
-                tokenRemap[t] = inLexicon.Store(w, wl);
-            }
-        }
+    for (M6TokenRun& run : mTokenRuns)
+    {
+        const uint32* src = &mTokenBuffer[run.mOffset];
+        uint32* dst = &tokens[mTokens[run.mIndex].mOffset + filled[run.mIndex]];
+
+        for (uint32 i = 0; i < run.mCount; ++i)
+            dst[i] = tokenMap[src[i]];
+
+        filled[run.mIndex] += run.mCount;
     }
 
-    RemapTokens(&tokenRemap[0]);
+    swap(tokens, mTokenBuffer);
+    mTokenRuns.clear();
+
+    // the words are no longer needed
+    mWordOffsets.clear();
+    mWordBuffer.clear();
+    vector<uint32>().swap(mWordHash);
 }
 
-void M6InputDocument::RemapTokens(const uint32 inTokenMap[])
+M6InputDocument::M6TokenRange M6InputDocument::GetTokens(const M6IndexTokens& inTokens) const
 {
-    for (M6IndexTokens& tm : mTokens)
-    {
-        for (uint32& t : tm.mTokens)
-            t = inTokenMap[t];
-    }
+    const uint32* tokens = mTokenBuffer.data() + inTokens.mOffset;
+    return M6TokenRange(tokens, tokens + inTokens.mCount);
+}
+
+string M6InputDocument::GetValue(const M6IndexValue& inValue) const
+{
+    return mValueBuffer.substr(inValue.mOffset, inValue.mLength);
 }
 
 // --------------------------------------------------------------------
@@ -16,6 +16,8 @@
 #include <set>
 #include <vector>
 
+#include <boost/range/iterator_range.hpp>
+
 #include "M6Lexicon.h"
 
 class M6Databank;
@@ -46,35 +48,54 @@ class M6Document
     M6Document&            operator=(const M6Document&);
 };
 
-// Input document, used to create documents that need to be inserted into the databank
+// Input document, used to create documents that need to be inserted into the databank.
+//
+// An input document is created for every entry in a databank and so it
+// should be cheap to create. All data collected for the document is kept
+// in a few flat buffers that are allocated once and grow as needed.
+// Index, attribute and databank names are stored as numbers, the names
+// themselves are stored once in a process wide lexicon, use GetName
+// to get the name back.
+//
+// Before Tokenize is called, tokens refer to the words in this document.
+// Tokenize replaces them with the number of the word in the lexicon
+// for the databank and orders them by index.
 
 class M6InputDocument : public M6Document
 {
   public:
 
-    typedef std::map<std::string,std::string>    M6DocAttributes;
-    typedef std::vector<uint32>                    M6TokenList;
-
     struct M6IndexTokens
     {
+        uint32            mIndex;
         M6DataType        mDataType;
-        std::string        mIndexName;
-        M6TokenList        mTokens;
+        uint32            mOffset;        // offset and count in the token buffer
+        uint32            mCount;
     };
 
     typedef std::vector<M6IndexTokens>            M6IndexTokenList;
+    typedef boost::iterator_range<const uint32*>    M6TokenRange;
 
     struct M6IndexValue
     {
+        uint32            mIndex;
         M6DataType        mDataType;
-        std::string        mIndexName;
-        std::string        mIndexValue;
-        double            mIndexFloatValue;
         bool            mUnique;
+        uint32            mOffset;        // offset and length in the value buffer
+        uint32            mLength;
     };
 
     typedef std::vector<M6IndexValue>            M6IndexValueList;
 
+    struct M6Link
+    {
+        uint32            mDatabank;
+        uint32            mOffset;        // offset and length in the link buffer
+        uint32            mLength;
+    };
+
+    typedef std::vector<M6Link>                    M6LinkList;
+
                         M6InputDocument(M6Databank& inDatabank);
                         M6InputDocument(M6Databank& inDatabank,
                             const std::string& inText);
@@ -94,41 +115,82 @@ class M6InputDocument : public M6Document
     virtual void        Index(const std::string& inIndex,
                             M6DataType inDataType, bool isUnique,
                             const char* inText, size_t inSize);
-    void                Index(const std::string& inIndex, bool isUnique, double inValue);
 
     virtual void        Index(const std::string& inIndex,
                             const std::vector<std::pair<const char*,size_t>>& inWords);
 
     virtual void        AddLink(const std::string& inDatabank, const std::string& inValue);
 
-//    virtual void        IndexSequence(const std::string& inIndex, uint32 inWordSize,
-//                            const char* inSequence, size_t inLength);
-
     virtual void        Tokenize(M6Lexicon& inLexicon, uint32 inLastStopWord);
-    virtual void        RemapTokens(const uint32 inTokenMap[]);
 
     void                Compress();
     void                Store();
+    void                Store(uint32 inWriter);
 
     uint32                GetDocNr() const                    { return mDocNr; }
 
     const M6IndexTokenList& GetIndexTokens() const            { return mTokens; }
+    M6TokenRange        GetTokens(const M6IndexTokens& inTokens) const;
+
     const M6IndexValueList& GetIndexValues() const            { return mValues; }
-    virtual M6DocLinks&    GetLinks()                            { return mLinks; }
+    std::string            GetValue(const M6IndexValue& inValue) const;
+
+    // The link list is sorted and contains no duplicates after Compress
+    const M6LinkList&    GetLinkList() const                    { return mLinkList; }
+    std::string            GetLinkID(const M6Link& inLink) const;
+    virtual M6DocLinks&    GetLinks();
+
+    static uint32        GetNameNr(const std::string& inName);
+    static std::string    GetName(uint32 inNameNr);
 
   private:
 
-    M6IndexTokenList::iterator
-                        GetIndexTokens(const std::string& inIndexName,
-                            M6DataType inDataType);
+    struct M6Attribute
+    {
+        uint32            mName;
+        uint32            mOffset;
+        uint32            mLength;
+    };
+
+    typedef std::vector<M6Attribute>            M6AttributeList;
+
+    struct M6TokenRun
+    {
+        uint32            mIndex;            // index in mTokens
+        uint32            mOffset;
+        uint32            mCount;
+    };
+
+    uint32                GetIndexTokens(const std::string& inIndex, M6DataType inDataType);
+    void                AddToken(uint32 inIndex, uint32 inToken);
+    uint32                StoreWord(const char* inWord, size_t inLength);
+    void                SortLinks();
 
     std::string            mText;
     std::string            mFasta;
     std::vector<char>    mBuffer;
-    M6DocAttributes        mAttributes;
+
+    M6AttributeList        mAttributes;
+    std::string            mAttributeBuffer;
+
     M6IndexTokenList    mTokens;
+    std::vector<uint32>    mLastToken;
+    std::vector<M6TokenRun>
+                        mTokenRuns;
+    std::vector<uint32>    mTokenBuffer;
+
+    // the words in this document, each preceded by its length
+    std::string            mWordBuffer;
+    std::vector<uint32>    mWordOffsets;
+    std::vector<uint32>    mWordHash;
+
     M6IndexValueList    mValues;
-    M6Lexicon            mDocLexicon;
+    std::string            mValueBuffer;
+
+    M6LinkList            mLinkList;
+    std::string            mLinkBuffer;
+    bool                mLinksSorted;
+
     uint32                mDocNr;
 };
 
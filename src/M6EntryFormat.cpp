@@ -0,0 +1,275 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#include "M6Lib.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/algorithm/string.hpp>
+
+#include "M6EntryFormat.h"
+#include "M6Tokenizer.h"
+
+using namespace std;
+namespace ba = boost::algorithm;
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+// back references are numbered relative to the start of the expression,
+// a rule containing them can not be combined with other rules
+bool HasBackReference(const string& inRx)
+{
+    for (string::size_type i = 0; i + 1 < inRx.length(); ++i)
+    {
+        if (inRx[i] != '\\')
+            continue;
+
+        char ch = inRx[i + 1];
+        if ((ch >= '1' and ch <= '9') or ch == 'g' or ch == 'k')
+            return true;
+        ++i;
+    }
+
+    return false;
+}
+
+inline char FoldChar(char inChar)
+{
+    return (inChar >= 'A' and inChar <= 'Z') ? inChar - 'A' + 'a' : inChar;
+}
+
+// the same definition as \b in a boost::regex
+inline bool IsWordChar(char inChar)
+{
+    return (inChar >= 'a' and inChar <= 'z') or (inChar >= 'A' and inChar <= 'Z') or
+           (inChar >= '0' and inChar <= '9') or inChar == '_';
+}
+
+}
+
+// --------------------------------------------------------------------
+
+M6EntryFormat::M6EntryFormat(const string& inID, const vector<M6LinkRule>& inRules)
+    : mID(inID), mCount(0), mTotal(0), mMax(0)
+{
+    M6Matcher combined;
+    string pattern;
+    uint32 group = 1;
+
+    for (const M6LinkRule& rule : inRules)
+    {
+        if (rule.mID.empty() or rule.mRx.empty())
+            continue;
+
+        // compile each rule by itself first, an invalid rule is skipped
+        boost::regex rx;
+        try
+        {
+            rx.assign(rule.mRx);
+        }
+        catch (boost::regex_error&)
+        {
+            continue;
+        }
+
+        if (HasBackReference(rule.mRx))
+        {
+            M6Matcher single;
+            single.mRx = rx;
+
+            M6CompiledRule r = { 0, CompileField(rule.mDb, 0), CompileField(rule.mIx, 0),
+                CompileField(rule.mID, 0), CompileField(rule.mAnchor, 0) };
+            single.mRules.push_back(r);
+
+            mMatchers.push_back(single);
+            continue;
+        }
+
+        if (not pattern.empty())
+            pattern += '|';
+        pattern += "(" + rule.mRx + ")";
+
+        M6CompiledRule r = { group, CompileField(rule.mDb, group), CompileField(rule.mIx, group),
+            CompileField(rule.mID, group), CompileField(rule.mAnchor, group) };
+        combined.mRules.push_back(r);
+
+        group += 1 + rx.mark_count();
+    }
+
+    if (not combined.mRules.empty())
+    {
+        combined.mRx.assign(pattern);
+        mMatchers.insert(mMatchers.begin(), combined);
+    }
+}
+
+M6EntryFormat::M6Field M6EntryFormat::CompileField(const string& inValue, uint32 inGroup) const
+{
+    M6Field result = { inValue, -1 };
+    if (ba::starts_with(inValue, "$"))
+        result.mGroup = inGroup + atoi(inValue.c_str() + 1);
+    return result;
+}
+
+string M6EntryFormat::GetField(const M6Field& inField, const boost::smatch& inMatch,
+    const string& inDefault) const
+{
+    string result = inField.mValue;
+    if (inField.mGroup >= 0 and static_cast<size_t>(inField.mGroup) < inMatch.size())
+        result = inMatch[inField.mGroup];
+    if (result.empty())
+        result = inDefault;
+    return result;
+}
+
+void M6EntryFormat::FindLinks(const string& inText, const string& inDatabank,
+    vector<M6EntryLink>& outLinks) const
+{
+    outLinks.clear();
+
+    for (const M6Matcher& matcher : mMatchers)
+    {
+        boost::sregex_iterator end;
+        for (boost::sregex_iterator m(inText.begin(), inText.end(), matcher.mRx); m != end; ++m)
+        {
+            const boost::smatch& match = *m;
+            if (match[0].length() == 0)
+                continue;
+
+            // the first rule that matched is the one we use
+            for (const M6CompiledRule& rule : matcher.mRules)
+            {
+                if (not match[rule.mGroup].matched)
+                    continue;
+
+                M6EntryLink link;
+                link.mOffset = match.position();
+                link.mLength = match[0].length();
+                link.mDb = GetField(rule.mDb, match, inDatabank);
+                link.mIx = GetField(rule.mIx, match, "");
+                link.mID = GetField(rule.mID, match, "");
+                link.mAnchor = GetField(rule.mAnchor, match, "");
+
+                if (not link.mID.empty())
+                    outLinks.push_back(link);
+                break;
+            }
+        }
+    }
+
+    if (mMatchers.size() > 1)
+    {
+        // links of more than one matcher, keep the leftmost of overlapping links
+        stable_sort(outLinks.begin(), outLinks.end(),
+            [](const M6EntryLink& a, const M6EntryLink& b) -> bool { return a.mOffset < b.mOffset; });
+
+        size_t end = 0;
+        outLinks.erase(remove_if(outLinks.begin(), outLinks.end(),
+            [&end](const M6EntryLink& link) -> bool
+            {
+                if (link.mOffset < end)
+                    return true;
+                end = link.mOffset + link.mLength;
+                return false;
+            }), outLinks.end());
+    }
+}
+
+void M6EntryFormat::AddTiming(double inSeconds)
+{
+    boost::mutex::scoped_lock lock(mTimingMutex);
+
+    ++mCount;
+    mTotal += inSeconds;
+    if (mMax < inSeconds)
+        mMax = inSeconds;
+}
+
+void M6EntryFormat::GetTiming(uint32& outCount, double& outTotal, double& outMax) const
+{
+    boost::mutex::scoped_lock lock(mTimingMutex);
+
+    outCount = mCount;
+    outTotal = mTotal;
+    outMax = mMax;
+}
+
+// --------------------------------------------------------------------
+
+M6Highlighter::M6Highlighter(const vector<string>& inTerms)
+    : mWordBoundaries(true)
+{
+    fill(mFirst, mFirst + 256, false);
+
+    for (string term : inTerms)
+    {
+        if (term.empty())
+            continue;
+
+        if (uc::contains_han(term))
+            mWordBoundaries = false;
+
+        transform(term.begin(), term.end(), term.begin(), &FoldChar);
+        mTerms.push_back(term);
+        mLengths.push_back(term.length());
+        mFirst[static_cast<uint8>(term[0])] = true;
+    }
+
+    sort(mTerms.begin(), mTerms.end());
+    mTerms.erase(unique(mTerms.begin(), mTerms.end()), mTerms.end());
+
+    sort(mLengths.begin(), mLengths.end(), greater<size_t>());
+    mLengths.erase(unique(mLengths.begin(), mLengths.end()), mLengths.end());
+}
+
+void M6Highlighter::Find(const string& inText, vector<pair<size_t,size_t>>& outMatches) const
+{
+    outMatches.clear();
+
+    if (mLengths.empty())
+        return;
+
+    const char* text = inText.c_str();
+    size_t length = inText.length();
+    string word;
+
+    size_t i = 0;
+    while (i < length)
+    {
+        bool match = false;
+
+        if (mFirst[static_cast<uint8>(FoldChar(text[i]))] and
+            (not mWordBoundaries or IsWordChar(text[i]) != (i > 0 and IsWordChar(text[i - 1]))))
+        {
+            for (size_t l : mLengths)
+            {
+                size_t e = i + l;
+                if (e > length)
+                    continue;
+
+                if (mWordBoundaries and IsWordChar(text[e - 1]) == (e < length and IsWordChar(text[e])))
+                    continue;
+
+                word.assign(text + i, text + e);
+                transform(word.begin(), word.end(), word.begin(), &FoldChar);
+
+                if (binary_search(mTerms.begin(), mTerms.end(), word))
+                {
+                    outMatches.push_back(make_pair(i, l));
+                    i = e;
+                    match = true;
+                    break;
+                }
+            }
+        }
+
+        if (not match)
+            ++i;
+    }
+}
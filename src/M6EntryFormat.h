@@ -0,0 +1,112 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <boost/thread.hpp>
+#include <boost/regex.hpp>
+
+// A link rule from an entry format in the configuration. The db, ix, id
+// and an fields are either a literal value or a reference to a group
+// in the regular expression written as $N.
+
+struct M6LinkRule
+{
+    std::string        mRx, mDb, mIx, mID, mAnchor;
+};
+
+struct M6EntryLink
+{
+    size_t            mOffset, mLength;
+    std::string        mDb, mIx, mID, mAnchor;
+};
+
+// M6EntryFormat contains the link rules of an entry format compiled into
+// a single regular expression, all rules are searched for in one pass over
+// the text. Compiled once when the configuration is loaded, the format
+// is shared by all server threads.
+
+class M6EntryFormat
+{
+  public:
+                    M6EntryFormat(const std::string& inID, const std::vector<M6LinkRule>& inRules);
+
+    const std::string&
+                    GetID() const                { return mID; }
+
+    // FindLinks returns the non-overlapping links in inText sorted by
+    // offset. At each position the first matching rule wins, rules without
+    // a databank link to inDatabank.
+    void            FindLinks(const std::string& inText, const std::string& inDatabank,
+                        std::vector<M6EntryLink>& outLinks) const;
+
+    // time spent generating entries using this format
+    void            AddTiming(double inSeconds);
+    void            GetTiming(uint32& outCount, double& outTotal, double& outMax) const;
+
+  private:
+                    M6EntryFormat(const M6EntryFormat&);
+    M6EntryFormat&    operator=(const M6EntryFormat&);
+
+    // a field is either a literal or the index of a group in the match
+    struct M6Field
+    {
+        std::string    mValue;
+        int            mGroup;
+    };
+
+    struct M6CompiledRule
+    {
+        uint32        mGroup;        // the group containing the entire rule
+        M6Field        mDb, mIx, mID, mAnchor;
+    };
+
+    // rules containing back references cannot be combined with other
+    // rules and end up in a matcher of their own.
+    struct M6Matcher
+    {
+        boost::regex                mRx;
+        std::vector<M6CompiledRule>    mRules;
+    };
+
+    M6Field            CompileField(const std::string& inValue, uint32 inGroup) const;
+    std::string        GetField(const M6Field& inField, const boost::smatch& inMatch,
+                        const std::string& inDefault) const;
+
+    std::string        mID;
+    std::vector<M6Matcher>
+                    mMatchers;
+
+    mutable boost::mutex
+                    mTimingMutex;
+    uint32            mCount;
+    double            mTotal, mMax;
+};
+
+// M6Highlighter finds the query terms in a text in a single scan. Matching
+// is case insensitive and on word boundaries, unless the terms contain Han
+// characters in which case any occurrence matches.
+
+class M6Highlighter
+{
+  public:
+                    M6Highlighter(const std::vector<std::string>& inTerms);
+
+    bool            Empty() const                { return mLengths.empty(); }
+
+    // returns offset and length of the leftmost longest occurrences
+    void            Find(const std::string& inText,
+                        std::vector<std::pair<size_t,size_t>>& outMatches) const;
+
+  private:
+    std::vector<std::string>
+                    mTerms;        // folded and sorted
+    std::vector<size_t>
+                    mLengths;    // distinct term lengths, longest first
+    bool            mFirst[256];
+    bool            mWordBoundaries;
+};
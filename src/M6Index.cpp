@@ -889,6 +889,7 @@ struct M6IndexImpl
     virtual void        Find(const string& inLowerBound, const string& inUpperBound, vector<bool>& outBitmap, uint32& outCount) = 0;
     virtual void        FindPattern(const string& inPattern, vector<bool>& outBitmap, uint32& outCount) = 0;
     virtual M6Iterator*    FindString(const string& inString) = 0;
+    virtual M6Iterator*    FindNear(const string& inTermA, const string& inTermB, uint32 inDistance) = 0;
 
     uint32            Size() const                { return mHeader.mSize; }
     uint32            Depth() const                { return mHeader.mDepth; }
@@ -1010,6 +1011,7 @@ class M6IndexImplT : public M6IndexImpl
     virtual void        Find(const string& inLowerBound, const string& inUpperBound, vector<bool>& outBitmap, uint32& outCount);
     virtual void        FindPattern(const string& inPattern, vector<bool>& outBitmap, uint32& outCount);
     virtual M6Iterator*    FindString(const string& inString);
+    virtual M6Iterator*    FindNear(const string& inTermA, const string& inTermB, uint32 inDistance);
 
     virtual bool    Contains(const string& inKey);
 
@@ -2891,7 +2893,7 @@ M6Iterator* M6IndexImplT<M6MultiIDLData>::FindString(const string& inString)
     {
         IndexPage* root(Load<IndexPage>(mHeader.mRoot));
         M6MultiIDLData data;
-        vector<tuple<M6Iterator*,int64,uint32>> iterators;
+        vector<pair<M6MultiIDLData,uint32>> terms;
         bool ok = true;
         uint32 index = 0;
 
@@ -2910,9 +2912,7 @@ M6Iterator* M6IndexImplT<M6MultiIDLData>::FindString(const string& inString)
                     break;
                 }
 
-                iterators.push_back(make_tuple(
-                    new M6MultiDocIterator(M6IBitStream(new M6IBitVectorImpl(*this, data.mBitVector)),
-                            data.mCount), data.mIDLOffset, index));
+                terms.push_back(make_pair(data, index));
                 ++index;
             }
             else if (token == eM6TokenPunctuation)
@@ -2922,14 +2922,78 @@ M6Iterator* M6IndexImplT<M6MultiIDLData>::FindString(const string& inString)
         Release(root);
 
         if (not ok)
+            terms.clear();
+
+        fs::path idlFile = mPath.parent_path() / (mPath.stem().string() + ".idl");
+
+        if (M6PositionalIterator::IsPositionalFile(idlFile))
         {
-            for (auto i : iterators)
-                delete get<0>(i);
-            iterators.clear();
+            // the postings in the .idl file contain the documents as well
+            vector<tuple<int64,uint32,uint32>> postings;
+            for (auto& term : terms)
+                postings.push_back(make_tuple(term.first.mIDLOffset, term.first.mCount, term.second));
+
+            result = new M6PositionalPhraseIterator(idlFile, postings);
         }
+        else
+        {
+            vector<tuple<M6Iterator*,int64,uint32>> iterators;
+            for (auto& term : terms)
+            {
+                iterators.push_back(make_tuple(
+                    new M6MultiDocIterator(M6IBitStream(new M6IBitVectorImpl(*this, term.first.mBitVector)),
+                            term.first.mCount), term.first.mIDLOffset, term.second));
+            }
 
-        fs::path idlFile = mPath.parent_path() / (mPath.stem().string() + ".idl");
-        result = new M6PhraseIterator(idlFile, iterators);
+            result = new M6PhraseIterator(idlFile, iterators);
+        }
+    }
+    return result;
+}
+
+template<class M6DataType>
+M6Iterator* M6IndexImplT<M6DataType>::FindNear(const string& inTermA, const string& inTermB, uint32 inDistance)
+{
+    return nullptr;
+}
+
+template<>
+M6Iterator* M6IndexImplT<M6MultiIDLData>::FindNear(const string& inTermA, const string& inTermB, uint32 inDistance)
+{
+    M6Iterator* result = nullptr;
+    if (mHeader.mRoot != 0)
+    {
+        IndexPage* root(Load<IndexPage>(mHeader.mRoot));
+        M6MultiIDLData a, b;
+        bool found = root->Find(inTermA, a) and root->Find(inTermB, b);
+        Release(root);
+
+        if (found)
+        {
+            fs::path idlFile = mPath.parent_path() / (mPath.stem().string() + ".idl");
+
+            // both terms get index zero, their locations are compared directly
+            if (M6PositionalIterator::IsPositionalFile(idlFile))
+            {
+                vector<tuple<int64,uint32,uint32>> postings;
+                postings.push_back(make_tuple(a.mIDLOffset, a.mCount, 0));
+                postings.push_back(make_tuple(b.mIDLOffset, b.mCount, 0));
+
+                result = new M6ProximityIterator(idlFile, postings, inDistance);
+            }
+            else
+            {
+                vector<tuple<M6Iterator*,int64,uint32>> iterators;
+                for (M6MultiIDLData* data : { &a, &b })
+                {
+                    iterators.push_back(make_tuple(
+                        new M6MultiDocIterator(M6IBitStream(new M6IBitVectorImpl(*this, data->mBitVector)),
+                            data->mCount), data->mIDLOffset, 0));
+                }
+
+                result = new M6PhraseIterator(idlFile, iterators, inDistance);
+            }
+        }
     }
     return result;
 }
@@ -3098,8 +3162,14 @@ void M6IndexImplT<M6DataType>::FinishBatchMode(M6Progress& inProgress)
     string key;
     M6DataType v;
 
-    if (not iter.Next(key, v))
-        return;    // empty index
+    if (not iter.Next(key, v))    // empty index
+    {
+        delete mBatchFile;
+        mBatchFile = nullptr;
+
+        fs::remove(mPath.parent_path() / (mPath.filename().string() + ".bf"));
+        return;
+    }
 
     uint32 n = 1;
 
@@ -3716,6 +3786,11 @@ M6Iterator* M6BasicIndex::FindString(const string& inString)
     return mImpl->FindString(inString);
 }
 
+M6Iterator* M6BasicIndex::FindNear(const string& inTermA, const string& inTermB, uint32 inDistance)
+{
+    return mImpl->FindNear(inTermA, inTermB, inDistance);
+}
+
 bool M6BasicIndex::Contains(const string& inKey)
 {
     return mImpl->Contains(inKey);
@@ -3810,6 +3885,17 @@ void M6MultiBasicIndex::Insert(uint32 inKey, const vector<uint32>& inDocuments)
     mImpl->Insert(to_string(inKey), data);
 }
 
+void M6MultiBasicIndex::InsertTerm(uint32 inTerm, const vector<uint32>& inDocuments)
+{
+    M6MultiData data = { static_cast<uint32>(inDocuments.size()) };
+
+    M6OBitStream bits;
+    CompressSimpleArraySelector(bits, inDocuments);
+    mImpl->StoreBits(bits, data.mBitVector);
+
+    mImpl->Insert(inTerm, data);
+}
+
 void M6MultiBasicIndex::Insert(double inKey, const vector<uint32>& inDocuments)
 {
    M6MultiData data = { static_cast<uint32>(inDocuments.size()) };
@@ -4140,6 +4226,60 @@ void M6WeightedBasicIndex::CalculateDocumentWeights(uint32 inDocCount,
         [](float w) -> float { return sqrt(w); });
 }
 
+void M6WeightedBasicIndex::VisitPostings(PostingVisitor inVisitor, M6Progress& inProgress)
+{
+    typedef M6LeafPage<M6MultiData> LeafPage;
+
+    vector<uint32> docs;
+
+    M6BasicPage* page = mImpl->GetFirstLeafPage();
+    uint32 cntr = 0;
+
+    while (page != nullptr)
+    {
+        LeafPage* leaf = dynamic_cast<LeafPage*>(page);
+        if (leaf == nullptr)
+            THROW(("invalid index"));
+
+        for (uint32 i = 0; i < leaf->GetN(); ++i)
+        {
+            M6MultiData data = leaf->GetValue(i);
+            M6IBitStream bits(new M6IBitVectorImpl(*mImpl, data.mBitVector));
+
+            uint32 weight = mImpl->GetMaxWeight() + 1;
+            uint32 count = data.mCount;
+
+            while (count > 0)
+            {
+                uint32 delta;
+                ReadGamma(bits, delta);
+                weight -= delta;
+
+                ReadArray(bits, docs);
+
+                inVisitor(cntr, data.mCount, static_cast<uint8>(weight), docs);
+
+                count -= static_cast<uint32>(docs.size());
+            }
+
+            ++cntr;
+        }
+
+        inProgress.Progress(cntr);
+
+        uint32 link = page->GetLink();
+        if (link == 0)
+            break;
+
+        M6BasicPage* next = mImpl->Load<M6BasicPage>(page->GetLink());
+        mImpl->Release(page);
+        page = next;
+    }
+
+    if (page != nullptr)
+        mImpl->Release(page);
+}
+
 void M6WeightedBasicIndex::SetMaxWeight(uint32 inMaxWeight)
 {
     mImpl->SetMaxWeight(inMaxWeight);
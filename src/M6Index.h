@@ -140,6 +140,7 @@ class M6BasicIndex
     void            Find(const std::string& inLowerBound, const std::string& inUpperBound, std::vector<bool>& outBitmap, uint32& outCount);
     void            FindPattern(const std::string& inPattern, std::vector<bool>& outBitmap, uint32& outCount);
     M6Iterator*        FindString(const std::string& inString);
+    M6Iterator*        FindNear(const std::string& inTermA, const std::string& inTermB, uint32 inDistance);
 
     uint32            size() const;
     uint32            depth() const;
@@ -229,11 +230,12 @@ class M6MultiBasicIndex : public M6BasicIndex
                     M6MultiBasicIndex(const boost::filesystem::path& inPath, M6IndexType inIndexType, MOpenMode inMode);
 
     void            Insert(const std::string& inKey, const std::vector<uint32>& inDocuments);
+    void            Insert(uint32 inKey, const std::vector<uint32>& inDocuments);
     void            Insert(double inKey, const std::vector<uint32>& inDocuments);
 //    bool            Find(const std::string& inKey, M6CompressedArray& outDocuments);
 
-    // for batch mode only:
-    void            Insert(uint32 inKey, const std::vector<uint32>& inDocuments);
+    // for batch mode only, inTerm is the number of the key in the lexicon:
+    void            InsertTerm(uint32 inTerm, const std::vector<uint32>& inDocuments);
 };
 
 typedef M6Index<M6MultiBasicIndex, M6BasicComparator, eM6CharMultiIndex> M6SimpleMultiIndex;
@@ -297,6 +299,12 @@ class M6WeightedBasicIndex : public M6BasicIndex
     void            CalculateDocumentWeights(uint32 inDocCount, std::vector<float>& outWeights,
                         M6Progress& inProgress);
 
+    // VisitPostings calls inVisitor for each run of documents sharing the
+    // same weight for a term, terms are numbered in index order.
+    typedef boost::function<void(uint32 inTermNr, uint32 inDocFrequency, uint8 inWeight,
+                const std::vector<uint32>& inDocs)>    PostingVisitor;
+    void            VisitPostings(PostingVisitor inVisitor, M6Progress& inProgress);
+
     // for batch mode only:
     void            Insert(uint32 inKey, std::vector<std::pair<uint32,uint8>>& inDocuments);
 
@@ -9,10 +9,22 @@
 
 
 #include "M6Iterator.h"
+#include "M6Error.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
 
+bool M6Iterator::SkipTo(uint32 inDoc, uint32& outDoc, float& outRank)
+{
+    bool result;
+
+    do
+        result = Next(outDoc, outRank);
+    while (result and outDoc < inDoc);
+
+    return result;
+}
+
 void M6Iterator::Intersect(vector<uint32>& ioDocs, M6Iterator* inIterator)
 {
     // merge boolean filter result and ranked results
@@ -43,36 +55,128 @@ void M6Iterator::Intersect(vector<uint32>& ioDocs, M6Iterator* inIterator)
 // --------------------------------------------------------------------
 
 M6NotIterator::M6NotIterator(M6Iterator* inIter, uint32 inMax)
-    : mIter(inIter)
-    , mCur(0)
-    , mNext(0)
-    , mMax(inMax)
+    : mBits(inMax / 64 + 1, ~0ULL)
+    , mCur(1)
 {
+    // document 0 does not exist, nor do those beyond inMax
+    mBits.front() &= ~1ULL;
+    if ((inMax + 1) % 64 != 0)
+        mBits.back() &= (1ULL << ((inMax + 1) % 64)) - 1;
+
     mCount = inMax;
+
     if (inIter != nullptr)
-        mCount -= inIter->GetCount();
+    {
+        uint32 doc;
+        float rank;
+
+        while (inIter->Next(doc, rank) and doc <= inMax)
+        {
+            uint64 bit = 1ULL << (doc % 64);
+            if (mBits[doc / 64] & bit)
+            {
+                mBits[doc / 64] &= ~bit;
+                --mCount;
+            }
+        }
 
-    float rank;
-    if (not mIter->Next(mNext, rank))
-        mNext = 0;
+        delete inIter;
+    }
 }
 
 bool M6NotIterator::Next(uint32& outDoc, float& outRank)
 {
-    for (;;)
+    bool result = false;
+
+    for (uint32 w = mCur / 64; w < mBits.size(); ++w)
     {
-        ++mCur;
-        outDoc = mCur;
-        if (mCur < mNext or mNext == 0 or mIter == nullptr)
+        uint64 bits = mBits[w];
+        if (w == mCur / 64)
+            bits &= ~0ULL << (mCur % 64);
+
+        if (bits != 0)
+        {
+            outDoc = w * 64 + __builtin_ctzll(bits);
+            outRank = 1.0f;
+            mCur = outDoc + 1;
+            result = true;
             break;
+        }
+    }
 
-        assert(mCur == mNext);
-        float rank;
-        if (not mIter->Next(mNext, rank))
-            mNext = 0;
+    if (not result)
+        mCur = static_cast<uint32>(mBits.size() * 64);
+
+    return result;
+}
+
+bool M6NotIterator::SkipTo(uint32 inDoc, uint32& outDoc, float& outRank)
+{
+    if (mCur < inDoc)
+        mCur = inDoc;
+    return Next(outDoc, outRank);
+}
+
+// --------------------------------------------------------------------
+
+M6DifferenceIterator::M6DifferenceIterator(M6Iterator* inA, M6Iterator* inB)
+    : mA(inA), mB(inB), mBitmap(dynamic_cast<M6BitmapIterator*>(inB)), mBDoc(0)
+{
+    if (mA != nullptr)
+    {
+        mCount = mA->GetCount();
+        mRanked = mA->IsRanked();
+    }
+}
+
+M6DifferenceIterator::~M6DifferenceIterator()
+{
+    delete mA;
+    delete mB;
+}
+
+bool M6DifferenceIterator::Excluded(uint32 inDoc)
+{
+    bool result = false;
+
+    if (mBitmap != nullptr)
+        result = mBitmap->Contains(inDoc);
+    else if (mB != nullptr)
+    {
+        if (mBDoc < inDoc)
+        {
+            float rank;
+            if (not mB->SkipTo(inDoc, mBDoc, rank))
+            {
+                delete mB;
+                mB = nullptr;
+            }
+        }
+
+        result = mB != nullptr and mBDoc == inDoc;
     }
 
-    return outDoc <= mMax;
+    return result;
+}
+
+bool M6DifferenceIterator::Next(uint32& outDoc, float& outRank)
+{
+    bool result = false;
+
+    while (not result and mA != nullptr and mA->Next(outDoc, outRank))
+        result = not Excluded(outDoc);
+
+    return result;
+}
+
+bool M6DifferenceIterator::SkipTo(uint32 inDoc, uint32& outDoc, float& outRank)
+{
+    bool result = mA != nullptr and mA->SkipTo(inDoc, outDoc, outRank);
+
+    if (result and Excluded(outDoc))
+        result = Next(outDoc, outRank);
+
+    return result;
 }
 
 // --------------------------------------------------------------------
@@ -157,6 +261,26 @@ bool M6UnionIterator::Next(uint32& outDoc, float& outRank)
     return result;
 }
 
+bool M6UnionIterator::SkipTo(uint32 inDoc, uint32& outDoc, float& outRank)
+{
+    // move the parts that are behind, the heap is rebuilt afterwards
+    for (auto part = mIterators.begin(); part != mIterators.end(); )
+    {
+        float r;
+        if (part->mDoc >= inDoc or part->mIter->SkipTo(inDoc, part->mDoc, r))
+            ++part;
+        else
+        {
+            delete part->mIter;
+            part = mIterators.erase(part);
+        }
+    }
+
+    make_heap(mIterators.begin(), mIterators.end(), greater<M6IteratorPart>());
+
+    return Next(outDoc, outRank);
+}
+
 M6Iterator* M6UnionIterator::Create(M6Iterator* inA, M6Iterator* inB)
 {
     M6Iterator* result;
@@ -182,10 +306,12 @@ M6Iterator* M6UnionIterator::Create(M6Iterator* inA, M6Iterator* inB)
 // --------------------------------------------------------------------
 
 M6IntersectionIterator::M6IntersectionIterator()
+    : mEmpty(false)
 {
 }
 
 M6IntersectionIterator::M6IntersectionIterator(M6Iterator* inA, M6Iterator* inB)
+    : mEmpty(false)
 {
     if (inA != nullptr and inB != nullptr)
     {
@@ -208,26 +334,26 @@ M6IntersectionIterator::~M6IntersectionIterator()
 
 void M6IntersectionIterator::AddIterator(M6Iterator* inIter)
 {
-    if (inIter == nullptr)
+    M6IteratorPart p = { inIter };
+    float r;
+
+    if (mEmpty or inIter == nullptr or not inIter->Next(p.mDoc, r))
     {
+        // intersecting with an empty set, the result is empty as well
+        delete inIter;
+
         for (M6IteratorPart& part : mIterators)
             delete part.mIter;
         mIterators.clear();
+
+        mEmpty = true;
     }
     else
     {
-        M6IteratorPart p = { inIter };
-
-        float r;
-        if (inIter->Next(p.mDoc, r))
-        {
-            mIterators.push_back(p);
+        mIterators.push_back(p);
 
-            if (mCount < p.mIter->GetCount())
-                mCount = p.mIter->GetCount();
-        }
-        else
-            delete inIter;
+        if (mCount < p.mIter->GetCount())
+            mCount = p.mIter->GetCount();
     }
 }
 
@@ -245,13 +371,11 @@ bool M6IntersectionIterator::Next(uint32& outDoc, float& outRank)
 
         for (M6IteratorPart& part : mIterators)
         {
-            while (part.mDoc < outDoc)
+            if (part.mDoc < outDoc and not part.mIter->SkipTo(outDoc, part.mDoc, r))
             {
-                if (not part.mIter->Next(part.mDoc, r))
-                {
-                    done = true;
-                    break;
-                }
+                result = false;
+                done = true;
+                break;
             }
             result = result and part.mDoc == outDoc;
         }
@@ -277,6 +401,30 @@ bool M6IntersectionIterator::Next(uint32& outDoc, float& outRank)
     return result;
 }
 
+bool M6IntersectionIterator::SkipTo(uint32 inDoc, uint32& outDoc, float& outRank)
+{
+    bool done = false;
+
+    for (M6IteratorPart& part : mIterators)
+    {
+        float r;
+        if (part.mDoc < inDoc and not part.mIter->SkipTo(inDoc, part.mDoc, r))
+        {
+            done = true;
+            break;
+        }
+    }
+
+    if (done)
+    {
+        for (M6IteratorPart& part : mIterators)
+            delete part.mIter;
+        mIterators.clear();
+    }
+
+    return Next(outDoc, outRank);
+}
+
 M6Iterator* M6IntersectionIterator::Create(M6Iterator* inA, M6Iterator* inB)
 {
     M6Iterator* result = nullptr;
@@ -294,6 +442,59 @@ M6Iterator* M6IntersectionIterator::Create(M6Iterator* inA, M6Iterator* inB)
 
 // --------------------------------------------------------------------
 
+namespace
+{
+
+// galloping search, returns the first element in [inFirst, inLast) that
+// is not less than inValue. Cheap when that element is near inFirst.
+template<class Iterator, class T>
+Iterator Gallop(Iterator inFirst, Iterator inLast, T inValue)
+{
+    if (inFirst == inLast or not (*inFirst < inValue))
+        return inFirst;
+
+    // invariant: *inFirst < inValue
+    ptrdiff_t step = 1;
+    while (step < inLast - inFirst and inFirst[step] < inValue)
+    {
+        inFirst += step;
+        step *= 2;
+    }
+
+    Iterator last = step < inLast - inFirst ? inFirst + step + 1 : inLast;
+    return lower_bound(inFirst + 1, last, inValue);
+}
+
+// returns true if there are two locations, one from each array, that
+// differ at least one and at most inDistance. The shorter array is walked,
+// the longer one is searched by galloping.
+bool LocationsNear(const vector<uint32>& inA, const vector<uint32>& inB, uint32 inDistance)
+{
+    const vector<uint32>& a = inA.size() <= inB.size() ? inA : inB;
+    const vector<uint32>& b = inA.size() <= inB.size() ? inB : inA;
+
+    auto l = b.begin();
+
+    for (uint32 x : a)
+    {
+        l = Gallop(l, b.end(), x > inDistance ? x - inDistance : 0);
+        if (l == b.end())
+            break;
+
+        for (auto n = l; n != b.end() and *n <= x + inDistance; ++n)
+        {
+            if (*n != x)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+}
+
+// --------------------------------------------------------------------
+
 M6PhraseIterator::M6PhraseIteratorPart::M6PhraseIteratorPart(
     M6Iterator* inIter, M6IBitStream&& inIBitStream, uint32 inIndex)
     : mIter(inIter), mBits(std::move(inIBitStream)), mIndex(inIndex), mDoc(0)
@@ -329,8 +530,8 @@ void M6PhraseIterator::M6PhraseIteratorPart::ReadArray()
 }
 
 M6PhraseIterator::M6PhraseIterator(fs::path& inIDLFile,
-    vector<std::tuple<M6Iterator*,int64,uint32>>& inIterators)
-    : mIDLFile(inIDLFile, eReadOnly)
+    vector<std::tuple<M6Iterator*,int64,uint32>>& inIterators, uint32 inDistance)
+    : mIDLFile(inIDLFile, eReadOnly), mDistance(inDistance)
 {
     bool ok = true;
 
@@ -401,22 +602,27 @@ bool M6PhraseIterator::Next(uint32& outDoc, float& outRank)
             outRank = 1;
 
             // now check the IDL vectors
-            mIDLCache1 = mIterators.front().mIDL;
-
-            for (auto i = mIterators.begin() + 1; i != mIterators.end(); ++i)
+            if (mDistance > 0)
+                result = LocationsNear(mIterators.front().mIDL, mIterators.back().mIDL, mDistance);
+            else
             {
-                mIDLCache2.clear();
+                mIDLCache1 = mIterators.front().mIDL;
 
-                std::set_intersection(mIDLCache1.begin(), mIDLCache1.end(),
-                    i->mIDL.begin(), i->mIDL.end(), std::back_inserter(mIDLCache2));
-
-                if (mIDLCache2.empty())    // no adjacent words found
+                for (auto i = mIterators.begin() + 1; i != mIterators.end(); ++i)
                 {
-                    result = false;
-                    break;
-                }
+                    mIDLCache2.clear();
+
+                    std::set_intersection(mIDLCache1.begin(), mIDLCache1.end(),
+                        i->mIDL.begin(), i->mIDL.end(), std::back_inserter(mIDLCache2));
 
-                swap(mIDLCache1, mIDLCache2);
+                    if (mIDLCache2.empty())    // no adjacent words found
+                    {
+                        result = false;
+                        break;
+                    }
+
+                    swap(mIDLCache1, mIDLCache2);
+                }
             }
 
             for (M6PhraseIteratorPart& part : mIterators)
@@ -445,3 +651,249 @@ bool M6PhraseIterator::Next(uint32& outDoc, float& outRank)
 
     return result;
 }
+
+// --------------------------------------------------------------------
+
+M6PositionalIterator::M6PostingCursor::M6PostingCursor(
+    M6File& inFile, int64 inOffset, uint32 inDocCount, uint32 inIndex)
+    : mFile(&inFile), mNextBlock(inOffset), mDocCount(inDocCount), mIndex(inIndex)
+    , mLastDoc(0), mPrevLastDoc(0), mBlockDocCount(0)
+    , mDocIx(0), mLocationBits(0), mDocsRead(false)
+{
+}
+
+bool M6PositionalIterator::M6PostingCursor::NextBlock()
+{
+    if (mDocCount == 0)
+        return false;
+
+    mBits = M6IBitStream(*mFile, mNextBlock);
+
+    uint32 size, delta;
+    ReadBinary(mBits, 32, size);
+    mNextBlock += sizeof(uint32) + size;
+
+    ReadGamma(mBits, delta);
+    mPrevLastDoc = mLastDoc;
+    mLastDoc += delta;
+
+    ReadGamma(mBits, mBlockDocCount);
+    if (mBlockDocCount > mDocCount)
+        THROW(("Invalid positional postings block"));
+    mDocCount -= mBlockDocCount;
+
+    mDocIx = 0;
+    mDocsRead = false;
+
+    return true;
+}
+
+void M6PositionalIterator::M6PostingCursor::ReadDocs()
+{
+    mDocs.clear();
+    mLocationOffsets.clear();
+
+    uint32 doc = mPrevLastDoc, offset = 0;
+
+    for (uint32 i = 0; i < mBlockDocCount; ++i)
+    {
+        uint32 delta, bits;
+        ReadGamma(mBits, delta);
+        ReadGamma(mBits, bits);
+
+        doc += delta;
+        mDocs.push_back(doc);
+        mLocationOffsets.push_back(offset);
+        offset += bits - 1;
+    }
+
+    // the end of the last location array
+    mLocationOffsets.push_back(offset);
+
+    mLocationBits = 0;
+    mDocsRead = true;
+}
+
+bool M6PositionalIterator::M6PostingCursor::SkipTo(uint32 inDoc)
+{
+    // skip over blocks without decoding their documents
+    while (mLastDoc < inDoc)
+    {
+        if (not NextBlock())
+            return false;
+    }
+
+    if (not mDocsRead)
+        ReadDocs();
+
+    mDocIx = static_cast<uint32>(Gallop(mDocs.begin() + mDocIx, mDocs.end(), inDoc) - mDocs.begin());
+    assert(mDocIx < mDocs.size());
+
+    return true;
+}
+
+void M6PositionalIterator::M6PostingCursor::ReadLocations()
+{
+    // location arrays are read in document order, skip those we did not need
+    assert(mLocationOffsets[mDocIx] >= mLocationBits);
+    mBits.Skip(mLocationOffsets[mDocIx] - mLocationBits);
+
+    ::ReadArray(mBits, mLocations);
+
+    mLocationBits = mLocationOffsets[mDocIx + 1];
+}
+
+M6PositionalIterator::M6PositionalIterator(const fs::path& inIDLFile,
+    const vector<tuple<int64,uint32,uint32>>& inTerms)
+    : mIDLFile(inIDLFile, eReadOnly), mDoc(1)
+{
+    for (auto& term : inTerms)
+    {
+        mCursors.push_back(M6PostingCursor(mIDLFile, get<0>(term), get<1>(term), get<2>(term)));
+
+        if (mCount < get<1>(term))
+            mCount = get<1>(term);
+    }
+
+    // the rarest term leads the intersection
+    sort(mCursors.begin(), mCursors.end(),
+        [](const M6PostingCursor& a, const M6PostingCursor& b) -> bool { return a.mDocCount < b.mDocCount; });
+}
+
+bool M6PositionalIterator::IsPositionalFile(const fs::path& inIDLFile)
+{
+    bool result = false;
+
+    M6File file(inIDLFile, eReadOnly);
+    if (file.Size() >= static_cast<int64>(sizeof(M6PostingFileHeader)))
+    {
+        M6PostingFileHeader header;
+        file.PRead(header, 0);
+
+        if (header.mSignature == kM6PostingFileSignature)
+        {
+            if (header.mVersion > kM6PostingFileVersion)
+                THROW(("Unsupported version of positional postings in %s", inIDLFile.string().c_str()));
+            result = true;
+        }
+    }
+
+    return result;
+}
+
+bool M6PositionalIterator::SkipTo(uint32 inDoc, uint32& outDoc, float& outRank)
+{
+    if (mDoc < inDoc)
+        mDoc = inDoc;
+    return Next(outDoc, outRank);
+}
+
+bool M6PositionalIterator::Next(uint32& outDoc, float& outRank)
+{
+    bool result = false;
+
+    while (not result and not mCursors.empty())
+    {
+        bool match = true;
+
+        for (M6PostingCursor& cursor : mCursors)
+        {
+            if (not cursor.SkipTo(mDoc))
+            {
+                mCursors.clear();
+                match = false;
+                break;
+            }
+
+            if (cursor.Doc() > mDoc)
+            {
+                mDoc = cursor.Doc();
+                match = false;
+                break;
+            }
+        }
+
+        if (match)
+        {
+            result = LocationsMatch();
+            outDoc = mDoc;
+            outRank = 1.0f;
+            ++mDoc;
+        }
+    }
+
+    return result;
+}
+
+// All terms occur in the current document, see if there is a location x
+// so that x + index is a location of each term. The term with the smallest
+// location array provides the candidates, these are then checked against
+// the other terms using a galloping search. Locations of the remaining
+// terms are not read once all candidates are gone.
+
+bool M6PositionalPhraseIterator::LocationsMatch()
+{
+    mOrder.clear();
+    for (M6PostingCursor& cursor : mCursors)
+        mOrder.push_back(&cursor);
+
+    sort(mOrder.begin(), mOrder.end(), [](const M6PostingCursor* a, const M6PostingCursor* b) -> bool
+        { return a->LocationBitSize() < b->LocationBitSize(); });
+
+    M6PostingCursor* lead = mOrder.front();
+    lead->ReadLocations();
+
+    mCandidates.clear();
+    for (uint32 location : lead->mLocations)
+        mCandidates.push_back(static_cast<int64>(location) - lead->mIndex);
+
+    for (auto c = mOrder.begin() + 1; c != mOrder.end() and not mCandidates.empty(); ++c)
+    {
+        M6PostingCursor& cursor = **c;
+        cursor.ReadLocations();
+
+        auto l = cursor.mLocations.begin(), end = cursor.mLocations.end();
+        auto e = mCandidates.begin();
+
+        // galloping only pays off if there are far more locations than candidates
+        bool gallop = cursor.mLocations.size() > 4 * mCandidates.size();
+
+        for (int64 x : mCandidates)
+        {
+            if (gallop)
+                l = Gallop(l, end, x + cursor.mIndex);
+            else
+            {
+                while (l != end and *l < x + cursor.mIndex)
+                    ++l;
+            }
+
+            if (l == end)
+                break;
+
+            if (*l == x + cursor.mIndex)
+                *e++ = x;
+        }
+
+        mCandidates.erase(e, mCandidates.end());
+    }
+
+    return not mCandidates.empty();
+}
+
+// --------------------------------------------------------------------
+
+M6ProximityIterator::M6ProximityIterator(const fs::path& inIDLFile,
+    const vector<tuple<int64,uint32,uint32>>& inTerms, uint32 inDistance)
+    : M6PositionalIterator(inIDLFile, inTerms), mDistance(inDistance)
+{
+    assert(mCursors.size() == 2 or mCursors.empty());
+}
+
+bool M6ProximityIterator::LocationsMatch()
+{
+    mCursors.front().ReadLocations();
+    mCursors.back().ReadLocations();
+
+    return LocationsNear(mCursors.front().mLocations, mCursors.back().mLocations, mDistance);
+}
@@ -25,6 +25,10 @@ class M6Iterator
 
     virtual bool    Next(uint32& outDoc, float& outRank) = 0;
 
+    // return the first document that is not less than inDoc, skipping
+    // over the documents before it. The default implementation calls Next.
+    virtual bool    SkipTo(uint32 inDoc, uint32& outDoc, float& outRank);
+
     static void        Intersect(std::vector<uint32>& ioDocs, M6Iterator* inIterator);
 
     // count is a heuristic, it is a best guess, don't trust it!
@@ -57,7 +61,14 @@ class M6AllDocIterator : public M6Iterator
                     {
                         outRank = 1.0f;
                         outDoc = mCur++;
-                        return mCur <= mMax;
+                        return outDoc <= mMax;
+                    }
+
+    virtual bool    SkipTo(uint32 inDoc, uint32& outDoc, float& outRank)
+                    {
+                        if (mCur < inDoc)
+                            mCur = inDoc;
+                        return Next(outDoc, outRank);
                     }
 
   private:
@@ -114,17 +125,47 @@ class M6MultiDocIterator : public M6Iterator
     M6CompressedArrayIterator    mIter;
 };
 
+// M6NotIterator returns the documents up to and including inMax that are
+// not returned by inIter. The documents of inIter are collected first in
+// a bitmap which is then complemented, a word at a time.
+
 class M6NotIterator : public M6Iterator
 {
   public:
                     M6NotIterator(M6Iterator* inIter, uint32 inMax);
-                    ~M6NotIterator() { delete mIter; }
 
     virtual bool    Next(uint32& outDoc, float& outRank);
+    virtual bool    SkipTo(uint32 inDoc, uint32& outDoc, float& outRank);
 
   private:
-    M6Iterator*        mIter;
-    uint32            mCur, mNext, mMax;
+    std::vector<uint64>
+                    mBits;
+    uint32            mCur;
+};
+
+// M6DifferenceIterator returns the documents of inA that are not in inB.
+// It is driven by inA, inB is only advanced up to the documents of inA
+// using SkipTo. If inB is an M6BitmapIterator it is probed instead.
+
+class M6BitmapIterator;
+
+class M6DifferenceIterator : public M6Iterator
+{
+  public:
+                    M6DifferenceIterator(M6Iterator* inA, M6Iterator* inB);
+                    ~M6DifferenceIterator();
+
+    virtual bool    Next(uint32& outDoc, float& outRank);
+    virtual bool    SkipTo(uint32 inDoc, uint32& outDoc, float& outRank);
+
+  private:
+    bool            Excluded(uint32 inDoc);
+
+    M6Iterator*        mA;
+    M6Iterator*        mB;
+    M6BitmapIterator*
+                    mBitmap;
+    uint32            mBDoc;
 };
 
 // --------------------------------------------------------------------
@@ -153,6 +194,7 @@ class M6UnionIterator : public M6Iterator
     void            AddIterator(M6Iterator* inIter);
 
     virtual bool    Next(uint32& outDoc, float& outRank);
+    virtual bool    SkipTo(uint32 inDoc, uint32& outDoc, float& outRank);
 
     static M6Iterator*
                     Create(M6Iterator* inA, M6Iterator* inB);
@@ -170,7 +212,11 @@ class M6IntersectionIterator : public M6Iterator
 
     void            AddIterator(M6Iterator* inIter);
 
+    // true if one of the iterators added was empty
+    bool            IsEmpty() const                    { return mEmpty; }
+
     virtual bool    Next(uint32& outDoc, float& outRank);
+    virtual bool    SkipTo(uint32 inDoc, uint32& outDoc, float& outRank);
 
     static M6Iterator*
                     Create(M6Iterator* inA, M6Iterator* inB);
@@ -178,14 +224,18 @@ class M6IntersectionIterator : public M6Iterator
   private:
 
     M6IteratorParts    mIterators;
+    bool            mEmpty;
 };
 
 class M6PhraseIterator : public M6Iterator
 {
   public:
 
+                    // with a non-zero inDistance, the two terms should occur at most
+                    // inDistance locations apart instead of forming a phrase
                     M6PhraseIterator(boost::filesystem::path& inIDLFile,
-                        std::vector<std::tuple<M6Iterator*,int64,uint32>>& inIterators);
+                        std::vector<std::tuple<M6Iterator*,int64,uint32>>& inIterators,
+                        uint32 inDistance = 0);
                     ~M6PhraseIterator();
 
     virtual bool    Next(uint32& outDoc, float& outRank);
@@ -218,9 +268,130 @@ class M6PhraseIterator : public M6Iterator
 
     M6PhraseIteratorParts    mIterators;
     M6File                    mIDLFile;
+    uint32                    mDistance;
     std::vector<uint32>        mIDLCache1, mIDLCache2;
 };
 
+// --------------------------------------------------------------------
+//    Positional postings
+//
+//    Newer .idl files start with an M6PostingFileHeader. In these files
+//    the documents of a term are stored together with the in-document
+//    locations, in byte aligned blocks of at most kM6PostingBlockSize
+//    documents. Each block starts with its size in bytes (32 bit binary)
+//    followed by gamma coded values for the last document in the block
+//    (as a delta to the last document of the previous block) and the
+//    number of documents in the block. Next come per document the delta
+//    to the previous document and the bit size of its location array + 1,
+//    followed by the location arrays themselves, written using WriteArray.
+//    This way blocks can be skipped using only their header and locations
+//    are only read for documents that are actually needed.
+
+struct M6PostingFileHeader
+{
+    uint32            mSignature;
+    uint32            mVersion;
+};
+
+const uint32
+    kM6PostingFileSignature = 'm6pp',
+    kM6PostingFileVersion = 1,
+    kM6PostingBlockSize = 128;
+
+// M6PositionalIterator intersects the positional postings of a set of
+// terms at document level. Derived classes decide whether a document
+// that contains all terms is a hit by looking at the locations of the
+// terms, these are only read for such documents.
+
+class M6PositionalIterator : public M6Iterator
+{
+  public:
+                    // the tuples contain the offset of the postings for a term
+                    // in the .idl file, its document count and its index in the query
+                    M6PositionalIterator(const boost::filesystem::path& inIDLFile,
+                        const std::vector<std::tuple<int64,uint32,uint32>>& inTerms);
+
+    virtual bool    Next(uint32& outDoc, float& outRank);
+    virtual bool    SkipTo(uint32 inDoc, uint32& outDoc, float& outRank);
+
+    // returns true if inIDLFile is written in the positional postings format
+    static bool        IsPositionalFile(const boost::filesystem::path& inIDLFile);
+
+  protected:
+
+    struct M6PostingCursor
+    {
+                            M6PostingCursor(M6File& inFile, int64 inOffset,
+                                uint32 inDocCount, uint32 inIndex);
+
+        uint32                Doc() const                        { return mDocs[mDocIx]; }
+        uint32                LocationBitSize() const
+                                { return mLocationOffsets[mDocIx + 1] - mLocationOffsets[mDocIx]; }
+
+        // move to the first document that is >= inDoc, returns false if there is none
+        bool                SkipTo(uint32 inDoc);
+        // read the locations for the current document
+        void                ReadLocations();
+
+        M6File*                mFile;
+        int64                mNextBlock;
+        uint32                mDocCount;        // documents in blocks not yet read
+        uint32                mIndex;
+        uint32                mLastDoc, mPrevLastDoc;
+        uint32                mBlockDocCount;
+        uint32                mDocIx, mLocationBits;
+        bool                mDocsRead;
+        M6IBitStream        mBits;
+        std::vector<uint32>    mDocs, mLocationOffsets, mLocations;
+
+      private:
+        bool                NextBlock();
+        void                ReadDocs();
+    };
+
+    // called for each document that contains all terms
+    virtual bool    LocationsMatch() = 0;
+
+    M6File                        mIDLFile;
+    std::vector<M6PostingCursor>mCursors;
+    uint32                        mDoc;
+};
+
+// Phrases: the terms should occur at consecutive locations, as given
+// by their index in the query.
+
+class M6PositionalPhraseIterator : public M6PositionalIterator
+{
+  public:
+                    M6PositionalPhraseIterator(const boost::filesystem::path& inIDLFile,
+                        const std::vector<std::tuple<int64,uint32,uint32>>& inTerms)
+                        : M6PositionalIterator(inIDLFile, inTerms) {}
+
+  private:
+    virtual bool    LocationsMatch();
+
+    std::vector<M6PostingCursor*>
+                    mOrder;
+    std::vector<int64>
+                    mCandidates;
+};
+
+// Proximity: two terms should occur at most inDistance locations apart,
+// in any order.
+
+class M6ProximityIterator : public M6PositionalIterator
+{
+  public:
+                    M6ProximityIterator(const boost::filesystem::path& inIDLFile,
+                        const std::vector<std::tuple<int64,uint32,uint32>>& inTerms,
+                        uint32 inDistance);
+
+  private:
+    virtual bool    LocationsMatch();
+
+    uint32            mDistance;
+};
+
 class M6VectorIterator : public M6Iterator
 {
   public:
@@ -291,6 +462,18 @@ class M6BitmapIterator : public M6Iterator
                         return result;
                     }
 
+    virtual bool    SkipTo(uint32 inDoc, uint32& outDoc, float& outRank)
+                    {
+                        if (mPtr < mVector.begin() + inDoc and inDoc <= mVector.size())
+                            mPtr = mVector.begin() + inDoc;
+                        return Next(outDoc, outRank);
+                    }
+
+    bool            Contains(uint32 inDoc) const
+                    {
+                        return inDoc < mVector.size() and mVector[inDoc];
+                    }
+
   private:
     M6Vector        mVector;
     M6Vector::iterator
@@ -5,381 +5,336 @@
 
 #include "M6Lib.h"
 
+#include <atomic>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #include <boost/thread.hpp>
-#include <boost/thread/condition.hpp>
-#include <boost/algorithm/string.hpp>
 
 #include "M6Error.h"
 #include "M6Lexicon.h"
 #include "M6Index.h"
 
 using namespace std;
-namespace ba = boost::algorithm;
 
 // --------------------------------------------------------------------
+// The lexicon is a hash table split into shards. Each shard has its own
+// open addressing table and its own arena for the strings. A slot in a
+// table contains the lower 32 bits of the hash of a word and its number.
+// Slots are written only while holding the shard's mutex, but they are
+// read without any locking. When a table grows, the old table is kept
+// around until the lexicon is destroyed since other threads might still
+// be reading it.
+//
+// The strings are stored in the arena prefixed by their length. The
+// address of a string is found by its number using an array of blocks,
+// block i contains kBlockSize * 2^i entries.
+
+namespace
+{
 
-// M6LexPage stores strings without null terminator packed in s.
-// e is an array with offsets into s, s and e grow towards each other.
-// This asserts that space is used optimally.
+const uint32
+    kBlockSize = 256,
+    kBlockCount = 24,
+    kMaxWordCount = kBlockSize * ((1U << kBlockCount) - 1),
+    kSharedShardCount = 64,
+    kMinTableSize = 64,
+    kMinArenaPageSize = 4 * 1024,
+    kMaxArenaPageSize = 8 * 1024 * 1024;
 
-struct M6LexPage
+inline uint64 Hash(const char* inWord, size_t inWordLength)
 {
-    // pages are 8 MB each:
-    static const uint32 kLexDataSize = 8 * 1024 * 1024 - 2 * sizeof(uint32);
-
-    uint32        N;
-    uint32        first;
-    union
+    // FNV-1a
+    uint64 h = 14695981039346656037ULL;
+    for (size_t i = 0; i < inWordLength; ++i)
     {
-        char        s[kLexDataSize];
-        uint32        e[kLexDataSize / sizeof(uint32)];
-    };
-
-                M6LexPage(uint32 inFirst)
-                    : N(0)
-                    , first(inFirst)
-                {
-                    e[0] = kLexDataSize;
-                }
+        h ^= static_cast<uint8>(inWord[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
 
-    void        Add(const char* inWord, size_t inWordLength)
-                {
-                    assert(N == 0 or Free() >= inWordLength + sizeof(uint32));
-                    e[N + 1] = static_cast<uint32>(e[N] - inWordLength);
-                    memcpy(s + e[N + 1], inWord, inWordLength);
-                    ++N;
-                }
+// find the block containing entry inNr and the offset in that block
+inline uint32 GetBlock(uint32 inNr, uint32& outOffset)
+{
+    uint32 x = inNr / kBlockSize + 1;
 
-    void        GetEntry(uint32 inEntry, const char*& outWord, size_t& outWordLength) const
-                {
-                    assert(inEntry < N);
-                    assert(e[inEntry + 1] <= e[inEntry]);
-                    assert(e[inEntry] <= kLexDataSize);
+#if defined(_MSC_VER)
+    unsigned long block;
+    _BitScanReverse(&block, x);
+#else
+    uint32 block = 31 - __builtin_clz(x);
+#endif
 
-                    outWord = s + e[inEntry + 1];
-                    outWordLength = e[inEntry] - e[inEntry + 1];
-                }
-
-    int            Compare(const char* inWord, size_t inWordLength, uint32 inEntry) const
-                {
-                    assert(static_cast<int32>(inEntry) < N);
-                    assert(e[inEntry + 1] < e[inEntry]);
-                    assert(e[inEntry] <= kLexDataSize);
+    outOffset = inNr - kBlockSize * ((1U << block) - 1);
+    return block;
+}
 
-                    size_t l = e[inEntry] - e[inEntry + 1];
-                    if (l > inWordLength)
-                        l = inWordLength;
+}
 
-                    int d = memcmp(inWord, s + e[inEntry + 1], l);
-                    if (d == 0)
+struct M6LexTable
+{
+                    M6LexTable(uint32 inSize)
+                        : mMask(inSize - 1), mSlots(new atomic<uint64>[inSize])
                     {
-                        if (inWordLength > l)
-                            d = 1;
-                        else if (e[inEntry] - e[inEntry + 1] > l)
-                            d = -1;
+                        for (uint32 i = 0; i < inSize; ++i)
+                            mSlots[i].store(0, memory_order_relaxed);
                     }
 
-                    return d;
-                }
+                    ~M6LexTable()                    { delete[] mSlots; }
 
-    int            Compare(const M6LexPage* inPage, uint32 inPEntry, uint32 inEntry) const
-                {
-                    assert(inPEntry < inPage->N);
-                    assert(inEntry < N);
+    uint32            Size() const                    { return mMask + 1; }
 
-                    const uint32* e1 = inPage->e;
-                    const uint32* e2 = e;
-
-                    uint32 l1 = e1[inPEntry] - e1[inPEntry + 1];
-                    uint32 l2 = e2[inEntry] - e2[inEntry + 1];
-
-                    static const M6BasicComparator comp = M6BasicComparator();
-                    return comp(inPage->s + e1[inPEntry + 1], l1, s + e2[inEntry + 1], l2);
-                }
+    uint32            mMask;
+    atomic<uint64>*    mSlots;
+};
 
-    bool        TestKeyBit(uint32 inEntry, uint32 inBit) const
-                {
-                    assert(static_cast<int32>(inEntry) < N);
-                    assert(e[inEntry + 1] < e[inEntry]);
-                    assert(e[inEntry] <= kLexDataSize);
+struct M6LexShard
+{
+                    M6LexShard()
+                        : mTable(new M6LexTable(kMinTableSize)), mUsed(0)
+                        , mPageFree(0), mPageSize(kMinArenaPageSize), mPage(nullptr) {}
+                    ~M6LexShard();
 
-                    bool result = false;
+    const char*        Allocate(const char* inWord, size_t inWordLength);
 
-                    uint32 byte = inBit >> 3;
-                    if (byte < e[inEntry] - e[inEntry + 1])
-                    {
-                        uint32 bit = 7 - (inBit & 0x0007);
-                        result = (s[e[inEntry + 1] + byte] & (1 << bit)) != 0;
-                    }
+    atomic<M6LexTable*>    mTable;
+    uint32            mUsed;
+    boost::mutex    mMutex;
 
-                    return result;
-                }
+    vector<M6LexTable*>    mRetired;
 
-    uint32        Free() const
-                {
-                    return e[N] - (N + 1) * sizeof(uint32);
-                }
+    // the arena
+    vector<char*>    mPages;
+    uint32            mPageFree;
+    uint32            mPageSize;
+    char*            mPage;
 };
 
-// --------------------------------------------------------------------
-
-struct M6LexiconImpl
+M6LexShard::~M6LexShard()
 {
-    // M6Node is a node in a Patricia tree
-    // and we store kIxNodeCount node in a page
+    delete mTable.load();
+    for (M6LexTable* table : mRetired)
+        delete table;
+    for (char* page : mPages)
+        delete[] page;
+}
 
-    static const uint32 kIxNodeCount = 8 * 1024;
+const char* M6LexShard::Allocate(const char* inWord, size_t inWordLength)
+{
+    uint32 size = static_cast<uint32>(sizeof(uint32) + inWordLength);
+    size = (size + 3) & ~3;        // keep the length prefix aligned
 
-    struct M6Node
+    if (mPageFree < size)
     {
-        M6Node*            left;
-        M6Node*            right;
-        uint32            value;
-        uint32            bit;
-    };
+        uint32 pageSize = max(mPageSize, size);
+
+        mPage = new char[pageSize];
+        mPages.push_back(mPage);
+        mPageFree = pageSize;
+
+        // start small, lexicons for a single document contain few words
+        if (mPageSize < kMaxArenaPageSize)
+            mPageSize *= 2;
+    }
+
+    char* result = mPage;
+    mPage += size;
+    mPageFree -= size;
 
-                    M6LexiconImpl();
+    *reinterpret_cast<uint32*>(result) = static_cast<uint32>(inWordLength);
+    memcpy(result + sizeof(uint32), inWord, inWordLength);
+
+    return result;
+}
+
+// --------------------------------------------------------------------
+
+struct M6LexiconImpl
+{
+                    M6LexiconImpl(uint32 inShardCount);
                     ~M6LexiconImpl();
 
     uint32            Lookup(const char* inWord, size_t inWordLength) const;
     uint32            Store(const char* inWord, size_t inWordLength);
     void            GetString(uint32 inNr, const char*& outWord, size_t& outWordLength) const;
-    const M6Node*    Find(const M6Node* inNode, const char* inWord, size_t inWordLength) const;
-    bool            Find(const char* inWord, size_t inWordLength, uint32& outNr) const;
-    int                Compare(const char* inWord, size_t inWordLength, uint32 inNr) const;
     int                Compare(uint32 inA, uint32 inB) const;
 
-    bool            TestKeyBit(const char* inWord, size_t inWordLength, uint32 inBit) const
-                    {
-                        bool result = false;
-
-                        uint32 byte = inBit >> 3;
-                        if (byte < inWordLength)
-                        {
-                            uint32 bit = 7 - (inBit & 0x0007);
-                            result = (inWord[byte] & (1 << bit)) != 0;
-                        }
-
-                        return result;
-                    }
-
-    bool            CompareKeyBits(const char* inWordA, size_t inWordALength,
-                        const char* inWordB, size_t inWordBLength, uint32 inBit) const
+    M6LexShard&        GetShard(uint64 inHash) const
                     {
-                        return
-                            TestKeyBit(inWordA, inWordALength, inBit) ==
-                            TestKeyBit(inWordB, inWordBLength, inBit);
+                        return mShards[(inHash >> 32) % mShardCount];
                     }
 
-    bool            CompareKeyBits(const char* inWord, size_t inWordLength, uint32 inNr, uint32 inBit) const;
+    uint32            Find(const M6LexTable* inTable, uint64 inHash,
+                        const char* inWord, size_t inWordLength) const;
 
+    const char*        GetEntry(uint32 inNr) const;
+    void            SetEntry(uint32 inNr, const char* inEntry);
 
-    typedef vector<M6LexPage*> LexPageArray;
-
-    LexPageArray::const_iterator
-                    GetPage(uint32& ioNr) const;
-
-    typedef vector<M6Node*> NodePageArray;
-
-    M6Node*            AllocateNode();
-
-    LexPageArray    mPages;
-    NodePageArray    mNodes;
-    M6Node*            mRoot;
-    uint32            mCount;
+    uint32            mShardCount;
+    M6LexShard*        mShards;
+    atomic<const char**>
+                    mBlocks[kBlockCount];
+    atomic<uint32>    mCount;
 };
 
-// --------------------------------------------------------------------
-
-M6LexiconImpl::M6LexiconImpl()
-    : mCount(0)
+M6LexiconImpl::M6LexiconImpl(uint32 inShardCount)
+    : mShardCount(inShardCount)
+    , mShards(new M6LexShard[inShardCount])
+    , mCount(1)
 {
-    mPages.push_back(new M6LexPage(0));
-
-    mRoot = AllocateNode();
+    for (auto& block : mBlocks)
+        block.store(nullptr, memory_order_relaxed);
 
-    mRoot->value = 0;
-    mRoot->bit = 0;
-    mRoot->left = mRoot;
-    mRoot->right = mRoot;
-
-    mPages.front()->Add(" ", 1);
-    mCount = 1;
+    // entry zero is reserved, it is never found by Lookup
+    SetEntry(0, mShards[0].Allocate(" ", 1));
 }
 
 M6LexiconImpl::~M6LexiconImpl()
 {
-    for (LexPageArray::iterator p = mPages.begin(); p != mPages.end(); ++p)
-        delete *p;
+    delete[] mShards;
 
-    for (NodePageArray::iterator p = mNodes.begin(); p != mNodes.end(); ++p)
-        delete[] *p;
+    for (auto& block : mBlocks)
+        delete[] block.load();
 }
 
-M6LexiconImpl::M6Node* M6LexiconImpl::AllocateNode()
+inline const char* M6LexiconImpl::GetEntry(uint32 inNr) const
 {
-    uint32 ix = mCount % kIxNodeCount;
+    uint32 offset;
+    uint32 block = GetBlock(inNr, offset);
 
-    if (ix == 0)    // time for a new node page
-    {
-        assert((mCount / kIxNodeCount) == mNodes.size());
-        mNodes.push_back(new M6Node[kIxNodeCount]);
-    }
+    const char** entries = mBlocks[block].load(memory_order_acquire);
+    if (entries == nullptr)
+        THROW(("Lexicon is invalid"));
 
-    return mNodes.back() + ix;
+    return entries[offset];
 }
 
-inline M6LexiconImpl::LexPageArray::const_iterator
-M6LexiconImpl::GetPage(uint32& ioNr) const
+void M6LexiconImpl::SetEntry(uint32 inNr, const char* inEntry)
 {
-    int32 L = 0, R = static_cast<int32>(mPages.size() - 1);
-    while (L <= R)
-    {
-        int32 i = (L + R) / 2;
+    uint32 offset;
+    uint32 block = GetBlock(inNr, offset);
 
-        if (mPages[i]->first <= ioNr)
-            L = i + 1;
+    const char** entries = mBlocks[block].load(memory_order_acquire);
+    if (entries == nullptr)
+    {
+        // several shards may need a new block at the same time
+        const char** newEntries = new const char*[kBlockSize << block]();
+        if (mBlocks[block].compare_exchange_strong(entries, newEntries))
+            entries = newEntries;
         else
-            R = i - 1;
+            delete[] newEntries;
     }
 
-    LexPageArray::const_iterator p = mPages.begin() + L - 1;
-
-    assert(L > 0);
-    assert(uint32(L - 1) < mPages.size());
-    assert((*p)->first <= ioNr);
-    assert(ioNr < (*p)->first + (*p)->N);
-
-    ioNr -= (*p)->first;
-
-    return p;
+    entries[offset] = inEntry;
 }
 
-const M6LexiconImpl::M6Node* M6LexiconImpl::Find(const M6Node* inNode, const char* inWord, size_t inWordLength) const
+uint32 M6LexiconImpl::Find(const M6LexTable* inTable, uint64 inHash,
+    const char* inWord, size_t inWordLength) const
 {
-    const M6Node* p;
+    uint32 tag = static_cast<uint32>(inHash);
 
-    do
+    for (uint32 i = tag & inTable->mMask; ; i = (i + 1) & inTable->mMask)
     {
-        p = inNode;
+        uint64 slot = inTable->mSlots[i].load(memory_order_acquire);
+        if (slot == 0)
+            break;
 
-        if (TestKeyBit(inWord, inWordLength, inNode->bit))
-            inNode = inNode->right;
-        else
-            inNode = inNode->left;
-    }
-    while (p->bit < inNode->bit);
+        if (static_cast<uint32>(slot >> 32) != tag)
+            continue;
 
-    return inNode;
-}
-
-bool M6LexiconImpl::Find(const char* inWord, size_t inWordLength, uint32& outNr) const
-{
-    bool result = false;
+        uint32 nr = static_cast<uint32>(slot);
+        const char* entry = GetEntry(nr);
 
-    if (mCount > 0)
-    {
-        const M6Node* t = Find(mRoot, inWord, inWordLength);
-        if (t != nullptr and Compare(inWord, inWordLength, t->value) == 0)
+        if (*reinterpret_cast<const uint32*>(entry) == inWordLength and
+            memcmp(entry + sizeof(uint32), inWord, inWordLength) == 0)
         {
-            result = true;
-            outNr = t->value;
+            return nr;
         }
     }
 
-    return result;
+    return 0;
 }
 
 uint32 M6LexiconImpl::Lookup(const char* inWord, size_t inWordLength) const
 {
-    uint32 result = 0;
-
-    const M6Node* t = Find(mRoot, inWord, inWordLength);
+    uint64 h = Hash(inWord, inWordLength);
+    M6LexShard& shard = GetShard(h);
 
-    if (t != mRoot and Compare(inWord, inWordLength, t->value) == 0)
-        result = t->value;
-
-    return result;
+    return Find(shard.mTable.load(memory_order_acquire), h, inWord, inWordLength);
 }
 
 uint32 M6LexiconImpl::Store(const char* inWord, size_t inWordLength)
 {
-    // check first to see if something has been added to inNode
-    // while we were locked...
+    uint64 h = Hash(inWord, inWordLength);
+    M6LexShard& shard = GetShard(h);
 
-    const M6Node* t = Find(mRoot, inWord, inWordLength);
+    uint32 result = Find(shard.mTable.load(memory_order_acquire), h, inWord, inWordLength);
 
-    if (t != mRoot and Compare(inWord, inWordLength, t->value) == 0)
-        return t->value;
+    if (result == 0)
+    {
+        boost::mutex::scoped_lock lock(shard.mMutex);
 
-    uint32 i = 0;
+        // check again, another thread may have stored the word in the meantime
+        M6LexTable* table = shard.mTable.load(memory_order_relaxed);
+        result = Find(table, h, inWord, inWordLength);
 
-    while (CompareKeyBits(inWord, inWordLength, t->value, i))
-        ++i;
+        if (result == 0)
+        {
+            result = mCount.fetch_add(1);
+            if (result >= kMaxWordCount)
+                THROW(("Lexicon is full"));
 
-    M6Node* p;
-    M6Node* x = mRoot;
+            SetEntry(result, shard.Allocate(inWord, inWordLength));
 
-    do
-    {
-        p = x;
-        if (TestKeyBit(inWord, inWordLength, x->bit))
-            x = x->right;
-        else
-            x = x->left;
-    }
-    while (x->bit < i and p->bit < x->bit);
+            if (2 * (shard.mUsed + 1) > table->Size())
+            {
+                M6LexTable* newTable = new M6LexTable(2 * table->Size());
 
-    if (mPages.back()->Free() < inWordLength + sizeof(uint32))
-        mPages.push_back(new M6LexPage(mCount));
+                for (uint32 i = 0; i < table->Size(); ++i)
+                {
+                    uint64 slot = table->mSlots[i].load(memory_order_relaxed);
+                    if (slot == 0)
+                        continue;
+
+                    uint32 j = static_cast<uint32>(slot >> 32) & newTable->mMask;
+                    while (newTable->mSlots[j].load(memory_order_relaxed) != 0)
+                        j = (j + 1) & newTable->mMask;
+                    newTable->mSlots[j].store(slot, memory_order_relaxed);
+                }
 
-    mPages.back()->Add(inWord, inWordLength);
+                shard.mRetired.push_back(table);
+                shard.mTable.store(newTable, memory_order_release);
+                table = newTable;
+            }
 
-    M6Node* n = AllocateNode();
-    n->value = mCount;
-    n->bit = i;
+            uint32 tag = static_cast<uint32>(h);
+            uint32 i = tag & table->mMask;
+            while (table->mSlots[i].load(memory_order_relaxed) != 0)
+                i = (i + 1) & table->mMask;
 
-    if (TestKeyBit(inWord, inWordLength, n->bit))
-    {
-        n->right = n;
-        n->left = x;
-    }
-    else
-    {
-        n->right = x;
-        n->left = n;
+            table->mSlots[i].store((static_cast<uint64>(tag) << 32) | result, memory_order_release);
+            ++shard.mUsed;
+        }
     }
 
-    if (TestKeyBit(inWord, inWordLength, p->bit))
-        p->right = n;
-    else
-        p->left = n;
-
-    uint32 result = mCount;
-
-    ++mCount;
-
     return result;
 }
 
 inline void M6LexiconImpl::GetString(uint32 inNr, const char*& outWord, size_t& outWordLength) const
 {
-    LexPageArray::const_iterator p = GetPage(inNr);
-
-    if (p == mPages.end() or (*p)->N == 0 or inNr >= (*p)->N)
+    if (inNr >= mCount)
         THROW(("Lexicon is invalid"));
 
-    return (*p)->GetEntry(inNr, outWord, outWordLength);
-}
-
-int M6LexiconImpl::Compare(const char* inWord, size_t inWordLength, uint32 inNr) const
-{
-    LexPageArray::const_iterator p = GetPage(inNr);
-
-    if (p == mPages.end() or (*p)->N == 0 or inNr >= (*p)->N)
+    const char* entry = GetEntry(inNr);
+    if (entry == nullptr)
         THROW(("Lexicon is invalid"));
 
-    return (*p)->Compare(inWord, inWordLength, inNr);
+    outWordLength = *reinterpret_cast<const uint32*>(entry);
+    outWord = entry + sizeof(uint32);
 }
 
 int M6LexiconImpl::Compare(uint32 inA, uint32 inB) const
@@ -388,39 +343,25 @@ int M6LexiconImpl::Compare(uint32 inA, uint32 inB) const
 
     if (inA != inB)
     {
-        LexPageArray::const_iterator a = GetPage(inA);
-        LexPageArray::const_iterator b = GetPage(inB);
+        const char* a;
+        size_t la;
+        GetString(inA, a, la);
 
-        assert(a != mPages.end());
-        assert(b != mPages.end());
+        const char* b;
+        size_t lb;
+        GetString(inB, b, lb);
 
-        if (a != mPages.end() and inA < (*a)->N and
-            b != mPages.end() and inB < (*b)->N)
-        {
-            result = (*b)->Compare(*a, inA, inB);
-        }
-        else
-            assert(false);
+        static const M6BasicComparator comp = M6BasicComparator();
+        result = comp(a, la, b, lb);
     }
 
     return result;
 }
 
-bool M6LexiconImpl::CompareKeyBits(const char* inWord, size_t inWordLength, uint32 inNr, uint32 inBit) const
-{
-    LexPageArray::const_iterator p = GetPage(inNr);
-
-    if (p == mPages.end() or (*p)->N == 0 or inNr >= (*p)->N)
-        THROW(("Lexicon is invalid"));
-
-    return
-        TestKeyBit(inWord, inWordLength, inBit) == (*p)->TestKeyBit(inNr, inBit);
-}
-
 // --------------------------------------------------------------------
 
-M6Lexicon::M6Lexicon()
-    : mImpl(new M6LexiconImpl)
+M6Lexicon::M6Lexicon(bool inShared)
+    : mImpl(new M6LexiconImpl(inShared ? kSharedShardCount : 1))
 {
 }
 
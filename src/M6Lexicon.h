@@ -10,10 +10,15 @@
 
 #include <boost/thread.hpp>
 
-// M6Lexicon stores text strings in an ordered way using the least
-// possible amount of memory. Each text string gets a unique number.
-// Strings can be accessed by this number and the number for a string
-// can be found very quickly since the storage is based on a Patricia tree.
+// M6Lexicon stores text strings using the least possible amount of
+// memory. Each text string gets a unique number. Strings can be accessed
+// by this number and the number for a string can be found very quickly
+// since the storage is based on a hash table.
+//
+// M6Lexicon is one of the most heavily used classes and it is shared
+// by all threads building a databank. Looking up words that are already
+// known does not require any locking, storing new words locks only a
+// part of the lexicon. Callers therefore do not need to synchronise.
 
 class M6Lexicon
 {
@@ -23,57 +28,12 @@ class M6Lexicon
 
     // since we now have several locations where a M6Lexicon class
     // is used, we have the option to create a lightweight version.
-                    M6Lexicon();
+    // A lexicon that is shared by many threads should be created with
+    // inShared set to true, it is split up in more parts to reduce
+    // contention.
+    explicit        M6Lexicon(bool inShared = false);
     virtual            ~M6Lexicon();
 
-    // M6Lexicon is one of the most heavily used classes.
-    // To optimize, we now use separate threads but there
-    // can only be one lexicon. So we need locking.
-    // Profiling has shown that locking is taking a
-    // disproportionate amount of time, so we split the
-    // code into a part that looks up words first in a
-    // shared lock mode and then stores those unknown
-    // in a unique lock mode.
-
-    class M6SharedLock
-    {
-      public:
-                    M6SharedLock(M6Lexicon& inLexicon)
-                        : mMutex(inLexicon.mMutex)
-                    {
-                        mMutex.lock_shared();
-                    }
-
-                    ~M6SharedLock()
-                    {
-                        mMutex.unlock_shared();
-                    }
-
-      private:
-        boost::shared_mutex&    mMutex;
-    };
-
-    class M6UniqueLock
-    {
-      public:
-                    M6UniqueLock(M6Lexicon& inLexicon)
-                        : mMutex(inLexicon.mMutex)
-                    {
-                        mMutex.lock();
-                    }
-
-                    ~M6UniqueLock()
-                    {
-                        mMutex.unlock();
-                    }
-
-      private:
-        boost::shared_mutex&    mMutex;
-    };
-
-    friend class M6SharedLock;
-    friend class M6UniqueLock;
-
     uint32            Lookup(const std::string& inWord) const;
     uint32            Lookup(const char* inWord, size_t inWordLength) const;
 
@@ -95,7 +55,6 @@ class M6Lexicon
     M6Lexicon&        operator=(const M6Lexicon&);
 
     struct M6LexiconImpl*    mImpl;
-    boost::shared_mutex        mMutex;
 };
 
 // --------------------------------------------------------------------
@@ -0,0 +1,585 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#include "M6Lib.h"
+
+#include <cstring>
+#include <map>
+#include <queue>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+#include "M6LinkGraph.h"
+#include "M6Error.h"
+#include "M6File.h"
+#include "M6Iterator.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+namespace io = boost::iostreams;
+namespace ip = boost::interprocess;
+
+// The file starts with a header and a table with the databanks. A node
+// in the adjacency lists is the databank number in the upper 32 bits
+// and the document number in the lower 32 bits. The offset tables for
+// the forward and reverse adjacency lists contain an entry for each
+// document of each databank, the entries for a databank start at
+// mFirstNode. The lists are sorted and so the links to a single
+// databank form a range in each list.
+
+const uint32
+    kM6LinkGraphSignature    = 'm6lg',
+    kM6LinkGraphVersion        = 2;
+
+struct M6LinkGraphHeader
+{
+    uint32        mSignature;
+    uint32        mVersion;
+    uint32        mDatabankCount;
+    uint32        mReserved;
+    int64        mNodeCount;
+    int64        mLinkCount;
+    int64        mDatabanks;
+    int64        mForwardOffsets;    // file offset of mNodeCount + 1 offsets into the forward links
+    int64        mReverseOffsets;
+    int64        mForward;
+    int64        mReverse;
+    int64        mFileSize;
+};
+
+struct M6LinkGraphDatabank
+{
+    char        mUUID[40];
+    uint32        mDocCount;
+    uint32        mReserved;
+    int64        mFirstNode;
+};
+
+static_assert(sizeof(M6LinkGraphDatabank) == 56, "Link graph databank is of incorrect size");
+
+inline uint64 M6LinkNode(uint32 inDb, uint32 inDocNr)
+{
+    return (static_cast<uint64>(inDb) << 32) | inDocNr;
+}
+
+struct M6LinkGraphImpl
+{
+                M6LinkGraphImpl(const fs::path& inFile);
+
+    // the links from or to inNode into databank inDb
+    void        GetRange(const int64* inOffsets, const uint64* inLinks, int64 inNode, uint32 inDb,
+                    const uint64*& outBegin, const uint64*& outEnd) const;
+
+    io::mapped_file                mFile;
+    const M6LinkGraphHeader*    mHeader;
+    const M6LinkGraphDatabank*    mDatabanks;
+    const int64*                mForwardOffsets;
+    const int64*                mReverseOffsets;
+    const uint64*                mForward;
+    const uint64*                mReverse;
+};
+
+M6LinkGraphImpl::M6LinkGraphImpl(const fs::path& inFile)
+{
+    mFile.open(inFile.string().c_str(), io::mapped_file::readonly);
+    if (not mFile.is_open())
+        THROW(("Could not open link graph %s", inFile.string().c_str()));
+
+    const char* data = mFile.const_data();
+    mHeader = reinterpret_cast<const M6LinkGraphHeader*>(data);
+
+    if (mFile.size() < sizeof(M6LinkGraphHeader) or
+        mHeader->mSignature != kM6LinkGraphSignature or mHeader->mVersion != kM6LinkGraphVersion or
+        mHeader->mFileSize != static_cast<int64>(mFile.size()))
+    {
+        THROW(("Link graph %s is invalid", inFile.string().c_str()));
+    }
+
+    mDatabanks = reinterpret_cast<const M6LinkGraphDatabank*>(data + mHeader->mDatabanks);
+    mForwardOffsets = reinterpret_cast<const int64*>(data + mHeader->mForwardOffsets);
+    mReverseOffsets = reinterpret_cast<const int64*>(data + mHeader->mReverseOffsets);
+    mForward = reinterpret_cast<const uint64*>(data + mHeader->mForward);
+    mReverse = reinterpret_cast<const uint64*>(data + mHeader->mReverse);
+}
+
+void M6LinkGraphImpl::GetRange(const int64* inOffsets, const uint64* inLinks, int64 inNode,
+    uint32 inDb, const uint64*& outBegin, const uint64*& outEnd) const
+{
+    outBegin = lower_bound(inLinks + inOffsets[inNode], inLinks + inOffsets[inNode + 1], M6LinkNode(inDb, 0));
+    outEnd = lower_bound(outBegin, inLinks + inOffsets[inNode + 1], M6LinkNode(inDb + 1, 0));
+}
+
+// --------------------------------------------------------------------
+// The links are collected in runs, each run is sorted and appended to
+// a temporary file. The runs are merged again when the adjacency lists
+// are written, much like the entry runs of the full text index.
+
+struct M6Link
+{
+    uint64        mFrom, mTo;
+
+    bool        operator<(const M6Link& inLink) const
+                    { return mFrom < inLink.mFrom or (mFrom == inLink.mFrom and mTo < inLink.mTo); }
+    bool        operator==(const M6Link& inLink) const
+                    { return mFrom == inLink.mFrom and mTo == inLink.mTo; }
+};
+
+class M6LinkRuns
+{
+  public:
+                    M6LinkRuns(const fs::path& inFile);
+                    ~M6LinkRuns();
+
+    void            Add(uint64 inFrom, uint64 inTo);
+
+    // Merge calls inVisitor for each link, sorted and unique
+    template<class Visitor>
+    void            Merge(Visitor inVisitor);
+
+  private:
+
+    // 2 x 64 MB for the forward and reverse runs
+    enum {
+        kM6LinkRunSize = 4000000,
+        kM6LinkReadSize = 65536
+    };
+
+    struct M6Run
+    {
+        int64        mOffset;
+        int64        mCount;
+    };
+
+    struct M6RunIterator
+    {
+                    M6RunIterator(M6File& inFile, const M6Run& inRun)
+                        : mFile(inFile), mRun(inRun), mIndex(0) {}
+
+        bool        Next();
+
+        M6File&        mFile;
+        M6Run        mRun;
+        vector<M6Link>
+                    mBuffer;
+        uint32        mIndex;
+        M6Link        mLink;
+    };
+
+    struct CompareRunIterator
+    {
+        bool operator()(const M6RunIterator* a, const M6RunIterator* b) const
+        {
+            return b->mLink < a->mLink;
+        }
+    };
+
+    void            FlushRun();
+
+    fs::path        mPath;
+    M6File            mFile;
+    vector<M6Link>    mBuffer;
+    vector<M6Run>    mRuns;
+};
+
+M6LinkRuns::M6LinkRuns(const fs::path& inFile)
+    : mPath(inFile), mFile(inFile, eReadWrite)
+{
+    mBuffer.reserve(kM6LinkRunSize);
+}
+
+M6LinkRuns::~M6LinkRuns()
+{
+    mFile.Close();
+    fs::remove(mPath);
+}
+
+void M6LinkRuns::Add(uint64 inFrom, uint64 inTo)
+{
+    M6Link link = { inFrom, inTo };
+    mBuffer.push_back(link);
+
+    if (mBuffer.size() == kM6LinkRunSize)
+        FlushRun();
+}
+
+void M6LinkRuns::FlushRun()
+{
+    sort(mBuffer.begin(), mBuffer.end());
+    mBuffer.erase(unique(mBuffer.begin(), mBuffer.end()), mBuffer.end());
+
+    M6Run run = { mFile.Size(), static_cast<int64>(mBuffer.size()) };
+    if (not mBuffer.empty())
+        mFile.PWrite(&mBuffer[0], mBuffer.size() * sizeof(M6Link), run.mOffset);
+    mRuns.push_back(run);
+
+    mBuffer.clear();
+}
+
+bool M6LinkRuns::M6RunIterator::Next()
+{
+    if (mIndex == mBuffer.size())
+    {
+        if (mRun.mCount == 0)
+            return false;
+
+        uint32 n = kM6LinkReadSize;
+        if (n > mRun.mCount)
+            n = static_cast<uint32>(mRun.mCount);
+
+        mBuffer.resize(n);
+        mFile.PRead(&mBuffer[0], n * sizeof(M6Link), mRun.mOffset);
+
+        mRun.mOffset += n * sizeof(M6Link);
+        mRun.mCount -= n;
+        mIndex = 0;
+    }
+
+    mLink = mBuffer[mIndex++];
+    return true;
+}
+
+template<class Visitor>
+void M6LinkRuns::Merge(Visitor inVisitor)
+{
+    // the usual case, all links fit in a single run
+    if (mRuns.empty())
+    {
+        sort(mBuffer.begin(), mBuffer.end());
+        mBuffer.erase(unique(mBuffer.begin(), mBuffer.end()), mBuffer.end());
+
+        for (const M6Link& link : mBuffer)
+            inVisitor(link);
+
+        return;
+    }
+
+    FlushRun();
+
+    vector<unique_ptr<M6RunIterator>> iterators;
+    priority_queue<M6RunIterator*, vector<M6RunIterator*>, CompareRunIterator> queue;
+
+    for (const M6Run& run : mRuns)
+    {
+        iterators.emplace_back(new M6RunIterator(mFile, run));
+        if (iterators.back()->Next())
+            queue.push(iterators.back().get());
+    }
+
+    bool first = true;
+    M6Link last = {};
+
+    while (not queue.empty())
+    {
+        M6RunIterator* iter = queue.top();
+        queue.pop();
+
+        if (first or not (iter->mLink == last))
+        {
+            inVisitor(iter->mLink);
+            last = iter->mLink;
+            first = false;
+        }
+
+        if (iter->Next())
+            queue.push(iter);
+    }
+}
+
+// write the adjacency lists for inRuns, the offsets for all inNodeCount
+// nodes are written to ioOffsets, returns the number of links written
+
+static int64 WriteAdjacencyLists(M6LinkRuns& inRuns, const vector<M6LinkGraphDatabank>& inDatabanks,
+    int64 inNodeCount, M6File& ioLinks, M6File& ioOffsets)
+{
+    const uint32 kBufferSize = 65536;
+
+    vector<uint64> links;
+    vector<int64> offsets;
+
+    links.reserve(kBufferSize);
+    offsets.reserve(kBufferSize);
+
+    int64 linkCount = 0, node = 0;
+
+    auto writeOffsets = [&](int64 inLastNode)
+    {
+        for (; node <= inLastNode; ++node)
+        {
+            offsets.push_back(linkCount);
+            if (offsets.size() == kBufferSize)
+            {
+                ioOffsets.Write(&offsets[0], offsets.size() * sizeof(int64));
+                offsets.clear();
+            }
+        }
+    };
+
+    inRuns.Merge([&](const M6Link& inLink)
+    {
+        uint32 db = static_cast<uint32>(inLink.mFrom >> 32), docNr = static_cast<uint32>(inLink.mFrom);
+        writeOffsets(inDatabanks[db].mFirstNode + docNr);
+
+        links.push_back(inLink.mTo);
+        if (links.size() == kBufferSize)
+        {
+            ioLinks.Write(&links[0], links.size() * sizeof(uint64));
+            links.clear();
+        }
+
+        ++linkCount;
+    });
+
+    writeOffsets(inNodeCount);
+
+    if (not links.empty())
+        ioLinks.Write(&links[0], links.size() * sizeof(uint64));
+    if (not offsets.empty())
+        ioOffsets.Write(&offsets[0], offsets.size() * sizeof(int64));
+
+    return linkCount;
+}
+
+// --------------------------------------------------------------------
+
+const uint32 M6LinkGraph::kNoDatabank;
+
+M6LinkGraph::M6LinkGraph(const fs::path& inFile)
+    : mImpl(new M6LinkGraphImpl(inFile))
+{
+}
+
+M6LinkGraph::~M6LinkGraph()
+{
+    delete mImpl;
+}
+
+uint32 M6LinkGraph::GetDatabankNr(const M6Databank& inDatabank) const
+{
+    uint32 result = kNoDatabank;
+
+    string uuid = inDatabank.GetUUID();
+
+    for (uint32 db = 0; db < mImpl->mHeader->mDatabankCount; ++db)
+    {
+        if (uuid == mImpl->mDatabanks[db].mUUID)
+        {
+            if (inDatabank.GetMaxDocNr() == mImpl->mDatabanks[db].mDocCount)
+                result = db;
+            break;
+        }
+    }
+
+    return result;
+}
+
+void M6LinkGraph::GetLinkedDocuments(uint32 inDb, uint32 inDocNr, uint32 inTargetDb,
+    vector<uint32>& outDocNrs) const
+{
+    outDocNrs.clear();
+
+    uint32 dbCount = mImpl->mHeader->mDatabankCount;
+    if (inDb >= dbCount or inTargetDb >= dbCount or inDocNr >= mImpl->mDatabanks[inDb].mDocCount)
+        return;
+
+    int64 node = mImpl->mDatabanks[inDb].mFirstNode + inDocNr;
+
+    const uint64 *fb, *fe, *rb, *re;
+    mImpl->GetRange(mImpl->mForwardOffsets, mImpl->mForward, node, inTargetDb, fb, fe);
+    mImpl->GetRange(mImpl->mReverseOffsets, mImpl->mReverse, node, inTargetDb, rb, re);
+
+    vector<uint64> nodes;
+    nodes.reserve((fe - fb) + (re - rb));
+    set_union(fb, fe, rb, re, back_inserter(nodes));
+
+    outDocNrs.reserve(nodes.size());
+    for (uint64 n : nodes)
+        outDocNrs.push_back(static_cast<uint32>(n));
+}
+
+uint32 M6LinkGraph::CountLinkedDocuments(uint32 inDb, uint32 inDocNr, uint32 inTargetDb) const
+{
+    uint32 dbCount = mImpl->mHeader->mDatabankCount;
+    if (inDb >= dbCount or inTargetDb >= dbCount or inDocNr >= mImpl->mDatabanks[inDb].mDocCount)
+        return 0;
+
+    int64 node = mImpl->mDatabanks[inDb].mFirstNode + inDocNr;
+
+    const uint64 *fb, *fe, *rb, *re;
+    mImpl->GetRange(mImpl->mForwardOffsets, mImpl->mForward, node, inTargetDb, fb, fe);
+    mImpl->GetRange(mImpl->mReverseOffsets, mImpl->mReverse, node, inTargetDb, rb, re);
+
+    // count the union of both ranges
+    uint32 result = 0;
+    while (fb != fe and rb != re)
+    {
+        if (*fb < *rb)
+            ++fb;
+        else if (*rb < *fb)
+            ++rb;
+        else
+            ++fb, ++rb;
+        ++result;
+    }
+
+    return result + static_cast<uint32>((fe - fb) + (re - rb));
+}
+
+void M6LinkGraph::GetLinkedDatabanks(uint32 inDb, uint32 inDocNr,
+    vector<pair<uint32,uint32>>& outDbs) const
+{
+    outDbs.clear();
+
+    uint32 dbCount = mImpl->mHeader->mDatabankCount;
+    if (inDb >= dbCount or inDocNr >= mImpl->mDatabanks[inDb].mDocCount)
+        return;
+
+    for (uint32 db = 0; db < dbCount; ++db)
+    {
+        uint32 count = CountLinkedDocuments(inDb, inDocNr, db);
+        if (count > 0)
+            outDbs.push_back(make_pair(db, count));
+    }
+}
+
+void M6LinkGraph::Create(const fs::path& inFile, const vector<M6Databank*>& inDatabanks,
+    const M6LinkMap& inLinkMap)
+{
+    // only one process at a time can create the graph
+    fs::path lockFile(inFile.parent_path() / (inFile.filename().string() + ".lock"));
+    if (not fs::exists(lockFile))
+    {
+        fs::ofstream file(lockFile);
+    }
+
+    ip::file_lock lock(lockFile.string().c_str());
+    ip::scoped_lock<ip::file_lock> guard(lock);
+
+    vector<M6LinkGraphDatabank> databanks;
+    map<M6Databank*,uint32> databankNr;
+    int64 nodeCount = 0;
+
+    for (M6Databank* db : inDatabanks)
+    {
+        M6LinkGraphDatabank d = {};
+
+        string uuid = db->GetUUID();
+        if (uuid.length() >= sizeof(d.mUUID))
+            THROW(("Invalid databank UUID %s", uuid.c_str()));
+        strcpy(d.mUUID, uuid.c_str());
+
+        d.mDocCount = db->GetMaxDocNr();
+        d.mFirstNode = nodeCount;
+        nodeCount += d.mDocCount;
+
+        databankNr[db] = static_cast<uint32>(databanks.size());
+        databanks.push_back(d);
+    }
+
+    // write to a temporary file first, a running server may have the
+    // current graph mapped
+
+    fs::path tmpFile(inFile.parent_path() / fs::unique_path(inFile.filename().string() + "-%%%%-%%%%-%%%%.tmp"));
+    fs::path offsetsFile(tmpFile.string() + "-offsets");
+
+    try
+    {
+        M6LinkRuns forwardRuns(tmpFile.string() + "-forward"), reverseRuns(tmpFile.string() + "-reverse");
+
+        // collect all links as (from, to) node pairs, the link indices of
+        // a databank map the ID of a linked document to the linking documents
+
+        for (uint32 db = 0; db < inDatabanks.size(); ++db)
+        {
+            uint32 count = databanks[db].mDocCount;
+
+            inDatabanks[db]->VisitLinks([&](const string& inDb, const string& inId, M6Iterator& inDocs)
+            {
+                auto l = inLinkMap.find(inDb);
+                if (l == inLinkMap.end())
+                    return;
+
+                vector<uint64> targets;
+                for (M6Databank* target : l->second)
+                {
+                    auto t = databankNr.find(target);
+                    if (t == databankNr.end())
+                        continue;
+
+                    uint32 docNr = target->DocNrForID(inId);
+                    if (docNr != 0 and docNr < databanks[t->second].mDocCount)
+                        targets.push_back(M6LinkNode(t->second, docNr));
+                }
+
+                uint32 docNr;
+                float rank;
+
+                while (not targets.empty() and inDocs.Next(docNr, rank))
+                {
+                    if (docNr >= count)
+                        continue;
+
+                    for (uint64 target : targets)
+                    {
+                        forwardRuns.Add(M6LinkNode(db, docNr), target);
+                        reverseRuns.Add(target, M6LinkNode(db, docNr));
+                    }
+                }
+            });
+        }
+
+        M6LinkGraphHeader header = { kM6LinkGraphSignature, kM6LinkGraphVersion,
+            static_cast<uint32>(databanks.size()) };
+
+        header.mNodeCount = nodeCount;
+        header.mDatabanks = sizeof(header);
+        header.mForward = header.mDatabanks + databanks.size() * sizeof(M6LinkGraphDatabank);
+
+        M6File file(tmpFile, eReadWrite);
+        file.Truncate(0);
+
+        // the header is written again when all offsets are known
+        file.Write(&header, sizeof(header));
+        if (not databanks.empty())
+            file.Write(&databanks[0], databanks.size() * sizeof(M6LinkGraphDatabank));
+
+        M6File offsets(offsetsFile, eReadWrite);
+        offsets.Truncate(0);
+
+        header.mLinkCount = WriteAdjacencyLists(forwardRuns, databanks, nodeCount, file, offsets);
+        header.mReverse = header.mForward + header.mLinkCount * sizeof(uint64);
+
+        int64 reverseCount = WriteAdjacencyLists(reverseRuns, databanks, nodeCount, file, offsets);
+        header.mForwardOffsets = header.mReverse + reverseCount * sizeof(uint64);
+        header.mReverseOffsets = header.mForwardOffsets + (nodeCount + 1) * sizeof(int64);
+        header.mFileSize = header.mReverseOffsets + (nodeCount + 1) * sizeof(int64);
+
+        // append the offset tables
+        vector<char> buffer(1024 * 1024);
+        for (int64 offset = 0; offset < offsets.Size(); offset += buffer.size())
+        {
+            int64 n = buffer.size();
+            if (n > offsets.Size() - offset)
+                n = offsets.Size() - offset;
+
+            offsets.PRead(&buffer[0], n, offset);
+            file.Write(&buffer[0], n);
+        }
+
+        file.PWrite(header, 0);
+    }
+    catch (...)
+    {
+        fs::remove(tmpFile);
+        fs::remove(offsetsFile);
+        throw;
+    }
+
+    fs::remove(offsetsFile);
+    fs::rename(tmpFile, inFile);
+}
@@ -0,0 +1,57 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <vector>
+#include <boost/filesystem/path.hpp>
+
+#include "M6Databank.h"
+
+struct M6LinkGraphImpl;
+
+// The link graph contains the resolved links between the documents of
+// all databanks, as forward (document links to) and reverse (document is
+// linked from) adjacency lists. It is created with mrs link-graph after
+// the databanks have been built. A databank is identified by its UUID and
+// document count so a databank that was rebuilt afterwards is simply not
+// part of the graph and links to and from it are resolved the old way.
+
+class M6LinkGraph
+{
+  public:
+                    M6LinkGraph(const boost::filesystem::path& inFile);
+                    ~M6LinkGraph();
+
+    static const uint32 kNoDatabank = ~0U;
+
+    // GetDatabankNr returns kNoDatabank if the graph does not contain
+    // inDatabank or if it was changed after the graph was created
+    uint32            GetDatabankNr(const M6Databank& inDatabank) const;
+
+    // returns the documents in databank inTargetDb that are linked from
+    // or link to document inDocNr in databank inDb, sorted and unique
+    void            GetLinkedDocuments(uint32 inDb, uint32 inDocNr, uint32 inTargetDb,
+                        std::vector<uint32>& outDocNrs) const;
+    uint32            CountLinkedDocuments(uint32 inDb, uint32 inDocNr, uint32 inTargetDb) const;
+
+    // returns the databanks that contain documents linked from or to
+    // document inDocNr in databank inDb along with the number of linked
+    // documents in each
+    void            GetLinkedDatabanks(uint32 inDb, uint32 inDocNr,
+                        std::vector<std::pair<uint32,uint32>>& outDbs) const;
+
+    // inDatabanks should have been initialised with InitLinkMap. The
+    // links are sorted on disk, so memory use does not depend on the
+    // number of links. Only one process at a time can create the graph.
+    static void        Create(const boost::filesystem::path& inFile,
+                        const std::vector<M6Databank*>& inDatabanks, const M6LinkMap& inLinkMap);
+
+  private:
+                    M6LinkGraph(const M6LinkGraph&);
+    M6LinkGraph&    operator=(const M6LinkGraph&);
+
+    M6LinkGraphImpl*    mImpl;
+};
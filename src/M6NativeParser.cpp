@@ -0,0 +1,1007 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#include "M6Lib.h"
+
+#include <set>
+#include <vector>
+
+#include <boost/regex.hpp>
+#include <boost/format.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "M6NativeParser.h"
+#include "M6Document.h"
+#include "M6Error.h"
+
+using namespace std;
+namespace ba = boost::algorithm;
+
+// --------------------------------------------------------------------
+// Helpers that mimic the XS callbacks used by the Perl scripts in
+// M6Parser.cpp: empty text or string values are silently ignored,
+// empty numbers and links are errors.
+
+namespace
+{
+
+// Perl's \s and \w on byte strings
+inline bool IsSpace(char c)
+{
+    return c == ' ' or c == '\t' or c == '\n' or c == '\r' or c == '\f' or c == '\v';
+}
+
+inline bool IsWord(char c)
+{
+    return (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or (c >= '0' and c <= '9') or c == '_';
+}
+
+inline bool IsDigit(char c)
+{
+    return c >= '0' and c <= '9';
+}
+
+// the regular expressions below are written in Perl syntax, '.' does not
+// match a newline and ^ and $ match at line boundaries only when the
+// Perl version used the /m modifier
+const boost::regex::flag_type kRx = boost::regex::perl | boost::regex::no_mod_s;
+const boost::regex::flag_type kRxSingleLine = kRx | boost::regex::no_mod_m;
+
+void IndexText(M6InputDocument* inDoc, const string& inIndex, const string& inText)
+{
+    if (not inText.empty())
+        inDoc->Index(inIndex, eM6TextData, false, inText.c_str(), inText.length());
+}
+
+void IndexString(M6InputDocument* inDoc, const string& inIndex, const string& inText,
+    bool inUnique = false)
+{
+    if (not inText.empty())
+        inDoc->Index(inIndex, eM6StringData, inUnique, inText.c_str(), inText.length());
+}
+
+void IndexNumber(M6InputDocument* inDoc, const string& inIndex, const string& inText)
+{
+    if (inText.empty())
+        THROW(("Error, value is undefined in call to index_number"));
+    inDoc->Index(inIndex, eM6NumberData, false, inText.c_str(), inText.length());
+}
+
+void AddLink(M6InputDocument* inDoc, const string& inDatabank, const string& inValue)
+{
+    if (inDatabank.empty())
+        THROW(("Error, databank is undefined in call to add_link"));
+    if (inValue.empty())
+        THROW(("Error, value is undefined in call to add_link"));
+    inDoc->AddLink(inDatabank, inValue);
+}
+
+void SetAttribute(M6InputDocument* inDoc, const string& inName, const string& inValue)
+{
+    inDoc->SetAttribute(inName, inValue.c_str(), inValue.length());
+}
+
+// Perl's split removes trailing empty fields
+
+void PopEmptyFields(vector<string>& ioFields)
+{
+    while (not ioFields.empty() and ioFields.back().empty())
+        ioFields.pop_back();
+}
+
+// split(m/;\s*/, $s)
+vector<string> SplitSemicolon(const string& inText)
+{
+    vector<string> result;
+
+    string::size_type s = 0;
+    for (;;)
+    {
+        string::size_type e = inText.find(';', s);
+        if (e == string::npos)
+        {
+            result.push_back(inText.substr(s));
+            break;
+        }
+
+        result.push_back(inText.substr(s, e - s));
+
+        s = e + 1;
+        while (s < inText.length() and IsSpace(inText[s]))
+            ++s;
+    }
+
+    PopEmptyFields(result);
+    return result;
+}
+
+// split(m/<inSeparator>/, $s) for a literal separator
+vector<string> Split(const string& inText, const string& inSeparator)
+{
+    vector<string> result;
+
+    string::size_type s = 0;
+    for (;;)
+    {
+        string::size_type e = inText.find(inSeparator, s);
+        if (e == string::npos)
+        {
+            result.push_back(inText.substr(s));
+            break;
+        }
+
+        result.push_back(inText.substr(s, e - s));
+        s = e + inSeparator.length();
+    }
+
+    PopEmptyFields(result);
+    return result;
+}
+
+// Perl's substr returns the empty string when reading past the end
+string SubStr(const string& inText, string::size_type inOffset, string::size_type inLength = string::npos)
+{
+    return inOffset < inText.length() ? inText.substr(inOffset, inLength) : string();
+}
+
+// $s =~ s/\s+$//
+void TrimRight(string& ioText)
+{
+    string::size_type n = ioText.length();
+    while (n > 0 and IsSpace(ioText[n - 1]))
+        --n;
+    ioText.erase(n);
+}
+
+// $s =~ s/.{72}/$&\n/g
+string WrapSequence(const string& inSequence)
+{
+    string result;
+    result.reserve(inSequence.length() + inSequence.length() / 72 + 1);
+
+    for (string::size_type i = 0; i < inSequence.length(); i += 72)
+    {
+        result.append(inSequence, i, 72);
+        if (i + 72 <= inSequence.length())
+            result += '\n';
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------
+// The line type formats (UniProt, EMBL) are parsed by the Perl scripts
+// by taking groups of lines sharing the same two letter code:
+//
+//    m/^(?:([A-Z]{2})   ).+\n(?:\1.+\n)*/gm
+//
+// and then stripping the line codes with s/^$key   //mg.
+
+class M6LineGroupReader
+{
+  public:
+                    M6LineGroupReader(const string& inText)
+                        : mText(inText), mOffset(0) {}
+
+    bool            Next(string& outKey, string& outValue);
+
+  private:
+
+    // offset of the newline ending a line of at least inMinLength
+    // characters starting at inOffset, or npos
+    string::size_type
+                    LineEnd(string::size_type inOffset, string::size_type inMinLength) const;
+
+    const string&    mText;
+    string::size_type
+                    mOffset;
+};
+
+string::size_type M6LineGroupReader::LineEnd(string::size_type inOffset,
+    string::size_type inMinLength) const
+{
+    string::size_type result = mText.find('\n', inOffset);
+    if (result != string::npos and result - inOffset < inMinLength)
+        result = string::npos;
+    return result;
+}
+
+bool M6LineGroupReader::Next(string& outKey, string& outValue)
+{
+    const string& text = mText;
+
+    while (mOffset < text.length())
+    {
+        string::size_type line = mOffset;
+        string::size_type eol = text.find('\n', line);
+
+        mOffset = eol == string::npos ? text.length() : eol + 1;
+
+        if (eol == string::npos or eol - line < 6 or
+            text[line] < 'A' or text[line] > 'Z' or text[line + 1] < 'A' or text[line + 1] > 'Z' or
+            text.compare(line + 2, 3, "   ") != 0)
+        {
+            continue;
+        }
+
+        outKey.assign(text, line, 2);
+        outValue.clear();
+
+        for (;;)
+        {
+            if (text.compare(line + 2, 3, "   ") == 0)
+                outValue.append(text, line + 5, eol + 1 - line - 5);
+            else
+                outValue.append(text, line, eol + 1 - line);
+
+            line = eol + 1;
+            if (text.compare(line, 2, outKey) != 0)
+                break;
+
+            eol = LineEnd(line, 3);
+            if (eol == string::npos)
+                break;
+
+            mOffset = eol + 1;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// --------------------------------------------------------------------
+// uniprot, see parsers/uniprot.pm
+
+class M6UniProtParser : public M6NativeParser
+{
+  public:
+    virtual void    Parse(M6InputDocument* inDoc,
+                        const string& inFileName, const string& inDbHeader);
+    virtual bool    ToFasta(const string& inDoc, const string& inDb,
+                        const string& inID, const string& inTitle, string& outFasta);
+};
+
+void M6UniProtParser::Parse(M6InputDocument* inDoc,
+    const string& inFileName, const string& inDbHeader)
+{
+    static const boost::regex
+        kTitleRx("Full=(.+?);", kRx),
+        kECRx("(EC=)(\\d+\\.\\d+\\.\\d+\\.\\d+)", kRx),
+        kDateRx("(\\d{2})-(JAN|FEB|MAR|APR|MAY|JUN|JUL|AUG|SEP|OCT|NOV|DEC)-(\\d{4})", kRx),
+        kGNRx("(?:\\w+=)?(.+);", kRx),
+        kOCRx("(.+);", kRx),
+        kRXRx("(MEDLINE|PubMed|DOI)=([^;]+);", kRx),
+        kDRRx("^(.+?); (.+?);(?: (.+?);)?", kRx),
+        kSQRx("SEQUENCE\\s+(\\d+) AA;\\s+(\\d+) MW;\\s+([0-9A-F]{16}) CRC64;", kRx);
+
+    static const char* kMonths[] = {
+        "JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"
+    };
+
+    const boost::sregex_iterator end;
+
+    M6LineGroupReader reader(inDoc->Peek());
+    string key, value;
+
+    while (reader.Next(key, value))
+    {
+        if (key == "ID")
+        {
+            string::size_type n = 0;
+            while (n < value.length() and IsWord(value[n]))
+                ++n;
+
+            if (n == 0)
+                THROW(("No ID in UniProt record?\n%s   %s", key.c_str(), value.c_str()));
+
+            string id = value.substr(0, n);
+            IndexString(inDoc, "id", id, true);
+            SetAttribute(inDoc, "id", id);
+        }
+        else if (key == "AC")
+        {
+            vector<string> acs = SplitSemicolon(value);
+            for (vector<string>::size_type i = 0; i < acs.size(); ++i)
+            {
+                if (i == 0)
+                {
+                    IndexString(inDoc, "ac", acs[i], true);
+                    SetAttribute(inDoc, "ac", acs[i]);
+                }
+                else
+                    IndexString(inDoc, "ac", acs[i]);
+            }
+        }
+        else if (key == "DE")
+        {
+            boost::smatch m;
+            if (boost::regex_search(value, m, kTitleRx))
+                SetAttribute(inDoc, "title", m[1]);
+            IndexText(inDoc, "de", value);
+
+            for (boost::sregex_iterator i(value.begin(), value.end(), kECRx); i != end; ++i)
+                AddLink(inDoc, "enzyme", (*i)[2]);
+        }
+        else if (key == "DT")
+        {
+            for (boost::sregex_iterator i(value.begin(), value.end(), kDateRx); i != end; ++i)
+            {
+                int month = 0;
+                while ((*i)[2] != kMonths[month])
+                    ++month;
+
+                string date = (boost::format("%04d-%02d-%02d")
+                    % stoi((*i)[3]) % (month + 1) % stoi((*i)[1])).str();
+                IndexString(inDoc, "dt", date);
+            }
+        }
+        else if (key == "GN")
+        {
+            for (boost::sregex_iterator i(value.begin(), value.end(), kGNRx); i != end; ++i)
+                IndexText(inDoc, "gn", (*i)[1]);
+        }
+        else if (key == "OC" or key == "KW")
+        {
+            string index = ba::to_lower_copy(key);
+            for (boost::sregex_iterator i(value.begin(), value.end(), kOCRx); i != end; ++i)
+                IndexString(inDoc, index, (*i)[1]);
+        }
+        else if (key == "CC")
+        {
+            vector<string> lines;
+            ba::split(lines, value, ba::is_any_of("\n"));
+
+            for (const string& line : lines)
+            {
+                if (line.empty() or
+                    line == "-----------------------------------------------------------------------" or
+                    line == "Copyrighted by the UniProt Consortium, see http://www.uniprot.org/terms" or
+                    line == "Distributed under the Creative Commons Attribution-NoDerivs License")
+                {
+                    continue;
+                }
+
+                IndexText(inDoc, "cc", line);
+            }
+        }
+        else if (key == "RX")
+        {
+            for (boost::sregex_iterator i(value.begin(), value.end(), kRXRx); i != end; ++i)
+                IndexString(inDoc, ba::to_lower_copy(string((*i)[1])), (*i)[2]);
+        }
+        else if (key[0] == 'R')
+            IndexText(inDoc, "ref", value);
+        else if (key == "DR")
+        {
+            for (boost::sregex_iterator i(value.begin(), value.end(), kDRRx); i != end; ++i)
+            {
+                string db = (*i)[1], id = (*i)[2];
+                string ldb = ba::to_lower_copy(db);
+
+                if (ldb == "prosite" or ldb == "pfam")
+                    id = (*i)[3];
+                else if (ldb == "refseq")
+                {
+                    string::size_type n = id.length();
+                    while (n > 0 and IsDigit(id[n - 1]))
+                        --n;
+                    if (n < id.length() and n > 0 and id[n - 1] == '.')
+                        id.erase(n - 1);
+                }
+                else if (ldb == "go")
+                    id = SubStr(id, 3);
+
+                AddLink(inDoc, db, id);
+            }
+
+            IndexText(inDoc, "dr", value);
+        }
+        else if (key == "SQ")
+        {
+            boost::smatch m;
+            if (boost::regex_search(value, m, kSQRx))
+            {
+                IndexNumber(inDoc, "length", m[1]);
+                IndexNumber(inDoc, "mw", m[2]);
+                IndexString(inDoc, "crc64", m[3]);
+            }
+
+            break;
+        }
+        else if (key != "XX")
+            IndexText(inDoc, ba::to_lower_copy(key), value);
+    }
+}
+
+bool M6UniProtParser::ToFasta(const string& inDoc, const string& inDb,
+    const string& inID, const string& inTitle, string& outFasta)
+{
+    static const boost::regex
+        kSQRx("SEQUENCE\\s+(\\d+) AA;\\s+\\d+ MW;\\s+[0-9A-F]{16} CRC64;\\n", kRx);
+
+    boost::smatch m;
+    if (not boost::regex_search(inDoc, m, kSQRx))
+        THROW(("no sequence"));
+
+    string::size_type length = stoul(m[1]);
+
+    // the sequence lines all start with white space and are followed by the '//' line
+    string seq;
+    seq.reserve(length);
+
+    string::size_type line = m[0].second - inDoc.begin();
+    while (line < inDoc.length() and IsSpace(inDoc[line]))
+    {
+        string::size_type eol = inDoc.find('\n', line);
+        if (eol == string::npos)
+            break;
+
+        for (string::size_type i = line; i < eol; ++i)
+        {
+            if (not IsSpace(inDoc[i]))
+                seq += inDoc[i];
+        }
+
+        line = eol + 1;
+    }
+
+    if (seq.empty() or inDoc.compare(line, 2, "//") != 0)
+        THROW(("no sequence"));
+
+    if (seq.length() != length)
+        THROW(("invalid SEQUENCE record %d!=%d", static_cast<int>(seq.length()), static_cast<int>(length)));
+
+    outFasta = ">gnl|" + inDb + '|' + inID + ' ' + inTitle + '\n' + WrapSequence(seq) + '\n';
+
+    return true;
+}
+
+// --------------------------------------------------------------------
+// embl, see parsers/embl.pm
+
+class M6EMBLParser : public M6NativeParser
+{
+  public:
+    virtual void    Parse(M6InputDocument* inDoc,
+                        const string& inFileName, const string& inDbHeader);
+};
+
+void M6EMBLParser::Parse(M6InputDocument* inDoc,
+    const string& inFileName, const string& inDbHeader)
+{
+    static const boost::regex
+        kIDRx("(\\w+);.*", kRx),
+        kDRRx("^(.+?); (.+?);", kRx),
+        kFeatureRx("^\\w+\\s+((?:\\S.+)(?:\\n\\s{15,}.+)*)", kRx),
+        kQualifierRx("/(\\w+)=(?|([^\"].+)|\"((?:[^\"]++|\"\")*)\")\\n?", kRx),
+        kDbXrefRx("^(.+?):(.+)$", kRxSingleLine);
+
+    const boost::sregex_iterator end;
+
+    M6LineGroupReader reader(inDoc->Peek());
+    string key, value;
+
+    while (reader.Next(key, value))
+    {
+        // chomp
+        if (not value.empty() and value.back() == '\n')
+            value.pop_back();
+
+        if (key == "XX" or key == "DT" or key == "RN" or key == "RP" or key == "FH")
+            continue;
+
+        if (key == "ID")
+        {
+            value = boost::regex_replace(value, kIDRx, "$1", boost::format_first_only);
+            IndexString(inDoc, "id", value, true);
+            SetAttribute(inDoc, "id", value);
+        }
+        else if (key == "AC")
+        {
+            vector<string> acs = SplitSemicolon(value);
+            for (vector<string>::size_type i = 0; i < acs.size(); ++i)
+            {
+                IndexString(inDoc, "ac", acs[i]);
+                if (i == 0)
+                    SetAttribute(inDoc, "ac", acs[i]);
+            }
+        }
+        else if (key == "DE")
+        {
+            IndexText(inDoc, "de", value);
+
+            // s/;.+//
+            string::size_type s = value.find(';');
+            while (s != string::npos and (s + 1 == value.length() or value[s + 1] == '\n'))
+                s = value.find(';', s + 1);
+            if (s != string::npos)
+            {
+                string::size_type e = value.find('\n', s);
+                value.erase(s, e == string::npos ? string::npos : e - s);
+            }
+
+            SetAttribute(inDoc, "title", value.substr(0, 255));
+        }
+        else if (key == "DR")
+        {
+            for (boost::sregex_iterator i(value.begin(), value.end(), kDRRx); i != end; ++i)
+                AddLink(inDoc, (*i)[1], (*i)[2]);
+
+            IndexText(inDoc, "dr", value);
+        }
+        else if (key == "FT")
+        {
+            for (boost::sregex_iterator f(value.begin(), value.end(), kFeatureRx); f != end; ++f)
+            {
+                string ft = (*f)[1];
+
+                for (boost::sregex_iterator q(ft.begin(), ft.end(), kQualifierRx); q != end; ++q)
+                {
+                    string fkey = (*q)[1], fval = (*q)[2];
+
+                    if (fkey == "translation")
+                        continue;
+
+                    IndexText(inDoc, "ft", fval);
+
+                    boost::smatch m;
+                    if (fkey == "db_xref" and boost::regex_search(fval, m, kDbXrefRx))
+                        AddLink(inDoc, m[1], m[2]);
+                }
+            }
+        }
+        else if (key == "SQ")
+            break;
+        else
+            IndexText(inDoc, ba::to_lower_copy(key), value);
+    }
+}
+
+// --------------------------------------------------------------------
+// fasta, see parsers/fasta.pm
+
+class M6FastaParser : public M6NativeParser
+{
+  public:
+    virtual void    Parse(M6InputDocument* inDoc,
+                        const string& inFileName, const string& inDbHeader);
+};
+
+void M6FastaParser::Parse(M6InputDocument* inDoc,
+    const string& inFileName, const string& inDbHeader)
+{
+    static const boost::regex
+        kLocalRx("(?:lcl|gi|bbs|bbm|gim)\\|([^|]*)", kRxSingleLine),
+        kAccessionRx("(?:gb|emb|pir|sp|ref|gnl|dbj|prf|tpg|tpe|tpd|tr|gpp|nat)\\|([^|]*)\\|([^|]*)", kRxSingleLine),
+        kPatentRx("pat\\|([^|]*)\\|([^|]*)\\|([^|]*)", kRxSingleLine),
+        kPrePatentRx("pgp\\|([^|]*)\\|([^|]*)\\|([^|]*)", kRxSingleLine),
+        kPDBRx("pdb\\|([^|]*)\\|([^|]*)", kRxSingleLine);
+
+    const string& text = inDoc->Peek();
+
+    // m/^>(\S+)(?: (.*))?/
+    string::size_type n = 1;
+    while (n < text.length() and not IsSpace(text[n]))
+        ++n;
+
+    if (text.empty() or text[0] != '>' or n == 1)
+        THROW(("no id"));
+
+    string id = text.substr(1, n - 1), comment;
+    if (n < text.length() and text[n] == ' ')
+        comment = text.substr(n + 1, text.find('\n', n + 1) - n - 1);
+
+    SetAttribute(inDoc, "title", comment);
+    IndexText(inDoc, "title", comment);
+
+    boost::smatch m;
+    if (boost::regex_match(id, m, kLocalRx))
+    {
+        SetAttribute(inDoc, "id", m[1]);
+        IndexString(inDoc, "id", m[1], true);
+    }
+    else if (boost::regex_match(id, m, kAccessionRx))
+    {
+        IndexString(inDoc, "acc", m[1], true);
+        SetAttribute(inDoc, "id", m[2]);
+        IndexString(inDoc, "id", m[2], true);
+    }
+    else if (boost::regex_match(id, m, kPatentRx))
+    {
+        SetAttribute(inDoc, "id", id);
+        IndexString(inDoc, "id", id, true);
+
+        IndexString(inDoc, "country", m[1]);
+        IndexString(inDoc, "patent", m[2]);
+        IndexString(inDoc, "sequence", m[3]);
+    }
+    else if (boost::regex_match(id, m, kPrePatentRx))
+    {
+        SetAttribute(inDoc, "id", id);
+        IndexString(inDoc, "id", id, true);
+
+        IndexString(inDoc, "country", m[1]);
+        IndexString(inDoc, "application", m[2]);
+        IndexString(inDoc, "sequence", m[3]);
+    }
+    else if (boost::regex_match(id, m, kPDBRx))
+    {
+        SetAttribute(inDoc, "id", m[1] + m[2]);
+        IndexString(inDoc, "id", m[1] + '.' + m[2], true);
+
+        IndexString(inDoc, "entry", m[1]);
+        IndexString(inDoc, "chain", m[2]);
+    }
+    else
+    {
+        SetAttribute(inDoc, "id", id);
+        IndexString(inDoc, "id", id, true);
+    }
+}
+
+// --------------------------------------------------------------------
+// pdb, see parsers/pdb.pm
+
+class M6PDBParser : public M6NativeParser
+{
+  public:
+    virtual void    Parse(M6InputDocument* inDoc,
+                        const string& inFileName, const string& inDbHeader);
+    virtual bool    ToFasta(const string& inDoc, const string& inDb,
+                        const string& inID, const string& inTitle, string& outFasta);
+
+  private:
+    static bool        SplitLine(const string& inLine, string& outField, string& outText);
+    static void        SeparateInitials(string& ioText);
+};
+
+// m/^(\S+)\s+(?:\d+\s+)?(.+)\n$/ for a line including its newline
+
+bool M6PDBParser::SplitLine(const string& inLine, string& outField, string& outText)
+{
+    string::size_type n = inLine.length();
+    if (n < 2 or inLine[n - 1] != '\n' or IsSpace(inLine[0]))
+        return false;
+
+    --n;    // index of the newline
+
+    string::size_type f = 0;
+    while (f < n and not IsSpace(inLine[f]))
+        ++f;
+
+    string::size_type p = f;
+    while (p < n and IsSpace(inLine[p]))
+        ++p;
+
+    if (p == f)
+        return false;
+
+    outField = inLine.substr(0, f);
+
+    if (p == n)
+    {
+        // only white space, (.+) takes the last character
+        if (n - f < 2)
+            return false;
+        outText = inLine.substr(n - 1, 1);
+        return true;
+    }
+
+    if (IsDigit(inLine[p]))
+    {
+        string::size_type q = p;
+        while (q < n and IsDigit(inLine[q]))
+            ++q;
+
+        string::size_type r = q;
+        while (r < n and IsSpace(inLine[r]))
+            ++r;
+
+        if (r > q and r < n)
+        {
+            outText = inLine.substr(r, n - r);
+            return true;
+        }
+
+        if (r == n and r - q >= 2)
+        {
+            outText = inLine.substr(n - 1, 1);
+            return true;
+        }
+    }
+
+    outText = inLine.substr(p, n - p);
+    return true;
+}
+
+// s/(\w)\.(?=\w)/$1. /g
+
+void M6PDBParser::SeparateInitials(string& ioText)
+{
+    string result;
+    result.reserve(ioText.length() + 16);
+
+    string::size_type i = 0;
+    while (i < ioText.length())
+    {
+        result += ioText[i];
+
+        if (IsWord(ioText[i]) and i + 2 < ioText.length() and
+            ioText[i + 1] == '.' and IsWord(ioText[i + 2]))
+        {
+            result += ". ";
+            i += 2;
+        }
+        else
+            ++i;
+    }
+
+    swap(ioText, result);
+}
+
+void M6PDBParser::Parse(M6InputDocument* inDoc,
+    const string& inFileName, const string& inDbHeader)
+{
+    static const boost::regex
+        kFinalRx("(.+\\/)?([a-z0-9]{4})_final\\.pdb", kRx),
+        kMoleculeRx("MOLECULE: (.+)", kRx),
+        kECRx("EC: (.+?);", kRx),
+        kAuthRx("\\s*(\\d+\\s+)?AUTH\\s+(.+)", kRx);
+
+    // *_final.pdb files (from pdb_redo) don't have the id in the header
+    string filename = ba::to_lower_copy(inFileName);
+
+    boost::smatch m;
+    if (boost::regex_search(filename, m, kFinalRx))
+    {
+        string id = m[2];
+
+        SetAttribute(inDoc, "id", id);
+        IndexString(inDoc, "id", id, true);
+        AddLink(inDoc, "dssp", id);
+        AddLink(inDoc, "hssp", id);
+        AddLink(inDoc, "pdbfinder2", id);
+    }
+
+    string header, title, compound;
+    bool hasHeader = false;
+    uint32 modelCount = 0;
+    set<string> ligands;
+
+    const string& doc = inDoc->Peek();
+    string line, fld, text;
+
+    for (string::size_type s = 0; s < doc.length(); )
+    {
+        string::size_type e = doc.find('\n', s);
+        e = (e == string::npos) ? doc.length() : e + 1;
+
+        line.assign(doc, s, e - s);
+        s = e;
+
+        if (not SplitLine(line, fld, text))
+            continue;
+
+        if (fld == "HEADER")
+        {
+            header = text;
+            hasHeader = true;
+
+            // xxxx is used in the pdb_redo files
+            string id = SubStr(line, 62, 4);
+            if (ba::to_lower_copy(id) != "xxxx")
+            {
+                SetAttribute(inDoc, "id", id);
+                IndexString(inDoc, "id", id, true);
+                AddLink(inDoc, "dssp", id);
+                AddLink(inDoc, "hssp", id);
+                AddLink(inDoc, "pdbfinder2", id);
+            }
+            IndexText(inDoc, "text", text);
+        }
+        else if (fld == "MODEL")
+            ++modelCount;
+        else if (fld == "TITLE")
+        {
+            title += ba::to_lower_copy(text);
+            IndexText(inDoc, "title", text);
+        }
+        else if (fld == "COMPND")
+        {
+            if (boost::regex_search(text, m, kMoleculeRx))
+                compound += ba::to_lower_copy(m[1] + ' ');
+            else if (boost::regex_search(text, m, kECRx))
+            {
+                string ec = m[1];
+                for (const string& ecc : Split(ec, ", "))
+                    AddLink(inDoc, "enzyme", ecc);
+                compound += "EC: " + ba::to_lower_copy(ec + ' ');
+            }
+            IndexText(inDoc, "compnd", text);
+        }
+        else if (fld == "KEYWDS")
+        {
+            for (const string& wrd : Split(text, " "))
+                IndexString(inDoc, "keyword", wrd);
+        }
+        else if (fld == "AUTHOR")
+        {
+            // split out the author name, otherwise users won't be able to find them
+            SeparateInitials(text);
+            IndexText(inDoc, "ref", text);
+        }
+        else if (fld == "JRNL")
+            IndexText(inDoc, "ref", text);
+        else if (fld == "REMARK")
+        {
+            if (boost::regex_search(text, m, kAuthRx))
+            {
+                text = m[2];
+                SeparateInitials(text);
+            }
+
+            IndexText(inDoc, "remark", text);
+        }
+        else if (fld == "DBREF")
+        {
+            string db = SubStr(line, 26, 7);    TrimRight(db);
+            string ac = SubStr(line, 33, 9);    TrimRight(ac);
+            string id = SubStr(line, 42, 12);    TrimRight(id);
+
+            static const char* kDbMap[][2] = {
+                { "embl",    "embl" },
+                { "gb",        "genbank" },
+                { "ndb",    "ndb" },
+                { "pdb",    "pdb" },
+                { "pir",    "pir" },
+                { "prf",    "profile" },
+                { "sws",    "uniprot" },
+                { "trembl",    "uniprot" },
+                { "unp",    "uniprot" }
+            };
+
+            string ldb = ba::to_lower_copy(db);
+            for (auto& map : kDbMap)
+            {
+                if (ldb == map[0])
+                {
+                    db = map[1];
+                    break;
+                }
+            }
+
+            if (not db.empty())
+            {
+                if (not id.empty())
+                    AddLink(inDoc, db, id);
+                if (not ac.empty())
+                    AddLink(inDoc, db, ac);
+            }
+        }
+        else if (fld == "HETATM")
+            ligands.insert(SubStr(line, 17, 3));
+    }
+
+    if (modelCount > 0)
+        IndexNumber(inDoc, "models", to_string(modelCount));
+
+    if (hasHeader)
+    {
+        if (not title.empty())
+            header = title + " (" + header + ")";
+        if (not compound.empty())
+            header += "; " + compound;
+        if (header.length() > 255)
+            header.erase(255);
+
+        static const boost::regex kSpacesRx(" {2,}");
+        header = boost::regex_replace(header, kSpacesRx, " ");
+
+        SetAttribute(inDoc, "title", header);
+    }
+
+    for (string ligand : ligands)
+    {
+        // s/^\s*(\S+)\s*$/$1/
+        string trimmed = ba::trim_copy_if(ligand, IsSpace);
+        if (not trimmed.empty() and find_if(trimmed.begin(), trimmed.end(), IsSpace) == trimmed.end())
+            ligand = trimmed;
+        IndexString(inDoc, "ligand", ligand);
+    }
+}
+
+bool M6PDBParser::ToFasta(const string& inDoc, const string& inDb,
+    const string& inID, const string& inTitle, string& outFasta)
+{
+    static const char* kAAMap[][2] = {
+        { "ALA", "A" }, { "ARG", "R" }, { "ASN", "N" }, { "ASP", "D" },
+        { "CYS", "C" }, { "GLN", "Q" }, { "GLU", "E" }, { "GLY", "G" },
+        { "HIS", "H" }, { "ILE", "I" }, { "LEU", "L" }, { "LYS", "K" },
+        { "MET", "M" }, { "PHE", "F" }, { "PRO", "P" }, { "SER", "S" },
+        { "THR", "T" }, { "TRP", "W" }, { "TYR", "Y" }, { "VAL", "V" },
+        { "GLX", "Z" }, { "ASX", "B" }
+    };
+
+    // chains in order of appearance
+    vector<pair<char,string>> chains;
+
+    for (string::size_type s = 0; s < inDoc.length(); )
+    {
+        string::size_type e = inDoc.find('\n', s);
+        if (e == string::npos)
+            e = inDoc.length();
+
+        string line = inDoc.substr(s, e - s);
+        s = e + 1;
+
+        // m/^SEQRES.+/mg
+        if (line.length() < 7 or line.compare(0, 6, "SEQRES") != 0)
+            continue;
+
+        char chainID = line.length() > 11 ? line[11] : 0;
+
+        auto chain = find_if(chains.begin(), chains.end(),
+            [chainID](const pair<char,string>& c) { return c.first == chainID; });
+        if (chain == chains.end())
+            chain = chains.insert(chains.end(), make_pair(chainID, string()));
+
+        for (const string& res : Split(SubStr(line, 19), " "))
+        {
+            if (res.length() != 3)
+                continue;
+
+            char aa = 'X';
+            for (auto& map : kAAMap)
+            {
+                if (res == map[0])
+                {
+                    aa = map[1][0];
+                    break;
+                }
+            }
+
+            chain->second += aa;
+        }
+    }
+
+    outFasta.clear();
+
+    string title = inTitle == "0" ? "" : inTitle;
+
+    for (auto& chain : chains)
+    {
+        if (chain.second.empty())
+            continue;
+
+        outFasta += ">gnl|" + inDb + '|' + inID + '|';
+        if (chain.first != 0)
+            outFasta += chain.first;
+        outFasta += ' ' + title + '\n' + WrapSequence(chain.second) + '\n';
+    }
+
+    return true;
+}
+
+}
+
+// --------------------------------------------------------------------
+
+M6NativeParser* M6NativeParser::Create(const string& inName)
+{
+    M6NativeParser* result = nullptr;
+
+    if (inName == "uniprot")
+        result = new M6UniProtParser;
+    else if (inName == "embl")
+        result = new M6EMBLParser;
+    else if (inName == "fasta")
+        result = new M6FastaParser;
+    else if (inName == "pdb")
+        result = new M6PDBParser;
+
+    return result;
+}
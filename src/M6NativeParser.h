@@ -0,0 +1,45 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+
+class M6InputDocument;
+
+// --------------------------------------------------------------------
+// M6NativeParser is the interface for parsers written in C++. These
+// are used instead of the Perl scripts in the parsers directory for
+// the formats that make up the bulk of the data: UniProt, EMBL, FASTA
+// and PDB headers. They must produce exactly the same index calls as
+// their Perl counterparts, see unit-tests/M6TestParser.cpp.
+//
+// Native parsers do not keep state between calls, a single instance
+// is shared by all processor threads.
+
+class M6NativeParser
+{
+  public:
+    virtual             ~M6NativeParser() {}
+
+                        // returns nullptr if there's no native parser for inName
+    static M6NativeParser*
+                        Create(const std::string& inName);
+
+    virtual void        Parse(M6InputDocument* inDoc,
+                            const std::string& inFileName, const std::string& inDbHeader) = 0;
+
+                        // returns false if the parser has no native to_fasta
+    virtual bool        ToFasta(const std::string& inDoc, const std::string& inDb,
+                            const std::string& inID, const std::string& inTitle,
+                            std::string& outFasta)                { return false; }
+
+  protected:
+                        M6NativeParser() {}
+
+  private:
+                        M6NativeParser(const M6NativeParser&);
+    M6NativeParser&        operator=(const M6NativeParser&);
+};
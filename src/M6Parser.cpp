@@ -12,6 +12,7 @@
 #include <boost/filesystem/operations.hpp>
 
 #include "M6Parser.h"
+#include "M6NativeParser.h"
 #include "M6Error.h"
 #include "M6Config.h"
 
@@ -1049,13 +1050,16 @@ void xs_init(pTHX)
 //    sv_setiv(get_sv("M6::INDEX_STRING", true),        eIndexString);
 }
 
-M6Parser::M6Parser(const string& inName)
-    : mName(inName)
+M6Parser::M6Parser(const string& inName, bool inUseNativeParser)
+    : mName(inName), mNativeParser(nullptr)
 {
+    if (inUseNativeParser)
+        mNativeParser = M6NativeParser::Create(inName);
 }
 
 M6Parser::~M6Parser()
 {
+    delete mNativeParser;
 }
 
 M6ParserImpl* M6Parser::Impl()
@@ -1085,7 +1089,22 @@ string M6Parser::GetVersion(const string& inSourceConfig)
 void M6Parser::ParseDocument(M6InputDocument* inDoc,
     const string& inFileName, const string& inDbHeader)
 {
-    Impl()->Parse(inDoc, inFileName, inDbHeader);
+    if (mNativeParser == nullptr)
+        Impl()->Parse(inDoc, inFileName, inDbHeader);
+    else
+    {
+        try
+        {
+            mNativeParser->Parse(inDoc, inFileName, inDbHeader);
+        }
+        catch (exception& e)
+        {
+            cerr << endl
+                 << "Error parsing document: " << endl
+                 << e.what() << endl;
+            THROW(("Error parsing document: %s", e.what()));
+        }
+    }
 }
 
 string M6Parser::GetValue(const string& inName)
@@ -1096,7 +1115,11 @@ string M6Parser::GetValue(const string& inName)
 void M6Parser::ToFasta(const string& inDoc, const string& inDb, const string& inID,
     const string& inTitle, string& outFasta)
 {
-    Impl()->ToFasta(inDoc, inDb, inID, inTitle, outFasta);
+    if (mNativeParser == nullptr or
+        not mNativeParser->ToFasta(inDoc, inDb, inID, inTitle, outFasta))
+    {
+        Impl()->ToFasta(inDoc, inDb, inID, inTitle, outFasta);
+    }
 }
 
 void M6Parser::GetIndexNames(vector<pair<string,string>>& outIndexNames)
@@ -10,12 +10,15 @@
 #include "M6Document.h"
 
 struct M6ParserImpl;
+class M6NativeParser;
 typedef boost::thread_specific_ptr<M6ParserImpl>    M6ParserImplPtr;
 
 class M6Parser
 {
   public:
-                    M6Parser(const std::string& inName);
+                    // if inUseNativeParser is true, documents are parsed by
+                    // the C++ version of the parser, if there is one.
+                    M6Parser(const std::string& inName, bool inUseNativeParser = false);
                     ~M6Parser();
 
                     // return the version string of the current data set.
@@ -39,4 +42,5 @@ class M6Parser
 
     std::string        mName;
     M6ParserImplPtr    mImpl;
+    M6NativeParser*    mNativeParser;
 };
@@ -20,6 +20,92 @@
 using namespace std;
 namespace ba = boost::algorithm;
 
+// distance used for NEAR without an explicit /n
+const uint32 kM6DefaultNearDistance = 10;
+
+// a union is collected in a bitmap instead of merged using a heap when
+// it has at least kM6BitmapMinTerms terms and those terms together
+// contain at least 1/kM6BitmapDensity of all documents
+const uint32
+    kM6BitmapMinTerms = 4,
+    kM6BitmapDensity = 32;
+
+// --------------------------------------------------------------------
+//    Boolean queries are not executed while being parsed. The parser
+//    builds a tree of M6QueryNode objects, the leaves of this tree hold
+//    the iterators returned by the databank lookups. The M6QueryPlanner
+//    then simplifies this tree, estimates the number of documents each
+//    node will produce and uses these estimates to decide how to
+//    execute each node.
+
+enum M6QueryNodeKind
+{
+    eM6LeafNode,        // a databank lookup, an empty leaf has no iterator
+    eM6AllNode,            // all documents
+    eM6AndNode,
+    eM6OrNode,
+    eM6NotNode,
+    eM6AndNotNode        // documents in the first child but not in the second
+};
+
+struct M6QueryNode
+{
+                    M6QueryNode(M6QueryNodeKind inKind, const string& inLabel = "",
+                            M6Iterator* inIter = nullptr)
+                        : mKind(inKind), mLabel(inLabel), mIter(inIter)
+                        , mEstimate(0), mActual(0), mBitmap(false), mExecuted(false) {}
+                    ~M6QueryNode();
+
+    bool            IsEmpty() const        { return mKind == eM6LeafNode and mIter == nullptr; }
+
+    M6QueryNodeKind    mKind;
+    string            mLabel;
+    M6Iterator*        mIter;
+    vector<M6QueryNode*>
+                    mChildren;
+    uint32            mEstimate, mActual;
+    bool            mBitmap, mExecuted;
+
+  private:
+                    M6QueryNode(const M6QueryNode&);
+    M6QueryNode&    operator=(const M6QueryNode&);
+};
+
+M6QueryNode::~M6QueryNode()
+{
+    delete mIter;
+    for (M6QueryNode* child : mChildren)
+        delete child;
+}
+
+class M6QueryPlanner
+{
+  public:
+                    // GetMaxDocNr returns the number for the next document
+                    M6QueryPlanner(M6Databank& inDatabank)
+                        : mLastDocNr(inDatabank.GetMaxDocNr())
+                    {
+                        if (mLastDocNr > 0)
+                            --mLastDocNr;
+                    }
+
+    // simplify the tree and estimate the counts, returns the new root
+    M6QueryNode*    Plan(M6QueryNode* inNode);
+
+    // create the iterator for a planned tree, the iterators in the leaves
+    // are moved into the result. If inCount is true the number of documents
+    // returned by each node is recorded in mActual.
+    M6Iterator*        Execute(M6QueryNode* inNode, bool inCount);
+
+    void            Explain(ostream& inOut, const M6QueryNode* inNode, uint32 inLevel = 0);
+
+  private:
+    M6QueryNode*    Simplify(M6QueryNode* inNode);
+    void            Estimate(M6QueryNode* inNode);
+
+    uint32            mLastDocNr;
+};
+
 // --------------------------------------------------------------------
 
 class M6QueryParser
@@ -28,18 +114,21 @@ class M6QueryParser
                     M6QueryParser(M6Databank* inDatabank, const string& inQuery,
                         bool inAllTermsRequired);
 
-    void            Parse(vector<string>& outTerms, M6Iterator*& outFilter);
+    M6QueryNode*    Parse(vector<string>& outTerms);
     bool            IsBooleanQuery() const    { return mIsBooleanQuery; }
 
   private:
-    M6Iterator*        ParseQuery();
-    M6Iterator*        ParseTest();
-    M6Iterator*        ParseLink();
-    M6Iterator*        ParseQualifiedTest(const string& inIndex);
-    M6Iterator*        ParseTerm(const string& inIndex);
-    M6Iterator*        ParseBooleanTerm(const string& inIndex, M6QueryOperator inOperator);
-    M6Iterator*        ParseBetween(const string& inIndex);
-    M6Iterator*        ParseString();
+    M6QueryNode*    ParseQuery();
+    M6QueryNode*    ParseTest();
+    M6QueryNode*    ParseLink();
+    M6QueryNode*    ParseQualifiedTest(const string& inIndex);
+    M6QueryNode*    ParseTerm(const string& inIndex);
+    M6QueryNode*    ParseBooleanTerm(const string& inIndex, M6QueryOperator inOperator,
+                        const char* inOperatorName);
+    M6QueryNode*    ParseBetween(const string& inIndex);
+    M6QueryNode*    ParseNear(const string& inIndex, const string& inTerm);
+
+    M6QueryNode*    Combine(M6QueryNodeKind inKind, M6QueryNode* inA, M6QueryNode* inB);
 
     M6Token            GetNextToken();
     void            Match(M6Token inToken);
@@ -76,60 +165,84 @@ void M6QueryParser::Match(M6Token inToken)
     mLookahead = GetNextToken();
 }
 
-void M6QueryParser::Parse(vector<string>& outTerms, M6Iterator*& outFilter)
+M6QueryNode* M6QueryParser::Parse(vector<string>& outTerms)
 {
-    outFilter = nullptr;
     outTerms.clear();
 
     mLookahead = GetNextToken();
-    outFilter = ParseQuery();
+    unique_ptr<M6QueryNode> result(ParseQuery());
     if (mLookahead != eM6TokenEOF)
         THROW(("Parse error"));
     swap(outTerms, mQueryTerms);
+
+    return result.release();
 }
 
-M6Iterator* M6QueryParser::ParseQuery()
+// add inB to inA if inA is already of kind inKind, flattening
+// (a AND b) AND c into a single node
+
+M6QueryNode* M6QueryParser::Combine(M6QueryNodeKind inKind, M6QueryNode* inA, M6QueryNode* inB)
 {
-    unique_ptr<M6Iterator> result(ParseTest());
+    M6QueryNode* result = inA;
+
+    if (inA->mKind != inKind)
+    {
+        result = new M6QueryNode(inKind);
+        result->mChildren.push_back(inA);
+    }
+
+    if (inB->mKind == inKind)
+    {
+        result->mChildren.insert(result->mChildren.end(), inB->mChildren.begin(), inB->mChildren.end());
+        inB->mChildren.clear();
+        delete inB;
+    }
+    else
+        result->mChildren.push_back(inB);
+
+    return result;
+}
+
+M6QueryNode* M6QueryParser::ParseQuery()
+{
+    unique_ptr<M6QueryNode> result(ParseTest());
 
     for (;;)
     {
         if (mLookahead == eM6TokenEOF or mLookahead == eM6TokenCloseParenthesis)
             break;
 
+        M6QueryNodeKind kind;
+
         switch (mLookahead)
         {
             case eM6TokenAND:
                 mIsBooleanQuery = true;
                 Match(mLookahead);
-                result.reset(M6IntersectionIterator::Create(result.release(), ParseTest()));
+                kind = eM6AndNode;
                 break;
 
             case eM6TokenOR:
                 mIsBooleanQuery = true;
                 Match(mLookahead);
-                result.reset(M6UnionIterator::Create(result.release(), ParseTest()));
+                kind = eM6OrNode;
                 break;
 
             default:
-                if (mImplicitIntersection)
-                {
-                    result.reset(M6IntersectionIterator::Create(result.release(), ParseTest()));
-                }
-                else
-                {
-                    result.reset(M6UnionIterator::Create(result.release(), ParseTest()));
-                }
+                kind = mImplicitIntersection ? eM6AndNode : eM6OrNode;
                 break;
         }
+
+        M6QueryNode* test = ParseTest();
+        result.reset(Combine(kind, result.release(), test));
     }
 
     return result.release();
 }
 
-M6Iterator* M6QueryParser::ParseTest()
+M6QueryNode* M6QueryParser::ParseTest()
 {
-    unique_ptr<M6Iterator> result;
+    unique_ptr<M6QueryNode> result;
 
     switch (mLookahead)
     {
@@ -147,21 +260,21 @@ M6Iterator* M6QueryParser::ParseTest()
 
         case eM6TokenNOT:
         {
-
             Match(eM6TokenNOT);
             mIsBooleanQuery = true;
 
             vector<string> queryterms(mQueryTerms);
 
-            if (mDatabank != nullptr)
-                result.reset(new M6NotIterator(ParseQuery(), mDatabank->GetMaxDocNr()));
+            result.reset(new M6QueryNode(eM6NotNode));
+            result->mChildren.push_back(ParseQuery());
 
             mQueryTerms = queryterms;
             break;
         }
 
         case eM6TokenDocNr:
-            result.reset(new M6SingleDocIterator(boost::lexical_cast<uint32>(mTokenizer.GetTokenString())));
+            result.reset(new M6QueryNode(eM6LeafNode, '#' + mTokenizer.GetTokenString(),
+                new M6SingleDocIterator(boost::lexical_cast<uint32>(mTokenizer.GetTokenString()))));
             Match(eM6TokenDocNr);
             break;
 
@@ -178,8 +291,10 @@ M6Iterator* M6QueryParser::ParseTest()
                     mQueryTerms.push_back(tokenizer.GetTokenString());
             }
 
+            M6Iterator* iter = nullptr;
             if (mDatabank != nullptr)
-                result.reset(mDatabank->FindString("*", mTokenizer.GetTokenString()));
+                iter = mDatabank->FindString("*", mTokenizer.GetTokenString());
+            result.reset(new M6QueryNode(eM6LeafNode, '"' + mTokenizer.GetTokenString() + '"', iter));
 
             Match(eM6TokenString);
             break;
@@ -194,12 +309,14 @@ M6Iterator* M6QueryParser::ParseTest()
                 Match(eM6TokenColon);
                 result.reset(ParseTest());
             }
-            else if (mDatabank != nullptr)
+            else if (pat == "*")
+                result.reset(new M6QueryNode(eM6AllNode, pat));
+            else
             {
-                if (pat == "*")
-                    result.reset(new M6AllDocIterator(mDatabank->size()));
-                else
-                    result.reset(mDatabank->FindPattern("full-text", pat));
+                M6Iterator* iter = nullptr;
+                if (mDatabank != nullptr)
+                    iter = mDatabank->FindPattern("full-text", pat);
+                result.reset(new M6QueryNode(eM6LeafNode, pat, iter));
             }
             break;
         }
@@ -220,6 +337,10 @@ M6Iterator* M6QueryParser::ParseTest()
             {
                 result.reset(ParseBetween(s));
             }
+            else if (mLookahead == eM6TokenNEAR)
+            {
+                result.reset(ParseNear("*", s));
+            }
             else if (mLookahead == eM6TokenPunctuation)
             {
                 mQueryTerms.push_back(s);
@@ -239,18 +360,22 @@ M6Iterator* M6QueryParser::ParseTest()
                 }
                 while (mLookahead == eM6TokenPunctuation);
 
+                M6Iterator* iter = nullptr;
                 if (mDatabank != nullptr)
                 {
                     if (mQueryTerms.size() > 1)
-                        result.reset(mDatabank->FindString("*", s));
+                        iter = mDatabank->FindString("*", s);
                     else
-                        result.reset(mDatabank->Find("*", mQueryTerms.front()));
+                        iter = mDatabank->Find("*", mQueryTerms.front());
                 }
+                result.reset(new M6QueryNode(eM6LeafNode, s, iter));
             }
             else
             {
+                M6Iterator* iter = nullptr;
                 if (mDatabank != nullptr)
-                    result.reset(mDatabank->Find("*", s));
+                    iter = mDatabank->Find("*", s);
+                result.reset(new M6QueryNode(eM6LeafNode, s, iter));
                 mQueryTerms.push_back(s);
             }
             break;
@@ -263,9 +388,9 @@ M6Iterator* M6QueryParser::ParseTest()
     return result.release();
 }
 
-M6Iterator* M6QueryParser::ParseQualifiedTest(const string& inIndex)
+M6QueryNode* M6QueryParser::ParseQualifiedTest(const string& inIndex)
 {
-    unique_ptr<M6Iterator> result;
+    unique_ptr<M6QueryNode> result;
 
     switch (mLookahead)
     {
@@ -284,25 +409,25 @@ M6Iterator* M6QueryParser::ParseQualifiedTest(const string& inIndex)
         case eM6TokenLessThan:
             mIsBooleanQuery = true;
             Match(eM6TokenLessThan);
-            result.reset(ParseBooleanTerm(inIndex, eM6LessThan));
+            result.reset(ParseBooleanTerm(inIndex, eM6LessThan, "<"));
             break;
 
         case eM6TokenLessEqual:
             mIsBooleanQuery = true;
             Match(eM6TokenLessEqual);
-            result.reset(ParseBooleanTerm(inIndex, eM6LessOrEqual));
+            result.reset(ParseBooleanTerm(inIndex, eM6LessOrEqual, "<="));
             break;
 
         case eM6TokenGreaterEqual:
             mIsBooleanQuery = true;
             Match(eM6TokenGreaterEqual);
-            result.reset(ParseBooleanTerm(inIndex, eM6GreaterOrEqual));
+            result.reset(ParseBooleanTerm(inIndex, eM6GreaterOrEqual, ">="));
             break;
 
         case eM6TokenGreaterThan:
             mIsBooleanQuery = true;
             Match(eM6TokenGreaterThan);
-            result.reset(ParseBooleanTerm(inIndex, eM6GreaterThan));
+            result.reset(ParseBooleanTerm(inIndex, eM6GreaterThan, ">"));
             break;
 
         default:
@@ -312,7 +437,7 @@ M6Iterator* M6QueryParser::ParseQualifiedTest(const string& inIndex)
     return result.release();
 }
 
-M6Iterator* M6QueryParser::ParseBetween(const string& inIndex)
+M6QueryNode* M6QueryParser::ParseBetween(const string& inIndex)
 {
     mIsBooleanQuery = true;
 
@@ -334,21 +459,28 @@ M6Iterator* M6QueryParser::ParseBetween(const string& inIndex)
     else
         Match(eM6TokenNumber);
 
-    M6Iterator* result = nullptr;
+    M6Iterator* iter = nullptr;
     if (mDatabank != nullptr)
-        result = mDatabank->Find(inIndex, lowerbound, upperbound);
-    return result;
+        iter = mDatabank->Find(inIndex, lowerbound, upperbound);
+    return new M6QueryNode(eM6LeafNode,
+        inIndex + " BETWEEN " + lowerbound + " AND " + upperbound, iter);
 }
 
-M6Iterator* M6QueryParser::ParseLink()
+M6QueryNode* M6QueryParser::ParseLink()
 {
     unique_ptr<M6UnionIterator> result(new M6UnionIterator);
+    string label;
 
     while (mLookahead != eM6TokenCloseBracket)
     {
         string db = mTokenizer.GetTokenString();
         Match(eM6TokenWord);
         Match(eM6TokenSlash);
+
+        if (not label.empty())
+            label += ' ';
+        label += db + '/' + mTokenizer.GetTokenString();
+
         switch (mLookahead)
         {
             case eM6TokenDocNr:
@@ -370,12 +502,12 @@ M6Iterator* M6QueryParser::ParseLink()
         }
     }
 
-    return result.release();
+    return new M6QueryNode(eM6LeafNode, '[' + label + ']', result.release());
 }
 
-M6Iterator* M6QueryParser::ParseTerm(const string& inIndex)
+M6QueryNode* M6QueryParser::ParseTerm(const string& inIndex)
 {
-    unique_ptr<M6Iterator> result;
+    unique_ptr<M6QueryNode> result;
 
     switch (mLookahead)
     {
@@ -392,26 +524,44 @@ M6Iterator* M6QueryParser::ParseTerm(const string& inIndex)
                     mQueryTerms.push_back(tokenizer.GetTokenString());
             }
 
+            M6Iterator* iter = nullptr;
             if (mDatabank != nullptr)
-                result.reset(mDatabank->FindString(inIndex, mTokenizer.GetTokenString()));
+                iter = mDatabank->FindString(inIndex, mTokenizer.GetTokenString());
+            result.reset(new M6QueryNode(eM6LeafNode,
+                inIndex + ":\"" + mTokenizer.GetTokenString() + '"', iter));
 
             Match(eM6TokenString);
             break;
         }
 
         case eM6TokenPattern:
+        {
+            M6Iterator* iter = nullptr;
             if (mDatabank != nullptr)
-                result.reset(mDatabank->FindPattern(inIndex, mTokenizer.GetTokenString()));
+                iter = mDatabank->FindPattern(inIndex, mTokenizer.GetTokenString());
+            result.reset(new M6QueryNode(eM6LeafNode, inIndex + ':' + mTokenizer.GetTokenString(), iter));
             Match(eM6TokenPattern);
             break;
+        }
 
         case eM6TokenWord:
         case eM6TokenNumber:
         case eM6TokenFloat:
-            if (mDatabank != nullptr)
-                result.reset(mDatabank->Find(inIndex, mTokenizer.GetTokenString()));
+        {
+            string term = mTokenizer.GetTokenString();
             Match(mLookahead);
+
+            if (mLookahead == eM6TokenNEAR)
+                result.reset(ParseNear(inIndex, term));
+            else
+            {
+                M6Iterator* iter = nullptr;
+                if (mDatabank != nullptr)
+                    iter = mDatabank->Find(inIndex, term);
+                result.reset(new M6QueryNode(eM6LeafNode, inIndex + ':' + term, iter));
+            }
             break;
+        }
 
         default:
             Match(eM6TokenWord);
@@ -421,9 +571,52 @@ M6Iterator* M6QueryParser::ParseTerm(const string& inIndex)
     return result.release();
 }
 
-M6Iterator* M6QueryParser::ParseBooleanTerm(const string& inIndex, M6QueryOperator inOperator)
+// term NEAR term, or term NEAR/n term. The terms should occur at most
+// n words apart, in any order, in the same index.
+
+M6QueryNode* M6QueryParser::ParseNear(const string& inIndex, const string& inTerm)
 {
-    unique_ptr<M6Iterator> result;
+    Match(eM6TokenNEAR);
+
+    uint32 distance = kM6DefaultNearDistance;
+
+    if (mLookahead == eM6TokenSlash)
+    {
+        Match(eM6TokenSlash);
+
+        string n = mTokenizer.GetTokenString();
+        Match(eM6TokenNumber);
+
+        if (n.empty() or not isdigit(n[0]) or (distance = boost::lexical_cast<uint32>(n)) == 0)
+            THROW(("NEAR distance should be a positive number"));
+    }
+
+    string term = mTokenizer.GetTokenString();
+
+    if (mLookahead == eM6TokenWord or mLookahead == eM6TokenNumber or mLookahead == eM6TokenFloat)
+        Match(mLookahead);
+    else
+        Match(eM6TokenWord);
+
+    mQueryTerms.push_back(inTerm);
+    mQueryTerms.push_back(term);
+
+    M6Iterator* iter = nullptr;
+    if (mDatabank != nullptr)
+        iter = mDatabank->FindNear(inIndex, inTerm, term, distance);
+
+    string label = inTerm + " NEAR/" + boost::lexical_cast<string>(distance) + ' ' + term;
+    if (inIndex != "*")
+        label = inIndex + ':' + label;
+
+    return new M6QueryNode(eM6LeafNode, label, iter);
+}
+
+M6QueryNode* M6QueryParser::ParseBooleanTerm(const string& inIndex, M6QueryOperator inOperator,
+    const char* inOperatorName)
+{
+    unique_ptr<M6QueryNode> result;
+    string label = inIndex + ' ' + inOperatorName + ' ' + mTokenizer.GetTokenString();
 
     switch (mLookahead)
     {
@@ -440,8 +633,10 @@ M6Iterator* M6QueryParser::ParseBooleanTerm(const string& inIndex, M6QueryOperat
                     mQueryTerms.push_back(tokenizer.GetTokenString());
             }
 
+            M6Iterator* iter = nullptr;
             if (mDatabank != nullptr)
-                result.reset(mDatabank->Find(inIndex, mTokenizer.GetTokenString(), inOperator));
+                iter = mDatabank->Find(inIndex, mTokenizer.GetTokenString(), inOperator);
+            result.reset(new M6QueryNode(eM6LeafNode, label, iter));
 
             Match(eM6TokenString);
             break;
@@ -450,10 +645,14 @@ M6Iterator* M6QueryParser::ParseBooleanTerm(const string& inIndex, M6QueryOperat
         case eM6TokenWord:
         case eM6TokenNumber:
         case eM6TokenFloat:
+        {
+            M6Iterator* iter = nullptr;
             if (mDatabank != nullptr)
-                result.reset(mDatabank->Find(inIndex, mTokenizer.GetTokenString(), inOperator));
+                iter = mDatabank->Find(inIndex, mTokenizer.GetTokenString(), inOperator);
+            result.reset(new M6QueryNode(eM6LeafNode, label, iter));
             Match(mLookahead);
             break;
+        }
 
         default:
             Match(eM6TokenNumber);
@@ -473,24 +672,421 @@ M6Iterator* M6QueryParser::GetLinks(const string& inDB, uint32 inDocNr)
     return mDatabank->GetLinkedDocuments(inDB, to_string(inDocNr));
 }
 
+// --------------------------------------------------------------------
+//    M6QueryPlanner
+
+namespace
+{
+
+// M6CountingIterator records the number of documents returned by the
+// iterator for a node, used to explain a query plan
+
+class M6CountingIterator : public M6Iterator
+{
+  public:
+                    M6CountingIterator(M6Iterator* inIter, uint32& outCount)
+                        : mIter(inIter), mCounter(outCount)
+                    {
+                        mCount = inIter->GetCount();
+                        mRanked = inIter->IsRanked();
+                    }
+                    ~M6CountingIterator()        { delete mIter; }
+
+    virtual bool    Next(uint32& outDoc, float& outRank)
+                    {
+                        bool result = mIter->Next(outDoc, outRank);
+                        if (result)
+                            ++mCounter;
+                        return result;
+                    }
+
+  private:
+    M6Iterator*        mIter;
+    uint32&            mCounter;
+};
+
+}
+
+M6QueryNode* M6QueryPlanner::Plan(M6QueryNode* inNode)
+{
+    M6QueryNode* result = Simplify(inNode);
+    Estimate(result);
+    return result;
+}
+
+// Simplify takes ownership of inNode and returns the node to use instead
+
+M6QueryNode* M6QueryPlanner::Simplify(M6QueryNode* inNode)
+{
+    unique_ptr<M6QueryNode> node(inNode);
+
+    for (M6QueryNode*& child : node->mChildren)
+        child = Simplify(child);
+
+    switch (node->mKind)
+    {
+        case eM6LeafNode:
+        case eM6AllNode:
+            break;
+
+        case eM6AndNode:
+        {
+            vector<M6QueryNode*> children, positive, negative;
+            swap(children, node->mChildren);
+
+            bool empty = false;
+
+            for (M6QueryNode* child : children)
+            {
+                empty = empty or child->IsEmpty();
+
+                if (child->mKind == eM6AndNode)
+                {
+                    positive.insert(positive.end(), child->mChildren.begin(), child->mChildren.end());
+                    child->mChildren.clear();
+                    delete child;
+                }
+                else if (child->mKind == eM6NotNode)
+                {
+                    negative.push_back(child->mChildren.front());
+                    child->mChildren.clear();
+                    delete child;
+                }
+                else if (child->mKind == eM6AllNode and children.size() > 1)
+                    delete child;
+                else
+                    positive.push_back(child);
+            }
+
+            if (positive.empty() and negative.empty())
+            {
+                node.reset(new M6QueryNode(eM6AllNode, "*"));
+                break;
+            }
+
+            if (empty)
+            {
+                for (M6QueryNode* child : positive)
+                    delete child;
+                for (M6QueryNode* child : negative)
+                    delete child;
+                node.reset(new M6QueryNode(eM6LeafNode));
+                break;
+            }
+
+            // a AND NOT b AND NOT c => a AND NOT (b OR c)
+            M6QueryNode* notNode = nullptr;
+            if (not negative.empty())
+            {
+                notNode = negative.front();
+                if (negative.size() > 1)
+                {
+                    notNode = new M6QueryNode(eM6OrNode);
+                    notNode->mChildren = negative;
+                    notNode = Simplify(notNode);
+                }
+            }
+
+            if (positive.empty())
+            {
+                // NOT a AND NOT b => NOT (a OR b)
+                node.reset(new M6QueryNode(eM6NotNode));
+                node->mChildren.push_back(notNode);
+                node.reset(Simplify(node.release()));
+            }
+            else
+            {
+                if (positive.size() == 1)
+                    node.reset(positive.front());
+                else
+                    node->mChildren = positive;
+
+                if (notNode != nullptr)
+                {
+                    M6QueryNode* andNot = new M6QueryNode(eM6AndNotNode);
+                    andNot->mChildren.push_back(node.release());
+                    andNot->mChildren.push_back(notNode);
+                    node.reset(Simplify(andNot));
+                }
+            }
+            break;
+        }
+
+        case eM6OrNode:
+        {
+            vector<M6QueryNode*> children;
+            swap(children, node->mChildren);
+
+            bool all = false;
+
+            for (M6QueryNode* child : children)
+            {
+                all = all or child->mKind == eM6AllNode;
+
+                if (child->mKind == eM6OrNode)
+                {
+                    node->mChildren.insert(node->mChildren.end(), child->mChildren.begin(), child->mChildren.end());
+                    child->mChildren.clear();
+                    delete child;
+                }
+                else if (child->IsEmpty())
+                    delete child;
+                else
+                    node->mChildren.push_back(child);
+            }
+
+            if (all)
+                node.reset(new M6QueryNode(eM6AllNode, "*"));
+            else if (node->mChildren.empty())
+                node.reset(new M6QueryNode(eM6LeafNode));
+            else if (node->mChildren.size() == 1)
+            {
+                M6QueryNode* child = node->mChildren.front();
+                node->mChildren.clear();
+                node.reset(child);
+            }
+            break;
+        }
+
+        case eM6NotNode:
+        {
+            M6QueryNode* child = node->mChildren.front();
+
+            if (child->IsEmpty())
+                node.reset(new M6QueryNode(eM6AllNode, "*"));
+            else if (child->mKind == eM6AllNode)
+                node.reset(new M6QueryNode(eM6LeafNode));
+            else if (child->mKind == eM6NotNode)
+            {
+                M6QueryNode* grandChild = child->mChildren.front();
+                child->mChildren.clear();
+                node.reset(grandChild);
+            }
+            break;
+        }
+
+        case eM6AndNotNode:
+        {
+            M6QueryNode* a = node->mChildren.front();
+            M6QueryNode* b = node->mChildren.back();
+
+            if (a->IsEmpty() or b->mKind == eM6AllNode)
+                node.reset(new M6QueryNode(eM6LeafNode));
+            else if (b->IsEmpty())
+            {
+                node->mChildren.erase(node->mChildren.begin());
+                node.reset(a);
+            }
+            break;
+        }
+    }
+
+    return node.release();
+}
+
+// The estimates assume the terms are independent. The operands of an
+// AND are ordered by their estimate, the rarest first.
+
+void M6QueryPlanner::Estimate(M6QueryNode* inNode)
+{
+    for (M6QueryNode* child : inNode->mChildren)
+        Estimate(child);
+
+    double N = mLastDocNr > 0 ? mLastDocNr : 1;
+    double estimate = 0;
+
+    switch (inNode->mKind)
+    {
+        case eM6LeafNode:
+            if (inNode->mIter != nullptr)
+                estimate = min(inNode->mIter->GetCount(), mLastDocNr);
+            break;
+
+        case eM6AllNode:
+            estimate = mLastDocNr;
+            break;
+
+        case eM6AndNode:
+        {
+            stable_sort(inNode->mChildren.begin(), inNode->mChildren.end(),
+                [](const M6QueryNode* a, const M6QueryNode* b) -> bool { return a->mEstimate < b->mEstimate; });
+
+            estimate = N;
+            for (M6QueryNode* child : inNode->mChildren)
+                estimate *= child->mEstimate / N;
+            break;
+        }
+
+        case eM6OrNode:
+        {
+            double p = 1, sum = 0;
+            for (M6QueryNode* child : inNode->mChildren)
+            {
+                p *= 1 - child->mEstimate / N;
+                sum += child->mEstimate;
+            }
+
+            estimate = N * (1 - p);
+
+            inNode->mBitmap = inNode->mChildren.size() >= kM6BitmapMinTerms and
+                sum * kM6BitmapDensity >= N;
+            break;
+        }
+
+        case eM6NotNode:
+            estimate = N - inNode->mChildren.front()->mEstimate;
+            break;
+
+        case eM6AndNotNode:
+            estimate = inNode->mChildren.front()->mEstimate *
+                (1 - inNode->mChildren.back()->mEstimate / N);
+            break;
+    }
+
+    inNode->mEstimate = static_cast<uint32>(estimate + 0.5);
+}
+
+M6Iterator* M6QueryPlanner::Execute(M6QueryNode* inNode, bool inCount)
+{
+    unique_ptr<M6Iterator> result;
+
+    switch (inNode->mKind)
+    {
+        case eM6LeafNode:
+            result.reset(inNode->mIter);
+            inNode->mIter = nullptr;
+            break;
+
+        case eM6AllNode:
+            result.reset(new M6AllDocIterator(mLastDocNr));
+            break;
+
+        case eM6AndNode:
+        {
+            // the children are ordered by estimate, if one of the rarer
+            // operands turns out to be empty the rest is not executed.
+            // AddIterator reads the first document of each operand, so
+            // this check is exact.
+            unique_ptr<M6IntersectionIterator> intersection(new M6IntersectionIterator);
+
+            for (M6QueryNode* child : inNode->mChildren)
+            {
+                M6Iterator* iter = Execute(child, inCount);
+                if (iter != nullptr)
+                    intersection->AddIterator(iter);
+
+                if (iter == nullptr or intersection->IsEmpty())
+                {
+                    intersection.reset();
+                    break;
+                }
+            }
+
+            result.reset(intersection.release());
+            break;
+        }
+
+        case eM6OrNode:
+            if (inNode->mBitmap)
+            {
+                vector<bool> bitmap(mLastDocNr + 1);
+                uint32 count = 0;
+
+                for (M6QueryNode* child : inNode->mChildren)
+                {
+                    unique_ptr<M6Iterator> iter(Execute(child, inCount));
+
+                    uint32 doc;
+                    float rank;
+                    while (iter and iter->Next(doc, rank))
+                    {
+                        if (doc < bitmap.size() and not bitmap[doc])
+                        {
+                            bitmap[doc] = true;
+                            ++count;
+                        }
+                    }
+                }
+
+                result.reset(new M6BitmapIterator(bitmap, count));
+            }
+            else
+            {
+                unique_ptr<M6UnionIterator> iter(new M6UnionIterator);
+                for (M6QueryNode* child : inNode->mChildren)
+                    iter->AddIterator(Execute(child, inCount));
+                result.reset(iter.release());
+            }
+            break;
+
+        case eM6NotNode:
+            result.reset(new M6NotIterator(Execute(inNode->mChildren.front(), inCount), mLastDocNr));
+            break;
+
+        case eM6AndNotNode:
+        {
+            M6Iterator* a = Execute(inNode->mChildren.front(), inCount);
+            if (a != nullptr)
+                result.reset(new M6DifferenceIterator(a, Execute(inNode->mChildren.back(), inCount)));
+            break;
+        }
+    }
+
+    if (inCount)
+    {
+        inNode->mExecuted = true;
+        if (result)
+            result.reset(new M6CountingIterator(result.release(), inNode->mActual));
+    }
+
+    return result.release();
+}
+
+void M6QueryPlanner::Explain(ostream& inOut, const M6QueryNode* inNode, uint32 inLevel)
+{
+    inOut << string(2 * inLevel, ' ');
+
+    switch (inNode->mKind)
+    {
+        case eM6LeafNode:
+            if (inNode->mLabel.empty())
+                inOut << "(nothing)";
+            else
+                inOut << inNode->mLabel;
+            break;
+
+        case eM6AllNode:        inOut << "all documents"; break;
+        case eM6AndNode:        inOut << "and"; break;
+        case eM6OrNode:            inOut << (inNode->mBitmap ? "or, using a bitmap" : "or"); break;
+        case eM6NotNode:        inOut << "not"; break;
+        case eM6AndNotNode:        inOut << "and not"; break;
+    }
+
+    inOut << " (estimated " << inNode->mEstimate << ", actual ";
+    if (inNode->mExecuted)
+        inOut << inNode->mActual;
+    else
+        inOut << "-, not executed";
+    inOut << ')' << endl;
+
+    for (const M6QueryNode* child : inNode->mChildren)
+        Explain(inOut, child, inLevel + 1);
+}
+
 // --------------------------------------------------------------------
 
 void AnalyseQuery(const string& inQuery, vector<string>& outTerms)
 {
     M6QueryParser parser(nullptr, inQuery, true);
 
-    M6Iterator* filter = nullptr;
-
     try
     {
-        parser.Parse(outTerms, filter);
+        delete parser.Parse(outTerms);
     }
     catch (...)
     {
         outTerms.clear();
     }
-
-    delete filter;
 }
 
 void ParseQuery(M6Databank& inDatabank, const string& inQuery,
@@ -498,15 +1094,37 @@ void ParseQuery(M6Databank& inDatabank, const string& inQuery,
     bool& outIsBooleanQuery)
 {
     M6QueryParser parser(&inDatabank, inQuery, inAllTermsRequired);
-    try
-    {
-        parser.Parse(outTerms, outFilter);
-        outIsBooleanQuery = parser.IsBooleanQuery();
-    }
-    catch (...)
-    {
-        delete outFilter;
-        throw;
-    }
+    unique_ptr<M6QueryNode> plan(parser.Parse(outTerms));
+    outIsBooleanQuery = parser.IsBooleanQuery();
+
+    M6QueryPlanner planner(inDatabank);
+    plan.reset(planner.Plan(plan.release()));
+    outFilter = planner.Execute(plan.get(), false);
 }
 
+void ExplainQuery(M6Databank& inDatabank, const string& inQuery,
+    bool inAllTermsRequired, ostream& inOut)
+{
+    vector<string> terms;
+
+    M6QueryParser parser(&inDatabank, inQuery, inAllTermsRequired);
+    unique_ptr<M6QueryNode> plan(parser.Parse(terms));
+
+    M6QueryPlanner planner(inDatabank);
+    plan.reset(planner.Plan(plan.release()));
+
+    unique_ptr<M6Iterator> filter(planner.Execute(plan.get(), true));
+
+    uint32 doc, count = 0;
+    float rank;
+    while (filter and filter->Next(doc, rank))
+        ++count;
+
+    planner.Explain(inOut, plan.get());
+
+    inOut << endl
+          << "documents: " << count << endl;
+
+    if (not terms.empty())
+        inOut << "ranked terms: " << ba::join(terms, " ") << endl;
+}
@@ -7,6 +7,7 @@
 
 #include <string>
 #include <vector>
+#include <iosfwd>
 
 class M6Databank;
 class M6Iterator;
@@ -18,3 +19,8 @@ void ParseQuery(M6Databank& inDatabank, const std::string& inQuery,
     bool inAllTermsRequired,
     std::vector<std::string>& outTerms, M6Iterator*& outFilter,
     bool& outIsBooleanQuery);
+
+// Execute the boolean part of inQuery and write the plan that was used
+// to inOut, along with the estimated and actual document counts per node
+void ExplainQuery(M6Databank& inDatabank, const std::string& inQuery,
+    bool inAllTermsRequired, std::ostream& inOut);
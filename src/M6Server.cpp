@@ -31,6 +31,9 @@
 
 #include "M6Utilities.h"
 #include "M6Databank.h"
+#include "M6Dictionary.h"
+#include "M6LinkGraph.h"
+#include "M6EntryFormat.h"
 #include "M6Server.h"
 #include "M6Error.h"
 #include "M6Iterator.h"
@@ -54,6 +57,7 @@ namespace pt = boost::posix_time;
 namespace po = boost::program_options;
 
 const string kM6ServerNS = "https://mrs.cmbi.ru.nl/mrs-web/ml";
+const uint32 kM6MaxSuggestPrefixLength = 64;
 
 // --------------------------------------------------------------------
 
@@ -70,6 +74,7 @@ M6Server* M6Server::sInstance;
 M6Server::M6Server(const zx::element* inConfig)
     : webapp(kM6ServerNS)
     , mConfig(inConfig)
+    , mLinkGraph(nullptr)
     , mAlignEnabled(false)
     , mConfigCopy(nullptr)
 {
@@ -79,6 +84,22 @@ M6Server::M6Server(const zx::element* inConfig)
 
     LOG(INFO,"M6Server: done loading databanks");
 
+    // compile the link rules of the entry formats once, they are shared by all threads
+    for (zx::element* format : M6Config::GetFormats())
+    {
+        vector<M6LinkRule> rules;
+        for (zx::element* link : format->find("link"))
+        {
+            M6LinkRule rule = { link->get_attribute("rx"), link->get_attribute("db"),
+                link->get_attribute("ix"), link->get_attribute("id"), link->get_attribute("an") };
+            rules.push_back(rule);
+        }
+
+        string id = format->get_attribute("id");
+        delete mEntryFormats[id];
+        mEntryFormats[id] = new M6EntryFormat(id, rules);
+    }
+
     set_docroot(M6Config::GetDirectory("docroot"));
 
     log_forwarded(mConfig->get_attribute("log-forwarded") == "true");
@@ -97,6 +118,7 @@ M6Server::M6Server(const zx::element* inConfig)
     mount("images",            boost::bind(&M6Server::handle_file, this, _1, _2, _3));
 
     mount("ajax/search",    boost::bind(&M6Server::handle_search_ajax, this, _1, _2, _3));
+    mount("ajax/suggest",    boost::bind(&M6Server::handle_suggest_ajax, this, _1, _2, _3));
 
     mount("rest",            boost::bind(&M6Server::handle_rest, this, _1, _2, _3));
 
@@ -229,6 +251,11 @@ M6Server::~M6Server()
         delete db.mParser;
     }
 
+    delete mLinkGraph;
+
+    for (auto& format : mEntryFormats)
+        delete format.second;
+
     for (zeep::dispatcher* ws : mWebServices)
         delete ws;
 
@@ -313,8 +340,45 @@ void M6Server::LoadAllDatabanks()
         }
     }
 
+    // the link graph is used for the loaded databanks it contains that
+    // were not rebuilt since, links from or to other databanks are
+    // resolved using the link indices and documents
+    fs::path linkGraphFile = M6Config::GetLinkGraphFile();
+    if (fs::exists(linkGraphFile))
+    {
+        try
+        {
+            unique_ptr<M6LinkGraph> linkGraph(new M6LinkGraph(linkGraphFile));
+
+            vector<string> dbs;
+            for (M6LoadedDatabank& db : mLoadedDatabanks)
+            {
+                uint32 nr = linkGraph->GetDatabankNr(*db.mDatabank);
+                if (nr == M6LinkGraph::kNoDatabank)
+                {
+                    LOG(INFO, "M6Server: link graph is out of date for %s", db.mID.c_str());
+                    continue;
+                }
+
+                if (dbs.size() <= nr)
+                    dbs.resize(nr + 1);
+                dbs[nr] = db.mID;
+            }
+
+            if (not dbs.empty())
+            {
+                mLinkGraph = linkGraph.release();
+                swap(mLinkGraphDbs, dbs);
+            }
+        }
+        catch (exception& e)
+        {
+            LOG(ERROR, "M6Server: error loading link graph: %s", e.what());
+        }
+    }
+
     for (M6LoadedDatabank& db : mLoadedDatabanks)
-        db.mDatabank->InitLinkMap(mLinkMap);
+        db.mDatabank->InitLinkMap(mLinkMap, mLinkGraph);
 
     // setup the mBlastDatabanks list
     for (auto& blastAlias : blastAliases)
@@ -685,15 +749,44 @@ vector<string> M6Server::GetAliases(const string& inDatabank)
 }
 
 void M6Server::GetLinkedDbs(const string& inDb, const string& inId,
-    vector<string>& outLinkedDbs)
+    vector<pair<string,uint32>>& outLinkedDbs)
 {
-    set<string> dbs;
+    map<string,uint32> dbs;
+    set<string> inGraph;    // the databanks for which the link graph is used
 
     string id(inId);
     M6Tokenizer::CaseFold(id);
 
     M6Databank* databank = Load(inDb);
-    if (databank != nullptr)
+
+    if (databank != nullptr and mLinkGraph != nullptr)
+    {
+        uint32 nr = mLinkGraph->GetDatabankNr(*databank);
+        uint32 docNr = databank->DocNrForID(id);
+
+        if (nr != M6LinkGraph::kNoDatabank and docNr != 0)
+        {
+            for (const string& db : mLinkGraphDbs)
+            {
+                if (not db.empty())
+                    inGraph.insert(db);
+            }
+
+            vector<pair<uint32,uint32>> linked;
+            mLinkGraph->GetLinkedDatabanks(nr, docNr, linked);
+
+            for (auto& l : linked)
+            {
+                if (l.first < mLinkGraphDbs.size() and not mLinkGraphDbs[l.first].empty())
+                    dbs[mLinkGraphDbs[l.first]] = l.second;
+            }
+        }
+    }
+
+    // the remaining databanks are checked the old way, the number of
+    // linked documents is not known for these
+
+    if (databank != nullptr and inGraph.size() < mLoadedDatabanks.size())
     {
         unique_ptr<M6Document> doc(databank->Fetch(id));
         if (doc)
@@ -704,7 +797,7 @@ void M6Server::GetLinkedDbs(const string& inDb, const string& inId,
 
                 for (const string& alias : aliases)
                 {
-                    if (dbs.count(alias))
+                    if (dbs.count(alias) or inGraph.count(alias))
                         continue;
 
                     M6Databank* db = Load(alias);
@@ -718,7 +811,7 @@ void M6Server::GetLinkedDbs(const string& inDb, const string& inId,
                         tie(exists, docNr) = db->Exists("id", id);
                         if (exists)
                         {
-                            dbs.insert(alias);
+                            dbs[alias] = 0;
                             break;
                         }
                     }
@@ -731,14 +824,14 @@ void M6Server::GetLinkedDbs(const string& inDb, const string& inId,
 
     for (auto& db : mLoadedDatabanks)
     {
-        if (dbs.count(db.mID))
+        if (dbs.count(db.mID) or inGraph.count(db.mID))
             continue;
 
         for (auto& alias : aliases)
         {
             if (db.mDatabank->IsLinked(alias, inId))
             {
-                dbs.insert(db.mID);
+                dbs[db.mID] = 0;
                 break;
             }
         }
@@ -749,14 +842,20 @@ void M6Server::GetLinkedDbs(const string& inDb, const string& inId,
 
 void M6Server::AddLinks(const string& inDB, const string& inID, el::object& inHit)
 {
-    vector<string> linkedDbs;
+    vector<pair<string,uint32>> linkedDbs;
     GetLinkedDbs(inDB, inID, linkedDbs);
 
     if (not linkedDbs.empty())
     {
         vector<el::object> linked;
-        for (string& db : linkedDbs)
-            linked.push_back(el::object(db));
+        for (auto& db : linkedDbs)
+        {
+            el::object link;
+            link["id"] = db.first;
+            if (db.second > 0)
+                link["count"] = db.second;
+            linked.push_back(link);
+        }
         inHit["links"] = el::object(linked);
     }
 }
@@ -828,6 +927,18 @@ void M6Server::handle_request(const zh::request& req, zh::reply& rep)
     }
 }
 
+// the request handlers only see the request, remember who sent it
+
+void M6Server::handle_request(boost::asio::ip::tcp::socket& socket,
+    const zh::request& req, zh::reply& rep)
+{
+    boost::system::error_code ec;
+    boost::asio::ip::tcp::endpoint peer = socket.remote_endpoint(ec);
+    mPeerAddress.reset(new string(ec ? "" : peer.address().to_string()));
+
+    zh::webapp::handle_request(socket, req, rep);
+}
+
 void M6Server::handle_welcome(const zh::request& request, const el::scope& scope, zh::reply& reply)
 {
     try
@@ -1064,13 +1175,19 @@ void M6Server::handle_entry(const zh::request& request, const el::scope& scope,
         sub.put("blastable", el::object(find_if(mBlastDatabanks.begin(), mBlastDatabanks.end(),
                 [&db](M6BlastDatabank& bdb) -> bool { return bdb.mID == db; }) != mBlastDatabanks.end()));
 
-        vector<string> linkedDbs;
+        vector<pair<string,uint32>> linkedDbs;
         GetLinkedDbs(db, id, linkedDbs);
         if (not linkedDbs.empty())
         {
             vector<el::object> linked;
-            for (string& db : linkedDbs)
-            linked.push_back(el::object(db));
+            for (auto& db : linkedDbs)
+            {
+                el::object link;
+                link["id"] = db.first;
+                if (db.second > 0)
+                    link["count"] = db.second;
+                linked.push_back(link);
+            }
             sub.put("links", el::object(linked));
         }
 
@@ -1118,52 +1235,42 @@ void M6Server::handle_entry(const zh::request& request, const el::scope& scope,
             else if (not dbConfig->get_attribute("stylesheet").empty())
                 sub["formatXSLT"] = dbConfig->get_attribute("stylesheet");
 
+            boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+
             process_xml(root, sub, "/");
 
+            M6EntryFormat* entryFormat = nullptr;
             if (format != nullptr)
             {
-                zx::element_set links(format->find("link"));
-                for (zx::element* link : links)
-                {
-                    try
-                    {
-                        string ldb = link->get_attribute("db");
-                        string id = link->get_attribute("id");
-                        string ix = link->get_attribute("ix");
-                        string anchor = link->get_attribute("an");
-                        if (ldb.empty())
-                            ldb = db;
-                        if (id.empty())
-                            continue;
-                        boost::regex re(link->get_attribute("rx"));
-                        create_link_tags(root, re, ldb, ix, id, anchor);
-                    }
-                    catch (...) {}
-                }
+                auto f = mEntryFormats.find(format->get_attribute("id"));
+                if (f != mEntryFormats.end())
+                    entryFormat = f->second;
             }
 
+            unique_ptr<M6Highlighter> highlighter;
             if (not q.empty())
             {
                 try
                 {
                     vector<string> terms;
                     AnalyseQuery(q, terms);
-                    if (not terms.empty())
-                    {
-                        string pattern = ba::join(terms, "|");
 
-                        if (uc::contains_han(pattern))
-                            pattern = string("(") + pattern + ")";
-                        else
-                            pattern = string("\\b(") + pattern + ")\\b";
-
-                        boost::regex re(pattern, boost::regex_constants::icase);
-                        highlight_query_terms(root, re);
-                    }
+                    highlighter.reset(new M6Highlighter(terms));
+                    if (highlighter->Empty())
+                        highlighter.reset();
                 }
                 catch (...) {}
             }
 
+            if (entryFormat != nullptr or highlighter)
+                create_link_and_highlight_tags(root, entryFormat, db, highlighter.get());
+
+            if (entryFormat != nullptr)
+            {
+                boost::chrono::duration<double> elapsed = boost::chrono::steady_clock::now() - start;
+                entryFormat->AddTiming(elapsed.count());
+            }
+
             reply.set_content(doc);
         }
         catch (M6Redirect& redirect)
@@ -1184,15 +1291,20 @@ void M6Server::handle_entry(const zh::request& request, const el::scope& scope,
     }
 }
 
-void M6Server::highlight_query_terms(zx::element* node, boost::regex& expr)
+// create_link_and_highlight_tags makes a single pass over the text nodes.
+// Links and query terms are both found in the original text of a node and
+// the node is split once. Highlights inside a link end up in the a element.
+
+void M6Server::create_link_and_highlight_tags(zx::element* node, const M6EntryFormat* inFormat,
+    const string& inDatabank, const M6Highlighter* inHighlighter)
 {
     for (zx::element* e : *node)
     {
         // do not highlight script, style or head blocks
         if (e->name() == "script" or e->name() == "head" or e->name() == "style")
-            continue;
-
-        highlight_query_terms(e, expr);
+            create_link_and_highlight_tags(e, inFormat, inDatabank, nullptr);
+        else
+            create_link_and_highlight_tags(e, inFormat, inDatabank, inHighlighter);
     }
 
     for (zx::node* n : node->nodes())
@@ -1202,122 +1314,161 @@ void M6Server::highlight_query_terms(zx::element* node, boost::regex& expr)
         if (text == nullptr)
             continue;
 
-        for (;;)
+        string s = text->str();
+
+        vector<M6EntryLink> links;
+        if (inFormat != nullptr and s.length() <= 1024 * 1024)    // if text is more than 1 MB we give up...
         {
-            boost::smatch m;
+            try
+            {
+                inFormat->FindLinks(s, inDatabank, links);
+            }
+            catch (...) {}
+        }
 
-            // somehow boost::regex_search works incorrectly with a const std::string...
-#if defined(_MSC_VER)
-            string s = text->str();
-#else
-            const string& s = text->str();
-#endif
-            if (not boost::regex_search(s, m, expr) or not m[0].matched or m[0].length() == 0)
-                break;
+        vector<pair<size_t,size_t>> matches;
+        if (inHighlighter != nullptr)
+        {
+            try
+            {
+                inHighlighter->Find(s, matches);
+            }
+            catch (...) {}
+        }
+
+        if (links.empty() and matches.empty())
+            continue;
 
-            // split the text
-            node->insert(text, new zx::text(m.prefix()));
+        vector<pair<size_t,size_t>>::const_iterator m = matches.begin();
 
-            zx::element* span = new zx::element("span");
-            span->add_text(m[0]);
-            span->set_attribute("class", "highlight");
-            node->insert(text, span);
+        // split the text
+        size_t offset = 0;
+        for (M6EntryLink& link : links)
+        {
+            if (link.mOffset > offset)
+                insert_highlighted_text(node, text, s, offset, link.mOffset, matches, m);
+
+            zx::element* a = create_link_tag(link);
+            if (a != nullptr)
+            {
+                insert_highlighted_text(a, nullptr, s, link.mOffset, link.mOffset + link.mLength, matches, m);
+                node->insert(text, a);
+            }
+            else
+                insert_highlighted_text(node, text, s, link.mOffset, link.mOffset + link.mLength, matches, m);
+
+            offset = link.mOffset + link.mLength;
+        }
 
-            text->str(m.suffix());
+        if (not matches.empty() and matches.back().first + matches.back().second > offset)
+        {
+            size_t end = matches.back().first + matches.back().second;
+            insert_highlighted_text(node, text, s, offset, end, matches, m);
+            offset = end;
         }
+
+        text->str(s.substr(offset));
     }
 }
 
-void M6Server::create_link_tags(zx::element* node, boost::regex& expr,
-    const string& inDatabank, const string& inIndex, const string& inID, const string& inAnchor)
-{
-    for (zx::element* e : *node)
-        create_link_tags(e, expr, inDatabank, inIndex, inID, inAnchor);
+// insert_highlighted_text adds the text between inFrom and inTo to inParent,
+// before inBefore if specified. Matches are clipped to the range, a match
+// continuing past inTo is left in ioMatch for the next range.
 
-    for (zx::node* n : node->nodes())
+void M6Server::insert_highlighted_text(zx::element* inParent, zx::node* inBefore,
+    const string& inText, size_t inFrom, size_t inTo,
+    const vector<pair<size_t,size_t>>& inMatches, vector<pair<size_t,size_t>>::const_iterator& ioMatch)
+{
+    auto add = [inParent, inBefore](zx::node* n)
     {
-        zx::text* text = dynamic_cast<zx::text*>(n);
+        if (inBefore != nullptr)
+            inParent->insert(inBefore, n);
+        else
+            inParent->append(n);
+    };
 
-        if (text == nullptr)
-            continue;
+    while (ioMatch != inMatches.end() and ioMatch->first + ioMatch->second <= inFrom)
+        ++ioMatch;
 
-        for (;;)
+    while (inFrom < inTo)
+    {
+        if (ioMatch == inMatches.end() or ioMatch->first >= inTo)
         {
-            boost::smatch m;
+            add(new zx::text(inText.substr(inFrom, inTo - inFrom)));
+            break;
+        }
 
-            // somehow boost::regex_search works incorrectly with a const std::string...
-            string s = text->str();
+        size_t b = max(ioMatch->first, inFrom);
+        size_t e = min(ioMatch->first + ioMatch->second, inTo);
 
-            if (s.length() > 1024 * 1024)    // if text is more than 1 MB we give up...
-                break;
+        if (b > inFrom)
+            add(new zx::text(inText.substr(inFrom, b - inFrom)));
 
-            if (not boost::regex_search(s, m, expr) or not m[0].matched or m[0].length() == 0)
-                break;
+        zx::element* span = new zx::element("span");
+        span->add_text(inText.substr(b, e - b));
+        span->set_attribute("class", "highlight");
+        add(span);
 
-            string db = inDatabank; if (ba::starts_with(db, "$")) db = m[atoi(db.c_str() + 1)];
-            string id = inID;        if (ba::starts_with(id, "$")) id = m[atoi(id.c_str() + 1)];
-            string ix = inIndex;    if (ba::starts_with(ix, "$")) ix = m[atoi(ix.c_str() + 1)];
-//            string ix = node->get_attribute("index");            process_el(scope, ix);
-            string an = inAnchor;    if (ba::starts_with(an, "$")) an = m[atoi(an.c_str() + 1)];
-//            string title = node->get_attribute("title");        process_el(scope, title);
-            string title;
-            string q;
-//            string q = node->get_attribute("q");                process_el(scope, q);
+        inFrom = e;
+        if (ioMatch->first + ioMatch->second <= inTo)
+            ++ioMatch;
+    }
+}
 
-            bool exists = false;
-            uint32 docNr = 0;
+// create_link_tag returns an a element for inLink, or nullptr when the
+// linked databank is not available.
 
-            zx::node* replacement = new zx::text(m[0]);
+zx::element* M6Server::create_link_tag(M6EntryLink& inLink)
+{
+    string& db = inLink.mDb;
+    string& id = inLink.mID;
+    string& ix = inLink.mIx;
+    string& an = inLink.mAnchor;
 
-            try
-            {
-                M6Databank* mdb = Load(db);
-                if (mdb != nullptr)
-                {
-                    M6Tokenizer::CaseFold(id);
+    unique_ptr<zx::element> a;
 
-                    tie(exists, docNr) = mdb->Exists(ix, id);
+    try
+    {
+        M6Databank* mdb = Load(db);
+        if (mdb != nullptr)
+        {
+            bool exists = false;
+            uint32 docNr = 0;
 
-                    unique_ptr<zx::element> a(new zeep::xml::element("a"));
+            M6Tokenizer::CaseFold(id);
 
-                    if (docNr != 0)
-                        a->set_attribute("href",
-                            (boost::format("entry?db=%1%&nr=%2%%3%%4%")
-                                % zeep::http::encode_url(db)
-                                % docNr
-                                % (q.empty() ? "" : ("&q=" + zeep::http::encode_url(q)).c_str())
-                                % (an.empty() ? "" : (string("#") + zeep::http::encode_url(an)).c_str())
-                            ).str());
-                    else
-                    {
-                        a->set_attribute("href",
-                            (boost::format("link?db=%1%&ix=%2%&id=%3%%4%%5%")
-                                % zeep::http::encode_url(db)
-                                % zeep::http::encode_url(ix)
-                                % zeep::http::encode_url(id)
-                                % (q.empty() ? "" : ("&q=" + zeep::http::encode_url(q)).c_str())
-                                % (an.empty() ? "" : (string("#") + zeep::http::encode_url(an)).c_str())
-                            ).str());
-
-                        if (not exists)
-                            a->set_attribute("class", "not-found");
-                    }
+            tie(exists, docNr) = mdb->Exists(ix, id);
 
-                    if (not title.empty())
-                        a->set_attribute("title", title);
+            a.reset(new zeep::xml::element("a"));
 
-                    a->append(replacement);
-                    replacement = a.release();
-                }
+            if (docNr != 0)
+                a->set_attribute("href",
+                    (boost::format("entry?db=%1%&nr=%2%%3%")
+                        % zeep::http::encode_url(db)
+                        % docNr
+                        % (an.empty() ? "" : (string("#") + zeep::http::encode_url(an)).c_str())
+                    ).str());
+            else
+            {
+                a->set_attribute("href",
+                    (boost::format("link?db=%1%&ix=%2%&id=%3%%4%")
+                        % zeep::http::encode_url(db)
+                        % zeep::http::encode_url(ix)
+                        % zeep::http::encode_url(id)
+                        % (an.empty() ? "" : (string("#") + zeep::http::encode_url(an)).c_str())
+                    ).str());
+
+                if (not exists)
+                    a->set_attribute("class", "not-found");
             }
-            catch (...) {}
-
-            // split the text
-            node->insert(text, new zx::text(m.prefix()));
-            node->insert(text, replacement);
-            text->str(m.suffix());
         }
     }
+    catch (...)
+    {
+        a.reset();
+    }
+
+    return a.release();
 }
 
 void M6Server::handle_search(const zh::request& request,
@@ -1750,17 +1901,24 @@ void M6Server::handle_similar(const zh::request& request, const el::scope& scope
         M6Databank* mdb = Load(db);
         if (mdb == nullptr) THROW(("Databank %s not loaded", db.c_str()));
 
-        vector<string> queryTerms;
+        uint32 docNr = boost::lexical_cast<uint32>(nr);
+        unique_ptr<M6Iterator> results(mdb->FindSimilar(docNr, resultoffset + maxresultcount));
 
-        unique_ptr<M6Document> doc(mdb->Fetch(boost::lexical_cast<uint32>(nr)));
-        if (not doc)
-            THROW(("Unable to fetch document"));
+        // databanks built without term vectors need the parser to tokenize the document
+        if (not results)
+        {
+            vector<string> queryTerms;
+
+            unique_ptr<M6Document> doc(mdb->Fetch(docNr));
+            if (not doc)
+                THROW(("Unable to fetch document"));
 
-        M6Builder::IndexDocument(db, mdb, doc->GetText(), doc->GetAttribute("filename"), queryTerms);
+            M6Builder::IndexDocument(db, mdb, doc->GetText(), doc->GetAttribute("filename"), queryTerms);
 
-        M6Iterator* filter = nullptr;
-        unique_ptr<M6Iterator> results(mdb->Find(queryTerms, filter, false, resultoffset + maxresultcount));
-        delete filter;
+            M6Iterator* filter = nullptr;
+            results.reset(mdb->Find(queryTerms, filter, false, resultoffset + maxresultcount));
+            delete filter;
+        }
 
         if (results)
         {
@@ -1871,6 +2029,45 @@ void M6Server::handle_search_ajax(const zh::request& request, const el::scope& s
     }
 }
 
+// Type-ahead suggestions, called on every keystroke. Only the last word
+// of q is completed, the answer comes straight from the completion index.
+
+void M6Server::handle_suggest_ajax(const zh::request& request, const el::scope& scope, zh::reply& reply)
+{
+    zh::parameter_map params;
+    get_parameters(scope, params);
+
+    string q = params.get("q", "").as<string>();
+    string db = params.get("db", "all").as<string>();
+    uint32 count = params.get("count", kM6CompletionSize).as<uint32>();
+
+    // the completion index does not store more terms per prefix
+    if (count == 0 or count > kM6CompletionSize)
+        count = kM6CompletionSize;
+
+    string::size_type s = q.find_last_of(" \t");
+    if (s != string::npos)
+        q.erase(0, s + 1);
+
+    vector<el::object> suggestions;
+
+    if (not q.empty() and q.length() <= kM6MaxSuggestPrefixLength)
+    {
+        vector<pair<string,uint32>> terms;
+        SuggestSearchTerms(db, q, terms);
+
+        for (auto& t : terms)
+        {
+            if (suggestions.size() >= count)
+                break;
+            suggestions.push_back(el::object(t.first));
+        }
+    }
+
+    reply.set_content(el::object(suggestions).toJSON(), "text/javascript");
+    reply.set_header("Cache-Control", "max-age=3600");
+}
+
 void M6Server::ProcessNewConfig(const string& inPage, zeep::http::parameter_map& inParams)
 {
     typedef zh::parameter_map::iterator iter;
@@ -2497,6 +2694,10 @@ void M6Server::handle_admin_blast_queue_ajax(const zh::request& request,
             job["db"] = jobDesc.db;
             job["queryLength"] = jobDesc.queryLength;
             job["status"] = jobDesc.status;
+            job["client"] = jobDesc.client;
+            job["queueTime"] = jobDesc.queueTime;
+            job["runTime"] = jobDesc.runTime;
+            job["threads"] = jobDesc.threads;
             jobs.push_back(job);
         }
 
@@ -2939,6 +3140,38 @@ void M6Server::SpellCheck(const string& inDatabank, const string& inTerm,
     }
 }
 
+void M6Server::SuggestSearchTerms(const string& inDatabank, const string& inPrefix,
+    vector<pair<string,uint32>>& outTerms)
+{
+    if (inDatabank == "all")
+    {
+        vector<pair<string,uint32>> terms;
+
+        for (M6LoadedDatabank& db : mLoadedDatabanks)
+            db.mDatabank->SuggestSearchTerms(inPrefix, terms);
+
+        sort(terms.begin(), terms.end());
+
+        // merge the document frequencies for terms found in several databanks
+        for (auto& t : terms)
+        {
+            if (not outTerms.empty() and outTerms.back().first == t.first)
+                outTerms.back().second += t.second;
+            else
+                outTerms.push_back(t);
+        }
+
+        stable_sort(outTerms.begin(), outTerms.end(),
+            [](const pair<string,uint32>& a, const pair<string,uint32>& b) -> bool { return a.second > b.second; });
+    }
+    else
+    {
+        M6Databank* db = Load(inDatabank);
+        if (db != nullptr)
+            db->SuggestSearchTerms(inPrefix, outTerms);
+    }
+}
+
 // ====================================================================
 // Blast
 
@@ -3364,10 +3597,29 @@ void M6Server::handle_blast_submit_ajax(
                 }
             }
 
+            // the scheduler shares the blast threads fairly between clients.
+            // Anyone can send an X-Forwarded-For header, so it is only used
+            // when we're configured to run behind a proxy.
+            string client;
+            if (mConfig->get_attribute("log-forwarded") == "true")
+            {
+                for (const zh::header& h : request.headers)
+                {
+                    if (ba::iequals(h.name, "X-Forwarded-For"))
+                    {
+                        client = h.value.substr(0, h.value.find(','));
+                        break;
+                    }
+                }
+            }
+
+            if (client.empty() and mPeerAddress.get() != nullptr)
+                client = *mPeerAddress;
+
             string jobId = M6BlastCache::Instance().Submit(
                 db, query, program, matrix, wordSize,
                 boost::lexical_cast<double>(expect), filter,
-                gapped, gapOpen, gapExtend, reportLimit);
+                gapped, gapOpen, gapExtend, reportLimit, client);
 
             LOG (DEBUG, "handle_blast_submit_ajax: created new job with id: %s", jobId.c_str ());
 
@@ -3558,6 +3810,22 @@ void M6Server::handle_status(const zh::request& request, const el::scope& scope,
         }
         sub.put("statusDatabanks", el::object(databanks));
 
+        vector<el::object> formats;
+        for (auto& f : mEntryFormats)
+        {
+            uint32 count;
+            double total, max;
+            f.second->GetTiming(count, total, max);
+
+            el::object format;
+            format["id"] = f.first;
+            format["entries"] = count;
+            format["average"] = (boost::format("%.2f") % (count ? 1000 * total / count : 0)).str();
+            format["max"] = (boost::format("%.2f") % (1000 * max)).str();
+            formats.push_back(format);
+        }
+        sub.put("statusFormats", el::object(formats));
+
         create_reply_from_template("status.html", sub, reply);
         reply.set_header("Cache-Control", "no-cache");
 
@@ -11,6 +11,8 @@
 
 #include <tuple>
 
+#include <boost/thread/tss.hpp>
+
 #include <zeep/http/webapp.hpp>
 #include <zeep/http/webapp/el.hpp>
 #include <zeep/dispatcher.hpp>
@@ -23,6 +25,10 @@ namespace el = zeep::http::el;
 
 class M6Iterator;
 class M6Databank;
+class M6EntryFormat;
+class M6Highlighter;
+struct M6EntryLink;
+class M6LinkGraph;
 class M6Parser;
 class M6WSSearch;
 class M6WSBlast;
@@ -45,6 +51,8 @@ class M6Server : public zh::webapp
     static int        Reload(const std::string& inPidFile);
 
     virtual void    handle_request(const zh::request& req, zh::reply& rep);
+    virtual void    handle_request(boost::asio::ip::tcp::socket& socket,
+                        const zh::request& req, zh::reply& rep);
 
     void            LoadAllDatabanks();
     M6Databank*        Load(const std::string& inDatabank);
@@ -80,7 +88,10 @@ class M6Server : public zh::webapp
                         std::vector<el::object>& outHits, uint32& outHitCount, bool& outRanked,
                         std::string& outParseError);
 
-    void            GetLinkedDbs(const std::string& inDb, const std::string& inId, std::vector<std::string>& outLinkedDbs);
+    // the linked databanks with the number of linked documents, or zero if
+    // this number is unknown
+    void            GetLinkedDbs(const std::string& inDb, const std::string& inId,
+                        std::vector<std::pair<std::string,uint32>>& outLinkedDbs);
     void            AddLinks(const std::string& inDb, const std::string& inId, el::object& inHit);
 
     uint32            Count(const std::string& inDatabank, const std::string& inQuery);
@@ -111,6 +122,7 @@ class M6Server : public zh::webapp
     void            handle_welcome(const zh::request& request, const el::scope& scope, zh::reply& reply);
 
     void            handle_search_ajax(const zh::request& request, const el::scope& scope, zh::reply& reply);
+    void            handle_suggest_ajax(const zh::request& request, const el::scope& scope, zh::reply& reply);
 
     void            handle_rest(const zh::request& request, const el::scope& scope, zh::reply& reply);
     void            handle_rest_entry(const zh::request& request, const el::scope& scope, zh::reply& reply);
@@ -143,12 +155,18 @@ class M6Server : public zh::webapp
                         const std::string& q, bool redirectForQuery,
                         const zh::request& req, zh::reply& rep);
 
-    void            highlight_query_terms(zx::element* node, boost::regex& expr);
-    void            create_link_tags(zx::element* node, boost::regex& expr, const std::string& inDatabank,
-                        const std::string& inIndex, const std::string& inID, const std::string& inAnchor);
+    void            create_link_and_highlight_tags(zx::element* node, const M6EntryFormat* inFormat,
+                        const std::string& inDatabank, const M6Highlighter* inHighlighter);
+    void            insert_highlighted_text(zx::element* inParent, zx::node* inBefore,
+                        const std::string& inText, size_t inFrom, size_t inTo,
+                        const std::vector<std::pair<size_t,size_t>>& inMatches,
+                        std::vector<std::pair<size_t,size_t>>::const_iterator& ioMatch);
+    zx::element*    create_link_tag(M6EntryLink& inLink);
 
     void            SpellCheck(const std::string& inDatabank, const std::string& inTerm,
                         std::vector<std::pair<std::string,uint16>>& outCorrections);
+    void            SuggestSearchTerms(const std::string& inDatabank, const std::string& inPrefix,
+                        std::vector<std::pair<std::string,uint32>>& outTerms);
 
     static M6Server*
                     sInstance;
@@ -158,10 +176,17 @@ class M6Server : public zh::webapp
     M6DbList        mLoadedDatabanks;
     M6BlastDbList    mBlastDatabanks;
     M6LinkMap        mLinkMap;
+    M6LinkGraph*    mLinkGraph;
+    std::vector<std::string>
+                    mLinkGraphDbs;    // databank ID for each databank in the link graph
+    std::map<std::string,M6EntryFormat*>
+                    mEntryFormats;    // the link rules of each format, compiled
 
     boost::mutex    mAuthMutex;
     std::string        mBaseURL;
     bool            mAlignEnabled;
+    boost::thread_specific_ptr<std::string>
+                    mPeerAddress;    // of the connection of the current request
 
     M6Config::File*    mConfigCopy;
 
@@ -0,0 +1,397 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#include "M6Lib.h"
+
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "M6Similarity.h"
+#include "M6Error.h"
+#include "M6File.h"
+#include "M6Progress.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+namespace io = boost::iostreams;
+
+// The file starts with a header, followed by an offset table and the
+// term vectors for all documents, and an offset table and the postings
+// for all terms. A term vector holds at most kM6SimilarTermCount terms
+// ordered by weight, normalized to unit length. The postings of a term
+// are ordered by weight as well (impact ordered). Terms are numbered
+// consecutively, only terms that occur in a vector are stored.
+
+const uint32
+    kM6SimilaritySignature    = 'm6sv',
+    kM6SimilarityVersion    = 1,
+    kM6SimilarTermCount        = 16,
+    kM6SimilarMaxWork        = 1 << 20;    // max number of postings read per search
+
+struct M6SimilarityHeader
+{
+    uint32        mSignature;
+    uint32        mVersion;
+    uint32        mDocCount;
+    uint32        mTermCount;
+    int64        mDocOffsets;    // file offset of mDocCount + 1 offsets into the vectors
+    int64        mVectors;
+    int64        mTermOffsets;    // file offset of mTermCount + 1 offsets into the postings
+    int64        mPostings;
+    int64        mFileSize;
+};
+
+// in a vector mNr is a term number, in the postings it is a document number
+
+struct M6SimilarityEntry
+{
+    uint32        mNr;
+    float        mWeight;
+};
+
+static_assert(sizeof(M6SimilarityEntry) == 8, "Similarity entry is of incorrect size");
+
+struct M6SimilarityIndexImpl
+{
+                M6SimilarityIndexImpl(const fs::path& inFile);
+
+    void        FindSimilar(uint32 inDocNr, uint32 inReportLimit,
+                    vector<pair<uint32,float>>& outDocs, uint32& outCount) const;
+
+    float        Score(const M6SimilarityEntry* inQuery, uint32 inQueryLength, uint32 inDocNr) const;
+
+    io::mapped_file                mFile;
+    const M6SimilarityHeader*    mHeader;
+    const uint32*                mDocOffsets;
+    const M6SimilarityEntry*    mVectors;
+    const uint32*                mTermOffsets;
+    const M6SimilarityEntry*    mPostings;
+};
+
+M6SimilarityIndexImpl::M6SimilarityIndexImpl(const fs::path& inFile)
+{
+    mFile.open(inFile.string().c_str(), io::mapped_file::readonly);
+    if (not mFile.is_open())
+        THROW(("Could not open similarity index %s", inFile.string().c_str()));
+
+    const char* data = mFile.const_data();
+    mHeader = reinterpret_cast<const M6SimilarityHeader*>(data);
+
+    if (mFile.size() < sizeof(M6SimilarityHeader) or
+        mHeader->mSignature != kM6SimilaritySignature or mHeader->mVersion != kM6SimilarityVersion or
+        mHeader->mFileSize != static_cast<int64>(mFile.size()))
+    {
+        THROW(("Similarity index %s is invalid", inFile.string().c_str()));
+    }
+
+    mDocOffsets = reinterpret_cast<const uint32*>(data + mHeader->mDocOffsets);
+    mVectors = reinterpret_cast<const M6SimilarityEntry*>(data + mHeader->mVectors);
+    mTermOffsets = reinterpret_cast<const uint32*>(data + mHeader->mTermOffsets);
+    mPostings = reinterpret_cast<const M6SimilarityEntry*>(data + mHeader->mPostings);
+}
+
+float M6SimilarityIndexImpl::Score(const M6SimilarityEntry* inQuery, uint32 inQueryLength, uint32 inDocNr) const
+{
+    float result = 0;
+
+    for (uint32 i = mDocOffsets[inDocNr]; i < mDocOffsets[inDocNr + 1]; ++i)
+    {
+        for (uint32 j = 0; j < inQueryLength; ++j)
+        {
+            if (inQuery[j].mNr == mVectors[i].mNr)
+            {
+                result += inQuery[j].mWeight * mVectors[i].mWeight;
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+// The search is score-at-a-time: the posting with the highest impact
+// (query weight times document weight) over all query terms is added
+// first. Since postings are ordered by weight, the sum of the impacts at
+// the cursors bounds what any document can still gain. Once the k-th best
+// score cannot be overtaken anymore, the search stops and the scores of
+// the k best documents are completed from their vectors.
+
+void M6SimilarityIndexImpl::FindSimilar(uint32 inDocNr, uint32 inReportLimit,
+    vector<pair<uint32,float>>& outDocs, uint32& outCount) const
+{
+    outCount = 0;
+
+    if (inDocNr >= mHeader->mDocCount or inReportLimit == 0)
+        return;
+
+    const M6SimilarityEntry* query = mVectors + mDocOffsets[inDocNr];
+    uint32 queryLength = mDocOffsets[inDocNr + 1] - mDocOffsets[inDocNr];
+
+    struct M6Cursor
+    {
+        const M6SimilarityEntry*    mPtr;
+        const M6SimilarityEntry*    mEnd;
+        float                        mWeight;
+
+        float                        Impact() const    { return mPtr < mEnd ? mWeight * mPtr->mWeight : 0; }
+    } cursors[kM6SimilarTermCount];
+
+    for (uint32 i = 0; i < queryLength; ++i)
+    {
+        cursors[i].mPtr = mPostings + mTermOffsets[query[i].mNr];
+        cursors[i].mEnd = mPostings + mTermOffsets[query[i].mNr + 1];
+        cursors[i].mWeight = query[i].mWeight;
+    }
+
+    unordered_map<uint32,float> A;
+    vector<float> scores;
+    uint32 work = 0, nextCheck = max(inReportLimit, 64U);
+
+    for (;;)
+    {
+        uint32 best = queryLength;
+        float impact = 0;
+
+        for (uint32 i = 0; i < queryLength; ++i)
+        {
+            if (impact < cursors[i].Impact())
+            {
+                impact = cursors[i].Impact();
+                best = i;
+            }
+        }
+
+        if (best == queryLength or ++work > kM6SimilarMaxWork)
+            break;
+
+        A[cursors[best].mPtr->mNr] += impact;
+        ++cursors[best].mPtr;
+
+        if (work == nextCheck and A.size() >= inReportLimit)
+        {
+            nextCheck *= 2;
+
+            float remaining = 0;
+            for (uint32 i = 0; i < queryLength; ++i)
+                remaining += cursors[i].Impact();
+
+            scores.clear();
+            for (auto& a : A)
+                scores.push_back(a.second);
+
+            // the k-th best score, and the best score after it
+            float next = 0;
+            if (scores.size() > inReportLimit)
+            {
+                nth_element(scores.begin(), scores.begin() + inReportLimit, scores.end(), greater<float>());
+                next = scores[inReportLimit];
+            }
+            float kth = *min_element(scores.begin(), scores.begin() + inReportLimit);
+
+            if (kth >= next + remaining)
+                break;
+        }
+        else if (work == nextCheck)
+            nextCheck *= 2;
+    }
+
+    outCount = static_cast<uint32>(A.size());
+
+    outDocs.clear();
+    for (auto& a : A)
+        outDocs.push_back(a);
+
+    auto compare = [](const pair<uint32,float>& a, const pair<uint32,float>& b) -> bool
+        { return a.second > b.second or (a.second == b.second and a.first < b.first); };
+
+    if (outDocs.size() > inReportLimit)
+    {
+        partial_sort(outDocs.begin(), outDocs.begin() + inReportLimit, outDocs.end(), compare);
+        outDocs.erase(outDocs.begin() + inReportLimit, outDocs.end());
+    }
+
+    for (auto& d : outDocs)
+        d.second = Score(query, queryLength, d.first);
+
+    sort(outDocs.begin(), outDocs.end(), compare);
+}
+
+// --------------------------------------------------------------------
+
+M6SimilarityIndex::M6SimilarityIndex(fs::path inFile)
+    : mImpl(nullptr)
+{
+    if (not fs::exists(inFile))
+        THROW(("Similarity index %s does not exist", inFile.string().c_str()));
+
+    mImpl = new M6SimilarityIndexImpl(inFile);
+}
+
+M6SimilarityIndex::~M6SimilarityIndex()
+{
+    delete mImpl;
+}
+
+void M6SimilarityIndex::FindSimilar(uint32 inDocNr, uint32 inReportLimit,
+    vector<pair<uint32,float>>& outDocs, uint32& outCount) const
+{
+    mImpl->FindSimilar(inDocNr, inReportLimit, outDocs, outCount);
+}
+
+bool M6SimilarityIndex::CanCreate(uint32 inMaxDocNr)
+{
+    return static_cast<uint64>(inMaxDocNr) * kM6SimilarTermCount <= numeric_limits<uint32>::max();
+}
+
+void M6SimilarityIndex::Create(M6WeightedBasicIndex& inIndex, uint32 inDocCount,
+    const vector<float>& inDocWeights, M6File& inFile, M6Progress& inProgress)
+{
+    uint32 maxDocNr = static_cast<uint32>(inDocWeights.size());
+    float docCount = static_cast<float>(inDocCount);
+
+    if (not CanCreate(maxDocNr))
+        THROW(("Too many documents for a similarity index"));
+
+    // collect the best terms for each document in a fixed size heap
+
+    vector<M6SimilarityEntry> vectors(static_cast<size_t>(maxDocNr) * kM6SimilarTermCount);
+    vector<uint8> counts(maxDocNr);
+    uint32 maxTermNr = 0;
+
+    auto lighter = [](const M6SimilarityEntry& a, const M6SimilarityEntry& b) -> bool
+        { return a.mWeight > b.mWeight or (a.mWeight == b.mWeight and a.mNr < b.mNr); };
+
+    inIndex.VisitPostings([&](uint32 inTermNr, uint32 inDocFrequency, uint8 inWeight, const vector<uint32>& inDocs)
+    {
+        float idf = log(1.f + docCount / inDocFrequency);
+        maxTermNr = inTermNr;
+
+        for (uint32 doc : inDocs)
+        {
+            if (doc >= maxDocNr or inDocWeights[doc] <= 0)
+                continue;
+
+            M6SimilarityEntry e = { inTermNr, inWeight * idf / inDocWeights[doc] };
+
+            M6SimilarityEntry* heap = &vectors[static_cast<size_t>(doc) * kM6SimilarTermCount];
+            uint8& n = counts[doc];
+
+            if (n < kM6SimilarTermCount)
+            {
+                heap[n++] = e;
+                push_heap(heap, heap + n, lighter);
+            }
+            else if (lighter(e, heap[0]))
+            {
+                pop_heap(heap, heap + n, lighter);
+                heap[n - 1] = e;
+                push_heap(heap, heap + n, lighter);
+            }
+        }
+    }, inProgress);
+
+    // sort and normalize the vectors, and store them consecutively
+
+    vector<uint32> docOffsets(maxDocNr + 1, 0);
+    vector<uint32> termNrs(maxTermNr + 1, 0);
+    uint32 offset = 0;
+
+    for (uint32 doc = 0; doc < maxDocNr; ++doc)
+    {
+        M6SimilarityEntry* v = &vectors[static_cast<size_t>(doc) * kM6SimilarTermCount];
+        uint32 n = counts[doc];
+
+        sort_heap(v, v + n, lighter);
+
+        float length = 0;
+        for (uint32 i = 0; i < n; ++i)
+            length += v[i].mWeight * v[i].mWeight;
+        length = sqrt(length);
+
+        for (uint32 i = 0; i < n; ++i)
+        {
+            if (length > 0)
+                v[i].mWeight /= length;
+            termNrs[v[i].mNr] = 1;
+            vectors[offset + i] = v[i];
+        }
+
+        offset += n;
+        docOffsets[doc + 1] = offset;
+    }
+
+    vectors.resize(offset);
+    vector<uint8>().swap(counts);
+
+    // renumber the terms and invert the vectors
+
+    uint32 termCount = 0;
+    for (uint32& nr : termNrs)
+    {
+        if (nr != 0)
+            nr = ++termCount;
+    }
+
+    vector<uint32> termOffsets(termCount + 1, 0);
+    for (M6SimilarityEntry& e : vectors)
+    {
+        e.mNr = termNrs[e.mNr] - 1;
+        ++termOffsets[e.mNr + 1];
+    }
+
+    partial_sum(termOffsets.begin(), termOffsets.end(), termOffsets.begin());
+
+    vector<M6SimilarityEntry> postings(vectors.size());
+    vector<uint32> fill(termOffsets.begin(), termOffsets.end() - 1);
+
+    for (uint32 doc = 0; doc < maxDocNr; ++doc)
+    {
+        for (uint32 i = docOffsets[doc]; i < docOffsets[doc + 1]; ++i)
+        {
+            M6SimilarityEntry e = { doc, vectors[i].mWeight };
+            postings[fill[vectors[i].mNr]++] = e;
+        }
+    }
+
+    for (uint32 term = 0; term < termCount; ++term)
+        sort(postings.begin() + termOffsets[term], postings.begin() + termOffsets[term + 1], lighter);
+
+    M6SimilarityHeader header = { kM6SimilaritySignature, kM6SimilarityVersion, maxDocNr, termCount };
+
+    header.mDocOffsets = sizeof(header);
+    header.mVectors = header.mDocOffsets + docOffsets.size() * sizeof(uint32);
+    header.mTermOffsets = header.mVectors + vectors.size() * sizeof(M6SimilarityEntry);
+    header.mPostings = header.mTermOffsets + termOffsets.size() * sizeof(uint32);
+    header.mFileSize = header.mPostings + postings.size() * sizeof(M6SimilarityEntry);
+
+    // keep the entries 8 byte aligned
+    if (docOffsets.size() % 2)
+    {
+        header.mVectors += sizeof(uint32);
+        header.mTermOffsets += sizeof(uint32);
+        header.mPostings += sizeof(uint32);
+        header.mFileSize += sizeof(uint32);
+        docOffsets.push_back(0);
+    }
+
+    if (termOffsets.size() % 2)
+    {
+        header.mPostings += sizeof(uint32);
+        header.mFileSize += sizeof(uint32);
+        termOffsets.push_back(0);
+    }
+
+    inFile.Write(&header, sizeof(header));
+    inFile.Write(&docOffsets[0], docOffsets.size() * sizeof(uint32));
+    if (not vectors.empty())
+        inFile.Write(&vectors[0], vectors.size() * sizeof(M6SimilarityEntry));
+    inFile.Write(&termOffsets[0], termOffsets.size() * sizeof(uint32));
+    if (not postings.empty())
+        inFile.Write(&postings[0], postings.size() * sizeof(M6SimilarityEntry));
+}
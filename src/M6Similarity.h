@@ -0,0 +1,42 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <vector>
+#include <boost/filesystem/path.hpp>
+
+#include "M6Index.h"
+
+class M6File;
+class M6Progress;
+struct M6SimilarityIndexImpl;
+
+// The similarity index stores for each document its kM6SimilarTermCount
+// most characteristic terms (by tf-idf against the full-text index) and,
+// per term, the documents that have it in their vector ordered by weight.
+// FindSimilar uses these to find documents with the highest cosine
+// similarity without looking at the document text.
+
+class M6SimilarityIndex
+{
+  public:
+            M6SimilarityIndex(boost::filesystem::path inFile);
+            ~M6SimilarityIndex();
+
+    // returns the inReportLimit most similar documents ordered by similarity,
+    // outCount is an estimate of the total number of similar documents
+    void    FindSimilar(uint32 inDocNr, uint32 inReportLimit,
+                std::vector<std::pair<uint32,float>>& outDocs, uint32& outCount) const;
+
+    // offsets in the index are 32 bit, which limits the number of documents
+    static bool CanCreate(uint32 inMaxDocNr);
+
+    static void Create(M6WeightedBasicIndex& inIndex, uint32 inDocCount,
+                const std::vector<float>& inDocWeights, M6File& inFile, M6Progress& inProgress);
+
+  private:
+    M6SimilarityIndexImpl*    mImpl;
+};
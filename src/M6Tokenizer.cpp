@@ -14,6 +14,9 @@
 #include <iostream>
 #include <tuple>
 
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+#include <immintrin.h>
+#endif
 
 #include "M6Tokenizer.h"
 //#include "M6Unicode.h"
@@ -54,6 +57,7 @@ ostream& operator<<(ostream& os, M6Token inToken)
         case eM6TokenGreaterThan:        os << "'>'"; break;
         case eM6TokenDocNr:                os << "document number"; break;
         case eM6TokenNOT:                os << "NOT"; break;
+        case eM6TokenNEAR:                os << "NEAR"; break;
     }
 
     return os;
@@ -343,6 +347,61 @@ inline bool isspace(uint32 c)
         uc::isspace(c);
 }
 
+// Copy the run of word characters [0-9A-Za-z_-] starting at inPtr to
+// outText in lower case. Returns the end of the run, scanning stops
+// somewhere after inMax characters. The SSE2 version classifies and
+// lower cases sixteen bytes at a time, outText should have room for
+// inMax + 16 characters.
+
+inline const uint8* CopyASCIIWord(const uint8* inPtr, const uint8* inEnd, char* outText, uint32 inMax)
+{
+    const uint8* p = inPtr;
+
+#if defined(__GNUC__) and defined(__SSE2__)
+    const __m128i kUpperA = _mm_set1_epi8('A' - 1), kUpperZ = _mm_set1_epi8('Z' + 1),
+        kLowerA = _mm_set1_epi8('a' - 1), kLowerZ = _mm_set1_epi8('z' + 1),
+        kDigit0 = _mm_set1_epi8('0' - 1), kDigit9 = _mm_set1_epi8('9' + 1),
+        kUnderscore = _mm_set1_epi8('_'), kHyphen = _mm_set1_epi8('-'),
+        kCaseBit = _mm_set1_epi8(kToLowerMask);
+
+    // bytes with the high bit set are negative and thus never match
+    while (inEnd - p >= 16 and static_cast<uint32>(p - inPtr) < inMax)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, kUpperA), _mm_cmplt_epi8(c, kUpperZ));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, kLowerA), _mm_cmplt_epi8(c, kLowerZ));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, kDigit0), _mm_cmplt_epi8(c, kDigit9));
+        __m128i other = _mm_or_si128(_mm_cmpeq_epi8(c, kUnderscore), _mm_cmpeq_epi8(c, kHyphen));
+
+        __m128i word = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, other));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(outText + (p - inPtr)),
+            _mm_or_si128(c, _mm_and_si128(upper, kCaseBit)));
+
+        uint32 mask = _mm_movemask_epi8(word);
+        if (mask != 0xffff)
+            return p + __builtin_ctz(~mask);
+
+        p += 16;
+    }
+#endif
+
+    while (p < inEnd and static_cast<uint32>(p - inPtr) < inMax)
+    {
+        uint8 c = *p;
+        if (c >= 0x080 or not ((kCharPropTable[c] & kCharIsAlNumMask) or c == '-'))
+            break;
+
+        if (c >= 'A' and c <= 'Z')
+            c |= kToLowerMask;
+        outText[p - inPtr] = c;
+        ++p;
+    }
+
+    return p;
+}
+
 }
 
 // --------------------------------------------------------------------
@@ -573,10 +632,97 @@ inline void M6Tokenizer::WriteUTF8(uint32 inString[], size_t inLength)
     mTokenLength = static_cast<uint32>(t - mTokenText);
 }
 
+// Most of our text is 7-bit ASCII. GetNextASCIIWord handles the common
+// tokens, words, numbers and punctuation, directly on the input bytes.
+// It returns eM6TokenNone if the next token cannot be handled this way
+// without risk of producing different output from the full version,
+// e.g. when a non-ASCII character is seen. In that case mPtr is left at
+// the start of the token and GetNextWord takes over.
+
+M6Token M6Tokenizer::GetNextASCIIWord()
+{
+    M6Token result = eM6TokenNone;
+
+    while (mPtr < mEnd and (*mPtr == ' ' or *mPtr == '\n' or *mPtr == '\r' or *mPtr == '\t'))
+        ++mPtr;
+
+    if (mPtr >= mEnd)
+    {
+        mTokenText[0] = 0;
+        mTokenLength = 1;
+        result = eM6TokenEOF;
+    }
+    else
+    {
+        uint8 c = *mPtr;
+        uint8 prop = c < 0x080 ? fast::kCharPropTable[c] : 0;
+
+        if (prop & fast::kCharIsPunctMask)
+        {
+            // '-' and '+' may start a number
+            if (c != '-' and c != '+')
+            {
+                mTokenText[0] = c;
+                mTokenLength = 1;
+                ++mPtr;
+                result = eM6TokenPunctuation;
+            }
+        }
+        else if (prop & fast::kCharIsAlNumMask)
+        {
+            const uint8* e = mPtr;
+            result = eM6TokenWord;
+
+            if (prop & fast::kCharIsDigitMask)
+            {
+                while (e < mEnd and *e >= '0' and *e <= '9')
+                    ++e;
+
+                if (e == mEnd or (e < mEnd and *e < 0x080 and
+                    (*e < 'A' or (*e > 'Z' and *e < 'a') or *e > 'z') and
+                    *e != '-' and *e != '.' and *e != '_'))
+                {
+                    result = eM6TokenNumber;
+                }
+                else if (*e >= 0x080 or *e == '.' or *e == '_')
+                    result = eM6TokenNone;
+            }
+
+            if (result == eM6TokenWord)
+            {
+                e = fast::CopyASCIIWord(mPtr, mEnd, mTokenText, kMaxTokenLength);
+
+                // a non-ASCII character may still be part of the word
+                if (e < mEnd and *e >= 0x080)
+                    result = eM6TokenNone;
+            }
+            else if (result == eM6TokenNumber)
+                copy(mPtr, e, mTokenText);
+
+            if (result != eM6TokenNone and e - mPtr < kMaxTokenLength)
+            {
+                mTokenLength = static_cast<uint32>(e - mPtr);
+                mPtr = e;
+            }
+            else
+                result = eM6TokenNone;
+        }
+    }
+
+    return result;
+}
+
 M6Token M6Tokenizer::GetNextWord()
 {
     M6Token result = eM6TokenNone;
 
+    if (mLookaheadLength == 0)
+    {
+        result = GetNextASCIIWord();
+        if (result != eM6TokenNone)
+            return result;
+    }
+
     mTokenLength = 0;
     uint32 token[kMaxTokenLength + 1];
     uint32* t = token;
@@ -1048,6 +1194,8 @@ M6Token M6Tokenizer::GetNextQueryToken()
             result = eM6TokenNOT;
         else if (mTokenLength == 7 and strncmp(reinterpret_cast<const char*>(b), "BETWEEN", 7) == 0)
             result = eM6TokenBETWEEN;
+        else if (mTokenLength == 4 and strncmp(reinterpret_cast<const char*>(b), "NEAR", 4) == 0)
+            result = eM6TokenNEAR;
     }
 
     return result;
@@ -1055,6 +1203,16 @@ M6Token M6Tokenizer::GetNextQueryToken()
 
 void M6Tokenizer::CaseFold(string& ioString)
 {
+    if (all_of(ioString.begin(), ioString.end(), [](char ch) -> bool { return (ch & 0x080) == 0; }))
+    {
+        for (char& ch : ioString)
+        {
+            if (ch >= 'A' and ch <= 'Z')
+                ch |= fast::kToLowerMask;
+        }
+        return;
+    }
+
     vector<uint32> s;
     s.reserve(ioString.length());
 
@@ -1085,6 +1243,10 @@ void M6Tokenizer::CaseFold(string& ioString)
 
 void M6Tokenizer::Normalize(string& ioString)
 {
+    // plain ASCII is already normalized
+    if (all_of(ioString.begin(), ioString.end(), [](char ch) -> bool { return (ch & 0x080) == 0; }))
+        return;
+
     vector<uint32> s;
     s.reserve(ioString.length());
 
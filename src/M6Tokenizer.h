@@ -44,6 +44,7 @@ enum M6Token
     eM6TokenAND,
     eM6TokenNOT,
     eM6TokenBETWEEN,
+    eM6TokenNEAR,
     eM6TokenOpenParenthesis,
     eM6TokenCloseParenthesis,
     eM6TokenOpenBracket,
@@ -86,6 +87,8 @@ class M6Tokenizer
 
   private:
 
+    M6Token            GetNextASCIIWord();
+
     uint32            GetNextCharacter();
     void            Retract(uint32 inUnicode);
 
@@ -429,10 +429,26 @@ M6Iterator* ParseQuery(M6Databank* inDatabank, const WSSearchNS::BooleanQuery& i
                 if (inQuery.leafs.size() < 1)
                     THROW(("Please supply at least one subquery for an INTERSECTION"));
 
+                // NOT operands are collected and subtracted from the rest
                 unique_ptr<M6IntersectionIterator> iter(new M6IntersectionIterator());
+                unique_ptr<M6UnionIterator> excluded(new M6UnionIterator());
+                bool positive = false;
+
                 for (auto leaf : inQuery.leafs)
-                    iter->AddIterator(ParseQuery(inDatabank, leaf));
-                result = iter.release();
+                {
+                    if (leaf.operation == WSSearchNS::NOT and leaf.leafs.size() == 1)
+                        excluded->AddIterator(ParseQuery(inDatabank, leaf.leafs[0]));
+                    else
+                    {
+                        iter->AddIterator(ParseQuery(inDatabank, leaf));
+                        positive = true;
+                    }
+                }
+
+                if (not positive)
+                    result = new M6NotIterator(excluded.release(), inDatabank->size());
+                else
+                    result = new M6DifferenceIterator(iter.release(), excluded.release());
                 break;
             }
 
@@ -55,6 +55,8 @@ int main(int argc, char* argv[])
 
         if ( ba::ends_with( filename, ".bz2" ) )
             in.push(io::bzip2_decompressor());
+        else if ( ba::ends_with( filename, ".m6br" ) )
+            in.push(io::zlib_decompressor());
 
         in.push(file);
 
@@ -73,6 +75,13 @@ int main(int argc, char* argv[])
 
                 doc.deserialize("blast-result", const_cast<M6Blast::Result&>(*result));
             }
+            else if ( ba::ends_with( filename, ".m6br" ) )
+            {
+                stack << "reading binary blast result\n";
+
+                M6Blast::Result result;
+                result.ReadBinary(in);
+            }
             else if ( ba::ends_with( filename, ".job" ) )
             {
                 stack << "parsing xml\n";
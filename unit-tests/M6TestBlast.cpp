@@ -1,4 +1,11 @@
+#include <memory>
+#include <sstream>
+#include <functional>
+
 #include <boost/thread.hpp>
+#include <boost/timer/timer.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
 #define BOOST_TEST_MODULE BlastTest
 #include <boost/test/included/unit_test.hpp>
 
@@ -6,6 +13,55 @@
 #include "M6Lib.h"
 #include "M6Blast.h"
 
+// A simple and reproducible pseudo random generator for the test data
+
+class Random
+{
+  public:
+                    Random(uint32 inSeed) : mSeed(inSeed) {}
+
+    uint32            operator()(uint32 inMax)
+                    {
+                        mSeed = mSeed * 1103515245 + 12345;
+                        return (mSeed >> 8) % inMax;
+                    }
+
+  private:
+    uint32            mSeed;
+};
+
+const char kAA[] = "ACDEFGHIKLMNPQRSTVWYXBZ";
+
+std::string RandomSequence(Random& inRandom, uint32 inLength)
+{
+    std::string result;
+    for (uint32 i = 0; i < inLength; ++i)
+        result += kAA[inRandom(20)];
+    return result;
+}
+
+// Write inCount random protein sequences to inFile, sequence nr i has
+// length inLength(i). inEdit can change a sequence before it is written,
+// e.g. to turn it into a homolog of the query.
+
+void CreateRandomFasta(const boost::filesystem::path& inFile, Random& inRandom, uint32 inCount,
+    std::function<uint32(uint32)> inLength,
+    std::function<void(uint32,std::string&)> inEdit = nullptr, const std::string& inIDPrefix = "ID")
+{
+    boost::filesystem::ofstream out(inFile);
+
+    for (uint32 i = 0; i < inCount; ++i)
+    {
+        std::string seq = RandomSequence(inRandom, inLength(i));
+        if (inEdit)
+            inEdit(i, seq);
+
+        out << ">gnl|test|" << inIDPrefix << i << " random sequence " << i << std::endl;
+        for (size_t j = 0; j < seq.length(); j += 60)
+            out << seq.substr(j, 60) << std::endl;
+    }
+}
+
 
 BOOST_AUTO_TEST_CASE(TestBlast1)
 {
@@ -36,3 +92,527 @@ BOOST_AUTO_TEST_CASE(TestBlast1)
                         "TTCCPSIVARSNFNVCRLPGTPEA+CATYTGCIIIPGATCPGDYAN"),
                       0);
 }
+
+// compare the results of two searches
+
+void CompareResults(const M6Blast::Result& a, const M6Blast::Result& b)
+{
+    BOOST_CHECK_EQUAL(a.mStats.mDbCount, b.mStats.mDbCount);
+    BOOST_CHECK_EQUAL(a.mStats.mDbLength, b.mStats.mDbLength);
+    BOOST_REQUIRE_EQUAL(a.mHits.size(), b.mHits.size());
+
+    auto ha = a.mHits.begin(), hb = b.mHits.begin();
+    for (; ha != a.mHits.end(); ++ha, ++hb)
+    {
+        BOOST_CHECK_EQUAL(ha->mDefLine, hb->mDefLine);
+        BOOST_CHECK_EQUAL(ha->mSequence, hb->mSequence);
+        BOOST_REQUIRE_EQUAL(ha->mHsps.size(), hb->mHsps.size());
+
+        auto pa = ha->mHsps.begin(), pb = hb->mHsps.begin();
+        for (; pa != ha->mHsps.end(); ++pa, ++pb)
+        {
+            BOOST_CHECK_EQUAL(pa->mScore, pb->mScore);
+            BOOST_CHECK_EQUAL(pa->mQueryAlignment, pb->mQueryAlignment);
+            BOOST_CHECK_EQUAL(pa->mTargetAlignment, pb->mTargetAlignment);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBinaryDatabank)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    boost::filesystem::path fasta("test/blast-binary.fasta");
+    boost::filesystem::copy_file("unit-tests/data/cram_craab.fasta", fasta,
+        boost::filesystem::copy_option::overwrite_if_exists);
+    boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+
+    std::string query = ">gnl|pdb|1CRN|A\nTTCCPSIVARSNFNVCRLPGTPEAICATYTGCIIIPGATCPGDYAN";
+    std::vector<boost::filesystem::path> databanks(1, fasta);
+
+    std::unique_ptr<M6Blast::Result> a(M6Blast::Search(databanks, query, "blastp", "BLOSUM62",
+        0, 10, true, true, -1, -1, 250, 2));
+
+    M6Blast::CreateBinaryDatabank(fasta);
+    BOOST_REQUIRE(boost::filesystem::exists(M6Blast::GetBinaryDatabankPath(fasta)));
+
+    std::unique_ptr<M6Blast::Result> b(M6Blast::Search(databanks, query, "blastp", "BLOSUM62",
+        0, 10, true, true, -1, -1, 250, 2));
+
+    BOOST_CHECK(a->mHits.size() > 0);
+    CompareResults(*a, *b);
+
+    boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+    boost::filesystem::remove(fasta);
+}
+
+// The gapped alignment scores should be exactly the same as those of the
+// original scalar implementation. The expected values were calculated
+// with that implementation.
+
+BOOST_AUTO_TEST_CASE(TestGappedAlignment)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    struct { const char* query; int32 score; } kCrambinTests[] = {
+        { "TTCCPSIVARSNFNVCRLPGTPEAICATYTGCIIIPGATCPGDYAN", 260 },
+        { "TTCCPSIVARSNFNVCRLPGWWKTPEAICATYTGCIIIPGATCPGDYAN", 247 },
+        { "TTCCPSIVARSNVCRLPGTPEAICATYTGCIIPGATCPGDYAN", 221 },
+        { "MKLVTTCCPSIVARSNFNGGVCRLPGTPEALCATYTGCIPGATCPGDYANKKE", 230 }
+    };
+
+    std::vector<boost::filesystem::path> databanks(1, "unit-tests/data/cram_craab.fasta");
+
+    for (auto& test : kCrambinTests)
+    {
+        std::unique_ptr<M6Blast::Result> r(M6Blast::Search(databanks, std::string(">query\n") + test.query,
+            "blastp", "BLOSUM62", 0, 10, false, true, -1, -1, 250, 1));
+
+        BOOST_REQUIRE_EQUAL(r->mHits.size(), 1U);
+        BOOST_REQUIRE(r->mHits.front().mHsps.size() > 0);
+        BOOST_CHECK_EQUAL(r->mHits.front().mHsps.front().mScore, test.score);
+    }
+
+    // and a databank with homologs of a random sequence, with mutations,
+    // insertions and deletions
+    Random random(7);
+    std::string query = RandomSequence(random, 200);
+
+    boost::filesystem::path fasta("test/blast-gapped.fasta");
+
+    {
+        boost::filesystem::ofstream out(fasta);
+
+        for (uint32 i = 0; i < 500; ++i)
+        {
+            std::string seq;
+            for (uint32 j = random(200); j > 0; --j)
+                seq += kAA[random(20)];
+
+            uint32 mutations = 5 + random(60);
+            for (char aa : query)
+            {
+                uint32 r = random(100);
+                if (r < mutations / 2)
+                    seq += kAA[random(22)];
+                else if (r < mutations / 2 + 3)
+                    ;
+                else if (r < mutations / 2 + 6)
+                {
+                    seq += aa;
+                    for (uint32 j = random(3); j > 0; --j)
+                        seq += kAA[random(20)];
+                }
+                else
+                    seq += aa;
+            }
+
+            for (uint32 j = random(200); j > 0; --j)
+                seq += kAA[random(20)];
+
+            out << ">gnl|test|H" << i << " homolog " << i << std::endl
+                << seq << std::endl;
+        }
+    }
+
+    std::unique_ptr<M6Blast::Result> r(M6Blast::Search(std::vector<boost::filesystem::path>(1, fasta),
+        ">query\n" + query, "blastp", "BLOSUM62", 0, 10, false, true, -1, -1, 1000, 1));
+
+    int64 sum = 0;
+    for (auto& hit : r->mHits)
+    {
+        for (auto& hsp : hit.mHsps)
+            sum += hsp.mScore;
+    }
+
+    BOOST_CHECK_EQUAL(r->mHits.size(), 500U);
+    BOOST_CHECK_EQUAL(sum, 399689);
+
+    boost::filesystem::remove(fasta);
+}
+
+// a batch search should give the same results as separate searches
+
+BOOST_AUTO_TEST_CASE(TestBatchSearch)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    boost::filesystem::path fasta("test/blast-batch.fasta");
+    std::vector<std::string> sequences;
+
+    Random random(3);
+    CreateRandomFasta(fasta, random, 5000, [](uint32) { return 300; },
+        [&sequences](uint32, std::string& seq) { sequences.push_back(seq); });
+
+    std::vector<boost::filesystem::path> databanks(1, fasta);
+
+    // queries with different parameters, the last one is crambin which has
+    // no real hits in this databank
+    std::vector<M6Blast::BatchQuery> queries = {
+        { ">q1\n" + sequences[10].substr(20, 150), 10, true, true, -1, -1, 250 },
+        { ">q2\n" + sequences[20].substr(0, 60), 1, false, true, -1, -1, 5 },
+        { ">q3\n" + sequences[30].substr(100, 200) + sequences[40].substr(0, 100), 10, false, false, 11, 1, 250 },
+        { ">q4\n" + sequences[50].substr(50, 80), 10, false, true, 9, 2, 250 },
+        { ">q5\nTTCCPSIVARSNFNVCRLPGTPEAICATYTGCIIIPGATCPGDYAN", 10, true, true, -1, -1, 250 }
+    };
+
+    for (uint32 threads : { 1, 2 })
+    {
+        std::vector<std::unique_ptr<M6Blast::Result>> single;
+        for (auto& q : queries)
+        {
+            single.emplace_back(M6Blast::Search(databanks, q.mQuery, "blastp", "BLOSUM62", 3,
+                q.mExpect, q.mFilter, q.mGapped, q.mGapOpen, q.mGapExtend, q.mReportLimit, threads));
+        }
+
+        std::vector<M6Blast::Result*> results = M6Blast::SearchBatch(databanks, queries, "blastp", "BLOSUM62", 3, threads);
+        std::vector<std::unique_ptr<M6Blast::Result>> batch(results.begin(), results.end());
+
+        BOOST_REQUIRE_EQUAL(batch.size(), single.size());
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            BOOST_CHECK_EQUAL(batch[i]->mQueryID, single[i]->mQueryID);
+            BOOST_CHECK_EQUAL(batch[i]->mParams.mGapOpen, single[i]->mParams.mGapOpen);
+            CompareResults(*batch[i], *single[i]);
+        }
+
+        BOOST_CHECK(batch[0]->mHits.size() > 0);
+        BOOST_CHECK(batch[1]->mHits.size() <= 5);
+    }
+
+    boost::filesystem::remove(fasta);
+}
+
+// searching the binary databank should give the same result as searching
+// the FastA file, for a short and a longer query
+
+BOOST_AUTO_TEST_CASE(TestBinaryDatabankQueries)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    boost::filesystem::path fasta("test/blast-binary-queries.fasta");
+    boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+
+    std::string query;
+
+    Random random(1);
+    CreateRandomFasta(fasta, random, 20000, [](uint32) { return 300; },
+        [&query](uint32 i, std::string& seq) { if (i == 100) query = seq.substr(50, 150); });
+
+    std::vector<boost::filesystem::path> databanks(1, fasta);
+
+    for (uint32 queryLength : { 30, 150 })
+    {
+        std::unique_ptr<M6Blast::Result> results[2];
+
+        for (int i = 0; i < 2; ++i)
+        {
+            if (i == 0)
+                boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+            else
+                M6Blast::CreateBinaryDatabank(fasta);
+
+            results[i].reset(M6Blast::Search(databanks, ">query\n" + query.substr(0, queryLength),
+                "blastp", "BLOSUM62", 0, 10, false, true, -1, -1, 250, 1));
+        }
+
+        BOOST_CHECK(results[0]->mHits.size() > 0);
+        CompareResults(*results[0], *results[1]);
+    }
+
+    boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+    boost::filesystem::remove(fasta);
+}
+
+// Searching with the seed index should give the same results as a scan,
+// for a range of query lengths and whatever the cost model picks. A seed
+// index that is older than the binary databank should not be used.
+
+BOOST_AUTO_TEST_CASE(TestSeedIndex)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    boost::filesystem::path fasta("test/blast-seeds.fasta");
+    boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+    boost::filesystem::remove(M6Blast::GetSeedIndexPath(fasta));
+
+    std::string query;
+
+    // some sequences contain unknown residues and some are homologs of
+    // the query
+    auto edit = [&query](uint32 i, std::string& seq)
+    {
+        if (i % 7 == 0)
+        {
+            for (size_t j = i % 20; j < seq.length(); j += 20)
+                seq[j] = 'X';
+        }
+
+        if (i == 1000)
+            query = seq.substr(0, 160);
+
+        if (i % 2000 == 1999)
+        {
+            seq = query;
+            for (uint32 j = 0; j < seq.length(); j += 5)
+                seq[j] = kAA[(i + j) % 20];
+        }
+    };
+
+    Random random(3);
+    CreateRandomFasta(fasta, random, 20000, [](uint32) { return 300; }, edit);
+
+    std::vector<boost::filesystem::path> databanks(1, fasta);
+
+    M6Blast::CreateBinaryDatabank(fasta);
+    M6Blast::CreateSeedIndex(fasta);
+    BOOST_REQUIRE(boost::filesystem::exists(M6Blast::GetSeedIndexPath(fasta)));
+
+    auto search = [&](M6Blast::SeedIndexMode inMode, uint32 inQueryLength) -> M6Blast::Result*
+    {
+        M6Blast::SetSeedIndexMode(inMode);
+        M6Blast::Result* result = M6Blast::Search(databanks, ">query\n" + query.substr(0, inQueryLength),
+            "blastp", "BLOSUM62", 3, 10, false, true, -1, -1, 250, 1);
+        M6Blast::SetSeedIndexMode(M6Blast::eSeedIndexAuto);
+        return result;
+    };
+
+    for (uint32 queryLength : { 10, 20, 40, 80, 160 })
+    {
+        std::unique_ptr<M6Blast::Result> scan(search(M6Blast::eSeedIndexNever, queryLength));
+        std::unique_ptr<M6Blast::Result> seeds(search(M6Blast::eSeedIndexAlways, queryLength));
+        std::unique_ptr<M6Blast::Result> automatic(search(M6Blast::eSeedIndexAuto, queryLength));
+
+        BOOST_CHECK(scan->mHits.size() > 0);
+        CompareResults(*scan, *seeds);
+        CompareResults(*scan, *automatic);
+    }
+
+    // Rewrite the databank with other sequences of the same length, the
+    // old index then still matches the residue count. Since it is older
+    // than the new binary databank it should be ignored, using it would
+    // give different results than a scan.
+    Random other(5);
+    CreateRandomFasta(fasta, other, 20000, [](uint32) { return 300; }, edit);
+
+    M6Blast::CreateBinaryDatabank(fasta);
+    boost::filesystem::last_write_time(M6Blast::GetSeedIndexPath(fasta),
+        boost::filesystem::last_write_time(M6Blast::GetBinaryDatabankPath(fasta)) - 10);
+
+    std::unique_ptr<M6Blast::Result> scan(search(M6Blast::eSeedIndexNever, 40));
+    std::unique_ptr<M6Blast::Result> seeds(search(M6Blast::eSeedIndexAlways, 40));
+
+    BOOST_CHECK(scan->mHits.size() > 0);
+    CompareResults(*scan, *seeds);
+
+    boost::filesystem::remove(M6Blast::GetSeedIndexPath(fasta));
+    boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+    boost::filesystem::remove(fasta);
+}
+
+// Most targets in a databank of short sequences are skipped by the
+// prefilter, the homologs should still be found. The search with the
+// seed index does not use the prefilter and should give the same result.
+
+BOOST_AUTO_TEST_CASE(TestShortSequences)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    boost::filesystem::path fasta("test/blast-short.fasta");
+    boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+    boost::filesystem::remove(M6Blast::GetSeedIndexPath(fasta));
+
+    Random random(17);
+    std::string query = RandomSequence(random, 120);
+
+    // every 1000th sequence is a part of the query
+    uint32 homologs = 0;
+    CreateRandomFasta(fasta, random, 50000, [](uint32 i) { return 1 + i % 40; },
+        [&](uint32 i, std::string& seq)
+        {
+            if (i % 1000 == 500)
+            {
+                seq = query.substr(i / 1000, 40);
+                ++homologs;
+            }
+        }, "P");
+
+    std::vector<boost::filesystem::path> databanks(1, fasta);
+
+    M6Blast::CreateBinaryDatabank(fasta);
+    M6Blast::CreateSeedIndex(fasta);
+
+    std::unique_ptr<M6Blast::Result> results[2];
+
+    M6Blast::SeedIndexMode modes[2] = { M6Blast::eSeedIndexNever, M6Blast::eSeedIndexAlways };
+    for (int i = 0; i < 2; ++i)
+    {
+        M6Blast::SetSeedIndexMode(modes[i]);
+
+        results[i].reset(M6Blast::Search(databanks, ">query\n" + query,
+            "blastp", "BLOSUM62", 3, 10, false, true, -1, -1, 250, 1));
+    }
+
+    M6Blast::SetSeedIndexMode(M6Blast::eSeedIndexAuto);
+
+    uint32 found = 0;
+    for (auto& hit : results[0]->mHits)
+    {
+        if (hit.mHsps.front().mQueryAlignment == hit.mHsps.front().mTargetAlignment and
+            hit.mSequence.length() == 40)
+        {
+            ++found;
+        }
+    }
+
+    BOOST_CHECK_EQUAL(found, homologs);
+    CompareResults(*results[0], *results[1]);
+
+    boost::filesystem::remove(M6Blast::GetSeedIndexPath(fasta));
+    boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+    boost::filesystem::remove(fasta);
+}
+
+// The databanks are searched in small chunks by all threads. The results
+// should not depend on the number of threads. The first part of each
+// databank contains long sequences, these used to end up in the part of
+// a single thread.
+
+BOOST_AUTO_TEST_CASE(TestThreadScaling)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    std::vector<boost::filesystem::path> databanks;
+    std::string query;
+
+    Random random(5);
+    for (int d = 0; d < 3; ++d)
+    {
+        boost::filesystem::path fasta("test/blast-threads-" + std::to_string(d) + ".fasta");
+        boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+
+        CreateRandomFasta(fasta, random, 6000, [](uint32 i) { return i < 500 ? 2000 : 200; },
+            [&](uint32 i, std::string& seq) { if (d == 1 and i == 3000) query = seq.substr(20, 150); },
+            "ID" + std::to_string(d) + '-');
+
+        // the last one is searched as a binary databank
+        if (d == 2)
+            M6Blast::CreateBinaryDatabank(fasta);
+
+        databanks.push_back(fasta);
+    }
+
+    std::unique_ptr<M6Blast::Result> first;
+
+    for (uint32 threads : { 1, 2, 4, 8, 16, 32 })
+    {
+        std::unique_ptr<M6Blast::Result> result(M6Blast::Search(databanks, ">query\n" + query,
+            "blastp", "BLOSUM62", 3, 10, false, true, -1, -1, 250, threads));
+
+        if (first)
+            CompareResults(*result, *first);
+        else
+        {
+            BOOST_CHECK(result->mHits.size() > 0);
+            first.reset(result.release());
+        }
+    }
+
+    for (auto& fasta : databanks)
+    {
+        boost::filesystem::remove(M6Blast::GetBinaryDatabankPath(fasta));
+        boost::filesystem::remove(fasta);
+    }
+}
+
+// A search can be paused and resized while it runs, the result should be
+// the same as that of a search with a fixed number of threads.
+
+BOOST_AUTO_TEST_CASE(TestThreadLimit)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    boost::filesystem::path fasta("test/blast-limit.fasta");
+    std::string query;
+
+    Random random(11);
+    CreateRandomFasta(fasta, random, 10000, [](uint32) { return 300; },
+        [&query](uint32 i, std::string& seq) { if (i == 500) query = seq.substr(100, 120); });
+
+    std::vector<boost::filesystem::path> databanks(1, fasta);
+
+    std::unique_ptr<M6Blast::Result> a(M6Blast::Search(databanks, ">query\n" + query,
+        "blastp", "BLOSUM62", 3, 10, true, true, -1, -1, 250, 4));
+
+    // start paused, run with one thread and then with all four
+    M6Blast::ThreadLimit limit(0);
+    boost::thread resizer([&limit]() {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+        limit.Set(1);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+        limit.Set(4);
+    });
+
+    boost::timer::cpu_timer timer;
+
+    std::unique_ptr<M6Blast::Result> b(M6Blast::Search(databanks, ">query\n" + query,
+        "blastp", "BLOSUM62", 3, 10, true, true, -1, -1, 250, 4, &limit));
+
+    resizer.join();
+
+    BOOST_CHECK(timer.elapsed().wall >= 200000000);
+    BOOST_CHECK(a->mHits.size() > 0);
+    CompareResults(*a, *b);
+
+    boost::filesystem::remove(fasta);
+}
+
+// Results are cached in a binary format, reading it back should give
+// exactly the same result. Truncated data or another version is an error.
+
+BOOST_AUTO_TEST_CASE(TestBinaryResult)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    std::string query = ">gnl|pdb|1CRN|A\nTTCCPSIVARSNFNVCRLPGTPEAICATYTGCIIIPGATCPGDYAN";
+    std::vector<boost::filesystem::path> databanks(1, "unit-tests/data/cram_craab.fasta");
+
+    std::unique_ptr<M6Blast::Result> a(M6Blast::Search(databanks, query, "blastp", "BLOSUM62",
+        0, 10, true, true, -1, -1, 250, 1));
+    BOOST_REQUIRE(a->mHits.size() > 0);
+
+    std::stringstream s;
+    a->WriteBinary(s);
+    std::string data = s.str();
+
+    M6Blast::Result b;
+    b.ReadBinary(s);
+
+    BOOST_CHECK_EQUAL(b.mDb, a->mDb);
+    BOOST_CHECK_EQUAL(b.mQueryID, a->mQueryID);
+    BOOST_CHECK_EQUAL(b.mQueryDef, a->mQueryDef);
+    BOOST_CHECK_EQUAL(b.mQueryLength, a->mQueryLength);
+    BOOST_CHECK_EQUAL(b.mParams.mMatrix, a->mParams.mMatrix);
+    BOOST_CHECK_EQUAL(b.mParams.mExpect, a->mParams.mExpect);
+    BOOST_CHECK_EQUAL(b.mParams.mGapOpen, a->mParams.mGapOpen);
+    BOOST_CHECK_EQUAL(b.mStats.mEffectiveSpace, a->mStats.mEffectiveSpace);
+    BOOST_CHECK_EQUAL(b.mStats.mLambda, a->mStats.mLambda);
+    CompareResults(b, *a);
+
+    auto ha = a->mHits.begin(), hb = b.mHits.begin();
+    for (; ha != a->mHits.end(); ++ha, ++hb)
+    {
+        BOOST_CHECK_EQUAL(ha->mID, hb->mID);
+        BOOST_CHECK_EQUAL(ha->mTitle, hb->mTitle);
+        BOOST_CHECK_EQUAL(ha->mHsps.front().mExpect, hb->mHsps.front().mExpect);
+        BOOST_CHECK_EQUAL(ha->mHsps.front().mMidLine, hb->mHsps.front().mMidLine);
+    }
+
+    std::stringstream truncated(data.substr(0, data.length() - 10));
+    BOOST_CHECK_THROW(b.ReadBinary(truncated), std::exception);
+
+    std::string other(data);
+    other[4] = 2;    // the version number
+    std::stringstream version(other);
+    BOOST_CHECK_THROW(b.ReadBinary(version), std::exception);
+}
@@ -0,0 +1,253 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/timer/timer.hpp>
+#include <boost/thread.hpp>
+#define BOOST_TEST_MODULE DecompressTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <zlib.h>
+#include <bzlib.h>
+
+#include "M6Lib.h"
+#include "M6DataSource.h"
+#include "M6Progress.h"
+
+namespace fs = boost::filesystem;
+namespace io = boost::iostreams;
+
+int VERBOSE = 0;
+
+// --------------------------------------------------------------------
+// Create some data that looks like a UniProt flat file
+
+std::string CreateTestData(uint32 inEntries)
+{
+    std::stringstream s;
+
+    const char kAA[] = "ACDEFGHIKLMNPQRSTVWY";
+    uint32 seed = 1;
+
+    for (uint32 i = 0; i < inEntries; ++i)
+    {
+        s << "ID   TEST" << i << "_HUMAN              Reviewed;         " << (100 + i % 400) << " AA." << std::endl
+          << "AC   P" << (10000 + i) << ";" << std::endl
+          << "DE   RecName: Full=Test protein " << i << ";" << std::endl
+          << "OS   Homo sapiens (Human)." << std::endl
+          << "CC   -!- FUNCTION: Does something useful in test number " << i << "." << std::endl
+          << "SQ   SEQUENCE" << std::endl;
+
+        uint32 length = 100 + i % 400;
+        for (uint32 j = 0; j < length; ++j)
+        {
+            seed = seed * 1103515245 + 12345;
+            if (j % 60 == 0)
+                s << (j == 0 ? "     " : "\n     ");
+            s << kAA[(seed >> 16) % 20];
+        }
+        s << std::endl << "//" << std::endl;
+    }
+
+    return s.str();
+}
+
+// Create data for which each bzip2 block contains inMagic at a false
+// position. The symbol map in a block header has a 16 bit word for each
+// used range of 16 byte values, listing the values used. Using three
+// ranges whose words spell out the magic puts the magic in every block.
+// Never repeating a byte keeps the run length encoding from adding values.
+
+std::string CreateMagicTestData(uint64 inMagic, size_t inSize)
+{
+    std::vector<char> bytes;
+    for (uint32 r = 0; r < 3; ++r)
+    {
+        uint32 word = (inMagic >> (32 - 16 * r)) & 0xffff;
+        for (uint32 j = 0; j < 16; ++j)
+        {
+            if (word & (0x8000 >> j))
+                bytes.push_back(static_cast<char>((r + 1) * 16 + j));
+        }
+    }
+
+    std::string result;
+    uint32 seed = 1;
+    while (result.length() < inSize)
+    {
+        seed = seed * 1103515245 + 12345;
+        char ch = bytes[(seed >> 16) % bytes.size()];
+        if (result.empty() or result.back() != ch)
+            result += ch;
+    }
+
+    return result;
+}
+
+void WriteBzip2(const fs::path& inFile, const std::string& inData, int inBlockSize, uint32 inStreams)
+{
+    fs::ofstream file(inFile, std::ios::binary);
+
+    size_t n = inData.length() / inStreams;
+    for (uint32 i = 0; i < inStreams; ++i)
+    {
+        std::string part = inData.substr(i * n, i + 1 == inStreams ? std::string::npos : n);
+
+        std::vector<char> buffer(part.length() + part.length() / 100 + 600);
+        unsigned int size = static_cast<unsigned int>(buffer.size());
+
+        int err = BZ2_bzBuffToBuffCompress(&buffer[0], &size,
+            const_cast<char*>(part.data()), static_cast<unsigned int>(part.length()),
+            inBlockSize, 0, 0);
+        BOOST_REQUIRE_EQUAL(err, BZ_OK);
+
+        file.write(&buffer[0], size);
+    }
+}
+
+// write inData as gzip, using a new member for every inMemberSize bytes.
+// If inBGZF is true, add the BGZF extra field with the block size.
+
+void WriteGzip(const fs::path& inFile, const std::string& inData, size_t inMemberSize, bool inBGZF)
+{
+    fs::ofstream file(inFile, std::ios::binary);
+
+    for (size_t offset = 0; offset < inData.length(); offset += inMemberSize)
+    {
+        size_t n = std::min(inMemberSize, inData.length() - offset);
+
+        std::vector<uint8> buffer(compressBound(static_cast<uLong>(n)) + 64);
+
+        z_stream z = {};
+        BOOST_REQUIRE_EQUAL(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY), Z_OK);
+
+        z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(inData.data() + offset));
+        z.avail_in = static_cast<uInt>(n);
+        z.next_out = &buffer[0];
+        z.avail_out = static_cast<uInt>(buffer.size());
+
+        BOOST_REQUIRE_EQUAL(deflate(&z, Z_FINISH), Z_STREAM_END);
+        size_t size = z.total_out;
+        deflateEnd(&z);
+
+        uint32 crc = crc32(0, reinterpret_cast<const Bytef*>(inData.data() + offset), static_cast<uInt>(n));
+
+        std::vector<uint8> header = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+        if (inBGZF)
+        {
+            uint32 bsize = static_cast<uint32>(size + 12 + 6 + 8 - 1);
+
+            header[3] = 4;
+            header.push_back(6); header.push_back(0);
+            header.push_back('B'); header.push_back('C');
+            header.push_back(2); header.push_back(0);
+            header.push_back(bsize & 0xff); header.push_back(bsize >> 8);
+        }
+
+        uint8 trailer[8] = {
+            static_cast<uint8>(crc), static_cast<uint8>(crc >> 8), static_cast<uint8>(crc >> 16), static_cast<uint8>(crc >> 24),
+            static_cast<uint8>(n), static_cast<uint8>(n >> 8), static_cast<uint8>(n >> 16), static_cast<uint8>(n >> 24)
+        };
+
+        file.write(reinterpret_cast<char*>(&header[0]), header.size());
+        file.write(reinterpret_cast<char*>(&buffer[0]), size);
+        file.write(reinterpret_cast<char*>(trailer), sizeof(trailer));
+    }
+}
+
+std::string ReadDataSource(const fs::path& inFile, uint32 inNrOfThreads)
+{
+    std::string result;
+
+    M6Progress progress("test", fs::file_size(inFile) + 1, "decompress");
+    M6DataSource data(inFile, progress, inNrOfThreads);
+
+    boost::timer::cpu_timer timer;
+
+    for (M6DataSource::iterator i = data.begin(); i != data.end(); ++i)
+        io::copy(i->mStream, io::back_inserter(result));
+
+    double seconds = timer.elapsed().wall / 1e9;
+    if (seconds > 0)
+        std::cout << inFile.filename() << " with " << inNrOfThreads << " thread(s): "
+                  << (result.length() / seconds / (1024 * 1024)) << " MB/s" << std::endl;
+
+    return result;
+}
+
+void TestFile(const fs::path& inFile, const std::string& inData)
+{
+    uint32 threads = boost::thread::hardware_concurrency();
+    if (threads < 2)
+        threads = 2;
+
+    BOOST_CHECK(ReadDataSource(inFile, 1) == inData);
+    BOOST_CHECK(ReadDataSource(inFile, 2) == inData);
+    BOOST_CHECK(ReadDataSource(inFile, threads) == inData);
+
+    fs::remove(inFile);
+}
+
+// --------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(TestBzip2)
+{
+    std::string data = CreateTestData(20000);
+
+    WriteBzip2("test/decompress-test.dat.bz2", data, 1, 1);
+    TestFile("test/decompress-test.dat.bz2", data);
+}
+
+BOOST_AUTO_TEST_CASE(TestBzip2MultiStream)
+{
+    std::string data = CreateTestData(20000);
+
+    WriteBzip2("test/decompress-test.dat.bz2", data, 9, 3);
+    TestFile("test/decompress-test.dat.bz2", data);
+}
+
+BOOST_AUTO_TEST_CASE(TestBzip2FalseMagic)
+{
+    // a false block magic is repaired by merging the block with the next
+    std::string data = CreateMagicTestData(0x314159265359ULL, 1024 * 1024);
+
+    WriteBzip2("test/decompress-test.dat.bz2", data, 1, 1);
+    TestFile("test/decompress-test.dat.bz2", data);
+
+    // a false end-of-stream magic cannot be repaired by merging, the rest
+    // of the stream is decoded sequentially
+    data = CreateMagicTestData(0x177245385090ULL, 1024 * 1024);
+
+    WriteBzip2("test/decompress-test.dat.bz2", data, 1, 1);
+    TestFile("test/decompress-test.dat.bz2", data);
+}
+
+BOOST_AUTO_TEST_CASE(TestGzip)
+{
+    std::string data = CreateTestData(20000);
+
+    WriteGzip("test/decompress-test.dat.gz", data, data.length(), false);
+    TestFile("test/decompress-test.dat.gz", data);
+}
+
+BOOST_AUTO_TEST_CASE(TestGzipMultiMember)
+{
+    std::string data = CreateTestData(20000);
+
+    WriteGzip("test/decompress-test.dat.gz", data, 3 * 1024 * 1024, false);
+    TestFile("test/decompress-test.dat.gz", data);
+}
+
+BOOST_AUTO_TEST_CASE(TestBGZF)
+{
+    std::string data = CreateTestData(20000);
+
+    WriteGzip("test/decompress-test.dat.gz", data, 65280, true);
+    TestFile("test/decompress-test.dat.gz", data);
+}
@@ -0,0 +1,444 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <new>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+#include <boost/timer/timer.hpp>
+#include <boost/algorithm/string.hpp>
+#define BOOST_TEST_MODULE DocumentTest
+#include <boost/test/included/unit_test.hpp>
+
+#include "M6Lib.h"
+#include "M6Databank.h"
+#include "M6Document.h"
+#include "M6Lexicon.h"
+#include "M6Iterator.h"
+#include "M6Query.h"
+#include "M6TestUtil.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+namespace ba = boost::algorithm;
+
+int VERBOSE = 0;
+
+// --------------------------------------------------------------------
+// count the number of allocations
+
+atomic<uint64> sAllocations(0);
+
+void* operator new(size_t inSize)
+{
+    ++sAllocations;
+
+    void* result = malloc(inSize == 0 ? 1 : inSize);
+    if (result == nullptr)
+        throw bad_alloc();
+    return result;
+}
+
+void* operator new[](size_t inSize)
+{
+    return operator new(inSize);
+}
+
+// the default operator delete calls free
+
+// --------------------------------------------------------------------
+// Create an entry that looks like a UniProt entry, and index it like
+// the uniprot parser does.
+
+string CreateEntry(uint32 inNr)
+{
+    stringstream s;
+
+    const char kAA[] = "ACDEFGHIKLMNPQRSTVWY";
+    const char* kWords[] = {
+        "protein", "kinase", "binding", "membrane", "transport", "human", "activity",
+        "catalytic", "domain", "receptor", "signal", "nucleus", "cytoplasm", "zinc"
+    };
+
+    M6TestRandom random(inNr + 1);
+
+    s << "ID   TEST" << inNr << "_HUMAN              Reviewed;         " << (100 + inNr % 400) << " AA." << endl
+      << "AC   P" << (10000 + inNr) << ";" << endl
+      << "DE   RecName: Full=Test protein " << inNr << ";" << endl
+      << "OS   Homo sapiens (Human)." << endl;
+
+    for (uint32 i = 0; i < 20; ++i)
+    {
+        s << "CC  ";
+        for (uint32 j = 0; j < 10; ++j)
+            s << ' ' << kWords[random(sizeof(kWords) / sizeof(char*))] << random(100);
+        s << '.' << endl;
+    }
+
+    for (uint32 i = 0; i < 30; ++i)
+        s << "DR   PDB; " << random(10) << "ABC" << random(100) << "; X-ray; 2.00 A; A=1-" << random(500) << "." << endl;
+
+    s << "SQ   SEQUENCE" << endl;
+    for (uint32 j = 0; j < 100 + inNr % 400; ++j)
+    {
+        if (j % 60 == 0)
+            s << (j == 0 ? "     " : "\n     ");
+        s << kAA[random(20)];
+    }
+    s << endl << "//" << endl;
+
+    return s.str();
+}
+
+// An entry split up in the calls a parser would make for it
+
+struct M6Field
+{
+    enum { eIndex, eAttribute, eLink } mKind;
+    string        mName;
+    M6DataType    mDataType;
+    bool        mUnique;
+    string        mValue;
+};
+
+typedef vector<M6Field> M6Fields;
+
+M6Fields ParseEntry(const string& inText)
+{
+    M6Fields result;
+
+    stringstream s(inText);
+    string line;
+
+    while (getline(s, line))
+    {
+        if (line.length() < 5)
+            continue;
+
+        string code = line.substr(0, 2), value = line.substr(5);
+
+        if (code == "ID")
+        {
+            string id = value.substr(0, value.find(' '));
+            result.push_back({ M6Field::eIndex, "id", eM6StringData, true, id });
+            result.push_back({ M6Field::eAttribute, "id", eM6StringData, false, id });
+        }
+        else if (code == "AC")
+            result.push_back({ M6Field::eIndex, "ac", eM6StringData, false, value.substr(0, value.length() - 1) });
+        else if (code == "DE")
+        {
+            result.push_back({ M6Field::eIndex, "de", eM6TextData, false, value });
+            result.push_back({ M6Field::eAttribute, "title", eM6StringData, false, value });
+        }
+        else if (code == "DR")
+        {
+            string::size_type s = value.find(';');
+            string id = value.substr(s + 2, value.find(';', s + 2) - s - 2);
+            result.push_back({ M6Field::eIndex, "dr", eM6TextData, false, value });
+            result.push_back({ M6Field::eLink, value.substr(0, s), eM6StringData, false, id });
+        }
+        else if (code == "SQ")
+            result.push_back({ M6Field::eIndex, "length", eM6NumberData, false, to_string(inText.length()) });
+        else if (code == "  ")
+            continue;
+        else
+            result.push_back({ M6Field::eIndex, code, eM6TextData, false, value });
+    }
+
+    return result;
+}
+
+void IndexEntry(M6InputDocument& inDoc, const M6Fields& inFields)
+{
+    for (const M6Field& f : inFields)
+    {
+        switch (f.mKind)
+        {
+            case M6Field::eIndex:
+                inDoc.Index(f.mName, f.mDataType, f.mUnique, f.mValue.c_str(), f.mValue.length());
+                break;
+
+            case M6Field::eAttribute:
+                inDoc.SetAttribute(f.mName, f.mValue.c_str(), f.mValue.length());
+                break;
+
+            case M6Field::eLink:
+                inDoc.AddLink(f.mName, f.mValue);
+                break;
+        }
+    }
+}
+
+// --------------------------------------------------------------------
+
+struct M6DatabankFixture
+{
+    M6DatabankFixture()
+    {
+        vector<pair<string,string>> indexNames;
+        mDatabank.reset(M6Databank::CreateNew("test", "test/document-test.m6", "test", indexNames));
+    }
+
+    ~M6DatabankFixture()
+    {
+        mDatabank.reset();
+        fs::remove_all("test/document-test.m6");
+    }
+
+    unique_ptr<M6Databank> mDatabank;
+};
+
+BOOST_FIXTURE_TEST_CASE(TestIndexTokens, M6DatabankFixture)
+{
+    M6Lexicon lexicon;
+    M6InputDocument doc(*mDatabank, "aap noot mies");
+
+    doc.Index("text", eM6TextData, false, "aap noot", 8);
+    doc.Index("other", eM6TextData, false, "mies, wim", 9);
+    doc.Index("text", eM6TextData, false, ". aap", 5);
+    doc.Index("id", eM6StringData, true, "Zus", 3);
+
+    doc.Tokenize(lexicon, 0);
+
+    // tokens are grouped by index, in order of first appearance
+    vector<vector<string>> expected = {
+        { "aap", "noot", "", "aap" }, { "mies", "", "wim" }, { "zus" }
+    };
+
+    const M6InputDocument::M6IndexTokenList& tokens = doc.GetIndexTokens();
+    BOOST_REQUIRE_EQUAL(tokens.size(), expected.size());
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        vector<string> words;
+        for (uint32 t : doc.GetTokens(tokens[i]))
+            words.push_back(t == 0 ? "" : lexicon.GetString(t));
+
+        BOOST_CHECK(words == expected[i]);
+    }
+
+    BOOST_CHECK_EQUAL(M6InputDocument::GetName(tokens[0].mIndex), "text");
+    BOOST_CHECK_EQUAL(M6InputDocument::GetName(tokens[1].mIndex), "other");
+    BOOST_CHECK_EQUAL(tokens[2].mDataType, eM6StringData);
+
+    const M6InputDocument::M6IndexValueList& values = doc.GetIndexValues();
+    BOOST_REQUIRE_EQUAL(values.size(), 1U);
+    BOOST_CHECK_EQUAL(M6InputDocument::GetName(values[0].mIndex), "id");
+    BOOST_CHECK_EQUAL(doc.GetValue(values[0]), "zus");
+    BOOST_CHECK(values[0].mUnique);
+
+    BOOST_CHECK_THROW(doc.Index("text", eM6StringData, false, "x", 1), exception);
+}
+
+BOOST_FIXTURE_TEST_CASE(TestAttributesAndLinks, M6DatabankFixture)
+{
+    M6InputDocument doc(*mDatabank, "text");
+
+    doc.SetAttribute("id", " P12345 ", 8);
+    doc.SetAttribute("title", "first", 5);
+    doc.SetAttribute("title", "second", 6);
+
+    BOOST_CHECK_EQUAL(doc.GetAttribute("id"), "P12345");
+    BOOST_CHECK_EQUAL(doc.GetAttribute("title"), "second");
+    BOOST_CHECK_EQUAL(doc.GetAttribute("unknown"), "");
+
+    doc.AddLink("PDB", "1ABC");
+    doc.AddLink("pdb", "1abc");
+    doc.AddLink("EMBL", "X1");
+
+    M6DocLinks links = doc.GetLinks();
+    BOOST_REQUIRE_EQUAL(links.size(), 2U);
+    BOOST_CHECK(links["pdb"] == set<string>({ "1abc" }));
+    BOOST_CHECK(links["embl"] == set<string>({ "x1" }));
+}
+
+// report the number of allocations and the time needed to create,
+// index and tokenize a document, and separately for compressing it
+
+BOOST_FIXTURE_TEST_CASE(TestDocumentAllocations, M6DatabankFixture)
+{
+    const uint32 kEntries = 5000;
+
+    vector<string> entries;
+    vector<M6Fields> fields;
+    for (uint32 i = 0; i < kEntries; ++i)
+    {
+        entries.push_back(CreateEntry(i));
+        fields.push_back(ParseEntry(entries.back()));
+    }
+
+    M6Lexicon lexicon(true);
+
+    uint64 indexAllocations = 0, compressAllocations = 0;
+    boost::timer::nanosecond_type indexTime = 0, compressTime = 0;
+
+    for (uint32 i = 0; i < kEntries; ++i)
+    {
+        uint64 allocations = sAllocations;
+        boost::timer::cpu_timer timer;
+
+        unique_ptr<M6InputDocument> doc(new M6InputDocument(*mDatabank, entries[i]));
+
+        IndexEntry(*doc, fields[i]);
+        doc->Tokenize(lexicon, 0);
+
+        indexTime += timer.elapsed().wall;
+        indexAllocations += sAllocations - allocations;
+
+        allocations = sAllocations;
+        timer.start();
+
+        doc->Compress();
+        doc.reset();
+
+        compressTime += timer.elapsed().wall;
+        compressAllocations += sAllocations - allocations;
+    }
+
+    cout << "index and tokenize: " << (indexAllocations / kEntries) << " allocations, "
+         << (indexTime / 1000 / kEntries) << " us per document" << endl
+         << "compress and free:  " << (compressAllocations / kEntries) << " allocations, "
+         << (compressTime / 1000 / kEntries) << " us per document" << endl;
+}
+
+// phrase searches over a full text index, compared with a brute force
+// search over the words of each document. Words are drawn from a skewed
+// distribution, so there are very frequent and fairly rare words.
+
+BOOST_AUTO_TEST_CASE(TestPhraseSearch)
+{
+    const uint32 kDocCount = 5000;
+    fs::path path("test/phrase-test.m6");
+
+    vector<vector<string>> words(kDocCount + 1);
+    vector<M6TestDocument> docs;
+    M6TestRandom random;
+
+    for (uint32 i = 1; i <= kDocCount; ++i)
+    {
+        string text;
+
+        for (uint32 j = 50 + random(400); j > 0; --j)
+        {
+            uint32 r = random(100);
+            string word = "w" + to_string(r < 60 ? random(20) : r < 95 ? random(500) : random(10000));
+
+            words[i].push_back(word);
+            text += word + (j % 12 == 0 ? '\n' : ' ');
+        }
+
+        docs.push_back(M6TestDocument("doc" + to_string(i), text));
+    }
+
+    CreateTestDatabank(path, docs);
+
+    BOOST_CHECK(M6PositionalIterator::IsPositionalFile(path / "text.idl"));
+
+    M6Databank databank(path, eReadOnly);
+
+    const char* kPhrases[] = {
+        "w1 w2", "w0 w0", "w3 w4 w5", "w7 w123", "w1 w2 w3 w4", "w250 w3", "w42 w300 w7", "w1 w9999"
+    };
+
+    for (const char* phrase : kPhrases)
+    {
+        vector<string> terms;
+        ba::split(terms, phrase, ba::is_any_of(" "));
+
+        vector<uint32> expected;
+        for (uint32 i = 1; i <= kDocCount; ++i)
+        {
+            if (search(words[i].begin(), words[i].end(), terms.begin(), terms.end()) != words[i].end())
+                expected.push_back(i);
+        }
+
+        vector<uint32> found;
+        unique_ptr<M6Iterator> iter(databank.FindString("text", phrase));
+
+        uint32 doc;
+        float rank;
+        while (iter and iter->Next(doc, rank))
+            found.push_back(doc);
+
+        if (VERBOSE)
+            cout << '"' << phrase << "\": " << found.size() << " documents" << endl;
+
+        BOOST_CHECK(found == expected);
+    }
+
+    // proximity, the terms may occur in any order
+
+    const char* kNear[] = {
+        "w1 NEAR/1 w2", "w0 NEAR/3 w0", "w7 NEAR/5 w123", "w250 NEAR w3", "text:w42 NEAR/20 w300"
+    };
+
+    for (const char* query : kNear)
+    {
+        vector<string> terms;
+        ba::split(terms, query, ba::is_any_of(" "));
+
+        string a = terms.front(), b = terms.back();
+        if (ba::starts_with(a, "text:"))
+            a.erase(0, 5);
+
+        uint32 distance = 10;
+        if (terms[1].length() > 5)
+            distance = stoi(terms[1].substr(5));
+
+        vector<uint32> expected;
+        for (uint32 i = 1; i <= kDocCount; ++i)
+        {
+            vector<string>& w = words[i];
+            bool match = false;
+
+            for (uint32 j = 0; j < w.size() and not match; ++j)
+            {
+                if (w[j] != a)
+                    continue;
+
+                for (uint32 k = j > distance ? j - distance : 0; k <= j + distance and k < w.size(); ++k)
+                {
+                    if (k != j and w[k] == b)
+                    {
+                        match = true;
+                        break;
+                    }
+                }
+            }
+
+            if (match)
+                expected.push_back(i);
+        }
+
+        vector<string> queryTerms;
+        M6Iterator* filter = nullptr;
+        bool isBooleanQuery;
+        ParseQuery(databank, query, true, queryTerms, filter, isBooleanQuery);
+        unique_ptr<M6Iterator> iter(filter);
+
+        vector<uint32> found;
+        uint32 doc;
+        float rank;
+        while (iter and iter->Next(doc, rank))
+            found.push_back(doc);
+
+        if (VERBOSE)
+            cout << query << ": " << found.size() << " documents" << endl;
+
+        BOOST_CHECK(queryTerms.size() == 2);
+        BOOST_CHECK(found == expected);
+    }
+
+    // the id index has no word positions, NEAR should not silently find nothing
+    {
+        vector<string> queryTerms;
+        M6Iterator* filter = nullptr;
+        bool isBooleanQuery;
+        BOOST_CHECK_THROW(ParseQuery(databank, "id:doc1 NEAR doc2", true, queryTerms, filter, isBooleanQuery), exception);
+    }
+
+    fs::remove_all(path);
+}
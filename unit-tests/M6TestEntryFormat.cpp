@@ -0,0 +1,88 @@
+#include <iostream>
+#include <vector>
+#include <string>
+
+#define BOOST_TEST_MODULE EntryFormatTest
+#include <boost/test/included/unit_test.hpp>
+
+#include "M6Lib.h"
+#include "M6EntryFormat.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(TestEntryFormat)
+{
+    std::vector<M6LinkRule> rules = {
+        { "(?<=DR   EMBL; )(\\S+)(?=;)", "embl", "id", "$1", "" },
+        { "(?<=DR   PDB; )(\\S+)(?=;)", "pdb", "", "$0", "" },
+        { "\\b(sp|tr):(\\w+)", "$1", "ac", "$2", "" },
+        { "([a-z])\\1+x", "", "id", "$0", "" },
+        { "invalid(", "x", "", "y", "" }
+    };
+
+    M6EntryFormat format("test", rules);
+
+    std::string text =
+        "DR   EMBL; X12345; AAA.\n"
+        "DR   PDB; 1CRN; X-RAY.\n"
+        "see sp:P12345 and tr:Q9 or aaax\n";
+
+    std::vector<M6EntryLink> links;
+    format.FindLinks(text, "uniprot", links);
+
+    BOOST_REQUIRE_EQUAL(links.size(), 5);
+
+    BOOST_CHECK_EQUAL(text.substr(links[0].mOffset, links[0].mLength), "X12345");
+    BOOST_CHECK_EQUAL(links[0].mDb, "embl");
+    BOOST_CHECK_EQUAL(links[0].mIx, "id");
+    BOOST_CHECK_EQUAL(links[0].mID, "X12345");
+
+    BOOST_CHECK_EQUAL(links[1].mDb, "pdb");
+    BOOST_CHECK_EQUAL(links[1].mID, "1CRN");
+
+    BOOST_CHECK_EQUAL(text.substr(links[2].mOffset, links[2].mLength), "sp:P12345");
+    BOOST_CHECK_EQUAL(links[2].mDb, "sp");
+    BOOST_CHECK_EQUAL(links[2].mID, "P12345");
+    BOOST_CHECK_EQUAL(links[3].mDb, "tr");
+    BOOST_CHECK_EQUAL(links[3].mID, "Q9");
+
+    // the rule with a back reference, and no databank
+    BOOST_CHECK_EQUAL(links[4].mDb, "uniprot");
+    BOOST_CHECK_EQUAL(links[4].mID, "aaax");
+
+    format.AddTiming(0.5);
+    format.AddTiming(1.5);
+
+    uint32 count;
+    double total, max;
+    format.GetTiming(count, total, max);
+    BOOST_CHECK_EQUAL(count, 2);
+    BOOST_CHECK_EQUAL(total, 2.0);
+    BOOST_CHECK_EQUAL(max, 1.5);
+}
+
+BOOST_AUTO_TEST_CASE(TestHighlighter)
+{
+    std::vector<std::string> terms = { "kinase", "protein", "protein kinase" };
+    M6Highlighter highlighter(terms);
+
+    std::string text = "Protein Kinase, kinases and a PROTEIN_x protein.";
+
+    std::vector<std::pair<size_t,size_t>> matches;
+    highlighter.Find(text, matches);
+
+    BOOST_REQUIRE_EQUAL(matches.size(), 2);
+    BOOST_CHECK_EQUAL(text.substr(matches[0].first, matches[0].second), "Protein Kinase");
+    BOOST_CHECK_EQUAL(text.substr(matches[1].first, matches[1].second), "protein");
+
+    // Han characters match anywhere
+    std::vector<std::string> hanTerms = { "\xe8\x9b\x8b\xe7\x99\xbd" };
+    M6Highlighter han(hanTerms);
+    han.Find("abc\xe8\x9b\x8b\xe7\x99\xbd\xe8\xb4\xa8", matches);
+    BOOST_REQUIRE_EQUAL(matches.size(), 1);
+    BOOST_CHECK_EQUAL(matches[0].first, 3);
+    BOOST_CHECK_EQUAL(matches[0].second, 6);
+
+    M6Highlighter empty(std::vector<std::string>{});
+    BOOST_CHECK(empty.Empty());
+}
@@ -4,7 +4,8 @@
 #include "M6Lib.h"
 #include "M6Iterator.h"
 
-#include <boost/test/unit_test.hpp>
+#define BOOST_TEST_MODULE IteratorTest
+#include <boost/test/included/unit_test.hpp>
 
 using namespace std;
 
@@ -58,3 +59,69 @@ BOOST_AUTO_TEST_CASE(test_union_iterator)
     BOOST_CHECK(vt == vc);
 }
 
+
+BOOST_AUTO_TEST_CASE(test_not_iterator)
+{
+    cout << "testing not iterator" << endl;
+
+    uint32 a[] = { 1, 4, 8, 63, 64, 130 };
+
+    vector<uint32> va(a, a + sizeof(a) / sizeof(uint32));
+    vector<uint32> vc;
+    for (uint32 d = 1; d <= 130; ++d)
+    {
+        if (find(va.begin(), va.end(), d) == va.end())
+            vc.push_back(d);
+    }
+
+    M6Iterator* ni = new M6NotIterator(new M6VectorIterator(va), 130);
+    BOOST_CHECK_EQUAL(ni->GetCount(), vc.size());
+
+    vector<uint32> vt;
+    uint32 doc; float rank;
+    while (ni->Next(doc, rank))
+        vt.push_back(doc);
+
+    BOOST_CHECK(vt == vc);
+    delete ni;
+}
+
+BOOST_AUTO_TEST_CASE(test_difference_iterator)
+{
+    cout << "testing difference iterator" << endl;
+
+    uint32 a[] = { 1, 4, 8, 9, 12 };
+    uint32 b[] = { 1, 2, 5, 8, 9 };
+    uint32 c[] = { 4, 12 };
+
+    vector<uint32> va(a, a + sizeof(a) / sizeof(uint32));
+    vector<uint32> vb(b, b + sizeof(b) / sizeof(uint32));
+    vector<uint32> vc(c, c + sizeof(c) / sizeof(uint32));
+
+    // once with an iterator and once with a bitmap for b
+    for (int i = 0; i < 2; ++i)
+    {
+        vector<uint32> vai(va), vbi(vb);
+        M6Iterator* bi;
+
+        if (i == 0)
+            bi = new M6VectorIterator(vbi);
+        else
+        {
+            vector<bool> bitmap(13);
+            for (uint32 d : vb)
+                bitmap[d] = true;
+            bi = new M6BitmapIterator(bitmap, static_cast<uint32>(vb.size()));
+        }
+
+        M6Iterator* di = new M6DifferenceIterator(new M6VectorIterator(vai), bi);
+
+        vector<uint32> vt;
+        uint32 doc; float rank;
+        while (di->Next(doc, rank))
+            vt.push_back(doc);
+
+        BOOST_CHECK(vt == vc);
+        delete di;
+    }
+}
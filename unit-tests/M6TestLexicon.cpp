@@ -0,0 +1,131 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <algorithm>
+
+#include <boost/thread.hpp>
+#include <boost/timer/timer.hpp>
+#define BOOST_TEST_MODULE LexiconTest
+#include <boost/test/included/unit_test.hpp>
+
+#include "M6Lib.h"
+#include "M6Lexicon.h"
+
+using namespace std;
+
+int VERBOSE = 0;
+
+// --------------------------------------------------------------------
+// Create a list of words with a Zipf like distribution, like the words
+// in a real databank: a few words are very common, most are rare.
+
+vector<string> CreateWords(uint32 inCount, uint32 inVocabulary, uint32 inSeed)
+{
+    vector<string> result;
+    result.reserve(inCount);
+
+    uint32 seed = inSeed;
+
+    for (uint32 i = 0; i < inCount; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32 r = (seed >> 8) % inVocabulary + 1;
+
+        seed = seed * 1103515245 + 12345;
+        uint32 nr = r / ((seed >> 8) % r + 1);
+
+        result.push_back("w" + to_string(nr));
+    }
+
+    return result;
+}
+
+// store part inPart of inParts of inWords in inLexicon
+
+void StoreWords(M6Lexicon& inLexicon, const vector<string>& inWords,
+    uint32 inPart, uint32 inParts, vector<uint32>& outNrs)
+{
+    size_t n = (inWords.size() + inParts - 1) / inParts;
+    size_t end = min(inWords.size(), (inPart + 1) * n);
+
+    for (size_t i = inPart * n; i < end; ++i)
+        outNrs[i] = inLexicon.Store(inWords[i]);
+}
+
+// --------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(TestLexicon)
+{
+    M6Lexicon lexicon;
+
+    vector<string> words = CreateWords(100000, 20000, 1);
+    vector<uint32> nrs(words.size());
+
+    StoreWords(lexicon, words, 0, 1, nrs);
+
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(lexicon.Lookup(words[i]), nrs[i]);
+        BOOST_CHECK_EQUAL(lexicon.GetString(nrs[i]), words[i]);
+    }
+
+    BOOST_CHECK_EQUAL(lexicon.Lookup("not-a-word"), 0U);
+    BOOST_CHECK_EQUAL(lexicon.Lookup(" "), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(TestConcurrentLexicon)
+{
+    M6Lexicon lexicon(true);
+
+    vector<string> words = CreateWords(400000, 100000, 2);
+    vector<uint32> nrs(words.size());
+
+    const uint32 kThreads = 8;
+    boost::thread_group threads;
+
+    for (uint32 i = 0; i < kThreads; ++i)
+        threads.create_thread([&, i]() { StoreWords(lexicon, words, i, kThreads, nrs); });
+
+    threads.join_all();
+
+    // each word should have exactly one number, whichever thread stored it
+    map<string,uint32> seen;
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        auto s = seen.insert(make_pair(words[i], nrs[i]));
+        BOOST_CHECK_EQUAL(s.first->second, nrs[i]);
+
+        BOOST_CHECK_EQUAL(lexicon.Lookup(words[i]), nrs[i]);
+        BOOST_CHECK_EQUAL(lexicon.GetString(nrs[i]), words[i]);
+    }
+
+    BOOST_CHECK_EQUAL(lexicon.Count(), seen.size() + 1);
+}
+
+// report how well the lexicon scales with the number of threads
+
+BOOST_AUTO_TEST_CASE(TestLexiconScaling)
+{
+    vector<string> words = CreateWords(2000000, 500000, 3);
+    vector<uint32> nrs(words.size());
+
+    for (uint32 nrOfThreads : { 1, 2, 4, 8, 16, 32 })
+    {
+        M6Lexicon lexicon(true);
+
+        boost::timer::cpu_timer timer;
+
+        boost::thread_group threads;
+        for (uint32 i = 0; i < nrOfThreads; ++i)
+            threads.create_thread([&, i]() { StoreWords(lexicon, words, i, nrOfThreads, nrs); });
+        threads.join_all();
+
+        double seconds = timer.elapsed().wall / 1e9;
+        if (seconds > 0)
+            cout << "lexicon with " << nrOfThreads << " thread(s): "
+                 << static_cast<uint64>(words.size() / seconds) << " words/s" << endl;
+
+        BOOST_CHECK_EQUAL(lexicon.Lookup(words.back()), nrs.back());
+    }
+}
@@ -0,0 +1,173 @@
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/timer/timer.hpp>
+#define BOOST_TEST_MODULE ParserTest
+#include <boost/test/included/unit_test.hpp>
+
+#include "M6Lib.h"
+#include "M6Config.h"
+#include "M6Databank.h"
+#include "M6Document.h"
+#include "M6Parser.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+namespace ba = boost::algorithm;
+
+int VERBOSE = 0;
+
+// --------------------------------------------------------------------
+// A document that records all index calls made by a parser
+
+class M6RecordingDocument : public M6InputDocument
+{
+  public:
+                        M6RecordingDocument(M6Databank& inDatabank, const string& inText)
+                            : M6InputDocument(inDatabank, inText) {}
+
+    virtual void        Index(const string& inIndex,
+                            M6DataType inDataType, bool isUnique,
+                            const char* inText, size_t inSize)
+                        {
+                            string entry = inIndex + '\t' + string(inText, inSize);
+
+                            // the order of text is relevant, for other data it is not
+                            if (inDataType == eM6TextData)
+                                mText.push_back(entry);
+                            else
+                                mValues.insert(to_string(inDataType) + (isUnique ? "U\t" : "\t") + entry);
+                        }
+
+    vector<string>        mText;
+    multiset<string>    mValues;
+};
+
+// --------------------------------------------------------------------
+
+vector<string> ReadDocuments(const fs::path& inFile, const string& inParser)
+{
+    fs::ifstream file(inFile);
+    BOOST_REQUIRE(file.is_open());
+
+    vector<string> result;
+    string doc, line;
+
+    while (getline(file, line))
+    {
+        if (inParser == "fasta" and ba::starts_with(line, ">") and not doc.empty())
+        {
+            result.push_back(doc);
+            doc.clear();
+        }
+
+        doc += line + '\n';
+
+        if (inParser != "fasta" and inParser != "pdb" and line == "//")
+        {
+            result.push_back(doc);
+            doc.clear();
+        }
+    }
+
+    if (not doc.empty())
+        result.push_back(doc);
+
+    return result;
+}
+
+// the order of chains in fasta output from the Perl pdb parser is random
+
+set<string> SplitFasta(const string& inFasta)
+{
+    vector<string> entries;
+    ba::split(entries, inFasta, ba::is_any_of(">"));
+    return set<string>(entries.begin(), entries.end());
+}
+
+void CompareParsers(const string& inParser, const fs::path& inFile, bool inFasta)
+{
+    M6Config::SetConfigFilePath("unit-tests/data/mrs-config.xml");
+
+    fs::path path = fs::path("test") / ("parser-" + inParser + ".m6");
+
+    vector<pair<string,string>> indexNames;
+    unique_ptr<M6Databank> databank(M6Databank::CreateNew(inParser, path, "test", indexNames));
+    M6Databank& db = *databank;
+
+    M6Parser perl(inParser), native(inParser, true);
+
+    vector<string> docs = ReadDocuments(inFile, inParser);
+    BOOST_REQUIRE(not docs.empty());
+
+    for (const string& text : docs)
+    {
+        M6RecordingDocument a(db, text), b(db, text);
+
+        perl.ParseDocument(&a, inFile.string(), "");
+        native.ParseDocument(&b, inFile.string(), "");
+
+        BOOST_CHECK(a.mText == b.mText);
+        BOOST_CHECK(a.mValues == b.mValues);
+        BOOST_CHECK(a.GetLinks() == b.GetLinks());
+
+        for (const char* attr : { "id", "ac", "title" })
+            BOOST_CHECK_EQUAL(a.GetAttribute(attr), b.GetAttribute(attr));
+
+        if (inFasta)
+        {
+            string fa, fb;
+            perl.ToFasta(text, "db", a.GetAttribute("id"), a.GetAttribute("title"), fa);
+            native.ToFasta(text, "db", b.GetAttribute("id"), b.GetAttribute("title"), fb);
+
+            BOOST_CHECK(not fb.empty());
+            BOOST_CHECK(SplitFasta(fa) == SplitFasta(fb));
+        }
+    }
+
+    // and report how much we gain
+    for (M6Parser* parser : { &perl, &native })
+    {
+        boost::timer::cpu_timer timer;
+
+        for (uint32 i = 0; i < 100; ++i)
+        {
+            for (const string& text : docs)
+            {
+                M6RecordingDocument doc(db, text);
+                parser->ParseDocument(&doc, inFile.string(), "");
+            }
+        }
+
+        cout << inParser << (parser == &perl ? " perl:   " : " native: ")
+             << timer.format(3, "%ws wall") << endl;
+    }
+}
+
+// --------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(TestUniProt)
+{
+    CompareParsers("uniprot", "unit-tests/data/test-uniprot.dat", true);
+}
+
+BOOST_AUTO_TEST_CASE(TestEMBL)
+{
+    CompareParsers("embl", "unit-tests/data/test-embl.dat", false);
+}
+
+BOOST_AUTO_TEST_CASE(TestFasta)
+{
+    CompareParsers("fasta", "unit-tests/data/test.fasta", false);
+}
+
+BOOST_AUTO_TEST_CASE(TestPDB)
+{
+    CompareParsers("pdb", "unit-tests/data/test-pdb.ent", true);
+}
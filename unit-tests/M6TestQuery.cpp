@@ -1,6 +1,10 @@
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <string>
+#include <functional>
+#include <map>
+#include <set>
 
 #define BOOST_TEST_MODULE QueryTest
 #include <boost/test/included/unit_test.hpp>
@@ -9,8 +13,17 @@
 #include "M6Query.h"
 #include "M6Iterator.h"
 #include "M6Databank.h"
+#include "M6Document.h"
+#include "M6Lexicon.h"
+#include "M6LinkGraph.h"
+#include "M6TestUtil.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
 
 using namespace std;
+namespace fs = boost::filesystem;
+namespace ba = boost::algorithm;
 
 
 int VERBOSE = 0;
@@ -48,3 +61,464 @@ BOOST_AUTO_TEST_CASE(TestQuery2)
     BOOST_CHECK_EQUAL(0, terms.size());
     BOOST_CHECK_EQUAL(isBooleanQuery, true);
 }
+
+BOOST_AUTO_TEST_CASE(TestQueryPlan)
+{
+    const uint32 kDocCount = 2000, kWordCount = 20;
+    fs::path path("test/plan-test.m6");
+
+    // NOT applies to the rest of the query, hence the parentheses below
+
+    // doc i contains word k if bit k of words[i] is set, word k occurs
+    // in about (k + 1) / 25 of the documents
+    vector<uint32> words(kDocCount + 1);
+    vector<M6TestDocument> docs;
+    M6TestRandom random;
+
+    for (uint32 i = 1; i <= kDocCount; ++i)
+    {
+        string text = "doc";
+
+        for (uint32 k = 0; k < kWordCount; ++k)
+        {
+            if (random(25) <= k)
+            {
+                words[i] |= 1 << k;
+                text += " w" + to_string(k);
+            }
+        }
+
+        docs.push_back(text);
+    }
+
+    CreateTestDatabank(path, docs);
+
+    M6Databank databank(path, eReadOnly);
+
+    auto has = [&words](uint32 inDoc, uint32 inWord) -> bool { return (words[inDoc] & (1 << inWord)) != 0; };
+
+    struct { const char* query; function<bool(uint32)> test; } kQueries[] = {
+        { "w1 AND w2",                        [&](uint32 d) { return has(d, 1) and has(d, 2); } },
+        { "w19 AND w0 AND w10",                [&](uint32 d) { return has(d, 19) and has(d, 0) and has(d, 10); } },
+        { "w1 OR w2 OR w3 OR w15 OR w16",    [&](uint32 d) { return has(d, 1) or has(d, 2) or has(d, 3) or has(d, 15) or has(d, 16); } },
+        { "w5 AND NOT w6",                    [&](uint32 d) { return has(d, 5) and not has(d, 6); } },
+        { "(NOT w4) AND (NOT w18)",        [&](uint32 d) { return not has(d, 4) and not has(d, 18); } },
+        { "w7 AND (w8 OR NOT w9)",            [&](uint32 d) { return has(d, 7) and (has(d, 8) or not has(d, 9)); } },
+        { "w3 AND (NOT w4) AND w17 AND NOT w19",
+                                            [&](uint32 d) { return has(d, 3) and not has(d, 4) and has(d, 17) and not has(d, 19); } },
+        { "w2 AND nonexisting",                [&](uint32 d) { return false; } },
+        { "w2 OR nonexisting",                [&](uint32 d) { return has(d, 2); } },
+        { "(NOT nonexisting) AND w11",    [&](uint32 d) { return has(d, 11); } },
+    };
+
+    for (auto& q : kQueries)
+    {
+        vector<uint32> expected;
+        for (uint32 i = 1; i <= kDocCount; ++i)
+        {
+            if (q.test(i))
+                expected.push_back(i);
+        }
+
+        M6Iterator* filter = nullptr;
+        bool isBooleanQuery;
+        vector<string> terms;
+
+        ParseQuery(databank, q.query, true, terms, filter, isBooleanQuery);
+        unique_ptr<M6Iterator> iter(filter);
+
+        // the server takes a zero count for no hits
+        BOOST_CHECK_MESSAGE(expected.empty() or (iter and iter->GetCount() > 0), q.query);
+
+        vector<uint32> found;
+        uint32 doc;
+        float rank;
+        while (iter and iter->Next(doc, rank))
+            found.push_back(doc);
+
+        if (VERBOSE)
+            ExplainQuery(databank, q.query, true, cout);
+
+        BOOST_CHECK_MESSAGE(found == expected, q.query);
+    }
+
+    stringstream s;
+    ExplainQuery(databank, "w19 AND NOT w1", true, s);
+    BOOST_CHECK(s.str().find("and not") != string::npos);
+
+    fs::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestSpelling)
+{
+    const uint32 kDocCount = 100;
+    fs::path path("test/spelling-test.m6");
+
+    const char* kWords[] = {
+        "protein", "proteins", "kinase", "membrane", "transport", "transferase",
+        "receptor", "reception", "hemoglobin", "oxidoreductase"
+    };
+
+    vector<M6TestDocument> docs;
+    for (uint32 i = 1; i <= kDocCount; ++i)
+    {
+        string text;
+        for (uint32 k = 0; k < sizeof(kWords) / sizeof(char*); ++k)
+        {
+            if ((i + k) % 3 != 0)
+                text = text + kWords[k] + ' ';
+        }
+
+        docs.push_back(text);
+    }
+
+    CreateTestDatabank(path, docs);
+
+    M6Databank databank(path, eReadOnly);
+
+    auto suggest = [&databank](const string& inWord) -> vector<string>
+    {
+        vector<pair<string,uint16>> corrections;
+        databank.SuggestCorrection(inWord, corrections);
+
+        vector<string> result;
+        for (auto& c : corrections)
+            result.push_back(c.first);
+        return result;
+    };
+
+    struct { const char* word; const char* correction; } kTests[] = {
+        { "protien",        "protein" },        // transposition
+        { "kinnase",        "kinase" },            // insertion
+        { "membrne",        "membrane" },        // deletion
+        { "recepter",        "receptor" },        // substitution
+        { "hemoglobni",        "hemoglobin" },
+        { "oxydoreductase",    "oxidoreductase" },
+    };
+
+    for (auto& t : kTests)
+    {
+        vector<string> s = suggest(t.word);
+        BOOST_CHECK_MESSAGE(find(s.begin(), s.end(), t.correction) != s.end(), t.word);
+    }
+
+    BOOST_CHECK(suggest("xqzvwk").empty());
+    BOOST_CHECK(suggest(string(200, 'e')).empty());
+
+    vector<string> s = suggest("protein");
+    BOOST_CHECK(find(s.begin(), s.end(), "protein") == s.end());
+
+    fs::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCompletion)
+{
+    const uint32 kDocCount = 400, kTermCount = 300;
+    fs::path path("test/completion-test.m6");
+
+    M6TestRandom random;
+
+    // terms over a small alphabet so that they share long prefixes
+    vector<string> terms;
+    while (terms.size() < kTermCount)
+    {
+        string term;
+        uint32 length = 3 + random(6);
+        for (uint32 i = 0; i < length; ++i)
+            term += "abcd"[random(4)];
+        if (find(terms.begin(), terms.end(), term) == terms.end())
+            terms.push_back(term);
+    }
+
+    map<string,uint32> df;
+    vector<M6TestDocument> docs;
+
+    for (uint32 i = 1; i <= kDocCount; ++i)
+    {
+        string text;
+        for (uint32 t = 0; t < kTermCount; ++t)
+        {
+            if (random(kTermCount) < t)
+            {
+                text += terms[t] + ' ';
+                ++df[terms[t]];
+            }
+        }
+
+        docs.push_back(text);
+    }
+
+    CreateTestDatabank(path, docs);
+
+    M6Databank databank(path, eReadOnly);
+
+    set<string> prefixes = { "", "e", "abcdabcdabcd", "aX" };
+    for (auto& t : terms)
+    {
+        for (uint32 i = 1; i <= t.length(); ++i)
+            prefixes.insert(t.substr(0, i));
+    }
+
+    for (const string& prefix : prefixes)
+    {
+        vector<pair<string,uint32>> expected;
+        for (auto& t : df)
+        {
+            if (t.second >= 4 and ba::starts_with(t.first, prefix))
+                expected.push_back(t);
+        }
+
+        stable_sort(expected.begin(), expected.end(),
+            [](const pair<string,uint32>& a, const pair<string,uint32>& b) -> bool { return a.second > b.second; });
+        if (expected.size() > 10)
+            expected.erase(expected.begin() + 10, expected.end());
+
+        vector<pair<string,uint32>> found;
+        databank.SuggestSearchTerms(prefix, found);
+
+        BOOST_CHECK_MESSAGE(found == expected, "prefix '" << prefix << "'");
+    }
+
+    vector<pair<string,uint32>> found;
+    databank.SuggestSearchTerms("ABC", found);
+    BOOST_CHECK(not found.empty());
+
+    fs::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestSimilar)
+{
+    const uint32 kDocCount = 3000, kTopicCount = 30;
+    fs::path path("test/similar-test.m6");
+
+    M6TestRandom random;
+
+    // each document is about one topic, it contains mostly words from
+    // that topic and some common words
+    vector<M6TestDocument> docs;
+    for (uint32 i = 1; i <= kDocCount; ++i)
+    {
+        uint32 topic = i % kTopicCount;
+
+        string text;
+        for (uint32 w = 0; w < 40; ++w)
+        {
+            if (random(3) == 0)
+                text += "common" + to_string(random(50)) + ' ';
+            else
+                text += "t" + to_string(topic) + "w" + to_string(random(40)) + ' ';
+        }
+
+        docs.push_back(text);
+    }
+
+    CreateTestDatabank(path, docs)->CreateSimilarityIndex();
+
+    M6Databank databank(path, eReadOnly);
+
+    auto similar = [&databank](uint32 inDoc, uint32 inLimit) -> vector<pair<uint32,float>>
+    {
+        vector<pair<uint32,float>> result;
+
+        unique_ptr<M6Iterator> iter(databank.FindSimilar(inDoc, inLimit));
+        BOOST_REQUIRE(iter);
+
+        uint32 doc;
+        float rank;
+        while (iter->Next(doc, rank))
+            result.push_back(make_pair(doc, rank));
+
+        return result;
+    };
+
+    for (uint32 doc = 1; doc <= kDocCount; doc += 97)
+    {
+        vector<pair<uint32,float>> top = similar(doc, 20);
+        vector<pair<uint32,float>> all = similar(doc, kDocCount * 2);
+
+        BOOST_REQUIRE_EQUAL(top.size(), 20);
+        BOOST_CHECK_EQUAL(top.front().first, doc);
+        BOOST_CHECK_CLOSE(top.front().second, 1.0f, 0.01f);
+
+        for (uint32 i = 0; i < top.size(); ++i)
+        {
+            BOOST_CHECK_EQUAL(top[i].first, all[i].first);
+            BOOST_CHECK_CLOSE(top[i].second, all[i].second, 0.01f);
+            BOOST_CHECK_EQUAL(top[i].first % kTopicCount, doc % kTopicCount);
+        }
+    }
+
+    fs::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestLinkGraph)
+{
+    const uint32 kACount = 300, kBCount = 400;
+    fs::path pathA("test/link-a.m6"), pathB("test/link-b.m6"), graphFile("test/link-graph");
+
+    M6TestRandom random;
+
+    // documents in a link to b using the alias bee, some of these links
+    // point to documents that do not exist. Documents in b link back to a.
+    map<string,set<string>> links;
+
+    auto create = [&](const string& inID, const fs::path& inPath, uint32 inCount)
+    {
+        vector<M6TestDocument> docs;
+
+        for (uint32 i = 1; i <= inCount; ++i)
+        {
+            string id = inID + to_string(i);
+            M6TestDocument doc(id, "entry " + id);
+
+            uint32 n = random(inID == "a" ? 5 : 3);
+            for (uint32 l = 0; l < n; ++l)
+            {
+                string link = inID == "a" ? "b" + to_string(random(kBCount + 50) + 1) : "a" + to_string(random(kACount) + 1);
+                doc.mLinks.push_back(make_pair(inID == "a" ? "bee" : "a", link));
+                links[id].insert(link);
+            }
+
+            docs.push_back(doc);
+        }
+
+        CreateTestDatabank(inPath, docs);
+    };
+
+    create("a", pathA, kACount);
+    create("b", pathB, kBCount);
+
+    auto linked = [](M6Databank& inDb, const string& inLinkDb, const string& inID) -> set<uint32>
+    {
+        set<uint32> result;
+
+        unique_ptr<M6Iterator> iter(inDb.GetLinkedDocuments(inLinkDb, inID));
+        BOOST_REQUIRE(iter);
+
+        uint32 doc;
+        float rank;
+        while (iter->Next(doc, rank))
+            result.insert(doc);
+
+        return result;
+    };
+
+    // pass 0 resolves the links without a graph, pass 1 with a graph and
+    // in pass 2 databank b was rebuilt after the graph was created
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        if (pass == 2)
+        {
+            for (uint32 j = 1; j <= kBCount; ++j)
+                links.erase("b" + to_string(j));
+            create("b", pathB, kBCount);
+        }
+
+        M6Databank a(pathA, eReadOnly), b(pathB, eReadOnly);
+
+        M6LinkMap linkMap;
+        linkMap["a"].insert(&a);
+        linkMap["b"].insert(&b);
+        linkMap["bee"].insert(&b);
+
+        unique_ptr<M6LinkGraph> graph;
+        if (pass == 1)
+        {
+            a.InitLinkMap(linkMap);
+            b.InitLinkMap(linkMap);
+
+            vector<M6Databank*> databanks = { &a };
+            M6LinkGraph::Create(graphFile, databanks, linkMap);
+
+            graph.reset(new M6LinkGraph(graphFile));
+            BOOST_CHECK_EQUAL(graph->GetDatabankNr(a), 0);
+            BOOST_CHECK_EQUAL(graph->GetDatabankNr(b), M6LinkGraph::kNoDatabank);
+
+            databanks.push_back(&b);
+            M6LinkGraph::Create(graphFile, databanks, linkMap);
+
+            graph.reset(new M6LinkGraph(graphFile));
+            BOOST_REQUIRE_EQUAL(graph->GetDatabankNr(a), 0);
+            BOOST_REQUIRE_EQUAL(graph->GetDatabankNr(b), 1);
+        }
+        else if (pass == 2)
+        {
+            graph.reset(new M6LinkGraph(graphFile));
+            BOOST_CHECK_EQUAL(graph->GetDatabankNr(a), 0);
+            BOOST_CHECK_EQUAL(graph->GetDatabankNr(b), M6LinkGraph::kNoDatabank);
+        }
+
+        // opening the databanks again so the link indices are loaded once
+        M6Databank la(pathA, eReadOnly), lb(pathB, eReadOnly);
+        linkMap.clear();
+        linkMap["a"].insert(&la);
+        linkMap["b"].insert(&lb);
+        linkMap["bee"].insert(&lb);
+
+        la.InitLinkMap(linkMap, graph.get());
+        lb.InitLinkMap(linkMap, graph.get());
+
+        // the documents linked to or from each document in a
+        for (uint32 i = 1; i <= kACount; ++i)
+        {
+            string id = "a" + to_string(i);
+
+            set<uint32> expected;
+            for (const string& link : links[id])
+            {
+                uint32 docNr = lb.DocNrForID(link);
+                if (docNr != 0)
+                    expected.insert(docNr);
+            }
+
+            for (uint32 j = 1; j <= kBCount; ++j)
+            {
+                if (links["b" + to_string(j)].count(id))
+                    expected.insert(lb.DocNrForID("b" + to_string(j)));
+            }
+
+            BOOST_CHECK(linked(lb, "a", id) == expected);
+
+            if (pass == 1)
+            {
+                uint32 docNr = la.DocNrForID(id);
+                vector<uint32> docs;
+                graph->GetLinkedDocuments(0, docNr, 1, docs);
+                BOOST_CHECK(set<uint32>(docs.begin(), docs.end()) == expected);
+                BOOST_CHECK_EQUAL(graph->CountLinkedDocuments(0, docNr, 1), expected.size());
+
+                vector<pair<uint32,uint32>> dbs;
+                graph->GetLinkedDatabanks(0, docNr, dbs);
+                BOOST_REQUIRE_EQUAL(dbs.size(), expected.empty() ? 0 : 1);
+                if (not dbs.empty())
+                {
+                    BOOST_CHECK_EQUAL(dbs[0].first, 1);
+                    BOOST_CHECK_EQUAL(dbs[0].second, expected.size());
+                }
+            }
+        }
+
+        // and the reverse, using the alias
+        for (uint32 j = 1; j <= kBCount; ++j)
+        {
+            string id = "b" + to_string(j);
+
+            set<uint32> expected;
+            for (const string& link : links[id])
+                expected.insert(la.DocNrForID(link));
+
+            for (uint32 i = 1; i <= kACount; ++i)
+            {
+                if (links["a" + to_string(i)].count(id))
+                    expected.insert(la.DocNrForID("a" + to_string(i)));
+            }
+
+            BOOST_CHECK(linked(la, "bee", id) == expected);
+        }
+    }
+
+    fs::remove_all(pathA);
+    fs::remove_all(pathB);
+    fs::remove(graphFile);
+    fs::remove(graphFile.string() + ".lock");
+}
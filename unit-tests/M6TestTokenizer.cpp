@@ -46,3 +46,47 @@ BOOST_AUTO_TEST_CASE(TestParse2)
     BOOST_CHECK_EQUAL(tokenizer.GetTokenString(), "111");
 }
 
+
+BOOST_AUTO_TEST_CASE(TestWords)
+{
+    // mixes tokens handled by the ASCII fast path with ones that need the full version
+    std::string text = "Hello, World-42 3.14 12abc 42. 1e5 x_y -7 +a Caf\xc3\xa9s ABC\tdef";
+
+    struct { M6Token token; const char* text; } kExpected[] = {
+        { eM6TokenWord, "hello" },
+        { eM6TokenPunctuation, "," },
+        { eM6TokenWord, "world-42" },
+        { eM6TokenFloat, "3.14" },
+        { eM6TokenWord, "12abc" },
+        { eM6TokenFloat, "42." },
+        { eM6TokenWord, "1e5" },
+        { eM6TokenWord, "x_y" },
+        { eM6TokenNumber, "-7" },
+        { eM6TokenPunctuation, "+" },
+        { eM6TokenWord, "a" },
+        { eM6TokenWord, "cafe\xcc\x81s" },
+        { eM6TokenWord, "abc" },
+        { eM6TokenWord, "def" },
+        { eM6TokenEOF, nullptr }
+    };
+
+    M6Tokenizer tokenizer(text);
+
+    for (auto& e : kExpected)
+    {
+        BOOST_CHECK_EQUAL(tokenizer.GetNextWord(), e.token);
+        if (e.text != nullptr)
+            BOOST_CHECK_EQUAL(tokenizer.GetTokenString(), e.text);
+    }
+
+    // tokens of kMaxTokenLength characters or more are undefined
+    std::string longWord = std::string(M6Tokenizer::kMaxTokenLength + 10, 'x') + " y";
+    M6Tokenizer tokenizer2(longWord);
+    BOOST_CHECK_EQUAL(tokenizer2.GetNextWord(), eM6TokenUndefined);
+    BOOST_CHECK_EQUAL(tokenizer2.GetNextWord(), eM6TokenWord);
+    BOOST_CHECK_EQUAL(tokenizer2.GetTokenString(), "y");
+
+    std::string s = "MiXeD Case";
+    M6Tokenizer::CaseFold(s);
+    BOOST_CHECK_EQUAL(s, "mixed case");
+}
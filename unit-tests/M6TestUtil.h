@@ -0,0 +1,94 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+// Shared helpers for the unit tests that need a small databank
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <boost/filesystem/operations.hpp>
+
+#include "M6Lib.h"
+#include "M6Databank.h"
+#include "M6Document.h"
+#include "M6Lexicon.h"
+
+// A simple and reproducible pseudo random generator for the test data
+
+class M6TestRandom
+{
+  public:
+                    M6TestRandom(uint32 inSeed = 1) : mSeed(inSeed) {}
+
+    uint32            operator()(uint32 inMax)
+                    {
+                        mSeed = mSeed * 1103515245 + 12345;
+                        return (mSeed >> 8) % inMax;
+                    }
+
+  private:
+    uint32            mSeed;
+};
+
+// A document for CreateTestDatabank, the text is stored and full text
+// indexed. When mID is not empty it is stored as id attribute and in a
+// unique id index, mLinks contains (databank, id) pairs.
+
+struct M6TestDocument
+{
+                    M6TestDocument(const std::string& inText)
+                        : mText(inText) {}
+                    M6TestDocument(const std::string& inID, const std::string& inText)
+                        : mID(inID), mText(inText) {}
+
+    std::string        mID, mText;
+    std::vector<std::pair<std::string,std::string>>
+                    mLinks;
+};
+
+// Create a new databank at inPath, replacing any existing one, containing
+// inDocuments in order. The databank is returned so a caller can create
+// additional indices, the tests open it read only afterwards.
+
+inline std::unique_ptr<M6Databank> CreateTestDatabank(
+    const boost::filesystem::path& inPath, const std::vector<M6TestDocument>& inDocuments)
+{
+    if (boost::filesystem::exists(inPath))
+        boost::filesystem::remove_all(inPath);
+
+    std::vector<std::pair<std::string,std::string>> indexNames;
+    std::unique_ptr<M6Databank> databank(M6Databank::CreateNew("test", inPath, "test", indexNames));
+
+    M6Lexicon lexicon(true);
+    databank->StartBatchImport(lexicon);
+
+    for (const M6TestDocument& d : inDocuments)
+    {
+        M6InputDocument* doc = new M6InputDocument(*databank, d.mText);
+
+        if (not d.mID.empty())
+        {
+            doc->SetAttribute("id", d.mID.c_str(), d.mID.length());
+            doc->Index("id", eM6StringData, true, d.mID.c_str(), d.mID.length());
+        }
+
+        doc->Index("text", eM6TextData, false, d.mText.c_str(), d.mText.length());
+
+        for (auto& link : d.mLinks)
+            doc->AddLink(link.first, link.second);
+
+        doc->Tokenize(lexicon, 0);
+        doc->Compress();
+        databank->Store(doc);
+    }
+
+    databank->EndBatchImport();
+    databank->FinishBatchImport();
+
+    return databank;
+}